@@ -0,0 +1,716 @@
+/** @file ansi_encoder.c
+ *  @brief Implementation of the ANSI terminal encoder.
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ansi_encoder.h"
+#include "tile_colors.h"
+
+/* Ways to move the cursor, as chosen by move_cursor. */
+#define MOVE_NONE 0
+#define MOVE_CUP 1
+#define MOVE_CUU 2
+#define MOVE_CUD 3
+#define MOVE_CRLF 4
+#define MOVE_CUF 5
+#define MOVE_CUB 6
+#define MOVE_REEMIT 7
+#define MOVE_CR 8
+#define MOVE_CR_CUF 9
+#define MOVE_CR_REEMIT 10
+
+/** @brief Maps VGA color numbers to ANSI color numbers.
+ */
+static const int vga_to_ansi[8] = {0, 4, 2, 6, 1, 5, 3, 7};
+
+/***** Function prototypes ******/
+
+/** @brief Find the closest xterm 256 color to an RGB color.
+ *
+ * @param rgb The color, as 0xRRGGBB.
+ * @return An index into the xterm 6x6x6 color cube or gray ramp.
+ */
+static int rgb_to_xterm(uint32_t rgb);
+
+/** @brief Write the SGR parameters for one half of a tile color.
+ *
+ * @param kind The palette kind.
+ * @param tile The tile color.
+ * @param background 1 for the background, 0 for the foreground.
+ * @param out The buffer to write into.
+ * @param size The size of out.
+ * @return The number of bytes written, as snprintf.
+ */
+static int format_tile(
+        int kind,
+        const tile_color_t *tile,
+        int background,
+        char *out,
+        size_t size);
+
+/** @brief Write the SGR parameters for one half of a VGA attribute byte.
+ *
+ * @param kind The palette kind.
+ * @param attr The attribute byte.
+ * @param background 1 for the background, 0 for the foreground.
+ * @param out The buffer to write into.
+ * @param size The size of out.
+ * @return The number of bytes written, as snprintf.
+ */
+static int format_vga(int kind, int attr, int background, char *out, size_t size);
+
+/** @brief Wrap SGR parameters in an escape sequence.
+ *
+ * @param entry The entry to fill in.
+ * @param prefix Parameters to put first, may be empty.
+ * @param params The parameters.
+ * @return 0 on success, -1 if the sequence does not fit.
+ */
+static int make_entry(sgr_entry_t *entry, const char *prefix, const char *params);
+
+/** @brief Give colors that share a sequence the same key.
+ *
+ * @param entries The sequences, one per color.
+ * @param keys Set to the lowest color with the same sequence.
+ * @return None.
+ */
+static void make_keys(const sgr_entry_t *entries, uint8_t *keys);
+
+/** @brief Count the decimal digits in a number.
+ *
+ * @param value The number.
+ * @return The number of digits.
+ */
+static int num_digits(unsigned value);
+
+/** @brief Append a decimal number to the frame buffer.
+ *
+ * The caller makes sure there is room.
+ *
+ * @param enc The encoder.
+ * @param value The number, which must not be negative.
+ * @return None.
+ */
+static void put_uint(ansi_encoder_t *enc, unsigned value);
+
+/** @brief The cost of a CSI sequence with one count parameter.
+ *
+ * A count of 1 is the default, and is left out.
+ *
+ * @param count The count.
+ * @return The number of bytes.
+ */
+static int csi_cost(int count);
+
+/** @brief Append a CSI sequence with one count parameter.
+ *
+ * @param enc The encoder.
+ * @param count The count.
+ * @param final The final byte of the sequence.
+ * @return None.
+ */
+static void put_csi(ansi_encoder_t *enc, int count, char final);
+
+/** @brief The cost of an absolute cursor move.
+ *
+ * @param row The row to move to.
+ * @param col The column to move to.
+ * @return The number of bytes.
+ */
+static int cup_cost(int row, int col);
+
+/** @brief Append an absolute cursor move.
+ *
+ * @param enc The encoder.
+ * @param row The row to move to.
+ * @param col The column to move to.
+ * @return None.
+ */
+static void put_cup(ansi_encoder_t *enc, int row, int col);
+
+/** @brief The cost of moving right by sending the cells on screen again.
+ *
+ * This is only possible if the cells are printable and already in the
+ * active color.
+ *
+ * @param enc The encoder.
+ * @param screen The cells on screen for the row, may be NULL.
+ * @param from The column the cursor is in.
+ * @param to The column to move to.
+ * @return The number of bytes, or -1 if it cannot be done.
+ */
+static int reemit_cost(ansi_encoder_t *enc, const cell_t *screen, int from, int to);
+
+/** @brief Append the cells on screen from one column up to another.
+ *
+ * @param enc The encoder.
+ * @param screen The cells on screen for the row.
+ * @param from The column the cursor is in.
+ * @param to The column to move to.
+ * @return None.
+ */
+static void put_reemit(ansi_encoder_t *enc, const cell_t *screen, int from, int to);
+
+/** @brief Find the cheapest way to move along a row.
+ *
+ * @param enc The encoder.
+ * @param screen The cells on screen for the row, may be NULL.
+ * @param from The column the cursor is in.
+ * @param to The column to move to.
+ * @param how Set to the MOVE_ constant for the cheapest way.
+ * @return The number of bytes.
+ */
+static int horizontal_cost(
+        ansi_encoder_t *enc,
+        const cell_t *screen,
+        int from,
+        int to,
+        int *how);
+
+/** @brief Append a move along a row, as chosen by horizontal_cost.
+ *
+ * @param enc The encoder.
+ * @param screen The cells on screen for the row, may be NULL.
+ * @param from The column the cursor is in.
+ * @param to The column to move to.
+ * @param how The MOVE_ constant from horizontal_cost.
+ * @return None.
+ */
+static void put_horizontal(
+        ansi_encoder_t *enc,
+        const cell_t *screen,
+        int from,
+        int to,
+        int how);
+
+/** @brief Move the terminal cursor the cheapest way.
+ *
+ * The caller makes sure there is room.
+ *
+ * @param enc The encoder.
+ * @param screen The cells on screen for the target row, may be NULL.
+ * @param row The row to move to.
+ * @param col The column to move to.
+ * @return None.
+ */
+static void move_cursor(ansi_encoder_t *enc, const cell_t *screen, int row, int col);
+
+/** @brief Switch to a color the cheapest way.
+ *
+ * The caller makes sure there is room.
+ *
+ * @param enc The encoder.
+ * @param color The color to switch to.
+ * @return None.
+ */
+static void set_color(ansi_encoder_t *enc, uint8_t color);
+
+/** @brief Append the UTF-8 for a glyph.
+ *
+ * The caller makes sure there is room.
+ *
+ * @param enc The encoder.
+ * @param glyph The glyph.
+ * @return None.
+ */
+static void put_glyph(ansi_encoder_t *enc, uint8_t glyph);
+
+/***** Function definitions ******/
+
+int rgb_to_xterm(uint32_t rgb) {
+    static const int levels[6] = {0, 95, 135, 175, 215, 255};
+    int parts[3];
+    int cube[3];
+    int ii, jj, best, dist, gray, gray_level, gray_dist, cube_dist;
+
+    parts[0] = (rgb >> 16) & 0xFF;
+    parts[1] = (rgb >> 8) & 0xFF;
+    parts[2] = rgb & 0xFF;
+
+    cube_dist = 0;
+    for(ii = 0; ii < 3; ii++) {
+        best = 0;
+        for(jj = 1; jj < 6; jj++) {
+            if(abs(levels[jj] - parts[ii]) < abs(levels[best] - parts[ii])) {
+                best = jj;
+            }
+        }
+        cube[ii] = best;
+        dist = levels[best] - parts[ii];
+        cube_dist += dist * dist;
+    }
+
+    /* The gray ramp runs from 8 to 238 in steps of 10. */
+    gray = (parts[0] + parts[1] + parts[2]) / 3;
+    gray_level = gray < 8 ? 0 : (gray - 8 + 5) / 10;
+    if(gray_level > 23) {
+        gray_level = 23;
+    }
+    gray_dist = 0;
+    for(ii = 0; ii < 3; ii++) {
+        dist = 8 + 10 * gray_level - parts[ii];
+        gray_dist += dist * dist;
+    }
+
+    if(gray_dist < cube_dist) {
+        return 232 + gray_level;
+    }
+    return 16 + 36 * cube[0] + 6 * cube[1] + cube[2];
+}
+
+int format_tile(
+        int kind,
+        const tile_color_t *tile,
+        int background,
+        char *out,
+        size_t size) {
+    uint32_t rgb = background ? tile->bg : tile->fg;
+    int base = background ? 48 : 38;
+
+    switch(kind) {
+        case PALETTE_TRUECOLOR:
+            return snprintf(out, size, "%d;2;%u;%u;%u", base,
+                (unsigned)(rgb >> 16) & 0xFF,
+                (unsigned)(rgb >> 8) & 0xFF,
+                (unsigned)rgb & 0xFF);
+        case PALETTE_256:
+            return snprintf(out, size, "%d;5;%d", base, rgb_to_xterm(rgb));
+        default:
+            return snprintf(out, size, "%d", background ? tile->bg16 : 30);
+    }
+}
+
+int format_vga(int kind, int attr, int background, char *out, size_t size) {
+    int nibble = background ? (attr >> 4) & 0xF : attr & 0xF;
+    int color = vga_to_ansi[nibble & 0x7];
+    int bright = (nibble & 0x8) != 0;
+
+    if(kind == PALETTE_16) {
+        return snprintf(out, size, "%d",
+            (background ? 40 : 30) + 60 * bright + color);
+    }
+    return snprintf(out, size, "%d;5;%d", background ? 48 : 38, color + 8 * bright);
+}
+
+int make_entry(sgr_entry_t *entry, const char *prefix, const char *params) {
+    int len = snprintf(entry->seq, SGR_MAX_LEN, "\033[%s%sm", prefix, params);
+    if(len < 0 || len >= SGR_MAX_LEN) {
+        return -1;
+    }
+    entry->len = len;
+    return 0;
+}
+
+void make_keys(const sgr_entry_t *entries, uint8_t *keys) {
+    int ii, jj;
+    for(ii = 0; ii < 256; ii++) {
+        keys[ii] = ii;
+        for(jj = 0; jj < ii; jj++) {
+            if(entries[jj].len == entries[ii].len
+                    && memcmp(entries[jj].seq, entries[ii].seq, entries[ii].len) == 0) {
+                keys[ii] = jj;
+                break;
+            }
+        }
+    }
+}
+
+int ansi_palette_init(ansi_palette_t *palette, int kind) {
+    char fg[SGR_MAX_LEN];
+    char bg[SGR_MAX_LEN];
+    char both[2 * SGR_MAX_LEN];
+    int ii, ok;
+
+    if(palette == NULL) {
+        return -1;
+    }
+    if(kind != PALETTE_16 && kind != PALETTE_256 && kind != PALETTE_TRUECOLOR) {
+        return -1;
+    }
+
+    palette->kind = kind;
+    for(ii = 0; ii < 256; ii++) {
+        if(ii == 0) {
+            strcpy(fg, "39");
+            strcpy(bg, "49");
+        } else if(ii <= NUM_TILE_COLORS) {
+            format_tile(kind, &tile_colors[ii - 1], 0, fg, sizeof(fg));
+            format_tile(kind, &tile_colors[ii - 1], 1, bg, sizeof(bg));
+        } else {
+            format_vga(kind, ii, 0, fg, sizeof(fg));
+            format_vga(kind, ii, 1, bg, sizeof(bg));
+        }
+        snprintf(both, sizeof(both), "%s;%s", fg, bg);
+
+        /* The full sequence resets first, so no attribute leaks over. */
+        if(ii == 0) {
+            ok = make_entry(&palette->sgr[ii], "", "0");
+        } else {
+            ok = make_entry(&palette->sgr[ii], "0;", both);
+        }
+        ok |= make_entry(&palette->fg[ii], "", fg);
+        ok |= make_entry(&palette->bg[ii], "", bg);
+        ok |= make_entry(&palette->both[ii], "", both);
+        if(ok != 0) {
+            return -1;
+        }
+    }
+    make_keys(palette->fg, palette->fg_key);
+    make_keys(palette->bg, palette->bg_key);
+    return 0;
+}
+
+int ansi_palette_detect(void) {
+    const char *colorterm = getenv("COLORTERM");
+    const char *term = getenv("TERM");
+
+    if(colorterm != NULL
+            && (strstr(colorterm, "truecolor") || strstr(colorterm, "24bit"))) {
+        return PALETTE_TRUECOLOR;
+    }
+    if(term != NULL && strstr(term, "256color")) {
+        return PALETTE_256;
+    }
+    return PALETTE_16;
+}
+
+void ansi_encoder_init(ansi_encoder_t *enc, const ansi_palette_t *palette) {
+    if(enc == NULL) {
+        return;
+    }
+    enc->palette = palette;
+    enc->len = 0;
+    ansi_invalidate(enc);
+}
+
+void ansi_invalidate(ansi_encoder_t *enc) {
+    if(enc == NULL) {
+        return;
+    }
+    enc->row = -1;
+    enc->col = -1;
+    enc->color = -1;
+}
+
+void ansi_reset_frame(ansi_encoder_t *enc) {
+    if(enc == NULL) {
+        return;
+    }
+    enc->len = 0;
+}
+
+int ansi_put_raw(ansi_encoder_t *enc, const char *s, size_t len) {
+    if(enc == NULL || s == NULL) {
+        return -1;
+    }
+    if(enc->len + len > ANSI_FRAME_MAX_LEN) {
+        return -1;
+    }
+    memcpy(enc->frame + enc->len, s, len);
+    enc->len += len;
+    return 0;
+}
+
+int num_digits(unsigned value) {
+    int digits = 1;
+    while(value >= 10) {
+        value /= 10;
+        digits++;
+    }
+    return digits;
+}
+
+void put_uint(ansi_encoder_t *enc, unsigned value) {
+    char digits[10];
+    int ii = 0;
+    do {
+        digits[ii++] = '0' + value % 10;
+        value /= 10;
+    } while(value > 0);
+    while(ii > 0) {
+        enc->frame[enc->len++] = digits[--ii];
+    }
+}
+
+int csi_cost(int count) {
+    return count == 1 ? 3 : 3 + num_digits(count);
+}
+
+void put_csi(ansi_encoder_t *enc, int count, char final) {
+    enc->frame[enc->len++] = '\033';
+    enc->frame[enc->len++] = '[';
+    if(count != 1) {
+        put_uint(enc, count);
+    }
+    enc->frame[enc->len++] = final;
+}
+
+int cup_cost(int row, int col) {
+    /* Both parameters default to 1, and can be left out. */
+    if(col == 0) {
+        return row == 0 ? 3 : 3 + num_digits(row + 1);
+    }
+    return 4 + num_digits(row + 1) + num_digits(col + 1);
+}
+
+void put_cup(ansi_encoder_t *enc, int row, int col) {
+    enc->frame[enc->len++] = '\033';
+    enc->frame[enc->len++] = '[';
+    if(row != 0 || col != 0) {
+        put_uint(enc, row + 1);
+    }
+    if(col != 0) {
+        enc->frame[enc->len++] = ';';
+        put_uint(enc, col + 1);
+    }
+    enc->frame[enc->len++] = 'H';
+}
+
+int reemit_cost(ansi_encoder_t *enc, const cell_t *screen, int from, int to) {
+    int cc, cost, len;
+    uint8_t glyph;
+
+    if(screen == NULL || to <= from || to - from > ANSI_REEMIT_MAX) {
+        return -1;
+    }
+    cost = 0;
+    for(cc = from; cc < to; cc++) {
+        glyph = cell_glyph(screen[cc]);
+        if(cell_color(screen[cc]) != enc->color || glyph < ' ' || glyph >= GLYPH_END) {
+            return -1;
+        }
+        console_glyph_utf8(glyph, &len);
+        cost += len;
+    }
+    return cost;
+}
+
+void put_reemit(ansi_encoder_t *enc, const cell_t *screen, int from, int to) {
+    int cc;
+    for(cc = from; cc < to; cc++) {
+        put_glyph(enc, cell_glyph(screen[cc]));
+    }
+}
+
+int horizontal_cost(
+        ansi_encoder_t *enc,
+        const cell_t *screen,
+        int from,
+        int to,
+        int *how) {
+    int best, cost;
+
+    if(from == to) {
+        *how = MOVE_NONE;
+        return 0;
+    }
+
+    if(to > from) {
+        *how = MOVE_CUF;
+        best = csi_cost(to - from);
+        cost = reemit_cost(enc, screen, from, to);
+        if(cost >= 0 && cost < best) {
+            *how = MOVE_REEMIT;
+            best = cost;
+        }
+        return best;
+    }
+
+    *how = MOVE_CUB;
+    best = csi_cost(from - to);
+    if(to == 0) {
+        if(1 < best) {
+            *how = MOVE_CR;
+            best = 1;
+        }
+        return best;
+    }
+    cost = 1 + csi_cost(to);
+    if(cost < best) {
+        *how = MOVE_CR_CUF;
+        best = cost;
+    }
+    cost = reemit_cost(enc, screen, 0, to);
+    if(cost >= 0 && 1 + cost < best) {
+        *how = MOVE_CR_REEMIT;
+        best = 1 + cost;
+    }
+    return best;
+}
+
+void put_horizontal(
+        ansi_encoder_t *enc,
+        const cell_t *screen,
+        int from,
+        int to,
+        int how) {
+    switch(how) {
+        case MOVE_CUF:
+            put_csi(enc, to - from, 'C');
+            break;
+        case MOVE_CUB:
+            put_csi(enc, from - to, 'D');
+            break;
+        case MOVE_REEMIT:
+            put_reemit(enc, screen, from, to);
+            break;
+        case MOVE_CR:
+            enc->frame[enc->len++] = '\r';
+            break;
+        case MOVE_CR_CUF:
+            enc->frame[enc->len++] = '\r';
+            put_csi(enc, to, 'C');
+            break;
+        case MOVE_CR_REEMIT:
+            enc->frame[enc->len++] = '\r';
+            put_reemit(enc, screen, 0, to);
+            break;
+    }
+}
+
+void move_cursor(ansi_encoder_t *enc, const cell_t *screen, int row, int col) {
+    int best, cost, how, best_how, dr;
+    int vertical = MOVE_CUP;
+
+    if(enc->row == row && enc->col == col) {
+        return;
+    }
+
+    best = cup_cost(row, col);
+    best_how = MOVE_NONE;
+    if(enc->row >= 0 && enc->col >= 0) {
+        dr = row - enc->row;
+
+        /* Stay on the row, or move straight up or down, then across. */
+        cost = dr == 0 ? 0 : csi_cost(dr > 0 ? dr : -dr);
+        cost += horizontal_cost(enc, screen, enc->col, col, &how);
+        if(cost < best) {
+            best = cost;
+            vertical = dr == 0 ? MOVE_NONE : (dr > 0 ? MOVE_CUD : MOVE_CUU);
+            best_how = how;
+        }
+
+        /* Line feeds also return to the first column. */
+        if(dr > 0 && dr <= ANSI_LF_MAX) {
+            cost = 2 * dr + horizontal_cost(enc, screen, 0, col, &how);
+            if(cost < best) {
+                best = cost;
+                vertical = MOVE_CRLF;
+                best_how = how;
+            }
+        }
+    }
+
+    switch(vertical) {
+        case MOVE_CUP:
+            put_cup(enc, row, col);
+            break;
+        case MOVE_CUU:
+            put_csi(enc, enc->row - row, 'A');
+            put_horizontal(enc, screen, enc->col, col, best_how);
+            break;
+        case MOVE_CUD:
+            put_csi(enc, row - enc->row, 'B');
+            put_horizontal(enc, screen, enc->col, col, best_how);
+            break;
+        case MOVE_CRLF:
+            for(dr = enc->row; dr < row; dr++) {
+                enc->frame[enc->len++] = '\r';
+                enc->frame[enc->len++] = '\n';
+            }
+            put_horizontal(enc, screen, 0, col, best_how);
+            break;
+        default:
+            put_horizontal(enc, screen, enc->col, col, best_how);
+            break;
+    }
+    enc->row = row;
+    enc->col = col;
+}
+
+void set_color(ansi_encoder_t *enc, uint8_t color) {
+    const ansi_palette_t *palette = enc->palette;
+    const sgr_entry_t *sgr;
+    const sgr_entry_t *part;
+    int from = enc->color;
+
+    if(from == color) {
+        return;
+    }
+
+    sgr = &palette->sgr[color];
+    if(from >= 0) {
+        /* Set only the half that differs, if that is shorter. */
+        part = &palette->both[color];
+        if(palette->fg_key[from] == palette->fg_key[color]) {
+            part = palette->bg_key[from] == palette->bg_key[color] 
+                ? NULL : &palette->bg[color];
+        } else if(palette->bg_key[from] == palette->bg_key[color]) {
+            part = &palette->fg[color];
+        }
+        if(part == NULL) {
+            enc->color = color;
+            return;
+        }
+        if(part->len < sgr->len) {
+            sgr = part;
+        }
+    }
+
+    memcpy(enc->frame + enc->len, sgr->seq, sgr->len);
+    enc->len += sgr->len;
+    enc->color = color;
+}
+
+void put_glyph(ansi_encoder_t *enc, uint8_t glyph) {
+    const char *utf8;
+    int len;
+    if(glyph < ' ') {
+        /* Control bytes would move the cursor behind our back. */
+        glyph = ' ';
+    }
+    utf8 = console_glyph_utf8(glyph, &len);
+    memcpy(enc->frame + enc->len, utf8, len);
+    enc->len += len;
+}
+
+int ansi_encode_span(
+        ansi_encoder_t *enc,
+        const cell_t *cells,
+        const cell_t *screen,
+        int row,
+        int col,
+        int count) {
+    int ii;
+
+    if(enc == NULL || enc->palette == NULL || cells == NULL) {
+        return -1;
+    }
+    if(row < 0 || col < 0 || count < 0) {
+        return -1;
+    }
+
+    for(ii = 0; ii < count; ii++) {
+        if(enc->len + ANSI_CELL_MAX_LEN + ANSI_TRAILER_MAX_LEN > ANSI_FRAME_MAX_LEN) {
+            return -1;
+        }
+        move_cursor(enc, screen, row, col + ii);
+        set_color(enc, cell_color(cells[ii]));
+        put_glyph(enc, cell_glyph(cells[ii]));
+
+        /*
+         * Writing the last column leaves the terminal waiting to wrap,
+         * and terminals disagree about where the cursor is then.
+         */
+        enc->col++;
+        if(enc->col >= CONSOLE_WIDTH) {
+            enc->row = -1;
+            enc->col = -1;
+        }
+    }
+    return 0;
+}
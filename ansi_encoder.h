@@ -0,0 +1,186 @@
+/** @file ansi_encoder.h
+ *  @brief Encodes console cells as ANSI terminal output.
+ *
+ *  The encoder turns spans of console cells into the bytes a VT100
+ *  style terminal needs to show them: cursor motion, SGR color changes,
+ *  and UTF-8 glyphs.  It does no I/O.  Bytes accumulate in the
+ *  encoder's frame buffer until the caller takes them.
+ *
+ *  Colors are looked up in a palette.  Every palette entry holds its
+ *  complete SGR escape sequence, encoded once when the palette is set
+ *  up, so a color change costs one copy and no number formatting.
+ *
+ *  The encoder keeps output small.  For each cursor jump it picks the
+ *  cheapest of an absolute move, relative moves, carriage returns and
+ *  line feeds, or simply sending the unchanged cells in between again.
+ *  For each color change it picks the shorter of the full sequence or
+ *  one that sets only what differs from the current color.
+ *
+ *  @bug None known.
+ */
+
+#ifndef _ANSI_ENCODER_H_
+#define _ANSI_ENCODER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "console_model.h"
+
+/** The basic eight terminal colors */
+#define PALETTE_16 0
+/** The xterm 256 color cube */
+#define PALETTE_256 1
+/** 24-bit color */
+#define PALETTE_TRUECOLOR 2
+
+/** Longest SGR sequence a palette entry can hold */
+#define SGR_MAX_LEN 48
+
+/** Most unchanged cells the encoder will send again to move the cursor */
+#define ANSI_REEMIT_MAX 8
+
+/** Most line feeds the encoder will send to move the cursor down */
+#define ANSI_LF_MAX 4
+
+/** Bytes a single cell can cost: a cursor move, a color and a glyph */
+#define ANSI_CELL_MAX_LEN (SGR_MAX_LEN + 16)
+
+/** Bytes kept free at the end of the frame buffer, for a closing escape */
+#define ANSI_TRAILER_MAX_LEN 16
+
+/** Size of the frame buffer, enough for every cell plus some control */
+#define ANSI_FRAME_MAX_LEN (CONSOLE_CELLS * ANSI_CELL_MAX_LEN + 256)
+
+/** @brief The pre-encoded escape sequence for a color.
+ */
+typedef struct sgr_entry_t {
+    /** The number of bytes in seq */
+    uint8_t len;
+    /** The escape sequence, not NUL terminated */
+    char seq[SGR_MAX_LEN];
+} sgr_entry_t;
+
+/** @brief A table of SGR sequences, one per console color.
+ */
+typedef struct ansi_palette_t {
+    /** One of PALETTE_16, PALETTE_256 or PALETTE_TRUECOLOR */
+    int kind;
+    /** The sequence for each color, starting with a reset */
+    sgr_entry_t sgr[256];
+    /** Sets only the foreground of each color */
+    sgr_entry_t fg[256];
+    /** Sets only the background of each color */
+    sgr_entry_t bg[256];
+    /** Sets the foreground and background, without a reset */
+    sgr_entry_t both[256];
+    /** Colors with equal keys here have the same foreground */
+    uint8_t fg_key[256];
+    /** Colors with equal keys here have the same background */
+    uint8_t bg_key[256];
+} ansi_palette_t;
+
+/** @brief The state of an encoder.
+ *
+ * The encoder tracks where it believes the terminal cursor is and
+ * which color is active, so it can leave out moves and color changes
+ * the terminal does not need.  A value of -1 means unknown.
+ */
+typedef struct ansi_encoder_t {
+    /** The palette used for colors */
+    const ansi_palette_t *palette;
+    /** The terminal cursor row, or -1 */
+    int row;
+    /** The terminal cursor column, or -1 */
+    int col;
+    /** The active color, or -1 */
+    int color;
+    /** The number of bytes in frame */
+    size_t len;
+    /** The bytes encoded so far */
+    char frame[ANSI_FRAME_MAX_LEN];
+} ansi_encoder_t;
+
+/** @brief Fill in a palette.
+ *
+ * Colors 1 through 6 are the tile colors, the same ones the ncurses
+ * view sets up as color pairs.  Color 0 is the terminal default.
+ * Any other color is read as a VGA attribute byte: the low nibble is
+ * the foreground, the high nibble the background.
+ *
+ * @param palette The palette to fill in.
+ * @param kind One of PALETTE_16, PALETTE_256 or PALETTE_TRUECOLOR.
+ * @return 0 on success, -1 if arguments are invalid.
+ */
+int ansi_palette_init(ansi_palette_t *palette, int kind);
+
+/** @brief Pick a palette kind from the environment.
+ *
+ * Looks at COLORTERM and TERM, the way most terminal programs do.
+ *
+ * @return The richest palette kind the terminal claims to support.
+ */
+int ansi_palette_detect(void);
+
+/** @brief Set up an encoder.
+ *
+ * The cursor position and color start out unknown.
+ *
+ * @param enc The encoder.
+ * @param palette The palette to encode colors with.
+ * @return None.
+ */
+void ansi_encoder_init(ansi_encoder_t *enc, const ansi_palette_t *palette);
+
+/** @brief Forget what the encoder knows about the terminal.
+ *
+ * Used after something else has written to the terminal.
+ *
+ * @param enc The encoder.
+ * @return None.
+ */
+void ansi_invalidate(ansi_encoder_t *enc);
+
+/** @brief Append bytes that the encoder passes through untouched.
+ *
+ * @param enc The encoder.
+ * @param s The bytes to append.
+ * @param len The number of bytes.
+ * @return 0 on success, -1 if the frame buffer is full.
+ */
+int ansi_put_raw(ansi_encoder_t *enc, const char *s, size_t len);
+
+/** @brief Encode a run of cells on one row.
+ *
+ * Encoding stops short of the last ANSI_TRAILER_MAX_LEN bytes of the
+ * frame buffer, so the caller can always close the frame.
+ *
+ * If screen is given, it holds what the terminal shows on this row
+ * right now.  The encoder may send some of those cells again when that
+ * is cheaper than an escape to move the cursor past them.
+ *
+ * @param enc The encoder.
+ * @param cells The cells to encode.
+ * @param screen The cells on screen for the whole row, may be NULL.
+ * @param row The row the run starts on.
+ * @param col The column the run starts on.
+ * @param count The number of cells.
+ * @return 0 on success, -1 if the frame buffer is full.
+ */
+int ansi_encode_span(
+        ansi_encoder_t *enc,
+        const cell_t *cells,
+        const cell_t *screen,
+        int row,
+        int col,
+        int count);
+
+/** @brief Empty the frame buffer.
+ *
+ * The cursor and color the encoder tracks are kept.
+ *
+ * @param enc The encoder.
+ * @return None.
+ */
+void ansi_reset_frame(ansi_encoder_t *enc);
+
+#endif
@@ -0,0 +1,341 @@
+/** @file ansi_view.c
+ *  @brief A view that drives the terminal directly with ANSI escapes.
+ *
+ *  This implements the interface in ncurses_view.h without ncurses.
+ *  The terminal is put in raw mode with termios, and frames are
+ *  encoded with ansi_encoder.  Colors come from a palette picked from
+ *  the environment, so terminals with 256 colors or truecolor get the
+ *  richer tile colors.
+ *
+ *  Each frame goes out in a single write.  If the terminal supports
+ *  synchronized output (DEC private mode 2026), the frame is wrapped
+ *  in it, so the terminal shows the whole frame at once instead of
+ *  drawing it as the bytes arrive.
+ *
+ *  Keys are read and decoded by a key_reader_t (see key_decoder.h).
+ *
+ *  @bug None known.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <ncurses.h>
+#include "ansi_encoder.h"
+#include "key_decoder.h"
+#include "ncurses_view.h"
+
+/** Enter the alternate screen and clear it */
+#define SEQ_ENTER "\033[?1049h\033[0m\033[2J"
+/** Reset colors and leave the alternate screen */
+#define SEQ_LEAVE "\033[0m\033[?25h\033[?1049l"
+/** Reset colors and clear the screen */
+#define SEQ_CLEAR "\033[0m\033[2J"
+/** Hide the cursor */
+#define SEQ_HIDE_CURSOR "\033[?25l"
+/** Show the cursor */
+#define SEQ_SHOW_CURSOR "\033[?25h"
+/** Ask about mode 2026 (DECRQM), then for device attributes (DA1) */
+#define SEQ_QUERY_SYNC "\033[?2026$p\033[c"
+/** Start of a synchronized update */
+#define SEQ_SYNC_BEGIN "\033[?2026h"
+/** End of a synchronized update */
+#define SEQ_SYNC_END "\033[?2026l"
+
+/** How long to wait for the terminal to answer a query, in ms */
+#define QUERY_TIMEOUT_MS 250
+/** Size of the buffer for the answer to a query */
+#define QUERY_REPLY_LEN 128
+
+/*
+ * A copy of the last frame presented to the screen, so that only cells
+ * that changed since then are encoded.
+ */
+static cell_t front_buffer[CONSOLE_CELLS] CONSOLE_ALIGNED;
+
+/* The color escapes for the terminal's palette. */
+static ansi_palette_t palette;
+
+/* Bytes waiting for the next present_view. */
+static ansi_encoder_t encoder;
+
+/* Set if frames are wrapped in synchronized updates. */
+static int sync_output = 0;
+
+/* The number of bytes in an empty frame. */
+static size_t empty_frame_len = 0;
+
+/* The terminal settings to restore on exit. */
+static struct termios saved_termios;
+static int termios_saved = 0;
+
+/* Keys read from the terminal, but not yet handed out. */
+static key_reader_t reader;
+
+/***** Function prototypes ******/
+
+/** @brief Forget the last frame, so the next copy redraws every cell.
+ *
+ * @return None.
+ */
+static void invalidate_front_buffer(void);
+
+/** @brief Write bytes to the terminal, retrying short writes.
+ *
+ * @param s The bytes to write.
+ * @param len The number of bytes.
+ * @return None.
+ */
+static void write_all(const char *s, size_t len);
+
+/** @brief Ask the terminal if it supports synchronized output.
+ *
+ * The DECRQM query is followed by a DA1 query, which every terminal
+ * answers, so a terminal that ignores DECRQM costs one round trip
+ * rather than the whole timeout.
+ *
+ * @return 1 if mode 2026 is supported, 0 otherwise.
+ */
+static int detect_sync_output(void);
+
+/** @brief Start an empty frame in the encoder.
+ *
+ * @return None.
+ */
+static void begin_frame(void);
+
+/** @brief Restore the terminal and exit on a fatal signal.
+ *
+ * @param sig The signal.
+ * @return None.
+ */
+static void handle_signal(int sig);
+
+/** @brief Encode a changed span of a console.
+ *
+ * The front buffer row is passed along as what is on screen.
+ *
+ * @param cells The console cells.
+ * @param line The index of the first cell of the row.
+ * @param start The index of the first cell of the span.
+ * @param end The index just past the span.
+ * @return 0 on success, -1 if the frame buffer is full.
+ */
+static int encode_span(const cell_t *cells, size_t line, size_t start, size_t end);
+
+/***** Function definitions ******/
+
+void invalidate_front_buffer(void) {
+    /* No cell is ever 0xFFFF, so every cell will compare as changed. */
+    memset(front_buffer, 0xFF, sizeof(front_buffer));
+}
+
+void write_all(const char *s, size_t len) {
+    ssize_t written;
+    while(len > 0) {
+        written = write(STDOUT_FILENO, s, len);
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        s += written;
+        len -= written;
+    }
+}
+
+int detect_sync_output(void) {
+    char reply[QUERY_REPLY_LEN];
+    size_t len = 0;
+    ssize_t got;
+    struct pollfd pfd;
+    char *mode;
+
+    write_all(SEQ_QUERY_SYNC, strlen(SEQ_QUERY_SYNC));
+
+    /* Read until the DA1 answer, ESC [ ? ... c, arrives. */
+    while(len < sizeof(reply) - 1) {
+        pfd.fd = STDIN_FILENO;
+        pfd.events = POLLIN;
+        if(poll(&pfd, 1, QUERY_TIMEOUT_MS) <= 0) {
+            break;
+        }
+        got = read(STDIN_FILENO, reply + len, sizeof(reply) - 1 - len);
+        if(got <= 0) {
+            break;
+        }
+        len += got;
+        reply[len] = '\0';
+        if(reply[len - 1] == 'c' && strstr(reply, "\033[?") != NULL) {
+            break;
+        }
+    }
+    reply[len] = '\0';
+
+    /* The DECRPM answer is ESC [ ? 2026 ; Ps $ y, Ps 1 or 2 if supported. */
+    mode = strstr(reply, "\033[?2026;");
+    if(mode == NULL) {
+        return 0;
+    }
+    mode += strlen("\033[?2026;");
+    return (mode[0] == '1' || mode[0] == '2') && mode[1] == '$';
+}
+
+void begin_frame(void) {
+    ansi_reset_frame(&encoder);
+    if(sync_output) {
+        ansi_put_raw(&encoder, SEQ_SYNC_BEGIN, strlen(SEQ_SYNC_BEGIN));
+    }
+    empty_frame_len = encoder.len;
+}
+
+void handle_signal(int sig) {
+    close_view();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+void init_ncurses_view() {
+    struct termios raw;
+
+    invalidate_front_buffer();
+    ansi_palette_init(&palette, ansi_palette_detect());
+    ansi_encoder_init(&encoder, &palette);
+    key_reader_init(&reader, STDIN_FILENO);
+
+    if(tcgetattr(STDIN_FILENO, &saved_termios) == 0) {
+        termios_saved = 1;
+        raw = saved_termios;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_iflag &= ~(IXON | ICRNL);
+        raw.c_cc[VMIN] = 0;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+        sync_output = detect_sync_output();
+    }
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    write_all(SEQ_ENTER, strlen(SEQ_ENTER));
+    hide_cursor();
+    begin_frame();
+}
+
+void close_view() {
+    write_all(SEQ_LEAVE, strlen(SEQ_LEAVE));
+    if(termios_saved) {
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved_termios);
+    }
+}
+
+void hide_cursor() {
+    write_all(SEQ_HIDE_CURSOR, strlen(SEQ_HIDE_CURSOR));
+}
+
+void show_cursor() {
+    write_all(SEQ_SHOW_CURSOR, strlen(SEQ_SHOW_CURSOR));
+}
+
+void clear_console() {
+    ansi_put_raw(&encoder, SEQ_CLEAR, strlen(SEQ_CLEAR));
+    ansi_invalidate(&encoder);
+    invalidate_front_buffer();
+}
+
+void copy_console(console_t* other) {
+    if(other == NULL) {
+        return;
+    }
+    copy_console_region(other, 0, 0, other->height, other->width);
+}
+
+void copy_console_region(console_t* other, int row, int col, int height, int width) {
+    stage_console_region(other, row, col, height, width);
+    present_view();
+}
+
+void present_view(void) {
+    if(encoder.len == empty_frame_len) {
+        return;
+    }
+    if(sync_output) {
+        ansi_put_raw(&encoder, SEQ_SYNC_END, strlen(SEQ_SYNC_END));
+    }
+    write_all(encoder.frame, encoder.len);
+    begin_frame();
+}
+
+int encode_span(const cell_t *cells, size_t line, size_t start, size_t end) {
+    return ansi_encode_span(
+            &encoder, 
+            cells + start, 
+            front_buffer + line, 
+            line / CONSOLE_WIDTH, 
+            start - line, 
+            end - start);
+}
+
+void stage_console_region(console_t* other, int row, int col, int height, int width) {
+    int rr;
+    size_t start, end;
+    size_t line;
+    const cell_t *cells;
+    if(other == NULL) {
+        return;
+    }
+    if(other->width != CONSOLE_WIDTH || other->height > CONSOLE_HEIGHT) {
+        return;
+    }
+    /* Clip the region to the console. */
+    if(row < 0) {
+        height += row;
+        row = 0;
+    }
+    if(col < 0) {
+        width += col;
+        col = 0;
+    }
+    if(row + height > other->height) {
+        height = other->height - row;
+    }
+    if(col + width > other->width) {
+        width = other->width - col;
+    }
+    cells = (const cell_t*) other->base_addr;
+    for(rr = row; rr < row + height; rr++) {
+        /* Encode only the runs of cells that changed. */
+        line = rr * other->width;
+        start = console_next_changed(cells, front_buffer, line + col, line + col + width);
+        while(start < line + col + width) {
+            end = console_next_unchanged(cells, front_buffer, start, line + col + width);
+            if(encode_span(cells, line, start, end) < 0) {
+                /* The frame is full; send what we have and carry on. */
+                present_view();
+                encode_span(cells, line, start, end);
+            }
+            memcpy(front_buffer + start, cells + start, sizeof(cell_t) * (end - start));
+            start = console_next_changed(cells, front_buffer, end, line + col + width);
+        }
+    }
+}
+
+int key_input(void) {
+    return key_reader_next(&reader, 0);
+}
+
+int wait_key_input(void) {
+    int ch;
+    /* Block in poll, so an idle screen costs no CPU while we wait. */
+    while((ch = key_reader_next(&reader, -1)) == KEY_DECODER_NONE) {
+    }
+    return ch;
+}
+
+int key_input_timeout(int timeout_ms) {
+    return key_reader_next(&reader, timeout_ms);
+}
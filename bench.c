@@ -0,0 +1,500 @@
+/** @file bench.c
+ *  @brief Times the engine over the positions of a corpus.
+ *
+ *  Runs each engine benchmark over every board of each phase of a
+ *  corpus (see corpus.h), a number of times, and reports the time per
+ *  call.  The boards are unpacked once up front, so a benchmark times
+ *  only the engine, plus a 64 byte copy for those that change the
+ *  board.
+ *
+ *  The engine's move is the one both the game and the replay tools
+ *  make.  move_left and the like time it as the replay tools call it;
+ *  move_traced times it as a session calls it, tracing the tiles that
+ *  move for the animations.
+ *
+ *  Each run of a benchmark makes at least MIN_OPS calls, going over the
+ *  boards as often as that takes.  The runs of the benchmarks of a phase
+ *  are interleaved, so a slow patch of the machine spreads over them
+ *  all rather than skewing one.
+ *
+ *  With -o, the time per call of every run is saved as JSON, for
+ *  comparing one build with another.  The compiler and flags bench was
+ *  built with go in too, since times from builds made with different
+ *  flags say nothing about the code:
+ *
+ *      {"corpus": {"version": 1, "seed": 1, "games": 5000},
+ *       "build": "gcc -O2 -g",
+ *       "runs": 10,
+ *       "benchmarks": [
+ *        {"name": "move_left", "phase": "early", "ops": 262144,
+ *         "ns_per_op": [3.51, 3.49, ...]},
+ *        ...]}
+ *
+ *  Usage: bench [-r runs] [-b benchmark] [-p phase] [-o results] corpus
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "corpus.h"
+
+/** The compiler and flags bench was built with, given by the Makefile */
+#ifndef BUILD_FLAGS
+#define BUILD_FLAGS "unknown"
+#endif
+
+/** Fewest calls in a run of a benchmark */
+#define MIN_OPS 262144
+/** Most runs of a benchmark */
+#define MAX_RUNS 1000
+
+/** @brief The boards of one phase, unpacked.
+ */
+typedef struct boards_t {
+    /** The boards */
+    int (*grids)[GRID_SIZE][GRID_SIZE];
+    /** The number of boards */
+    uint64_t count;
+    /** The generator for benchmarks that place tiles */
+    engine_rng_t rng;
+} boards_t;
+
+/** @brief A benchmark.
+ */
+typedef struct benchmark_t {
+    /** The benchmark's name */
+    const char *name;
+    /** Goes over every board once.  Returns a checksum, so the work is
+     *  not optimized away. */
+    unsigned long (*pass)(boards_t *boards);
+} benchmark_t;
+
+/** @brief Settings from the command line.
+ */
+typedef struct options_t {
+    /** Runs of each benchmark */
+    int runs;
+    /** The only benchmark to run, or NULL for all */
+    const char *benchmark;
+    /** The only phase to run, or -1 for all */
+    int phase;
+    /** Where to save the results, or NULL */
+    const char *output;
+} options_t;
+
+/***** Function prototypes ******/
+
+/** @brief Print how to run the program.
+ *
+ * @param name The program's name.
+ * @return None.
+ */
+static void usage(const char *name);
+
+/** @brief Read the command line.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param options Set to the settings.
+ * @return The index of the corpus, or -1 on a usage error.
+ */
+static int parse_options(int argc, char **argv, options_t *options);
+
+/** @brief Move every board in a direction.
+ *
+ * @param boards The boards.
+ * @param dir One of the DIR_ constants.
+ * @return The points scored.
+ */
+static unsigned long pass_move(boards_t *boards, int dir);
+
+/** @brief Move every board left.
+ *
+ * @param boards The boards.
+ * @return The points scored.
+ */
+static unsigned long pass_move_left(boards_t *boards);
+
+/** @brief Move every board right.
+ *
+ * @param boards The boards.
+ * @return The points scored.
+ */
+static unsigned long pass_move_right(boards_t *boards);
+
+/** @brief Move every board down.
+ *
+ * @param boards The boards.
+ * @return The points scored.
+ */
+static unsigned long pass_move_down(boards_t *boards);
+
+/** @brief Move every board up.
+ *
+ * @param boards The boards.
+ * @return The points scored.
+ */
+static unsigned long pass_move_up(boards_t *boards);
+
+/** @brief Move every board, tracing the tiles that move, as a session does.
+ *
+ * The boards take the directions in turn.
+ *
+ * @param boards The boards.
+ * @return The points scored plus the tiles moved.
+ */
+static unsigned long pass_move_traced(boards_t *boards);
+
+/** @brief Check every board for a loss.
+ *
+ * @param boards The boards.
+ * @return The number of lost boards.
+ */
+static unsigned long pass_is_lost(boards_t *boards);
+
+/** @brief Find the largest tile of every board.
+ *
+ * @param boards The boards.
+ * @return The sum of the largest tiles.
+ */
+static unsigned long pass_max_tile(boards_t *boards);
+
+/** @brief Place a new tile on every board.
+ *
+ * @param boards The boards.
+ * @return The number of tiles placed.
+ */
+static unsigned long pass_spawn(boards_t *boards);
+
+/** @brief Time a run of a benchmark.
+ *
+ * @param bench The benchmark.
+ * @param boards The boards.
+ * @param passes How many times to go over the boards.
+ * @param sink Where to add the checksum.
+ * @return The time per call, in nanoseconds.
+ */
+static double time_run(
+        const benchmark_t *bench,
+        boards_t *boards,
+        uint64_t passes,
+        unsigned long *sink);
+
+/** @brief Compare two times, for qsort.
+ *
+ * @param a The first time.
+ * @param b The second time.
+ * @return Less than, equal to or greater than 0 as a is less than, equal
+ *         to or greater than b.
+ */
+static int compare_times(const void *a, const void *b);
+
+/** The benchmarks, in the order they are run */
+static const benchmark_t benchmarks[] = {
+    { "move_left", pass_move_left },
+    { "move_right", pass_move_right },
+    { "move_down", pass_move_down },
+    { "move_up", pass_move_up },
+    { "move_traced", pass_move_traced },
+    { "is_lost", pass_is_lost },
+    { "max_tile", pass_max_tile },
+    { "spawn", pass_spawn },
+};
+
+/** Number of benchmarks */
+#define NUM_BENCHMARKS ((int) (sizeof(benchmarks) / sizeof(benchmarks[0])))
+
+/***** Function definitions ******/
+
+void usage(const char *name) {
+    int ii;
+
+    fprintf(stderr,
+        "usage: %s [-r runs] [-b benchmark] [-p phase] [-o results] corpus\n"
+        "  -r  runs of each benchmark (default 10)\n"
+        "  -b  run only this benchmark\n"
+        "  -p  run only this phase\n"
+        "  -o  save the time of every run, as JSON\n"
+        "Benchmarks:",
+        name);
+    for(ii = 0; ii < NUM_BENCHMARKS; ii++) {
+        fprintf(stderr, " %s", benchmarks[ii].name);
+    }
+    fprintf(stderr, "\nPhases:");
+    for(ii = 0; ii < CORPUS_PHASES; ii++) {
+        fprintf(stderr, " %s", corpus_phase_name(ii));
+    }
+    fprintf(stderr, "\n");
+}
+
+int parse_options(int argc, char **argv, options_t *options) {
+    int opt, ii;
+
+    options->runs = 10;
+    options->benchmark = NULL;
+    options->phase = -1;
+    options->output = NULL;
+
+    while((opt = getopt(argc, argv, "r:b:p:o:")) != -1) {
+        switch(opt) {
+            case 'r':
+                options->runs = atoi(optarg);
+                if(options->runs < 1 || options->runs > MAX_RUNS) {
+                    return -1;
+                }
+                break;
+            case 'b':
+                for(ii = 0; ii < NUM_BENCHMARKS; ii++) {
+                    if(strcmp(optarg, benchmarks[ii].name) == 0) {
+                        break;
+                    }
+                }
+                if(ii == NUM_BENCHMARKS) {
+                    return -1;
+                }
+                options->benchmark = optarg;
+                break;
+            case 'p':
+                for(ii = 0; ii < CORPUS_PHASES; ii++) {
+                    if(strcmp(optarg, corpus_phase_name(ii)) == 0) {
+                        break;
+                    }
+                }
+                if(ii == CORPUS_PHASES) {
+                    return -1;
+                }
+                options->phase = ii;
+                break;
+            case 'o':
+                options->output = optarg;
+                break;
+            default:
+                return -1;
+        }
+    }
+    if(optind != argc - 1) {
+        return -1;
+    }
+    return optind;
+}
+
+unsigned long pass_move(boards_t *boards, int dir) {
+    int grid[GRID_SIZE][GRID_SIZE];
+    unsigned long total = 0;
+    unsigned int score;
+    uint64_t ii;
+
+    for(ii = 0; ii < boards->count; ii++) {
+        memcpy(grid, boards->grids[ii], sizeof(grid));
+        score = 0;
+        engine_move(grid, dir, &score);
+        total += score;
+    }
+    return total;
+}
+
+unsigned long pass_move_left(boards_t *boards) {
+    return pass_move(boards, DIR_LEFT);
+}
+
+unsigned long pass_move_right(boards_t *boards) {
+    return pass_move(boards, DIR_RIGHT);
+}
+
+unsigned long pass_move_down(boards_t *boards) {
+    return pass_move(boards, DIR_DOWN);
+}
+
+unsigned long pass_move_up(boards_t *boards) {
+    return pass_move(boards, DIR_UP);
+}
+
+unsigned long pass_move_traced(boards_t *boards) {
+    engine_motion_t motions[ENGINE_MAX_MOTIONS];
+    int grid[GRID_SIZE][GRID_SIZE];
+    unsigned long total = 0;
+    unsigned int score;
+    int num_motions;
+    uint64_t ii;
+
+    for(ii = 0; ii < boards->count; ii++) {
+        memcpy(grid, boards->grids[ii], sizeof(grid));
+        score = 0;
+        num_motions = 0;
+        engine_move_traced(grid, ii % NUM_DIRS, &score, motions, &num_motions);
+        total += score + num_motions;
+    }
+    return total;
+}
+
+unsigned long pass_is_lost(boards_t *boards) {
+    unsigned long lost = 0;
+    uint64_t ii;
+
+    for(ii = 0; ii < boards->count; ii++) {
+        lost += engine_is_lost(boards->grids[ii]);
+    }
+    return lost;
+}
+
+unsigned long pass_max_tile(boards_t *boards) {
+    unsigned long total = 0;
+    uint64_t ii;
+
+    for(ii = 0; ii < boards->count; ii++) {
+        total += engine_max_tile(boards->grids[ii]);
+    }
+    return total;
+}
+
+unsigned long pass_spawn(boards_t *boards) {
+    int grid[GRID_SIZE][GRID_SIZE];
+    unsigned long placed = 0;
+    uint64_t ii;
+
+    for(ii = 0; ii < boards->count; ii++) {
+        memcpy(grid, boards->grids[ii], sizeof(grid));
+        placed += engine_spawn(grid, &boards->rng, NULL, NULL);
+    }
+    return placed;
+}
+
+double time_run(
+        const benchmark_t *bench,
+        boards_t *boards,
+        uint64_t passes,
+        unsigned long *sink) {
+    struct timespec start, end;
+    uint64_t ii;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(ii = 0; ii < passes; ii++) {
+        *sink += bench->pass(boards);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec))
+        / (passes * boards->count);
+}
+
+int compare_times(const void *a, const void *b) {
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+    options_t options;
+    corpus_t corpus;
+    boards_t boards;
+    double *times, *sorted;
+    unsigned long sink = 0;
+    uint64_t ii, passes;
+    int jj, run, phase, first = 1;
+    FILE *out = NULL;
+    const char *flag;
+
+    if(parse_options(argc, argv, &options) < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    if(corpus_open(&corpus, argv[argc - 1]) < 0) {
+        fprintf(stderr, "%s: not a readable corpus\n", argv[argc - 1]);
+        return 1;
+    }
+    times = malloc(sizeof(double) * NUM_BENCHMARKS * options.runs);
+    sorted = malloc(sizeof(double) * options.runs);
+    if(times == NULL || sorted == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    if(options.output != NULL) {
+        out = fopen(options.output, "w");
+        if(out == NULL) {
+            perror(options.output);
+            return 1;
+        }
+        fprintf(out, "{\"corpus\": {\"version\": %d, \"seed\": %llu, \"games\": %llu},\n"
+            " \"build\": \"", CORPUS_VERSION,
+            (unsigned long long) corpus.seed, (unsigned long long) corpus.games);
+        for(flag = BUILD_FLAGS; *flag != '\0'; flag++) {
+            if(*flag == '"' || *flag == '\\') {
+                fputc('\\', out);
+            }
+            fputc(*flag, out);
+        }
+        fprintf(out, "\",\n \"runs\": %d,\n \"benchmarks\": [", options.runs);
+    }
+
+    printf("%-10s %-12s %10s %10s %10s %10s\n",
+        "phase", "benchmark", "boards", "ns/op", "min", "max");
+    for(phase = 0; phase < CORPUS_PHASES; phase++) {
+        if(corpus.count[phase] == 0 || (options.phase >= 0 && phase != options.phase)) {
+            continue;
+        }
+        boards.count = corpus.count[phase];
+        boards.grids = malloc(sizeof(*boards.grids) * boards.count);
+        if(boards.grids == NULL) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+        for(ii = 0; ii < boards.count; ii++) {
+            engine_unpack_board(corpus_board(&corpus, phase, ii), boards.grids[ii]);
+        }
+        engine_rng_seed(&boards.rng, corpus.seed);
+        passes = (MIN_OPS + boards.count - 1) / boards.count;
+
+        /* One untimed pass each warms the caches and branch predictors. */
+        for(jj = 0; jj < NUM_BENCHMARKS; jj++) {
+            sink += benchmarks[jj].pass(&boards);
+        }
+        for(run = 0; run < options.runs; run++) {
+            for(jj = 0; jj < NUM_BENCHMARKS; jj++) {
+                if(options.benchmark != NULL
+                        && strcmp(options.benchmark, benchmarks[jj].name) != 0) {
+                    continue;
+                }
+                times[jj * options.runs + run] = time_run(&benchmarks[jj], &boards, passes, &sink);
+            }
+        }
+
+        for(jj = 0; jj < NUM_BENCHMARKS; jj++) {
+            if(options.benchmark != NULL && strcmp(options.benchmark, benchmarks[jj].name) != 0) {
+                continue;
+            }
+            memcpy(sorted, &times[jj * options.runs], sizeof(double) * options.runs);
+            qsort(sorted, options.runs, sizeof(double), compare_times);
+            printf("%-10s %-12s %10llu %10.2f %10.2f %10.2f\n", corpus_phase_name(phase),
+                benchmarks[jj].name, (unsigned long long) boards.count,
+                sorted[options.runs / 2], sorted[0], sorted[options.runs - 1]);
+            if(out != NULL) {
+                fprintf(out, "%s\n  {\"name\": \"%s\", \"phase\": \"%s\", \"ops\": %llu,"
+                    " \"ns_per_op\": [", first ? "" : ",", benchmarks[jj].name,
+                    corpus_phase_name(phase), (unsigned long long) (passes * boards.count));
+                for(run = 0; run < options.runs; run++) {
+                    fprintf(out, "%s%.3f", run ? ", " : "", times[jj * options.runs + run]);
+                }
+                fprintf(out, "]}");
+                first = 0;
+            }
+        }
+        free(boards.grids);
+    }
+
+    if(out != NULL) {
+        fprintf(out, "]}\n");
+        if(fclose(out) != 0) {
+            fprintf(stderr, "%s: could not save results\n", options.output);
+            return 1;
+        }
+    }
+    /* Printing the checksum keeps the compiler from skipping the work. */
+    printf("checksum %lu\n", sink);
+    free(times);
+    free(sorted);
+    corpus_close(&corpus);
+    return 0;
+}
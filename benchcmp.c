@@ -0,0 +1,840 @@
+/** @file benchcmp.c
+ *  @brief Decides whether a build is faster than another, from bench runs.
+ *
+ *  Reads two results files saved by bench -o, a baseline and a
+ *  candidate, pairs up their benchmarks by name and phase, and reports
+ *  for each the median time per call of both, the speedup of the
+ *  candidate, an interval the speedup lies in with the chosen
+ *  confidence, and the chance the difference is noise.
+ *
+ *  One run of a benchmark is too noisy to decide on, so the runs of each
+ *  are compared as two samples, with no assumption about how the times
+ *  are spread:
+ *
+ *  - The Mann-Whitney test gives the chance of the runs of one build
+ *    beating the other's as often as they did were the builds equally
+ *    fast.  It is taken from the normal approximation, with ties
+ *    corrected for, which is close from about 5 runs a build.
+ *  - The speedup is the Hodges-Lehmann estimate, the median of the
+ *    ratios of every baseline run to every candidate run, and its
+ *    interval comes from the same test's distribution.
+ *
+ *  A benchmark is faster or slower when the test clears -a and the
+ *  speedup is past -t percent either way; otherwise it is the same.
+ *  The test's chances are scaled by the number of benchmarks compared,
+ *  and the intervals widened to match, so -a bounds the chance of any
+ *  false alarm in the whole report, not of each line.
+ *  The program exits with 1 if any benchmark is slower, so a build
+ *  script can stop on a regression.  It refuses, with 2, to compare
+ *  runs of bench built with different compilers or flags.
+ *
+ *  Usage: benchcmp [-a alpha] [-t percent] baseline candidate
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <math.h>
+
+/** Longest benchmark or phase name kept */
+#define MAX_NAME 32
+/** Longest compiler and flags kept */
+#define MAX_BUILD 256
+/** Fewest runs a build needs for a benchmark to be compared */
+#define MIN_RUNS 3
+
+/** @brief Settings from the command line.
+ */
+typedef struct options_t {
+    /** The chance of calling noise a difference that is accepted */
+    double alpha;
+    /** The least speedup or slowdown that counts, as a fraction */
+    double threshold;
+} options_t;
+
+/** @brief The runs of one benchmark in one results file.
+ */
+typedef struct entry_t {
+    /** The benchmark */
+    char name[MAX_NAME];
+    /** The phase of the corpus it ran over */
+    char phase[MAX_NAME];
+    /** The time per call of each run, in nanoseconds */
+    double *times;
+    /** The number of runs */
+    int count;
+    /** The room for runs */
+    int cap;
+} entry_t;
+
+/** @brief A results file.
+ */
+typedef struct results_t {
+    /** The corpus version */
+    double version;
+    /** The corpus seed */
+    double seed;
+    /** The games the corpus was sampled from */
+    double games;
+    /** The compiler and flags bench was built with, or "" if not given */
+    char build[MAX_BUILD];
+    /** The benchmarks */
+    entry_t *entries;
+    /** The number of benchmarks */
+    int num_entries;
+    /** The room for benchmarks */
+    int cap;
+} results_t;
+
+/** @brief A JSON text being read.
+ */
+typedef struct parser_t {
+    /** The next character */
+    const char *pos;
+    /** The end of the text */
+    const char *end;
+} parser_t;
+
+/** @brief Reads one field of a JSON object.
+ *
+ * The parser is at the field's value, which must be read or skipped.
+ */
+typedef int (*field_fn)(parser_t *p, const char *key, void *ctx);
+
+/** @brief Reads one item of a JSON array.
+ *
+ * The parser is at the item, which must be read or skipped.
+ */
+typedef int (*item_fn)(parser_t *p, void *ctx);
+
+/** @brief How two builds compare on a benchmark.
+ */
+typedef struct comparison_t {
+    /** The baseline's median time per call */
+    double baseline;
+    /** The candidate's median time per call */
+    double candidate;
+    /** How many times faster the candidate is */
+    double speedup;
+    /** The low end of the speedup's interval */
+    double low;
+    /** The high end of the speedup's interval */
+    double high;
+    /** The chance of the difference being noise */
+    double p;
+} comparison_t;
+
+/***** Function prototypes ******/
+
+/** @brief Print how to run the program.
+ *
+ * @param name The program's name.
+ * @return None.
+ */
+static void usage(const char *name);
+
+/** @brief Read the command line.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param options Set to the settings.
+ * @return The index of the baseline, or -1 on a usage error.
+ */
+static int parse_options(int argc, char **argv, options_t *options);
+
+/** @brief Skip white space.
+ *
+ * @param p The parser.
+ * @return The next character, or -1 at the end of the text.
+ */
+static int peek(parser_t *p);
+
+/** @brief Read a given character, after any white space.
+ *
+ * @param p The parser.
+ * @param c The character.
+ * @return 0 on success, -1 if the next character is another.
+ */
+static int expect(parser_t *p, char c);
+
+/** @brief Read a JSON string.
+ *
+ * @param p The parser.
+ * @param out Set to the string, cut short if need be, or NULL to skip it.
+ * @param len The room in out.
+ * @return 0 on success, -1 on a syntax error.
+ */
+static int parse_string(parser_t *p, char *out, size_t len);
+
+/** @brief Read a JSON number.
+ *
+ * @param p The parser.
+ * @param value Set to the number.
+ * @return 0 on success, -1 on a syntax error.
+ */
+static int parse_number(parser_t *p, double *value);
+
+/** @brief Read a JSON object, a field at a time.
+ *
+ * @param p The parser.
+ * @param field Called with each field.
+ * @param ctx Passed to field.
+ * @return 0 on success, -1 on a syntax error.
+ */
+static int parse_object(parser_t *p, field_fn field, void *ctx);
+
+/** @brief Read a JSON array, an item at a time.
+ *
+ * @param p The parser.
+ * @param item Called with each item.
+ * @param ctx Passed to item.
+ * @return 0 on success, -1 on a syntax error.
+ */
+static int parse_array(parser_t *p, item_fn item, void *ctx);
+
+/** @brief Skip any JSON value.
+ *
+ * @param p The parser.
+ * @return 0 on success, -1 on a syntax error.
+ */
+static int skip_value(parser_t *p);
+
+/** @brief Skip a field of a JSON object, for parse_object.
+ *
+ * @param p The parser.
+ * @param key The field's name.
+ * @param ctx Unused.
+ * @return 0 on success, -1 on a syntax error.
+ */
+static int skip_field(parser_t *p, const char *key, void *ctx);
+
+/** @brief Skip an item of a JSON array, for parse_array.
+ *
+ * @param p The parser.
+ * @param ctx Unused.
+ * @return 0 on success, -1 on a syntax error.
+ */
+static int skip_item(parser_t *p, void *ctx);
+
+/** @brief Read a time of a benchmark's runs.
+ *
+ * @param p The parser.
+ * @param ctx The benchmark.
+ * @return 0 on success, -1 on a syntax error or if out of memory.
+ */
+static int read_time(parser_t *p, void *ctx);
+
+/** @brief Read a field of a benchmark.
+ *
+ * @param p The parser.
+ * @param key The field's name.
+ * @param ctx The benchmark.
+ * @return 0 on success, -1 on a syntax error or if out of memory.
+ */
+static int read_entry_field(parser_t *p, const char *key, void *ctx);
+
+/** @brief Read a benchmark.
+ *
+ * @param p The parser.
+ * @param ctx The results.
+ * @return 0 on success, -1 on a syntax error or if out of memory.
+ */
+static int read_entry(parser_t *p, void *ctx);
+
+/** @brief Read a field describing the corpus.
+ *
+ * @param p The parser.
+ * @param key The field's name.
+ * @param ctx The results.
+ * @return 0 on success, -1 on a syntax error.
+ */
+static int read_corpus_field(parser_t *p, const char *key, void *ctx);
+
+/** @brief Read a top level field of a results file.
+ *
+ * @param p The parser.
+ * @param key The field's name.
+ * @param ctx The results.
+ * @return 0 on success, -1 on a syntax error or if out of memory.
+ */
+static int read_results_field(parser_t *p, const char *key, void *ctx);
+
+/** @brief Load a results file.
+ *
+ * @param path The file.
+ * @param results Set to the results.
+ * @return 0 on success, -1 if it cannot be read or is not a results file.
+ */
+static int load_results(const char *path, results_t *results);
+
+/** @brief Free a results file.
+ *
+ * @param results The results.
+ * @return None.
+ */
+static void free_results(results_t *results);
+
+/** @brief Compare two numbers, for qsort.
+ *
+ * @param a The first number.
+ * @param b The second number.
+ * @return Less than, equal to or greater than 0 as a is less than, equal
+ *         to or greater than b.
+ */
+static int compare_doubles(const void *a, const void *b);
+
+/** @brief Find the median of some sorted numbers.
+ *
+ * @param values The numbers, sorted.
+ * @param count How many there are, at least 1.
+ * @return The median.
+ */
+static double median(const double *values, int count);
+
+/** @brief Find how far from the mean a normal variable is with a chance.
+ *
+ * @param alpha The chance of it being further either way.
+ * @return The distance, in standard deviations.
+ */
+static double normal_quantile(double alpha);
+
+/** @brief Compare the runs of two builds on a benchmark.
+ *
+ * @param a The baseline's runs, sorted.
+ * @param b The candidate's runs, sorted.
+ * @param alpha The interval leaves out this chance.
+ * @param cmp Set to the comparison.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int compare_runs(const entry_t *a, const entry_t *b, double alpha, comparison_t *cmp);
+
+/** @brief Find a benchmark in some results.
+ *
+ * @param results The results.
+ * @param entry The benchmark, by name and phase.
+ * @return The benchmark in the results, or NULL if they lack it.
+ */
+static const entry_t *find_entry(const results_t *results, const entry_t *entry);
+
+/***** Function definitions ******/
+
+void usage(const char *name) {
+    fprintf(stderr,
+        "usage: %s [-a alpha] [-t percent] baseline candidate\n"
+        "  -a  chance of taking noise for a difference (default 0.01)\n"
+        "  -t  smallest change that counts, in percent (default 2)\n"
+        "Both files are saved by bench -o.\n",
+        name);
+}
+
+int parse_options(int argc, char **argv, options_t *options) {
+    int opt;
+
+    options->alpha = 0.01;
+    options->threshold = 0.02;
+
+    while((opt = getopt(argc, argv, "a:t:")) != -1) {
+        switch(opt) {
+            case 'a':
+                options->alpha = atof(optarg);
+                if(options->alpha <= 0 || options->alpha >= 1) {
+                    return -1;
+                }
+                break;
+            case 't':
+                options->threshold = atof(optarg) / 100;
+                if(options->threshold < 0) {
+                    return -1;
+                }
+                break;
+            default:
+                return -1;
+        }
+    }
+    if(optind != argc - 2) {
+        return -1;
+    }
+    return optind;
+}
+
+int peek(parser_t *p) {
+    while(p->pos < p->end && isspace((unsigned char) *p->pos)) {
+        p->pos++;
+    }
+    return p->pos < p->end ? *p->pos : -1;
+}
+
+int expect(parser_t *p, char c) {
+    if(peek(p) != c) {
+        return -1;
+    }
+    p->pos++;
+    return 0;
+}
+
+int parse_string(parser_t *p, char *out, size_t len) {
+    size_t used = 0;
+    char c;
+
+    if(expect(p, '"') < 0) {
+        return -1;
+    }
+    while(p->pos < p->end && *p->pos != '"') {
+        c = *p->pos++;
+        if(c == '\\') {
+            /* Names need no escapes; keep the escaped character as is. */
+            if(p->pos == p->end) {
+                return -1;
+            }
+            c = *p->pos++;
+        }
+        if(out != NULL && used + 1 < len) {
+            out[used++] = c;
+        }
+    }
+    if(out != NULL) {
+        out[used] = '\0';
+    }
+    return expect(p, '"');
+}
+
+int parse_number(parser_t *p, double *value) {
+    char buf[64];
+    char *stop;
+    size_t len = 0;
+
+    peek(p);
+    while(p->pos + len < p->end && len + 1 < sizeof(buf)
+            && strchr("+-.eE0123456789", p->pos[len]) != NULL) {
+        buf[len] = p->pos[len];
+        len++;
+    }
+    buf[len] = '\0';
+    *value = strtod(buf, &stop);
+    if(len == 0 || *stop != '\0') {
+        return -1;
+    }
+    p->pos += len;
+    return 0;
+}
+
+int parse_object(parser_t *p, field_fn field, void *ctx) {
+    char key[MAX_NAME];
+
+    if(expect(p, '{') < 0) {
+        return -1;
+    }
+    if(peek(p) == '}') {
+        p->pos++;
+        return 0;
+    }
+    while(1) {
+        if(parse_string(p, key, sizeof(key)) < 0 || expect(p, ':') < 0
+                || field(p, key, ctx) < 0) {
+            return -1;
+        }
+        if(peek(p) != ',') {
+            return expect(p, '}');
+        }
+        p->pos++;
+    }
+}
+
+int parse_array(parser_t *p, item_fn item, void *ctx) {
+    if(expect(p, '[') < 0) {
+        return -1;
+    }
+    if(peek(p) == ']') {
+        p->pos++;
+        return 0;
+    }
+    while(1) {
+        if(item(p, ctx) < 0) {
+            return -1;
+        }
+        if(peek(p) != ',') {
+            return expect(p, ']');
+        }
+        p->pos++;
+    }
+}
+
+int skip_value(parser_t *p) {
+    static const char *words[] = { "true", "false", "null" };
+    double number;
+    size_t ii, len;
+
+    switch(peek(p)) {
+        case '"':
+            return parse_string(p, NULL, 0);
+        case '{':
+            return parse_object(p, skip_field, NULL);
+        case '[':
+            return parse_array(p, skip_item, NULL);
+        default:
+            break;
+    }
+    for(ii = 0; ii < sizeof(words) / sizeof(words[0]); ii++) {
+        len = strlen(words[ii]);
+        if((size_t) (p->end - p->pos) >= len && strncmp(p->pos, words[ii], len) == 0) {
+            p->pos += len;
+            return 0;
+        }
+    }
+    return parse_number(p, &number);
+}
+
+int skip_field(parser_t *p, const char *key, void *ctx) {
+    (void) key;
+    (void) ctx;
+    return skip_value(p);
+}
+
+int skip_item(parser_t *p, void *ctx) {
+    (void) ctx;
+    return skip_value(p);
+}
+
+int read_time(parser_t *p, void *ctx) {
+    entry_t *entry = ctx;
+    double *grown;
+    int cap;
+
+    if(entry->count == entry->cap) {
+        cap = entry->cap ? entry->cap * 2 : 16;
+        grown = realloc(entry->times, cap * sizeof(*grown));
+        if(grown == NULL) {
+            return -1;
+        }
+        entry->times = grown;
+        entry->cap = cap;
+    }
+    return parse_number(p, &entry->times[entry->count++]);
+}
+
+int read_entry_field(parser_t *p, const char *key, void *ctx) {
+    entry_t *entry = ctx;
+
+    if(strcmp(key, "name") == 0) {
+        return parse_string(p, entry->name, sizeof(entry->name));
+    }
+    if(strcmp(key, "phase") == 0) {
+        return parse_string(p, entry->phase, sizeof(entry->phase));
+    }
+    if(strcmp(key, "ns_per_op") == 0) {
+        return parse_array(p, read_time, entry);
+    }
+    return skip_value(p);
+}
+
+int read_entry(parser_t *p, void *ctx) {
+    results_t *results = ctx;
+    entry_t *grown;
+    int cap;
+
+    if(results->num_entries == results->cap) {
+        cap = results->cap ? results->cap * 2 : 32;
+        grown = realloc(results->entries, cap * sizeof(*grown));
+        if(grown == NULL) {
+            return -1;
+        }
+        results->entries = grown;
+        results->cap = cap;
+    }
+    memset(&results->entries[results->num_entries], 0, sizeof(entry_t));
+    return parse_object(p, read_entry_field, &results->entries[results->num_entries++]);
+}
+
+int read_corpus_field(parser_t *p, const char *key, void *ctx) {
+    results_t *results = ctx;
+
+    if(strcmp(key, "version") == 0) {
+        return parse_number(p, &results->version);
+    }
+    if(strcmp(key, "seed") == 0) {
+        return parse_number(p, &results->seed);
+    }
+    if(strcmp(key, "games") == 0) {
+        return parse_number(p, &results->games);
+    }
+    return skip_value(p);
+}
+
+int read_results_field(parser_t *p, const char *key, void *ctx) {
+    results_t *results = ctx;
+
+    if(strcmp(key, "corpus") == 0) {
+        return parse_object(p, read_corpus_field, ctx);
+    }
+    if(strcmp(key, "build") == 0) {
+        return parse_string(p, results->build, sizeof(results->build));
+    }
+    if(strcmp(key, "benchmarks") == 0) {
+        return parse_array(p, read_entry, ctx);
+    }
+    return skip_value(p);
+}
+
+int load_results(const char *path, results_t *results) {
+    parser_t p;
+    char *text;
+    long len;
+    FILE *in;
+    int rt;
+
+    memset(results, 0, sizeof(*results));
+    in = fopen(path, "rb");
+    if(in == NULL) {
+        return -1;
+    }
+    if(fseek(in, 0, SEEK_END) < 0 || (len = ftell(in)) < 0 || fseek(in, 0, SEEK_SET) < 0) {
+        fclose(in);
+        return -1;
+    }
+    text = malloc(len + 1);
+    if(text == NULL || fread(text, 1, len, in) != (size_t) len) {
+        free(text);
+        fclose(in);
+        return -1;
+    }
+    fclose(in);
+
+    p.pos = text;
+    p.end = text + len;
+    rt = parse_object(&p, read_results_field, results);
+    if(rt == 0 && peek(&p) != -1) {
+        rt = -1;
+    }
+    free(text);
+    if(rt < 0) {
+        free_results(results);
+    }
+    return rt;
+}
+
+void free_results(results_t *results) {
+    int ii;
+
+    for(ii = 0; ii < results->num_entries; ii++) {
+        free(results->entries[ii].times);
+    }
+    free(results->entries);
+    memset(results, 0, sizeof(*results));
+}
+
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+double median(const double *values, int count) {
+    return count % 2 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+double normal_quantile(double alpha) {
+    double lo = 0, hi = 10, mid;
+    int ii;
+
+    /* erfc falls steadily, so halving the range homes in on the answer. */
+    for(ii = 0; ii < 60; ii++) {
+        mid = (lo + hi) / 2;
+        if(erfc(mid / M_SQRT2) > alpha) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return (lo + hi) / 2;
+}
+
+int compare_runs(const entry_t *a, const entry_t *b, double alpha, comparison_t *cmp) {
+    double n = a->count, m = b->count;
+    double u = 0, ties = 0, sigma, z, spread;
+    double *ratios, *all;
+    long pairs = (long) a->count * b->count;
+    long k;
+    int ii, jj, run;
+
+    ratios = malloc(pairs * sizeof(double));
+    all = malloc((a->count + b->count) * sizeof(double));
+    if(ratios == NULL || all == NULL) {
+        free(ratios);
+        free(all);
+        return -1;
+    }
+
+    /* U counts the pairs the candidate wins, a tie counting half. */
+    for(ii = 0; ii < a->count; ii++) {
+        for(jj = 0; jj < b->count; jj++) {
+            u += a->times[ii] > b->times[jj] ? 1 : a->times[ii] == b->times[jj] ? 0.5 : 0;
+            ratios[(long) ii * b->count + jj] = log(a->times[ii] / b->times[jj]);
+        }
+    }
+
+    /* Tied times make U vary less; each run of t ties takes t^3 - t. */
+    memcpy(all, a->times, a->count * sizeof(double));
+    memcpy(all + a->count, b->times, b->count * sizeof(double));
+    qsort(all, a->count + b->count, sizeof(double), compare_doubles);
+    for(ii = 0; ii < a->count + b->count; ii += run) {
+        for(run = 1; ii + run < a->count + b->count && all[ii + run] == all[ii]; run++) {
+        }
+        ties += (double) run * run * run - run;
+    }
+    sigma = sqrt(n * m / 12 * ((n + m + 1) - ties / ((n + m) * (n + m - 1))));
+    if(sigma > 0) {
+        z = (fabs(u - n * m / 2) - 0.5) / sigma;
+        cmp->p = z > 0 ? erfc(z / M_SQRT2) : 1;
+    } else {
+        cmp->p = 1;
+    }
+
+    /* The interval drops the pairs U could differ by with chance alpha. */
+    qsort(ratios, pairs, sizeof(double), compare_doubles);
+    spread = normal_quantile(alpha) * sqrt(n * m * (n + m + 1) / 12);
+    k = (long) floor(n * m / 2 - spread);
+    if(k < 0) {
+        k = 0;
+    }
+    cmp->baseline = median(a->times, a->count);
+    cmp->candidate = median(b->times, b->count);
+    cmp->speedup = exp(median(ratios, pairs));
+    cmp->low = exp(ratios[k]);
+    cmp->high = exp(ratios[pairs - 1 - k]);
+    free(ratios);
+    free(all);
+    return 0;
+}
+
+const entry_t *find_entry(const results_t *results, const entry_t *entry) {
+    int ii;
+
+    for(ii = 0; ii < results->num_entries; ii++) {
+        if(strcmp(results->entries[ii].name, entry->name) == 0
+                && strcmp(results->entries[ii].phase, entry->phase) == 0) {
+            return &results->entries[ii];
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    options_t options;
+    results_t results[2];
+    comparison_t *cmps;
+    const entry_t *base, *cand;
+    const char *verdict;
+    double p;
+    int ii, jj, first, compared = 0, faster = 0, slower = 0, same = 0, unmatched = 0;
+
+    first = parse_options(argc, argv, &options);
+    if(first < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    for(ii = 0; ii < 2; ii++) {
+        if(load_results(argv[first + ii], &results[ii]) < 0) {
+            fprintf(stderr, "%s: not a readable results file\n", argv[first + ii]);
+            return 2;
+        }
+        for(jj = 0; jj < results[ii].num_entries; jj++) {
+            qsort(results[ii].entries[jj].times, results[ii].entries[jj].count,
+                sizeof(double), compare_doubles);
+        }
+    }
+    if(strcmp(results[0].build, results[1].build) != 0) {
+        fprintf(stderr, "the baseline was built with \"%s\" and the candidate with \"%s\";\n"
+            "times from different flags do not compare\n", results[0].build, results[1].build);
+        return 2;
+    }
+    if(results[0].version != results[1].version || results[0].seed != results[1].seed
+            || results[0].games != results[1].games) {
+        fprintf(stderr, "warning: the runs used different corpora\n");
+    }
+    cmps = calloc(results[1].num_entries + 1, sizeof(*cmps));
+    if(cmps == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 2;
+    }
+
+    /* Count what can be compared first: the verdicts depend on how many. */
+    for(ii = 0; ii < results[1].num_entries; ii++) {
+        cand = &results[1].entries[ii];
+        base = find_entry(&results[0], cand);
+        cmps[ii].p = -1;
+        if(base == NULL || base->count < MIN_RUNS || cand->count < MIN_RUNS) {
+            unmatched++;
+            continue;
+        }
+        cmps[ii].p = 0;
+        compared++;
+    }
+    for(ii = 0; ii < results[1].num_entries; ii++) {
+        if(cmps[ii].p < 0) {
+            continue;
+        }
+        cand = &results[1].entries[ii];
+        base = find_entry(&results[0], cand);
+        if(compare_runs(base, cand, options.alpha / compared, &cmps[ii]) < 0) {
+            fprintf(stderr, "out of memory\n");
+            return 2;
+        }
+    }
+    for(ii = 0; ii < results[0].num_entries; ii++) {
+        if(find_entry(&results[1], &results[0].entries[ii]) == NULL) {
+            unmatched++;
+        }
+    }
+
+    printf("%-10s %-12s %10s %10s %8s %19s %9s\n", "phase", "benchmark",
+        "baseline", "candidate", "speedup", "interval", "p");
+    for(ii = 0; ii < results[1].num_entries; ii++) {
+        cand = &results[1].entries[ii];
+        if(cmps[ii].p < 0) {
+            printf("%-10s %-12s  not compared: %s\n", cand->phase, cand->name,
+                find_entry(&results[0], cand) == NULL ? "not in the baseline" : "too few runs");
+            continue;
+        }
+
+        /*
+         * With many benchmarks some differ by chance alone; scaling each
+         * chance by their number (Bonferroni) keeps the chance of any
+         * false alarm in the whole comparison below alpha.  The
+         * intervals were taken at alpha over that number to agree.
+         */
+        p = cmps[ii].p * compared;
+        if(p > 1) {
+            p = 1;
+        }
+        if(p < options.alpha && cmps[ii].speedup > 1 + options.threshold) {
+            verdict = "faster";
+            faster++;
+        } else if(p < options.alpha && cmps[ii].speedup < 1 - options.threshold) {
+            verdict = "SLOWER";
+            slower++;
+        } else {
+            verdict = "same";
+            same++;
+        }
+        printf("%-10s %-12s %10.2f %10.2f %8.3f  [%7.3f, %7.3f] %9.2g %s\n",
+            cand->phase, cand->name, cmps[ii].baseline, cmps[ii].candidate,
+            cmps[ii].speedup, cmps[ii].low, cmps[ii].high, p, verdict);
+    }
+
+    printf("%d faster, %d slower, %d the same at p < %g over all %d and a %g%%"
+        " threshold; %.0f%% joint intervals", faster, slower, same, options.alpha, compared,
+        100 * options.threshold, 100 * (1 - options.alpha));
+    if(unmatched > 0) {
+        printf("; %d not compared", unmatched);
+    }
+    printf("\n");
+
+    free(cmps);
+    free_results(&results[0]);
+    free_results(&results[1]);
+    return slower > 0 ? 1 : 0;
+}
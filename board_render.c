@@ -0,0 +1,104 @@
+/** @file board_render.c
+ *  @brief Implementation of board drawing.
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include "board_render.h"
+
+const char board_background[] =
+"#-----------#-----------#-----------#-----------#  #-----------#-----------#\n"
+"|           |           |           |           |  |  SCORE    |  TOP      |\n"
+"|           |           |           |           |  #-----------#-----------#\n"
+"|           |           |           |           |  |           |           |\n"
+"|           |           |           |           |  #-----------#-----------#\n"
+"|           |           |           |           |\n"
+"#-----------#-----------#-----------#-----------#  WASD/Arrows to move tiles\n"
+"|           |           |           |           |  'P' To pause\n"
+"|           |           |           |           |  'Q' To quit\n"
+"|           |           |           |           |\n"
+"|           |           |           |           |\n"
+"|           |           |           |           |\n"
+"#-----------#-----------#-----------#-----------#\n"
+"|           |           |           |           |\n"
+"|           |           |           |           |  #-----------#\n"
+"|           |           |           |           |  |  TIME     |\n"
+"|           |           |           |           |  #-----------#\n"
+"|           |           |           |           |  |           |\n"
+"#-----------#-----------#-----------#-----------#  #-----------#\n"
+"|           |           |           |           |\n"
+"|           |           |           |           |\n"
+"|           |           |           |           |\n"
+"|           |           |           |           |\n"
+"|           |           |           |           |\n"
+"#-----------#-----------#-----------#-----------#";
+
+int board_tile_color(int value) {
+    /* Add some color, for the kids. */
+    switch(value) {
+        case 2: return 1;
+        case 4: return 2;
+        case 8: return 3;
+        case 16: return 4;
+        case 32: return 5;
+        default: return 6;
+    }
+}
+
+void board_draw_block(console_t* console, int row, int col, int value) {
+    char buf[MAX_INT_STR_LEN]; /* To store the value as a string */
+
+    int old_color = console->term_color;
+    console->term_color = board_tile_color(value);
+
+    console_set_cursor(console, row, col);
+    console_putstr(console, "           ");
+    console_set_cursor(console, row+1, col);
+    console_putstr(console, "           ");
+    console_set_cursor(console, row+2, col);
+    snprintf(buf, MAX_INT_STR_LEN, "  %4d     ", value); 
+    console_putstr(console, buf);
+    console_set_cursor(console, row+3, col);
+    console_putstr(console, "           ");
+    console_set_cursor(console, row+4, col);
+    console_putstr(console, "           ");
+
+    console->term_color = old_color;
+}
+
+void board_draw_blocks(console_t *console, int grid[GRID_SIZE][GRID_SIZE]) {
+    int ii, jj, num;
+    for(ii = 0; ii < GRID_SIZE; ii++) {
+        for(jj = 0; jj < GRID_SIZE; jj++) {
+            num = grid[ii][jj];
+            if(num > 0) {
+                /* 
+                 * The CONSOLE_ROW, CONSOLE_COL convert grid coordinates 
+                 * to console coordinates.
+                 */ 
+                board_draw_block(console, CONSOLE_ROW(ii), CONSOLE_COL(jj), num);
+            }
+        }
+    }
+}
+
+void board_draw_score(console_t *console, int row, int col, unsigned int score) {
+    char buf[MAX_INT_STR_LEN];
+    snprintf(buf, MAX_INT_STR_LEN, "%u", score);
+    console_set_cursor(console, row, col);
+    console_putstr(console, buf);
+}
+
+void board_draw_screen(
+        console_t *console,
+        int grid[GRID_SIZE][GRID_SIZE],
+        unsigned int score,
+        unsigned int high_score) {
+    console_clear(console);
+    console_set_cursor(console, 0, 0);
+    console_putstr(console, board_background);
+    board_draw_score(console, SCORE_ROW, SCORE_COL, score);
+    board_draw_score(console, SCORE_ROW, HIGH_SCORE_COL, high_score);
+    board_draw_blocks(console, grid);
+}
@@ -0,0 +1,87 @@
+/** @file board_render.h
+ *  @brief Draws the game board into a console.
+ *
+ *  The board background, the blocks and the scores are drawn here, so
+ *  the interactive game and offline tools render boards the same way.
+ *
+ *  @bug None known.
+ */
+
+#ifndef _BOARD_RENDER_H_
+#define _BOARD_RENDER_H_
+
+#include "console_model.h"
+#include "game.h"
+
+/** Console location and size of the score and high score */
+#define SCORE_ROW 3
+#define SCORE_COL 52
+#define HIGH_SCORE_COL 64
+#define SCORES_WIDTH 23
+
+/** Console columns covered by the grid of blocks */
+#define BOARD_WIDTH (CONSOLE_COL(GRID_SIZE))
+/** Console rows covered by the grid of blocks */
+#define BOARD_HEIGHT (CONSOLE_ROW(GRID_SIZE))
+
+/** @brief The game screen: the grid, and boxes for the scores and clock.
+ */
+extern const char board_background[];
+
+/** @brief Map a block value to the console color it is drawn in.
+ *
+ * @param value The value of the block.
+ * @return The color.
+ */
+int board_tile_color(int value);
+
+/** @brief Draw a block to a console, at the given row and column.
+ *
+ * The block will contain the given value, and this value will determine its 
+ * color.
+ * 
+ * @param console The console to draw to.
+ * @param row The console row of the upper left block corner
+ * @param col The console col of the upper left block corner
+ * @param value The value displayed inside the block
+ * @return None.
+ */
+void board_draw_block(console_t* console, int row, int col, int value); 
+
+/** @brief Draw a given grid of blocks.
+ *
+ * Iterate through the grid, and use board_draw_block to render the blocks
+ * to the console.
+ *
+ * @param console The console to draw to.
+ * @param grid The collection of blocks.
+ * @return None.
+ */
+void board_draw_blocks(console_t *console, int grid[GRID_SIZE][GRID_SIZE]);
+
+/** @brief Draw a score to a console, at the given row and column.
+ * @param console The console to draw to.
+ * @param row The console row where the score starts
+ * @param col The console col where the score starts
+ * @param score The value to render.
+ * @return None.
+ */
+void board_draw_score(console_t *console, int row, int col, unsigned int score);
+
+/** @brief Draw a whole game screen: background, scores and blocks.
+ *
+ * The clock box is left empty.
+ *
+ * @param console The console to draw to.
+ * @param grid The collection of blocks.
+ * @param score The current score.
+ * @param high_score The high score.
+ * @return None.
+ */
+void board_draw_screen(
+        console_t *console,
+        int grid[GRID_SIZE][GRID_SIZE],
+        unsigned int score,
+        unsigned int high_score);
+
+#endif
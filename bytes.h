@@ -0,0 +1,48 @@
+/** @file bytes.h
+ *  @brief Little endian numbers in byte buffers.
+ *
+ *  Replays, segments, corpora and coverage files all store their
+ *  numbers little endian, whatever the machine, through these.
+ *
+ *  @bug None known.
+ */
+
+#ifndef _BYTES_H_
+#define _BYTES_H_
+
+#include <stdint.h>
+
+/** @brief Store a 16 bit number, little endian. */
+static inline void put_u16(uint8_t *out, uint16_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+}
+
+/** @brief Store a 32 bit number, little endian. */
+static inline void put_u32(uint8_t *out, uint32_t value) {
+    put_u16(out, value);
+    put_u16(out + 2, value >> 16);
+}
+
+/** @brief Store a 64 bit number, little endian. */
+static inline void put_u64(uint8_t *out, uint64_t value) {
+    put_u32(out, value);
+    put_u32(out + 4, value >> 32);
+}
+
+/** @brief Load a little endian 16 bit number. */
+static inline uint16_t get_u16(const uint8_t *in) {
+    return in[0] | (in[1] << 8);
+}
+
+/** @brief Load a little endian 32 bit number. */
+static inline uint32_t get_u32(const uint8_t *in) {
+    return get_u16(in) | ((uint32_t)get_u16(in + 2) << 16);
+}
+
+/** @brief Load a little endian 64 bit number. */
+static inline uint64_t get_u64(const uint8_t *in) {
+    return get_u32(in) | ((uint64_t)get_u32(in + 4) << 32);
+}
+
+#endif
@@ -0,0 +1,319 @@
+/** @file capture.c
+ *  @brief Samples the positions of recorded games into a corpus.
+ *
+ *  Replays every game of some replay archives and segments (see
+ *  replay.h and segment.h), sorts each position into its phase, and
+ *  keeps a uniform sample of each phase, so the corpus (see corpus.h)
+ *  holds positions in the proportions games reach them.  Archives can
+ *  come from people playing game or game_server, and from the bots of
+ *  loadgen playing game_server.
+ *
+ *  The sample is drawn with a seeded generator, so the same inputs and
+ *  seed always give the same corpus.
+ *
+ *  Usage: capture [-n boards] [-s seed] -o corpus input...
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "replay.h"
+#include "segment.h"
+#include "corpus.h"
+
+/** @brief Settings from the command line.
+ */
+typedef struct options_t {
+    /** Most boards kept of each phase */
+    uint64_t boards;
+    /** The seed of the sample */
+    uint64_t seed;
+    /** Where to write the corpus */
+    const char *output;
+} options_t;
+
+/** @brief A uniform sample of the positions of one phase.
+ */
+typedef struct reservoir_t {
+    /** The boards kept */
+    uint64_t *boards;
+    /** The number of boards kept */
+    uint64_t count;
+    /** The number of positions offered */
+    uint64_t seen;
+} reservoir_t;
+
+/** @brief The state of a capture.
+ */
+typedef struct capture_t {
+    /** The settings */
+    const options_t *options;
+    /** The generator choosing what to keep */
+    engine_rng_t rng;
+    /** The sample of each phase */
+    reservoir_t phases[CORPUS_PHASES];
+    /** The number of games replayed */
+    unsigned long games;
+    /** The number of games whose moves do not replay */
+    unsigned long bad;
+    /** The number of positions with tiles too large to keep */
+    unsigned long too_large;
+} capture_t;
+
+/***** Function prototypes ******/
+
+/** @brief Print how to run the program.
+ *
+ * @param name The program's name.
+ * @return None.
+ */
+static void usage(const char *name);
+
+/** @brief Read the command line.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param options Set to the settings.
+ * @return The index of the first input, or -1 on a usage error.
+ */
+static int parse_options(int argc, char **argv, options_t *options);
+
+/** @brief Offer a position to the sample of its phase.
+ *
+ * Every position offered to a phase ends up kept with the same chance.
+ *
+ * @param capture The capture.
+ * @param grid The board.
+ * @param phase One of the CORPUS_PHASE_ constants.
+ * @return None.
+ */
+static void offer(capture_t *capture, int grid[GRID_SIZE][GRID_SIZE], int phase);
+
+/** @brief Replay a game, offering each of its positions.
+ *
+ * @param capture The capture.
+ * @param replay The game.
+ * @return None.
+ */
+static void capture_game(capture_t *capture, const replay_t *replay);
+
+/** @brief Capture every game of a replay archive.
+ *
+ * @param capture The capture.
+ * @param path The archive.
+ * @return 0 on success, -1 if it could not be read.
+ */
+static int capture_archive(capture_t *capture, const char *path);
+
+/** @brief Capture every game of a segment.
+ *
+ * @param capture The capture.
+ * @param path The segment.
+ * @return 0 on success, -1 if it could not be read.
+ */
+static int capture_segment(capture_t *capture, const char *path);
+
+/***** Function definitions ******/
+
+void usage(const char *name) {
+    fprintf(stderr,
+        "usage: %s [-n boards] [-s seed] -o corpus input...\n"
+        "  -n  most boards kept of each phase (default 65536)\n"
+        "  -s  seed of the sample (default 1)\n"
+        "  -o  the corpus to write\n"
+        "Inputs are replay archives or segments.\n",
+        name);
+}
+
+int parse_options(int argc, char **argv, options_t *options) {
+    long long value;
+    int opt;
+
+    options->boards = 65536;
+    options->seed = 1;
+    options->output = NULL;
+
+    while((opt = getopt(argc, argv, "n:s:o:")) != -1) {
+        switch(opt) {
+            case 'n':
+                value = atoll(optarg);
+                if(value < 1) {
+                    return -1;
+                }
+                options->boards = value;
+                break;
+            case 's':
+                options->seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'o':
+                options->output = optarg;
+                break;
+            default:
+                return -1;
+        }
+    }
+    if(options->output == NULL || optind >= argc) {
+        return -1;
+    }
+    return optind;
+}
+
+void offer(capture_t *capture, int grid[GRID_SIZE][GRID_SIZE], int phase) {
+    reservoir_t *res = &capture->phases[phase];
+    uint64_t board, pick;
+
+    if(engine_pack_board(grid, &board) < 0) {
+        capture->too_large++;
+        return;
+    }
+
+    /* Keep the first boards, then replace one at random less and less often. */
+    res->seen++;
+    if(res->count < capture->options->boards) {
+        res->boards[res->count++] = board;
+        return;
+    }
+    pick = (uint64_t) engine_rng_next(&capture->rng) << 32;
+    pick = (pick | engine_rng_next(&capture->rng)) % res->seen;
+    if(pick < res->count) {
+        res->boards[pick] = board;
+    }
+}
+
+void capture_game(capture_t *capture, const replay_t *replay) {
+    replay_cursor_t cursor;
+    int rt;
+
+    replay_cursor_start(&cursor, replay);
+    offer(capture, cursor.grid, corpus_phase(cursor.grid, replay->num_moves, replay->result));
+    while((rt = replay_cursor_step(&cursor)) > 0) {
+        offer(capture, cursor.grid,
+            corpus_phase(cursor.grid, replay->num_moves - cursor.played, replay->result));
+    }
+    if(rt < 0) {
+        capture->bad++;
+    }
+    capture->games++;
+}
+
+int capture_archive(capture_t *capture, const char *path) {
+    replay_t replay;
+    FILE *in;
+    int rt;
+
+    in = fopen(path, "rb");
+    if(in == NULL) {
+        perror(path);
+        return -1;
+    }
+    replay_init(&replay);
+    while((rt = replay_read(in, &replay)) > 0) {
+        capture_game(capture, &replay);
+    }
+    replay_free(&replay);
+    fclose(in);
+    if(rt < 0) {
+        fprintf(stderr, "%s: bad replay record\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+int capture_segment(capture_t *capture, const char *path) {
+    segment_t seg;
+    segment_block_t *block;
+    segment_record_t rec;
+    replay_t replay;
+    uint32_t ii, jj;
+    int rt = 0;
+
+    if(segment_open(&seg, path) < 0) {
+        fprintf(stderr, "%s: not a readable segment\n", path);
+        return -1;
+    }
+    block = calloc(1, sizeof(*block));
+    if(block == NULL) {
+        segment_close(&seg);
+        return -1;
+    }
+    replay_init(&replay);
+    for(ii = 0; ii < seg.num_blocks && rt == 0; ii++) {
+        if(segment_read_block(&seg, ii, SEGMENT_READ_ALL, block) < 0) {
+            fprintf(stderr, "%s: bad block %u\n", path, ii);
+            rt = -1;
+            break;
+        }
+        for(jj = 0; jj < block->count; jj++) {
+            segment_block_record(block, jj, &rec);
+            if(segment_record_to_replay(&rec, &replay) < 0) {
+                rt = -1;
+                break;
+            }
+            capture_game(capture, &replay);
+        }
+    }
+    replay_free(&replay);
+    segment_block_free(block);
+    free(block);
+    segment_close(&seg);
+    return rt;
+}
+
+int main(int argc, char **argv) {
+    options_t options;
+    capture_t capture;
+    uint64_t *boards[CORPUS_PHASES];
+    uint64_t count[CORPUS_PHASES];
+    int ii, first, rt;
+
+    first = parse_options(argc, argv, &options);
+    if(first < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    memset(&capture, 0, sizeof(capture));
+    capture.options = &options;
+    engine_rng_seed(&capture.rng, options.seed);
+    for(ii = 0; ii < CORPUS_PHASES; ii++) {
+        capture.phases[ii].boards = malloc(options.boards * sizeof(uint64_t));
+        if(capture.phases[ii].boards == NULL) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+    }
+
+    for(ii = first; ii < argc; ii++) {
+        if(segment_is_segment(argv[ii])) {
+            rt = capture_segment(&capture, argv[ii]);
+        } else {
+            rt = capture_archive(&capture, argv[ii]);
+        }
+        if(rt < 0) {
+            return 1;
+        }
+    }
+
+    printf("%-10s %14s %10s\n", "phase", "positions", "kept");
+    for(ii = 0; ii < CORPUS_PHASES; ii++) {
+        boards[ii] = capture.phases[ii].boards;
+        count[ii] = capture.phases[ii].count;
+        printf("%-10s %14llu %10llu\n", corpus_phase_name(ii),
+            (unsigned long long) capture.phases[ii].seen,
+            (unsigned long long) count[ii]);
+    }
+    printf("%lu games, %lu of them corrupt; %lu positions with tiles too large\n",
+        capture.games, capture.bad, capture.too_large);
+
+    if(corpus_write(options.output, options.seed, capture.games, boards, count) < 0) {
+        fprintf(stderr, "%s: could not write corpus\n", options.output);
+        return 1;
+    }
+    for(ii = 0; ii < CORPUS_PHASES; ii++) {
+        free(capture.phases[ii].boards);
+    }
+    return 0;
+}
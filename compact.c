@@ -0,0 +1,1100 @@
+/** @file compact.c
+ *  @brief Merges replay archives into large sorted segments.
+ *
+ *  Takes any number of replay archives (see replay.h) and segments (see
+ *  segment.h), and writes all of their games, sorted by seed and with
+ *  duplicates dropped, to new segments of up to -g games each.
+ *
+ *  The merge is external, so it needs memory for -m megabytes of games,
+ *  not the whole input, and it runs in two parallel phases:
+ *
+ *  - Sorting: each thread takes archives off a shared list, gathers
+ *    their games until its share of the memory is full, sorts them, and
+ *    writes them out as a temporary segment, called a run.  Segments
+ *    given as input are sorted already, so they are used as runs as
+ *    they are.
+ *  - Merging: the seeds are split into one range per thread, using the
+ *    first seed of every block of every run, and each thread merges its
+ *    range of every run into its own output segments, skipping the
+ *    blocks outside its range.  A duplicate always has the same seed,
+ *    so it meets its twin in the same thread.
+ *
+ *  A merge holds one block of each run in memory, so when there are
+ *  more than MAX_FAN_IN runs, groups of them are first merged into
+ *  bigger runs, in parallel, until few enough are left.
+ *
+ *  The output segments code their moves by context (see move_coder.h)
+ *  unless -c packed is given.  The temporary runs always keep them
+ *  packed, as they are read back at once.
+ *
+ *  Usage: compact [-j threads] [-m megabytes] [-g games] [-c codec] [-o dir] [-r]
+ *                 input...
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "replay.h"
+#include "segment.h"
+
+/** Longest path of a file */
+#define MAX_PATH_LEN 4096
+/** Most threads */
+#define MAX_THREADS 64
+/** Most runs merged at once; more are merged in passes */
+#define MAX_FAN_IN 256
+/** Size of a chunk of packed moves, unless a game needs more */
+#define CHUNK_LEN (1 << 16)
+
+/** @brief Settings from the command line.
+ */
+typedef struct options_t {
+    /** Number of threads */
+    int threads;
+    /** Bytes of games held in memory while sorting, over all threads */
+    size_t memory;
+    /** Most games in an output segment */
+    unsigned long segment_games;
+    /** How the output segments code their moves, a SEGMENT_CODEC_ constant */
+    int codec;
+    /** Where segments are written */
+    const char *outdir;
+    /** Remove the inputs once they are merged */
+    int remove_inputs;
+} options_t;
+
+/** @brief A run of sorted games, on disk.
+ */
+typedef struct run_t {
+    /** The file */
+    char *path;
+    /** Set if the file is a temporary one, to be removed at the end */
+    int temporary;
+    /** The file, open for reading during the merge */
+    segment_t segment;
+} run_t;
+
+/** @brief What every thread shares.
+ */
+typedef struct compactor_t {
+    /** The settings */
+    const options_t *options;
+    /** Guards everything below */
+    pthread_mutex_t lock;
+    /** The archives to sort */
+    char **archives;
+    /** The number of archives */
+    int num_archives;
+    /** The next archive to sort */
+    int next_archive;
+    /** The runs to merge */
+    run_t *runs;
+    /** The number of runs */
+    int num_runs;
+    /** The number of runs there is room for */
+    int runs_cap;
+    /** Names this compaction's output files apart from earlier ones */
+    unsigned long stamp;
+    /** Set if anything failed, so the inputs must be kept */
+    int failed;
+} compactor_t;
+
+/** @brief A chunk of packed moves.
+ */
+typedef struct chunk_t {
+    /** The chunk allocated before this one */
+    struct chunk_t *next;
+    /** The number of bytes used */
+    size_t len;
+    /** The number of bytes there is room for */
+    size_t cap;
+    /** The bytes */
+    uint8_t data[];
+} chunk_t;
+
+/** @brief A thread of the sorting phase.
+ */
+typedef struct sorter_t {
+    /** The thread */
+    pthread_t thread;
+    /** What the threads share */
+    compactor_t *shared;
+    /** The thread's number */
+    int id;
+    /** The games gathered so far, their moves in chunks */
+    segment_record_t *records;
+    /** The number of games gathered */
+    size_t count;
+    /** The number of games there is room for */
+    size_t cap;
+    /** The chunks, newest first */
+    chunk_t *chunks;
+    /** Bytes the gathered games take, not counting spare room */
+    size_t used;
+    /** The replay each game is read into */
+    replay_t replay;
+    /** The number of runs written */
+    int num_runs;
+    /** The number of games that cannot go in a segment */
+    unsigned long skipped;
+} sorter_t;
+
+/** @brief Where one run is up to, in a merge.
+ */
+typedef struct cursor_t {
+    /** The run */
+    const segment_t *segment;
+    /** The block being merged */
+    segment_block_t *block;
+    /** The next block to read */
+    uint32_t next_block;
+    /** The game of block being merged */
+    uint32_t pos;
+    /** That game */
+    segment_record_t rec;
+} cursor_t;
+
+/** @brief A thread of the merging phase.
+ */
+typedef struct merger_t {
+    /** The thread */
+    pthread_t thread;
+    /** What the threads share */
+    compactor_t *shared;
+    /** The thread's number, which is also its range's or group's */
+    int id;
+    /** 0 for the final merge, or the pass of a merge into a bigger run */
+    int pass;
+    /** The runs to merge */
+    run_t *runs;
+    /** The number of runs */
+    int num_runs;
+    /** The range of seeds merged, from lo, up to but not including hi */
+    uint64_t lo;
+    uint64_t hi;
+    /** Set if the range has no upper end */
+    int open_ended;
+    /** One cursor per run */
+    cursor_t *cursors;
+    /** Cursors that are not used up, as a heap on their games */
+    int *heap;
+    /** The number of cursors in heap */
+    int heap_len;
+    /** The segment being written */
+    segment_writer_t writer;
+    /** Its path */
+    char path[MAX_PATH_LEN];
+    /** Set while writer is open */
+    int writing;
+    /** The last game written, to drop its duplicates */
+    segment_record_t last;
+    /** Its moves, as the block they came from may be read over */
+    uint8_t *last_moves;
+    /** The number of bytes last_moves has room for */
+    size_t last_moves_cap;
+    /** Set once a game has been written */
+    int have_last;
+    /** The number of duplicates dropped */
+    unsigned long duplicates;
+    /** The number of games written */
+    unsigned long written;
+    /** The number of segments written */
+    int segments;
+    /** The number of bytes written */
+    unsigned long long bytes;
+} merger_t;
+
+/***** Function prototypes ******/
+
+/** @brief Print how to use the program.
+ *
+ * @param name The name of the program.
+ * @return None.
+ */
+static void usage(const char *name);
+
+/** @brief Read the command line.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param options Set to the settings.
+ * @return The index of the first input, or -1 on a bad command line.
+ */
+static int parse_options(int argc, char **argv, options_t *options);
+
+/** @brief Add a run to the list of runs to merge.
+ *
+ * @param shared What the threads share.
+ * @param path The run's file, copied.
+ * @param temporary Whether the file is to be removed at the end.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int add_run(compactor_t *shared, const char *path, int temporary);
+
+/** @brief Note that something failed, so the inputs must be kept.
+ *
+ * @param shared What the threads share.
+ * @return None.
+ */
+static void set_failed(compactor_t *shared);
+
+/** @brief Compare two records for qsort.
+ *
+ * @param a A segment_record_t.
+ * @param b Another one.
+ * @return As segment_record_compare.
+ */
+static int compare_records(const void *a, const void *b);
+
+/** @brief Gather a replay into a sorter's memory.
+ *
+ * @param sorter The sorter, holding the replay.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int gather_replay(sorter_t *sorter);
+
+/** @brief Sort what a sorter gathered, write it as a run, and start over.
+ *
+ * @param sorter The sorter.
+ * @return 0 on success, -1 on error.
+ */
+static int write_run(sorter_t *sorter);
+
+/** @brief Free the games a sorter gathered.
+ *
+ * @param sorter The sorter.
+ * @return None.
+ */
+static void clear_sorter(sorter_t *sorter);
+
+/** @brief The body of a sorting thread.
+ *
+ * @param arg The sorter_t.
+ * @return NULL.
+ */
+static void *sorter_main(void *arg);
+
+/** @brief Compare two seeds for qsort.
+ *
+ * @param a A uint64_t.
+ * @param b Another one.
+ * @return Less than, equal to or greater than 0.
+ */
+static int compare_seeds(const void *a, const void *b);
+
+/** @brief Split the seeds of all the runs into one range per merger.
+ *
+ * @param shared What the threads share.
+ * @param mergers The mergers, whose ranges are set.
+ * @param count The number of mergers.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int split_ranges(compactor_t *shared, merger_t *mergers, int count);
+
+/** @brief Move a cursor to the next game in its merger's range.
+ *
+ * @param merger The merger.
+ * @param cursor The cursor.
+ * @return 1 if there is such a game, 0 if the cursor is used up, -1 if
+ *         the run is malformed.
+ */
+static int advance_cursor(merger_t *merger, cursor_t *cursor);
+
+/** @brief Restore the heap order below a heap entry.
+ *
+ * @param merger The merger.
+ * @param ii The entry.
+ * @return None.
+ */
+static void sift_down(merger_t *merger, int ii);
+
+/** @brief Write a game to the merger's output, starting a segment if needed.
+ *
+ * @param merger The merger.
+ * @param rec The game.
+ * @return 0 on success, -1 on error.
+ */
+static int emit_record(merger_t *merger, const segment_record_t *rec);
+
+/** @brief Finish the segment a merger is writing, if any.
+ *
+ * @param merger The merger.
+ * @return 0 on success, -1 on error.
+ */
+static int finish_segment(merger_t *merger);
+
+/** @brief Open every run not open yet.
+ *
+ * @param shared What the threads share.
+ * @return 0 on success, -1 if a run is not a valid segment.
+ */
+static int open_runs(compactor_t *shared);
+
+/** @brief Close runs, remove the temporary ones, and free the list.
+ *
+ * @param runs The runs.
+ * @param count The number of runs.
+ * @return None.
+ */
+static void close_runs(run_t *runs, int count);
+
+/** @brief Merge groups of MAX_FAN_IN runs into one run each.
+ *
+ * @param shared What the threads share, whose runs are replaced.
+ * @param mergers One merger per thread.
+ * @param pass The number of the pass, from 1.
+ * @param duplicates Increased by the number of duplicates dropped.
+ * @return 0 on success, -1 on error.
+ */
+static int merge_pass(compactor_t *shared, merger_t *mergers, int pass,
+        unsigned long *duplicates);
+
+/** @brief Merge a merger's range of every run.
+ *
+ * @param merger The merger, with a cursor and a block for each run.
+ * @return 0 on success, -1 on error.
+ */
+static int merge_range(merger_t *merger);
+
+/** @brief The body of a merging thread.
+ *
+ * @param arg The merger_t.
+ * @return NULL.
+ */
+static void *merger_main(void *arg);
+
+/** @brief Note the last game written, copying its moves.
+ *
+ * @param merger The merger.
+ * @param rec The game.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int remember_last(merger_t *merger, const segment_record_t *rec);
+
+/** @brief Get the size of a file.
+ *
+ * @param path The file.
+ * @return Its size, or 0 if it cannot be found.
+ */
+static unsigned long long file_size(const char *path);
+
+/***** Function definitions ******/
+
+void usage(const char *name) {
+    fprintf(stderr,
+        "usage: %s [-j threads] [-m megabytes] [-g games] [-c codec] [-o dir] [-r]"
+        " input...\n"
+        "  -j  threads (default 4)\n"
+        "  -m  memory for sorting, in megabytes (default 256)\n"
+        "  -g  most games in an output segment (default 1048576)\n"
+        "  -c  how to store the moves: context (default), or packed, which\n"
+        "      is bigger but faster to read\n"
+        "  -o  output directory (default .)\n"
+        "  -r  remove the inputs once they are merged\n"
+        "Inputs are replay archives or segments.\n",
+        name);
+}
+
+int parse_options(int argc, char **argv, options_t *options) {
+    long value;
+    int opt;
+
+    options->threads = 4;
+    options->memory = (size_t) 256 << 20;
+    options->segment_games = 1 << 20;
+    options->codec = SEGMENT_CODEC_CONTEXT;
+    options->outdir = ".";
+    options->remove_inputs = 0;
+
+    while((opt = getopt(argc, argv, "j:m:g:c:o:r")) != -1) {
+        switch(opt) {
+            case 'j':
+                options->threads = atoi(optarg);
+                if(options->threads < 1 || options->threads > MAX_THREADS) {
+                    return -1;
+                }
+                break;
+            case 'm':
+                value = atol(optarg);
+                if(value < 1) {
+                    return -1;
+                }
+                options->memory = (size_t) value << 20;
+                break;
+            case 'g':
+                value = atol(optarg);
+                if(value < 1) {
+                    return -1;
+                }
+                options->segment_games = value;
+                break;
+            case 'c':
+                if(strcmp(optarg, "context") == 0) {
+                    options->codec = SEGMENT_CODEC_CONTEXT;
+                } else if(strcmp(optarg, "packed") == 0) {
+                    options->codec = SEGMENT_CODEC_PACKED;
+                } else {
+                    return -1;
+                }
+                break;
+            case 'o':
+                options->outdir = optarg;
+                break;
+            case 'r':
+                options->remove_inputs = 1;
+                break;
+            default:
+                return -1;
+        }
+    }
+    if(optind >= argc) {
+        return -1;
+    }
+    return optind;
+}
+
+int add_run(compactor_t *shared, const char *path, int temporary) {
+    run_t *grown;
+    int cap, rt = 0;
+
+    pthread_mutex_lock(&shared->lock);
+    if(shared->num_runs == shared->runs_cap) {
+        cap = shared->runs_cap ? shared->runs_cap * 2 : 16;
+        grown = realloc(shared->runs, sizeof(*grown) * cap);
+        if(grown == NULL) {
+            rt = -1;
+        } else {
+            shared->runs = grown;
+            shared->runs_cap = cap;
+        }
+    }
+    if(rt == 0) {
+        memset(&shared->runs[shared->num_runs], 0, sizeof(run_t));
+        shared->runs[shared->num_runs].path = strdup(path);
+        shared->runs[shared->num_runs].temporary = temporary;
+        if(shared->runs[shared->num_runs].path == NULL) {
+            rt = -1;
+        } else {
+            shared->num_runs++;
+        }
+    }
+    pthread_mutex_unlock(&shared->lock);
+    return rt;
+}
+
+void set_failed(compactor_t *shared) {
+    pthread_mutex_lock(&shared->lock);
+    shared->failed = 1;
+    pthread_mutex_unlock(&shared->lock);
+}
+
+int compare_records(const void *a, const void *b) {
+    return segment_record_compare(a, b);
+}
+
+int gather_replay(sorter_t *sorter) {
+    replay_t *replay = &sorter->replay;
+    size_t len = (replay->num_moves + 3) / 4;
+    segment_record_t *rec, *grown;
+    chunk_t *chunk = sorter->chunks;
+    size_t cap;
+    uint8_t *moves;
+    uint32_t ii;
+
+    if(sorter->count == sorter->cap) {
+        cap = sorter->cap ? sorter->cap * 2 : 4096;
+        grown = realloc(sorter->records, sizeof(*grown) * cap);
+        if(grown == NULL) {
+            return -1;
+        }
+        sorter->records = grown;
+        sorter->cap = cap;
+    }
+    if(chunk == NULL || chunk->cap - chunk->len < len) {
+        cap = (len > CHUNK_LEN) ? len : CHUNK_LEN;
+        chunk = malloc(sizeof(*chunk) + cap);
+        if(chunk == NULL) {
+            return -1;
+        }
+        chunk->next = sorter->chunks;
+        chunk->len = 0;
+        chunk->cap = cap;
+        sorter->chunks = chunk;
+    }
+
+    /* Pack the moves as segments keep them, so sorting compares bytes. */
+    moves = chunk->data + chunk->len;
+    chunk->len += len;
+    memset(moves, 0, len);
+    for(ii = 0; ii < replay->num_moves; ii++) {
+        moves[ii / 4] |= (replay->moves[ii] & 0x3) << (2 * (ii % 4));
+    }
+
+    sorter->used += sizeof(*rec) + len;
+    rec = &sorter->records[sorter->count];
+    rec->seed = replay->seed;
+    rec->winning_tile = replay->winning_tile;
+    rec->final_score = replay->final_score;
+    rec->max_tile = replay->max_tile;
+    rec->result = replay->result;
+    rec->num_moves = replay->num_moves;
+    rec->moves = moves;
+    if(!segment_record_ok(rec)) {
+        chunk->len -= len;
+        sorter->used -= sizeof(*rec) + len;
+        sorter->skipped++;
+        return 0;
+    }
+    sorter->count++;
+    return 0;
+}
+
+int write_run(sorter_t *sorter) {
+    compactor_t *shared = sorter->shared;
+    segment_writer_t writer;
+    char path[MAX_PATH_LEN];
+    size_t ii;
+    int rt = 0;
+
+    if(sorter->count == 0) {
+        return 0;
+    }
+    qsort(sorter->records, sorter->count, sizeof(*sorter->records), compare_records);
+
+    snprintf(path, sizeof(path), "%s/.run-%lu-%d-%d.tmp", shared->options->outdir,
+        shared->stamp, sorter->id, sorter->num_runs++);
+    if(segment_writer_open(&writer, path, SEGMENT_CODEC_PACKED) < 0) {
+        perror(path);
+        return -1;
+    }
+    for(ii = 0; ii < sorter->count && rt == 0; ii++) {
+        /* Duplicates are dropped while merging; a run keeps everything. */
+        rt = segment_writer_add(&writer, &sorter->records[ii]);
+    }
+    if(segment_writer_close(&writer) < 0 || rt < 0) {
+        fprintf(stderr, "%s: could not write run\n", path);
+        unlink(path);
+        return -1;
+    }
+    clear_sorter(sorter);
+    return add_run(shared, path, 1);
+}
+
+void clear_sorter(sorter_t *sorter) {
+    chunk_t *chunk, *next;
+
+    for(chunk = sorter->chunks; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+    sorter->chunks = NULL;
+    sorter->count = 0;
+    sorter->used = 0;
+}
+
+void *sorter_main(void *arg) {
+    sorter_t *sorter = arg;
+    compactor_t *shared = sorter->shared;
+    size_t budget = shared->options->memory / shared->options->threads;
+    const char *path;
+    FILE *in;
+    int rt;
+
+    replay_init(&sorter->replay);
+    while(1) {
+        pthread_mutex_lock(&shared->lock);
+        path = NULL;
+        if(shared->next_archive < shared->num_archives && !shared->failed) {
+            path = shared->archives[shared->next_archive++];
+        }
+        pthread_mutex_unlock(&shared->lock);
+        if(path == NULL) {
+            break;
+        }
+
+        in = fopen(path, "rb");
+        if(in == NULL) {
+            perror(path);
+            set_failed(shared);
+            break;
+        }
+        while((rt = replay_read(in, &sorter->replay)) > 0) {
+            if(gather_replay(sorter) < 0 || (sorter->used >= budget && write_run(sorter) < 0)) {
+                rt = -2;
+                break;
+            }
+        }
+        fclose(in);
+        if(rt == -1) {
+            fprintf(stderr, "%s: bad replay record\n", path);
+        }
+        if(rt < 0) {
+            set_failed(shared);
+            break;
+        }
+    }
+    if(write_run(sorter) < 0) {
+        set_failed(shared);
+    }
+    clear_sorter(sorter);
+    free(sorter->records);
+    replay_free(&sorter->replay);
+    return NULL;
+}
+
+int compare_seeds(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+int split_ranges(compactor_t *shared, merger_t *mergers, int count) {
+    uint64_t *firsts;
+    size_t num_blocks = 0;
+    size_t pos;
+    uint32_t bb;
+    int ii;
+
+    for(ii = 0; ii < shared->num_runs; ii++) {
+        num_blocks += shared->runs[ii].segment.num_blocks;
+    }
+    firsts = malloc(sizeof(*firsts) * (num_blocks ? num_blocks : 1));
+    if(firsts == NULL) {
+        return -1;
+    }
+    pos = 0;
+    for(ii = 0; ii < shared->num_runs; ii++) {
+        for(bb = 0; bb < shared->runs[ii].segment.num_blocks; bb++) {
+            firsts[pos++] = shared->runs[ii].segment.index[bb].first_seed;
+        }
+    }
+    qsort(firsts, num_blocks, sizeof(*firsts), compare_seeds);
+
+    /* Each range starts about as many blocks in as the last. */
+    for(ii = 0; ii < count; ii++) {
+        mergers[ii].lo = (ii == 0 || num_blocks == 0) ? 0 : firsts[num_blocks * ii / count];
+        mergers[ii].open_ended = (ii == count - 1);
+        if(ii > 0) {
+            mergers[ii - 1].hi = mergers[ii].lo;
+        }
+    }
+    free(firsts);
+    return 0;
+}
+
+int advance_cursor(merger_t *merger, cursor_t *cursor) {
+    const segment_t *seg = cursor->segment;
+
+    cursor->pos++;
+    while(cursor->pos >= cursor->block->count) {
+        /* Skip blocks that end before the range. */
+        while(cursor->next_block < seg->num_blocks
+                && seg->index[cursor->next_block].last_seed < merger->lo) {
+            cursor->next_block++;
+        }
+        if(cursor->next_block >= seg->num_blocks) {
+            return 0;
+        }
+        if(!merger->open_ended && seg->index[cursor->next_block].first_seed >= merger->hi) {
+            return 0;
+        }
+        if(segment_read_block(seg, cursor->next_block++, SEGMENT_READ_ALL, cursor->block) < 0) {
+            return -1;
+        }
+        cursor->pos = 0;
+        while(cursor->pos < cursor->block->count && cursor->block->seed[cursor->pos] < merger->lo) {
+            cursor->pos++;
+        }
+    }
+    segment_block_record(cursor->block, cursor->pos, &cursor->rec);
+    if(!merger->open_ended && cursor->rec.seed >= merger->hi) {
+        return 0;
+    }
+    return 1;
+}
+
+void sift_down(merger_t *merger, int ii) {
+    int *heap = merger->heap;
+    int child, tmp;
+
+    while(1) {
+        child = 2 * ii + 1;
+        if(child >= merger->heap_len) {
+            return;
+        }
+        if(child + 1 < merger->heap_len
+                && segment_record_compare(&merger->cursors[heap[child + 1]].rec,
+                    &merger->cursors[heap[child]].rec) < 0) {
+            child++;
+        }
+        if(segment_record_compare(&merger->cursors[heap[ii]].rec,
+                &merger->cursors[heap[child]].rec) <= 0) {
+            return;
+        }
+        tmp = heap[ii];
+        heap[ii] = heap[child];
+        heap[child] = tmp;
+        ii = child;
+    }
+}
+
+int emit_record(merger_t *merger, const segment_record_t *rec) {
+    compactor_t *shared = merger->shared;
+
+    /* A run from an earlier pass is never split. */
+    if(merger->writing && merger->pass == 0
+            && merger->writer.num_games >= shared->options->segment_games) {
+        if(finish_segment(merger) < 0) {
+            return -1;
+        }
+    }
+    if(!merger->writing) {
+        if(merger->pass > 0) {
+            snprintf(merger->path, sizeof(merger->path), "%s/.run-%lu-p%d-%d.tmp",
+                shared->options->outdir, shared->stamp, merger->pass, merger->id);
+        } else {
+            snprintf(merger->path, sizeof(merger->path), "%s/seg-%lu-%03d-%04d.seg",
+                shared->options->outdir, shared->stamp, merger->id, merger->segments);
+        }
+        if(segment_writer_open(&merger->writer, merger->path,
+                merger->pass > 0 ? SEGMENT_CODEC_PACKED : shared->options->codec) < 0) {
+            perror(merger->path);
+            return -1;
+        }
+        merger->writing = 1;
+    }
+    if(segment_writer_add(&merger->writer, rec) < 0) {
+        fprintf(stderr, "%s: could not write segment\n", merger->path);
+        return -1;
+    }
+    merger->written++;
+    return 0;
+}
+
+int finish_segment(merger_t *merger) {
+    if(!merger->writing) {
+        return 0;
+    }
+    merger->writing = 0;
+    if(segment_writer_close(&merger->writer) < 0) {
+        fprintf(stderr, "%s: could not write segment\n", merger->path);
+        unlink(merger->path);
+        return -1;
+    }
+    if(merger->pass > 0) {
+        return add_run(merger->shared, merger->path, 1);
+    }
+    merger->segments++;
+    merger->bytes += file_size(merger->path);
+    return 0;
+}
+
+int merge_range(merger_t *merger) {
+    cursor_t *cursor;
+    int ii, rt;
+
+    /* Start every run at the first game of the range. */
+    for(ii = 0; ii < merger->num_runs; ii++) {
+        cursor = &merger->cursors[ii];
+        cursor->segment = &merger->runs[ii].segment;
+        cursor->block->count = 0;
+        cursor->pos = 0;
+        rt = advance_cursor(merger, cursor);
+        if(rt < 0) {
+            fprintf(stderr, "%s: malformed block\n", merger->runs[ii].path);
+            return -1;
+        }
+        if(rt > 0) {
+            merger->heap[merger->heap_len++] = ii;
+        }
+    }
+    for(ii = merger->heap_len / 2 - 1; ii >= 0; ii--) {
+        sift_down(merger, ii);
+    }
+
+    while(merger->heap_len > 0) {
+        cursor = &merger->cursors[merger->heap[0]];
+        if(merger->have_last && segment_record_compare(&merger->last, &cursor->rec) == 0) {
+            merger->duplicates++;
+        } else {
+            if(emit_record(merger, &cursor->rec) < 0) {
+                return -1;
+            }
+            if(remember_last(merger, &cursor->rec) < 0) {
+                return -1;
+            }
+        }
+
+        rt = advance_cursor(merger, cursor);
+        if(rt < 0) {
+            fprintf(stderr, "%s: malformed block\n", merger->runs[merger->heap[0]].path);
+            return -1;
+        }
+        if(rt == 0) {
+            merger->heap[0] = merger->heap[--merger->heap_len];
+        }
+        sift_down(merger, 0);
+    }
+    return finish_segment(merger);
+}
+
+void *merger_main(void *arg) {
+    merger_t *merger = arg;
+    compactor_t *shared = merger->shared;
+    int ii, rt = -1;
+
+    merger->cursors = calloc(merger->num_runs, sizeof(*merger->cursors));
+    merger->heap = calloc(merger->num_runs, sizeof(*merger->heap));
+    if(merger->cursors != NULL && merger->heap != NULL) {
+        rt = 0;
+        for(ii = 0; ii < merger->num_runs; ii++) {
+            merger->cursors[ii].block = calloc(1, sizeof(segment_block_t));
+            if(merger->cursors[ii].block == NULL) {
+                rt = -1;
+            }
+        }
+    }
+    if(rt == 0) {
+        rt = merge_range(merger);
+    }
+    if(rt < 0) {
+        finish_segment(merger);
+        set_failed(shared);
+    }
+
+    if(merger->cursors != NULL) {
+        for(ii = 0; ii < merger->num_runs; ii++) {
+            if(merger->cursors[ii].block != NULL) {
+                segment_block_free(merger->cursors[ii].block);
+                free(merger->cursors[ii].block);
+            }
+        }
+    }
+    free(merger->cursors);
+    free(merger->heap);
+    free(merger->last_moves);
+    return NULL;
+}
+
+int open_runs(compactor_t *shared) {
+    int ii;
+
+    for(ii = 0; ii < shared->num_runs; ii++) {
+        if(shared->runs[ii].segment.data != NULL) {
+            continue;
+        }
+        if(segment_open(&shared->runs[ii].segment, shared->runs[ii].path) < 0) {
+            fprintf(stderr, "%s: not a valid segment\n", shared->runs[ii].path);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void close_runs(run_t *runs, int count) {
+    int ii;
+
+    for(ii = 0; ii < count; ii++) {
+        segment_close(&runs[ii].segment);
+        if(runs[ii].temporary) {
+            unlink(runs[ii].path);
+        }
+        free(runs[ii].path);
+    }
+    free(runs);
+}
+
+int merge_pass(compactor_t *shared, merger_t *mergers, int pass,
+        unsigned long *duplicates) {
+    int threads = shared->options->threads;
+    run_t *runs = shared->runs;
+    int num_runs = shared->num_runs;
+    int groups = (num_runs + MAX_FAN_IN - 1) / MAX_FAN_IN;
+    int group, ii, wave;
+
+    /* The merged runs are added to a fresh list. */
+    shared->runs = NULL;
+    shared->num_runs = 0;
+    shared->runs_cap = 0;
+
+    for(group = 0; group < groups && !shared->failed; group += wave) {
+        wave = (groups - group < threads) ? groups - group : threads;
+        for(ii = 0; ii < wave; ii++) {
+            memset(&mergers[ii], 0, sizeof(merger_t));
+            mergers[ii].shared = shared;
+            mergers[ii].id = group + ii;
+            mergers[ii].pass = pass;
+            mergers[ii].runs = runs + (group + ii) * MAX_FAN_IN;
+            mergers[ii].num_runs = num_runs - (group + ii) * MAX_FAN_IN;
+            if(mergers[ii].num_runs > MAX_FAN_IN) {
+                mergers[ii].num_runs = MAX_FAN_IN;
+            }
+            mergers[ii].open_ended = 1;
+            if(pthread_create(&mergers[ii].thread, NULL, merger_main, &mergers[ii]) != 0) {
+                fprintf(stderr, "could not start thread\n");
+                set_failed(shared);
+                wave = ii;
+                break;
+            }
+        }
+        for(ii = 0; ii < wave; ii++) {
+            pthread_join(mergers[ii].thread, NULL);
+            *duplicates += mergers[ii].duplicates;
+        }
+    }
+    close_runs(runs, num_runs);
+    if(shared->failed) {
+        return -1;
+    }
+    return open_runs(shared);
+}
+
+int remember_last(merger_t *merger, const segment_record_t *rec) {
+    size_t len = (rec->num_moves + 3) / 4;
+    uint8_t *grown;
+
+    if(len > merger->last_moves_cap) {
+        grown = realloc(merger->last_moves, len);
+        if(grown == NULL) {
+            return -1;
+        }
+        merger->last_moves = grown;
+        merger->last_moves_cap = len;
+    }
+    if(len > 0) {
+        memcpy(merger->last_moves, rec->moves, len);
+    }
+    merger->last = *rec;
+    merger->last.moves = merger->last_moves;
+    merger->have_last = 1;
+    return 0;
+}
+
+unsigned long long file_size(const char *path) {
+    struct stat st;
+    if(stat(path, &st) < 0) {
+        return 0;
+    }
+    return st.st_size;
+}
+
+int main(int argc, char **argv) {
+    options_t options;
+    compactor_t shared;
+    sorter_t *sorters;
+    merger_t *mergers;
+    unsigned long skipped = 0, duplicates = 0, written = 0;
+    unsigned long long bytes_in = 0, bytes_out = 0;
+    int segments = 0, passes = 0;
+    int ii, first;
+
+    first = parse_options(argc, argv, &options);
+    if(first < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    memset(&shared, 0, sizeof(shared));
+    pthread_mutex_init(&shared.lock, NULL);
+    shared.options = &options;
+    shared.stamp = (unsigned long) time(NULL) * 100000 + getpid() % 100000;
+    shared.archives = calloc(argc - first, sizeof(char*));
+    sorters = calloc(options.threads, sizeof(*sorters));
+    mergers = calloc(options.threads, sizeof(*mergers));
+    if(shared.archives == NULL || sorters == NULL || mergers == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    /* Segments are runs already; archives need sorting. */
+    for(ii = first; ii < argc; ii++) {
+        bytes_in += file_size(argv[ii]);
+        if(segment_is_segment(argv[ii])) {
+            if(add_run(&shared, argv[ii], 0) < 0) {
+                fprintf(stderr, "out of memory\n");
+                return 1;
+            }
+        } else {
+            shared.archives[shared.num_archives++] = argv[ii];
+        }
+    }
+
+    for(ii = 0; ii < options.threads; ii++) {
+        sorters[ii].shared = &shared;
+        sorters[ii].id = ii;
+        if(pthread_create(&sorters[ii].thread, NULL, sorter_main, &sorters[ii]) != 0) {
+            fprintf(stderr, "could not start thread\n");
+            return 1;
+        }
+    }
+    for(ii = 0; ii < options.threads; ii++) {
+        pthread_join(sorters[ii].thread, NULL);
+        skipped += sorters[ii].skipped;
+    }
+
+    if(!shared.failed && open_runs(&shared) < 0) {
+        shared.failed = 1;
+    }
+    while(!shared.failed && shared.num_runs > MAX_FAN_IN) {
+        if(merge_pass(&shared, mergers, ++passes, &duplicates) < 0) {
+            shared.failed = 1;
+        }
+    }
+
+    memset(mergers, 0, sizeof(*mergers) * options.threads);
+    if(!shared.failed && split_ranges(&shared, mergers, options.threads) < 0) {
+        fprintf(stderr, "out of memory\n");
+        shared.failed = 1;
+    }
+    if(!shared.failed) {
+        for(ii = 0; ii < options.threads; ii++) {
+            mergers[ii].shared = &shared;
+            mergers[ii].id = ii;
+            mergers[ii].runs = shared.runs;
+            mergers[ii].num_runs = shared.num_runs;
+            if(pthread_create(&mergers[ii].thread, NULL, merger_main, &mergers[ii]) != 0) {
+                fprintf(stderr, "could not start thread\n");
+                return 1;
+            }
+        }
+        for(ii = 0; ii < options.threads; ii++) {
+            pthread_join(mergers[ii].thread, NULL);
+            duplicates += mergers[ii].duplicates;
+            written += mergers[ii].written;
+            segments += mergers[ii].segments;
+            bytes_out += mergers[ii].bytes;
+        }
+    }
+    close_runs(shared.runs, shared.num_runs);
+
+    if(shared.failed) {
+        fprintf(stderr, "compaction failed; the inputs are left as they were, and "
+            "any seg-%lu-* files written are partial\n", shared.stamp);
+        return 1;
+    }
+    if(options.remove_inputs) {
+        for(ii = first; ii < argc; ii++) {
+            unlink(argv[ii]);
+        }
+    }
+
+    printf("%lu games read from %d inputs, %llu bytes\n",
+        written + duplicates + skipped, argc - first, bytes_in);
+    printf("%lu duplicates dropped, %lu games skipped, %d extra merge passes\n",
+        duplicates, skipped, passes);
+    printf("%lu games in %d segments, %llu bytes", written, segments, bytes_out);
+    if(written > 0) {
+        printf(", %.1f bytes per game", (double) bytes_out / written);
+    }
+    printf("\n");
+    free(shared.archives);
+    free(sorters);
+    free(mergers);
+    return 0;
+}
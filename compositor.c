@@ -0,0 +1,244 @@
+/** @file compositor.c
+ *  @brief Implementation of a layered compositor.
+ *
+ *  @bug No known bugs.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include "compositor.h"
+
+/***** Function prototypes ******/
+
+/** @brief Determines if a layer index is valid for a compositor.
+ *
+ * @param comp The compositor of interest.
+ * @param layer The layer index.
+ * @return 1 if the layer is valid, 0 otherwise.
+ */
+static int is_valid_layer(compositor_t *comp, int layer);
+
+/** @brief Clip a rectangle to the console.
+ *
+ * @param row The top row, adjusted in place.
+ * @param col The left column, adjusted in place.
+ * @param height The number of rows, adjusted in place.
+ * @param width The number of columns, adjusted in place.
+ * @return 1 if anything is left of the rectangle, 0 otherwise.
+ */
+static int clip_rect(int *row, int *col, int *height, int *width);
+
+/** @brief Determines if a cell of a layer is dirty.
+ *
+ * @param layer The layer of interest.
+ * @param row The row of the cell.
+ * @param col The column of the cell.
+ * @return 1 if the cell is dirty, 0 otherwise.
+ */
+static int is_dirty(layer_t *layer, int row, int col);
+
+/***** Function definitions ******/
+
+int is_valid_layer(compositor_t *comp, int layer) {
+    return comp != NULL && layer >= 0 && layer < comp->num_layers;
+}
+
+int clip_rect(int *row, int *col, int *height, int *width) {
+    if(*row < 0) {
+        *height += *row;
+        *row = 0;
+    }
+    if(*col < 0) {
+        *width += *col;
+        *col = 0;
+    }
+    if(*row + *height > CONSOLE_HEIGHT) {
+        *height = CONSOLE_HEIGHT - *row;
+    }
+    if(*col + *width > CONSOLE_WIDTH) {
+        *width = CONSOLE_WIDTH - *col;
+    }
+    return *height > 0 && *width > 0;
+}
+
+int is_dirty(layer_t *layer, int row, int col) {
+    return (layer->dirty[row][col / 64] >> (col % 64)) & 1;
+}
+
+int compositor_init(compositor_t *comp, int num_layers) {
+    int ii;
+    layer_t *layer;
+
+    if(comp == NULL || num_layers <= 0 || num_layers > COMPOSITOR_MAX_LAYERS) {
+        return -1;
+    }
+
+    comp->num_layers = num_layers;
+    for(ii = 0; ii < num_layers; ii++) {
+        layer = &comp->layers[ii];
+        layer->console.cursor.row = 0;
+        layer->console.cursor.col = 0;
+        layer->console.cursor.visibility = INVISIBLE;
+        layer->console.base_addr = layer->buffer;
+        layer->console.width = CONSOLE_WIDTH;
+        layer->console.height = CONSOLE_HEIGHT;
+        layer->console.clear_color = 0;
+        layer->console.term_color = 0;
+        memset(layer->buffer, 0, sizeof(layer->buffer));
+        memset(layer->dirty, 0, sizeof(layer->dirty));
+    }
+    return 0;
+}
+
+console_t *compositor_layer(compositor_t *comp, int layer) {
+    if(!is_valid_layer(comp, layer)) {
+        return NULL;
+    }
+    return &comp->layers[layer].console;
+}
+
+void compositor_mark_dirty(
+        compositor_t *comp,
+        int layer,
+        int row,
+        int col,
+        int height,
+        int width) {
+    int rr, cc;
+    layer_t *cur;
+
+    if(!is_valid_layer(comp, layer) || !clip_rect(&row, &col, &height, &width)) {
+        return;
+    }
+
+    cur = &comp->layers[layer];
+    for(rr = row; rr < row + height; rr++) {
+        for(cc = col; cc < col + width; cc++) {
+            cur->dirty[rr][cc / 64] |= (uint64_t)1 << (cc % 64);
+        }
+    }
+}
+
+void compositor_erase(
+        compositor_t *comp,
+        int layer,
+        int row,
+        int col,
+        int height,
+        int width) {
+    int rr, cc;
+    cell_t *cell;
+    layer_t *cur;
+
+    if(!is_valid_layer(comp, layer) || !clip_rect(&row, &col, &height, &width)) {
+        return;
+    }
+
+    cur = &comp->layers[layer];
+    for(rr = row; rr < row + height; rr++) {
+        cell = cur->buffer + rr * CONSOLE_WIDTH + col;
+        for(cc = col; cc < col + width; cc++, cell++) {
+            /* Erasing a transparent cell changes nothing on screen. */
+            if(cell_glyph(*cell) != 0) {
+                *cell = 0;
+                cur->dirty[rr][cc / 64] |= (uint64_t)1 << (cc % 64);
+            }
+        }
+    }
+}
+
+void compositor_clear_layer(compositor_t *comp, int layer) {
+    compositor_erase(comp, layer, 0, 0, CONSOLE_HEIGHT, CONSOLE_WIDTH);
+}
+
+void compositor_invalidate(compositor_t *comp) {
+    int ii;
+    if(comp == NULL) {
+        return;
+    }
+    for(ii = 0; ii < comp->num_layers; ii++) {
+        compositor_mark_dirty(comp, ii, 0, 0, CONSOLE_HEIGHT, CONSOLE_WIDTH);
+    }
+}
+
+void compositor_flatten(
+        compositor_t *comp,
+        console_t *out,
+        present_region_fn present,
+        void *ctx) {
+    int ii, rr, cc;
+    int run_start;
+    int touched;
+    uint64_t mask;
+    cell_t *src;
+    cell_t *dst;
+    layer_t *layer;
+
+    if(comp == NULL || out == NULL) {
+        return;
+    }
+    if(out->width != CONSOLE_WIDTH || out->height != CONSOLE_HEIGHT) {
+        return;
+    }
+
+    for(rr = 0; rr < CONSOLE_HEIGHT; rr++) {
+        run_start = -1;
+        for(cc = 0; cc < CONSOLE_WIDTH; cc++) {
+            /* Skip ahead a word at a time over clean cells. */
+            if(cc % 64 == 0) {
+                mask = 0;
+                for(ii = 0; ii < comp->num_layers; ii++) {
+                    mask |= comp->layers[ii].dirty[rr][cc / 64];
+                }
+                if(mask == 0) {
+                    if(run_start >= 0 && present != NULL) {
+                        present(ctx, out, rr, run_start, 1, cc - run_start);
+                    }
+                    run_start = -1;
+                    cc += 63;
+                    continue;
+                }
+            }
+
+            /*
+             * Walk down from the top layer to the first opaque cell.  If
+             * none of the layers we passed changed, neither did the
+             * composited cell.
+             */
+            touched = 0;
+            src = NULL;
+            for(ii = comp->num_layers - 1; ii >= 0; ii--) {
+                layer = &comp->layers[ii];
+                touched |= is_dirty(layer, rr, cc);
+                if(cell_glyph(layer->buffer[rr * CONSOLE_WIDTH + cc]) != 0) {
+                    src = &layer->buffer[rr * CONSOLE_WIDTH + cc];
+                    break;
+                }
+            }
+
+            if(touched) {
+                dst = (cell_t*)out->base_addr + rr * CONSOLE_WIDTH + cc;
+                if(src != NULL) {
+                    *dst = *src;
+                } else {
+                    *dst = cell_make(' ', out->clear_color);
+                }
+                if(run_start < 0) {
+                    run_start = cc;
+                }
+            } else if(run_start >= 0) {
+                if(present != NULL) {
+                    present(ctx, out, rr, run_start, 1, cc - run_start);
+                }
+                run_start = -1;
+            }
+        }
+        if(run_start >= 0 && present != NULL) {
+            present(ctx, out, rr, run_start, 1, CONSOLE_WIDTH - run_start);
+        }
+    }
+
+    for(ii = 0; ii < comp->num_layers; ii++) {
+        memset(comp->layers[ii].dirty, 0, sizeof(comp->layers[ii].dirty));
+    }
+}
@@ -0,0 +1,158 @@
+/** @file compositor.h
+ *  @brief A layered compositor over logical consoles.
+ *
+ *  A compositor owns a stack of layers, each a logical console of the
+ *  standard size.  Layer 0 is at the bottom.  A cell whose character is
+ *  0 is transparent, and shows the layers below it.  Each layer keeps
+ *  a mask of the cells that changed since the last flatten, so that
+ *  only those regions are recomposited into the output console.
+ *
+ *  Drawing into a layer is done with the usual console functions on
+ *  the console returned by compositor_layer.  Callers then report what
+ *  they touched with compositor_mark_dirty.
+ *
+ *  @bug None known.
+ */
+
+#ifndef _COMPOSITOR_H_
+#define _COMPOSITOR_H_
+
+#include <stdint.h>
+#include "console_model.h"
+
+/** Max layers in a compositor */
+#define COMPOSITOR_MAX_LAYERS 4
+
+/** Words in one row of a dirty mask */
+#define DIRTY_WORDS ((CONSOLE_WIDTH + 63) / 64)
+
+/** @brief Copies a region of a flattened console out to a screen.
+ *
+ * The first argument is whatever context the caller passed along with
+ * the function.
+ */
+typedef void (*present_region_fn)(
+        void *ctx,
+        console_t *console,
+        int row,
+        int col,
+        int height,
+        int width);
+
+/** @brief A single layer of a compositor.
+ */
+typedef struct layer_t {
+    /** The console used to draw into this layer */
+    console_t console;
+    /** The cells of this layer */
+    cell_t buffer[CONSOLE_CELLS] CONSOLE_ALIGNED;
+    /** One bit per cell, set if the cell changed since the last flatten */
+    uint64_t dirty[CONSOLE_HEIGHT][DIRTY_WORDS];
+} layer_t;
+
+/** @brief A stack of layers.
+ */
+typedef struct compositor_t {
+    /** The layers, bottom first */
+    layer_t layers[COMPOSITOR_MAX_LAYERS];
+    /** The number of layers in use */
+    int num_layers;
+} compositor_t;
+
+/** @brief Set up a compositor.
+ *
+ * All layers start out transparent, and nothing is dirty.
+ *
+ * @param comp The compositor to set up.
+ * @param num_layers The number of layers, at most COMPOSITOR_MAX_LAYERS.
+ * @return 0 on success, -1 if arguments are invalid.
+ */
+int compositor_init(compositor_t *comp, int num_layers);
+
+/** @brief Get the console used to draw into a layer.
+ *
+ * @param comp The compositor.
+ * @param layer The layer index.
+ * @return The layer's console, or NULL if arguments are invalid.
+ */
+console_t *compositor_layer(compositor_t *comp, int layer);
+
+/** @brief Mark a rectangle of a layer as changed.
+ *
+ * The rectangle is clipped to the console.
+ *
+ * @param comp The compositor.
+ * @param layer The layer index.
+ * @param row The top row of the rectangle.
+ * @param col The left column of the rectangle.
+ * @param height The number of rows in the rectangle.
+ * @param width The number of columns in the rectangle.
+ * @return None.
+ */
+void compositor_mark_dirty(
+        compositor_t *comp,
+        int layer,
+        int row,
+        int col,
+        int height,
+        int width);
+
+/** @brief Make a rectangle of a layer transparent.
+ *
+ * Only the cells that were not already transparent are marked dirty.
+ *
+ * @param comp The compositor.
+ * @param layer The layer index.
+ * @param row The top row of the rectangle.
+ * @param col The left column of the rectangle.
+ * @param height The number of rows in the rectangle.
+ * @param width The number of columns in the rectangle.
+ * @return None.
+ */
+void compositor_erase(
+        compositor_t *comp,
+        int layer,
+        int row,
+        int col,
+        int height,
+        int width);
+
+/** @brief Make a whole layer transparent.
+ *
+ * @param comp The compositor.
+ * @param layer The layer index.
+ * @return None.
+ */
+void compositor_clear_layer(compositor_t *comp, int layer);
+
+/** @brief Mark every cell of every layer as dirty.
+ *
+ * Used when the output console has been drawn over by something else,
+ * and must be recomposited in full.
+ *
+ * @param comp The compositor.
+ * @return None.
+ */
+void compositor_invalidate(compositor_t *comp);
+
+/** @brief Recomposite the dirty regions of the layers.
+ *
+ * For each dirty cell, the topmost non-transparent layer wins.  A cell
+ * is only rewritten if a layer at or above the winning layer changed;
+ * changes hidden under an opaque layer cost nothing.  Each run of
+ * rewritten cells is handed to present, if it is not NULL.  All dirty
+ * masks are cleared afterwards.
+ *
+ * @param comp The compositor.
+ * @param out The console to flatten into.
+ * @param present Called for each rewritten region, may be NULL.
+ * @param ctx Passed to present.
+ * @return None.
+ */
+void compositor_flatten(
+        compositor_t *comp,
+        console_t *out,
+        present_region_fn present,
+        void *ctx);
+
+#endif
@@ -7,8 +7,82 @@
        
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include "console_model.h"
 
+#if defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+/** Frame comparison uses SSE2, and AVX2 when the CPU has it. */
+#define CONSOLE_SIMD_X86
+#endif
+
+/** @brief Signature shared by the frame comparison kernels.
+ *
+ * Returns the first cell in [from, to) whose equality with the previous 
+ * frame matches want_change (1: first changed cell, 0: first unchanged 
+ * cell), or to if there is none.
+ */
+typedef size_t (*cell_scan_fn)(
+        const cell_t *cur, 
+        const cell_t *prev, 
+        size_t from, 
+        size_t to, 
+        int want_change);
+
+/** @brief An entry in the glyph table.
+ */
+typedef struct glyph_t {
+    /** The Unicode code point */
+    uint32_t codepoint;
+    /** The UTF-8 encoding */
+    const char *utf8;
+    /** A plain ASCII stand-in */
+    char ascii;
+} glyph_t;
+
+/** @brief The glyph table, for glyphs GLYPH_HLINE up to GLYPH_END.
+ */
+static const glyph_t glyph_table[GLYPH_END - 0x80] = {
+    {0x2500, "\xe2\x94\x80", '-'}, /* GLYPH_HLINE */
+    {0x2502, "\xe2\x94\x82", '|'}, /* GLYPH_VLINE */
+    {0x250C, "\xe2\x94\x8c", '+'}, /* GLYPH_ULCORNER */
+    {0x2510, "\xe2\x94\x90", '+'}, /* GLYPH_URCORNER */
+    {0x2514, "\xe2\x94\x94", '+'}, /* GLYPH_LLCORNER */
+    {0x2518, "\xe2\x94\x98", '+'}, /* GLYPH_LRCORNER */
+    {0x251C, "\xe2\x94\x9c", '+'}, /* GLYPH_LTEE */
+    {0x2524, "\xe2\x94\xa4", '+'}, /* GLYPH_RTEE */
+    {0x252C, "\xe2\x94\xac", '+'}, /* GLYPH_TTEE */
+    {0x2534, "\xe2\x94\xb4", '+'}, /* GLYPH_BTEE */
+    {0x253C, "\xe2\x94\xbc", '+'}, /* GLYPH_PLUS */
+};
+
+/** @brief The UTF-8 encoding of each ASCII glyph: the byte itself.
+ */
+static const char ascii_glyphs[0x80] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+    0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+    0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27,
+    0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f,
+    0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37,
+    0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f,
+    0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47,
+    0x48, 0x49, 0x4a, 0x4b, 0x4c, 0x4d, 0x4e, 0x4f,
+    0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57,
+    0x58, 0x59, 0x5a, 0x5b, 0x5c, 0x5d, 0x5e, 0x5f,
+    0x60, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67,
+    0x68, 0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e, 0x6f,
+    0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77,
+    0x78, 0x79, 0x7a, 0x7b, 0x7c, 0x7d, 0x7e, 0x7f,
+};
+
+/* The frame comparison kernel, picked once by pick_cell_scan. */
+static cell_scan_fn cell_scan = NULL;
+
+/* Guards the pick; the server's workers all compare frames. */
+static pthread_once_t cell_scan_once = PTHREAD_ONCE_INIT;
+
 /***** Function prototypes ******/
 
 /** @brief Get the address of a location in the console.
@@ -18,7 +92,7 @@
  * @param col The column of the location.
  * @return The address of the specified location.
  */
-static void *get_addr(console_t* console, int row, int col);
+static cell_t *get_addr(console_t* console, int row, int col);
 
 /** @brief Get the address of the cursor.
  *
@@ -29,7 +103,7 @@ static void *get_addr(console_t* console, int row, int col);
  * @param console The console of interest.
  * @return The address of the cursor.
  */
-static void *get_cursor_addr(console_t *console);
+static cell_t *get_cursor_addr(console_t *console);
 
 /** @brief Determines if a location is within the given console.
  *
@@ -47,11 +121,22 @@ static int is_valid_index(console_t *console, int row, int col);
  * The character can have a color.
  *
  * @param addr The address to write to.
- * @param ch The character to write.
+ * @param ch The character (glyph index) to write.
  * @param color The color of the character.
  * @return None. 
  */
-static void draw_char_at_addr(void* addr, int ch, int color);
+static void draw_char_at_addr(cell_t* addr, int ch, int color);
+
+/** @brief Decode one UTF-8 character into a glyph.
+ *
+ * Malformed or truncated sequences decode as '?', consuming one byte.
+ *
+ * @param s The bytes to decode.  s[0] must have its high bit set.
+ * @param len The number of bytes available at s.
+ * @param glyph Set to the decoded glyph.
+ * @return The number of bytes consumed.
+ */
+static int decode_utf8_glyph(const char *s, int len, uint8_t *glyph);
 
 /** @brief Scrolls the given console by one row.
  *
@@ -98,17 +183,71 @@ static int newline(console_t *console);
  */
 static void carriage_return(console_t *console);
 
+/** @brief Scan two frames for a (un)changed cell, one cell at a time.
+ *
+ * @param cur The current frame.
+ * @param prev The previous frame.
+ * @param from The first cell index to examine.
+ * @param to One past the last cell index to examine.
+ * @param want_change 1 to find a changed cell, 0 for an unchanged one.
+ * @return The index of the cell found, or to.
+ */
+static size_t scan_cells_scalar(
+        const cell_t *cur, 
+        const cell_t *prev, 
+        size_t from, 
+        size_t to, 
+        int want_change);
+
+#ifdef CONSOLE_SIMD_X86
+/** @brief Scan two frames for a (un)changed cell, 8 cells at a time.
+ *
+ * See scan_cells_scalar.
+ */
+static size_t scan_cells_sse2(
+        const cell_t *cur, 
+        const cell_t *prev, 
+        size_t from, 
+        size_t to, 
+        int want_change);
+
+/** @brief Scan two frames for a (un)changed cell, 16 cells at a time.
+ *
+ * See scan_cells_scalar.  Only called if the CPU supports AVX2.
+ */
+static size_t scan_cells_avx2(
+        const cell_t *cur, 
+        const cell_t *prev, 
+        size_t from, 
+        size_t to, 
+        int want_change) __attribute__((target("avx2")));
+#endif
+
+/** @brief Pick the fastest frame comparison kernel for this CPU.
+ *
+ * Run once, through pthread_once, by get_cell_scan.
+ *
+ * @return None.
+ */
+static void pick_cell_scan(void);
+
+/** @brief Get the frame comparison kernel, picking it on first use.
+ *
+ * @return The kernel to use.
+ */
+static cell_scan_fn get_cell_scan(void);
+
 /***** Function definitions ******/
 
-void *get_addr(console_t* console, int row, int col) {
+cell_t *get_addr(console_t* console, int row, int col) {
     if(console == NULL) {
         return NULL;
     }
-    char* base = (char*) console->base_addr;
-    return (void*)(base + 2 * (row * console->width + col));
+    cell_t* base = (cell_t*) console->base_addr;
+    return base + (row * console->width + col);
 }
 
-void* get_cursor_addr(console_t *console) {
+cell_t* get_cursor_addr(console_t *console) {
     if(console == NULL) {
         return NULL;
     }
@@ -121,16 +260,14 @@ int is_valid_index(console_t *console, int row, int col) {
         &&  ((col >= 0) && (col < console->width));
 }
 
-void draw_char_at_addr(void* addr, int ch, int color) { 
+void draw_char_at_addr(cell_t* addr, int ch, int color) { 
     /* 
-     * First byte encodes the character, second the color. 
+     * The low byte encodes the character, the high byte the color. 
      * We could check that addr is non-NULL, but the idea is
      * that this function will be used internally, and all
      * callers will ensure the input is valid.
      */
-    char* ch_addr = (char*) addr;
-    *(ch_addr) = (char) ch;      
-    *(ch_addr + 1) = (char) color;      
+    *addr = cell_make((uint8_t) ch, (uint8_t) color);
 }
 
 void scroll_by_one(console_t *console) {
@@ -138,20 +275,17 @@ void scroll_by_one(console_t *console) {
         return;
     }
 
-    int ii;
     int h = console->height;
     int w = console->width;
 
-    size_t save_len = 2 * h * (w - 1); /* The number of bytes to save */
-    char* second_row_addr = get_addr(console, 1, 0);
-    char* last_row_addr = get_addr(console, h - 1, 0);
+    size_t save_len = sizeof(cell_t) * w * (h - 1); /* The number of bytes to save */
+    cell_t* second_row_addr = get_addr(console, 1, 0);
+    cell_t* last_row_addr = get_addr(console, h - 1, 0);
 
     memmove(console->base_addr, second_row_addr, save_len);
 
     /* Clear the last row. */
-    for(ii = 0; ii < w * 2; ii += 2) {
-        draw_char_at_addr(last_row_addr + ii, ' ', console->clear_color);
-    }
+    console_fill_cells(last_row_addr, cell_make(' ', console->clear_color), w);
 }
 
 int console_putbyte(console_t *console, char ch) {
@@ -185,9 +319,20 @@ void console_putbytes(console_t *console, const char *s, int len) {
         return;
     }
 
-    int ii;
-    for(ii = 0; ii < len; ii++) {
-        console_putbyte(console, *(s + ii));
+    int ii = 0;
+    uint8_t glyph;
+    while(ii < len) {
+        if(*(s + ii) & 0x80) {
+            /* Store multi-byte characters as a glyph from the table. */
+            ii += decode_utf8_glyph(s + ii, len - ii, &glyph);
+            draw_char_at_addr(get_cursor_addr(console), glyph, console->term_color);
+            if(advance_cursor(console)) {
+                scroll_by_one(console);
+            }
+        } else {
+            console_putbyte(console, *(s + ii));
+            ii++;
+        }
     }
 }
 
@@ -196,13 +341,7 @@ void console_putstr(console_t *console, const char *s) {
         return;
     }
 
-    int off = 0;
-    char ch;
-
-    while((ch = *(s + off))) {
-        console_putbyte(console, ch);
-        off++;
-    }
+    console_putbytes(console, s, strlen(s));
 }
 
 void console_clear(console_t *console) {
@@ -210,19 +349,26 @@ void console_clear(console_t *console) {
         return;
     }
 
-    int ii;
-    size_t iters = console->width * console->height;
-    char *addr = (char*)console->base_addr;
-
-    for(ii = 0; ii < iters; ii++) {
-        draw_char_at_addr(addr, ' ', console->clear_color);
-        addr += 2;
-    }
+    console_fill_cells(
+        (cell_t*)console->base_addr,
+        cell_make(' ', console->clear_color),
+        console->width * console->height);
 
     console->cursor.row = 0;
     console->cursor.col = 0;
 }
 
+void console_fill_cells(cell_t *cells, cell_t cell, size_t count) {
+    size_t ii;
+    if(cells == NULL) {
+        return;
+    }
+    /* Cells are 16 bits, too wide for memset. */
+    for(ii = 0; ii < count; ii++) {
+        cells[ii] = cell;
+    }
+}
+
 void console_draw_char(
         console_t *console, 
         int row, 
@@ -245,16 +391,63 @@ char console_get_char(console_t* console, int row, int col) {
     if(console == NULL || !is_valid_index(console, row, col)) {
         return 0;
     }
-    return *((char*)get_addr(console, row, col));
+    return (char)cell_glyph(*get_addr(console, row, col));
 }
 
-char console_get(console_t* console, int row, int col, char *ch, char *color) {
+int console_get(console_t* console, int row, int col, uint8_t *ch, uint8_t *color) {
+    if(console == NULL || !is_valid_index(console, row, col)) {
+        return -1;
+    }
+    cell_t cell = *get_addr(console, row, col);
+    *ch = cell_glyph(cell);
+    *color = cell_color(cell);
+    return 0;
+}
+
+cell_t console_get_cell(console_t* console, int row, int col) {
     if(console == NULL || !is_valid_index(console, row, col)) {
         return 0;
     }
-    char *addr = (char*)get_addr(console, row, col);
-    *ch = *addr;
-    *color = *(addr + 1);
+    return *get_addr(console, row, col);
+}
+
+void console_copy_region(
+        console_t *dst, 
+        console_t *src, 
+        int row, 
+        int col, 
+        int height, 
+        int width) {
+    int rr;
+    if(dst == NULL || src == NULL) {
+        return;
+    }
+    if(dst->width != src->width || dst->height != src->height) {
+        return;
+    }
+
+    /* Clip the rectangle to the console. */
+    if(row < 0) {
+        height += row;
+        row = 0;
+    }
+    if(col < 0) {
+        width += col;
+        col = 0;
+    }
+    if(row + height > (int)dst->height) {
+        height = dst->height - row;
+    }
+    if(col + width > (int)dst->width) {
+        width = dst->width - col;
+    }
+    if(height <= 0 || width <= 0) {
+        return;
+    }
+
+    for(rr = row; rr < row + height; rr++) {
+        memcpy(get_addr(dst, rr, col), get_addr(src, rr, col), sizeof(cell_t) * width);
+    }
 }
 
 int console_set_cursor(console_t *console, int row, int col) {
@@ -316,3 +509,185 @@ void carriage_return(console_t *console) {
     }
     console->cursor.col = 0;
 }
+
+size_t scan_cells_scalar(
+        const cell_t *cur, 
+        const cell_t *prev, 
+        size_t from, 
+        size_t to, 
+        int want_change) {
+    size_t ii;
+    for(ii = from; ii < to; ii++) {
+        if((cur[ii] != prev[ii]) == want_change) {
+            return ii;
+        }
+    }
+    return to;
+}
+
+#ifdef CONSOLE_SIMD_X86
+size_t scan_cells_sse2(
+        const cell_t *cur, 
+        const cell_t *prev, 
+        size_t from, 
+        size_t to, 
+        int want_change) {
+    __m128i a, b;
+    uint32_t hits;
+    size_t ii = from;
+
+    /* 
+     * Compare 16 bytes (8 cells) at a time.  A cell that matches sets 
+     * both of its bits in the byte mask, so the lowest set bit of the 
+     * (possibly inverted) mask, halved, is the cell we're looking for.
+     */
+    while(ii + 8 <= to) {
+        a = _mm_loadu_si128((const __m128i*)(cur + ii));
+        b = _mm_loadu_si128((const __m128i*)(prev + ii));
+        hits = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi16(a, b));
+        if(want_change) {
+            hits = ~hits & 0xFFFF;
+        }
+        if(hits) {
+            return ii + (__builtin_ctz(hits) >> 1);
+        }
+        ii += 8;
+    }
+    return scan_cells_scalar(cur, prev, ii, to, want_change);
+}
+
+size_t scan_cells_avx2(
+        const cell_t *cur, 
+        const cell_t *prev, 
+        size_t from, 
+        size_t to, 
+        int want_change) {
+    __m256i a, b;
+    uint32_t hits;
+    size_t ii = from;
+
+    /* As scan_cells_sse2, but 32 bytes (16 cells) at a time. */
+    while(ii + 16 <= to) {
+        a = _mm256_loadu_si256((const __m256i*)(cur + ii));
+        b = _mm256_loadu_si256((const __m256i*)(prev + ii));
+        hits = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi16(a, b));
+        if(want_change) {
+            hits = ~hits;
+        }
+        if(hits) {
+            return ii + (__builtin_ctz(hits) >> 1);
+        }
+        ii += 16;
+    }
+    return scan_cells_sse2(cur, prev, ii, to, want_change);
+}
+#endif
+
+void pick_cell_scan(void) {
+#ifdef CONSOLE_SIMD_X86
+    __builtin_cpu_init();
+    cell_scan = __builtin_cpu_supports("avx2")? scan_cells_avx2 : scan_cells_sse2;
+#else
+    cell_scan = scan_cells_scalar;
+#endif
+}
+
+cell_scan_fn get_cell_scan(void) {
+    pthread_once(&cell_scan_once, pick_cell_scan);
+    return cell_scan;
+}
+
+size_t console_next_changed(const cell_t *cur, const cell_t *prev, size_t from, size_t to) {
+    if(cur == NULL || prev == NULL || from >= to) {
+        return to;
+    }
+    return get_cell_scan()(cur, prev, from, to, 1);
+}
+
+size_t console_next_unchanged(const cell_t *cur, const cell_t *prev, size_t from, size_t to) {
+    if(cur == NULL || prev == NULL || from >= to) {
+        return to;
+    }
+    return get_cell_scan()(cur, prev, from, to, 0);
+}
+
+int decode_utf8_glyph(const char *s, int len, uint8_t *glyph) {
+    const unsigned char *us = (const unsigned char*) s;
+    uint32_t codepoint;
+    int need, ii;
+
+    if((us[0] & 0xE0) == 0xC0) {
+        need = 2;
+        codepoint = us[0] & 0x1F;
+    } else if((us[0] & 0xF0) == 0xE0) {
+        need = 3;
+        codepoint = us[0] & 0x0F;
+    } else if((us[0] & 0xF8) == 0xF0) {
+        need = 4;
+        codepoint = us[0] & 0x07;
+    } else {
+        *glyph = '?';
+        return 1;
+    }
+
+    if(need > len) {
+        *glyph = '?';
+        return 1;
+    }
+    for(ii = 1; ii < need; ii++) {
+        if((us[ii] & 0xC0) != 0x80) {
+            *glyph = '?';
+            return 1;
+        }
+        codepoint = (codepoint << 6) | (us[ii] & 0x3F);
+    }
+
+    *glyph = console_glyph_from_codepoint(codepoint);
+    return need;
+}
+
+const char *console_glyph_utf8(uint8_t glyph, int *len) {
+    if(glyph < 0x80) {
+        *len = 1;
+        return &ascii_glyphs[glyph];
+    }
+    if(glyph < GLYPH_END) {
+        *len = strlen(glyph_table[glyph - 0x80].utf8);
+        return glyph_table[glyph - 0x80].utf8;
+    }
+    *len = 1;
+    return &ascii_glyphs['?'];
+}
+
+uint32_t console_glyph_codepoint(uint8_t glyph) {
+    if(glyph < 0x80) {
+        return glyph;
+    }
+    if(glyph < GLYPH_END) {
+        return glyph_table[glyph - 0x80].codepoint;
+    }
+    return '?';
+}
+
+char console_glyph_ascii(uint8_t glyph) {
+    if(glyph < 0x80) {
+        return glyph;
+    }
+    if(glyph < GLYPH_END) {
+        return glyph_table[glyph - 0x80].ascii;
+    }
+    return '?';
+}
+
+uint8_t console_glyph_from_codepoint(uint32_t codepoint) {
+    int ii;
+    if(codepoint < 0x80) {
+        return codepoint;
+    }
+    for(ii = 0; ii < GLYPH_END - 0x80; ii++) {
+        if(glyph_table[ii].codepoint == codepoint) {
+            return 0x80 + ii;
+        }
+    }
+    return '?';
+}
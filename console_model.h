@@ -14,6 +14,7 @@
 #define _CONSOLE_MODEL_H_
 
 #include <stdint.h>
+#include <stddef.h>
 
 /** @brief Determines if the input is a valid color.
  */
@@ -58,6 +59,56 @@
 #define BGND_BRWN  0x60
 #define BGND_LGRAY 0x70 /* Light gray. */
 
+/** Number of cells in a standard console */
+#define CONSOLE_CELLS (CONSOLE_HEIGHT * CONSOLE_WIDTH)
+
+/** @brief Alignment for cell buffers, so they can be read a vector at a time.
+ *
+ * Use as: static cell_t buffer[CONSOLE_CELLS] CONSOLE_ALIGNED;
+ */
+#define CONSOLE_ALIGNED __attribute__((aligned(32)))
+
+/* 
+ * Glyphs below 0x80 are plain ASCII.  The ones above are looked up in 
+ * the glyph table; see console_glyph_utf8.  Glyph 0 draws nothing.
+ */
+#define GLYPH_HLINE    0x80 /* U+2500 BOX DRAWINGS LIGHT HORIZONTAL */
+#define GLYPH_VLINE    0x81 /* U+2502 BOX DRAWINGS LIGHT VERTICAL */
+#define GLYPH_ULCORNER 0x82 /* U+250C BOX DRAWINGS LIGHT DOWN AND RIGHT */
+#define GLYPH_URCORNER 0x83 /* U+2510 BOX DRAWINGS LIGHT DOWN AND LEFT */
+#define GLYPH_LLCORNER 0x84 /* U+2514 BOX DRAWINGS LIGHT UP AND RIGHT */
+#define GLYPH_LRCORNER 0x85 /* U+2518 BOX DRAWINGS LIGHT UP AND LEFT */
+#define GLYPH_LTEE     0x86 /* U+251C BOX DRAWINGS LIGHT VERTICAL AND RIGHT */
+#define GLYPH_RTEE     0x87 /* U+2524 BOX DRAWINGS LIGHT VERTICAL AND LEFT */
+#define GLYPH_TTEE     0x88 /* U+252C BOX DRAWINGS LIGHT DOWN AND HORIZONTAL */
+#define GLYPH_BTEE     0x89 /* U+2534 BOX DRAWINGS LIGHT UP AND HORIZONTAL */
+#define GLYPH_PLUS     0x8A /* U+253C BOX DRAWINGS LIGHT VERTICAL AND HORIZONTAL */
+/** One past the last glyph in the table */
+#define GLYPH_END      0x8B
+
+/** @brief A console cell: a glyph index in the low byte, a color in the high.
+ *
+ * This is the same layout the console has always used in memory (glyph
+ * byte first, on a little-endian machine), but read and written as one 
+ * aligned 16-bit unit.  Use the cell_* helpers rather than shifting.
+ */
+typedef uint16_t cell_t;
+
+/** @brief Build a cell from a glyph and a color. */
+static inline cell_t cell_make(uint8_t glyph, uint8_t color) {
+    return (cell_t)(glyph | (color << 8));
+}
+
+/** @brief Get the glyph index of a cell. */
+static inline uint8_t cell_glyph(cell_t cell) {
+    return (uint8_t)(cell & 0xFF);
+}
+
+/** @brief Get the color of a cell. */
+static inline uint8_t cell_color(cell_t cell) {
+    return (uint8_t)(cell >> 8);
+}
+
 /** @brief Stores data for maintaining a cursor.
  */
 typedef struct cursor_t {
@@ -74,7 +125,7 @@ typedef struct cursor_t {
 typedef struct console_t {
     /** The cursor associated with this console */
     cursor_t cursor;    
-    /** The address where chars are written */
+    /** The address where cells are written (an array of cell_t) */
     void *base_addr;    
     /** The width of the console */ 
     size_t width;      
@@ -111,7 +162,9 @@ void console_putbytes(console_t *console, const char *s, int len);
 
 /** @brief Store a string into a logical console.
  * 
- * We interpret the argument as your standard c-string.
+ * We interpret the argument as your standard c-string.  UTF-8 sequences 
+ * for characters in the glyph table (e.g. box drawing characters) are 
+ * stored as the matching glyph; other non-ASCII characters become '?'.
  *
  * @param console The console to write to.
  * @param s A pointer to the bytes to write
@@ -166,6 +219,115 @@ void console_draw_char(console_t *console, int row, int col, int ch, int color);
  * @return The character at the specified index.
  */
 char console_get_char(console_t* console, int row, int col);
-char console_get(console_t* console, int row, int col, char *ch, char *color);
+
+/** @brief Reads a glyph and its color from a logical console.
+ *
+ * @param console The console to read from.
+ * @param row The row of the cell.
+ * @param col The column of the cell.
+ * @param ch Set to the glyph index of the cell.
+ * @param color Set to the color of the cell.
+ * @return 0 on success, -1 if arguments are invalid.
+ */
+int console_get(console_t* console, int row, int col, uint8_t *ch, uint8_t *color);
+
+/** @brief Reads a cell from a logical console.
+ *
+ * @param console The console to read from.
+ * @param row The row of the cell.
+ * @param col The column of the cell.
+ * @return The cell, or 0 if arguments are invalid.
+ */
+cell_t console_get_cell(console_t* console, int row, int col);
+
+/** @brief Fill a run of cells with the same value.
+ *
+ * @param cells The first cell to fill.
+ * @param cell The value to store.
+ * @param count The number of cells to fill.
+ * @return None.
+ */
+void console_fill_cells(cell_t *cells, cell_t cell, size_t count);
+
+/** @brief Get the UTF-8 encoding of a glyph.
+ *
+ * ASCII glyphs encode as themselves.  Unknown glyphs encode as '?'.
+ *
+ * @param glyph The glyph index.
+ * @param len Set to the length of the encoding, in bytes.
+ * @return The encoding.  It is not NUL terminated.
+ */
+const char *console_glyph_utf8(uint8_t glyph, int *len);
+
+/** @brief Get the Unicode code point of a glyph.
+ *
+ * @param glyph The glyph index.
+ * @return The code point, or '?' for unknown glyphs.
+ */
+uint32_t console_glyph_codepoint(uint8_t glyph);
+
+/** @brief Get a plain ASCII stand-in for a glyph.
+ *
+ * For displays that can't draw the glyph itself, e.g. '-' for GLYPH_HLINE.
+ *
+ * @param glyph The glyph index.
+ * @return An ASCII character.
+ */
+char console_glyph_ascii(uint8_t glyph);
+
+/** @brief Find the glyph for a Unicode code point.
+ *
+ * @param codepoint The code point.
+ * @return The glyph index, or '?' if the code point has no glyph.
+ */
+uint8_t console_glyph_from_codepoint(uint32_t codepoint);
+
+/** @brief Copy a rectangle of cells from one logical console to another.
+ *
+ * The consoles should have the same geometry.  The rectangle is clipped 
+ * to the consoles.  Cursors are not affected.
+ *
+ * @param dst The console to write to.
+ * @param src The console to read from.
+ * @param row The top row of the rectangle.
+ * @param col The left column of the rectangle.
+ * @param height The number of rows to copy.
+ * @param width The number of columns to copy.
+ * @return None.
+ */
+void console_copy_region(
+        console_t *dst, 
+        console_t *src, 
+        int row, 
+        int col, 
+        int height, 
+        int width);
+
+/** @brief Find the next cell that differs between two frames.
+ *
+ * Both frames are cell buffers of the same geometry (e.g. the
+ * base_addr of a console and a copy of the last frame presented).
+ * Cells are compared a vector at a time where the CPU allows.
+ *
+ * @param cur The current frame.
+ * @param prev The previous frame.
+ * @param from The first cell index to examine.
+ * @param to One past the last cell index to examine.
+ * @return The index of the first changed cell in [from, to), or to.
+ */
+size_t console_next_changed(const cell_t *cur, const cell_t *prev, size_t from, size_t to);
+
+/** @brief Find the next cell that is the same in two frames.
+ *
+ * The counterpart of console_next_changed, used to find where a run 
+ * of changed cells ends.
+ *
+ * @param cur The current frame.
+ * @param prev The previous frame.
+ * @param from The first cell index to examine.
+ * @param to One past the last cell index to examine.
+ * @return The index of the first unchanged cell in [from, to), or to.
+ */
+size_t console_next_unchanged(const cell_t *cur, const cell_t *prev, size_t from, size_t to);
 
 #endif
@@ -0,0 +1,62 @@
+/** @file coroutine.h
+ *  @brief Stackless coroutines, in the style of protothreads.
+ *
+ *  A coroutine is an ordinary function whose body is wrapped in
+ *  CO_BEGIN and CO_END.  CO_YIELD returns from the function, and the
+ *  next call resumes just after the yield.  The resume point is kept in
+ *  an int owned by the caller, so a coroutine costs that int plus
+ *  whatever state it keeps in its own struct; there is no stack.
+ *
+ *  Local variables are not preserved across a yield, and a coroutine
+ *  may not yield from a function it calls.  Only one CO_YIELD may
+ *  appear on a source line.
+ *
+ *  A coroutine may also name entries with CO_ENTRY.  Setting the resume
+ *  point to CO_ENTRY_STATE(entry) starts the next call at that entry,
+ *  so state saved elsewhere can be picked up again part way through.
+ *
+ *  @bug None known.
+ */
+
+#ifndef _COROUTINE_H_
+#define _COROUTINE_H_
+
+/** Running on into an entry is intended; say so to compilers that check */
+#if defined(__GNUC__) && __GNUC__ >= 7
+#define CO_FALL_THROUGH __attribute__((fallthrough));
+#else
+#define CO_FALL_THROUGH
+#endif
+
+/** The resume point of a coroutine that has not started */
+#define CO_START 0
+
+/** Start the body of a coroutine. */
+#define CO_BEGIN(state) switch(state) { case CO_START:
+
+/** Return a value, and resume here on the next call. */
+#define CO_YIELD(state, value) \
+    do { \
+        (state) = __LINE__; \
+        return (value); \
+        case __LINE__:; \
+    } while(0)
+
+/** Finish the coroutine: this call and every later one return value. */
+#define CO_EXIT(state, value) \
+    do { \
+        (state) = __LINE__; \
+        case __LINE__: \
+        return (value); \
+    } while(0)
+
+/** The resume point of entry number entry, a small int from 0 up */
+#define CO_ENTRY_STATE(entry) (-1 - (entry))
+
+/** A place the coroutine can be started from, besides its beginning. */
+#define CO_ENTRY(entry) CO_FALL_THROUGH case CO_ENTRY_STATE(entry):
+
+/** End the body of a coroutine. */
+#define CO_END(state) }
+
+#endif
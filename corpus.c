@@ -0,0 +1,170 @@
+/** @file corpus.c
+ *  @brief Implementation of corpus files.
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bytes.h"
+#include "replay.h"
+#include "corpus.h"
+
+/** Boards written at a time */
+#define WRITE_BOARDS 512
+
+/** The names of the phases, for reports */
+static const char *phase_names[CORPUS_PHASES] = {
+    "early", "mid", "late", "near-loss"
+};
+
+/***** Function prototypes ******/
+
+/** @brief Write the boards of a phase.
+ *
+ * @param out The file.
+ * @param boards The packed boards.
+ * @param count The number of boards.
+ * @return 0 on success, -1 on error.
+ */
+static int write_boards(FILE *out, const uint64_t *boards, uint64_t count);
+
+/***** Function definitions ******/
+
+int corpus_phase(int grid[GRID_SIZE][GRID_SIZE], uint32_t moves_left, int result) {
+    int max_tile;
+
+    if(result == REPLAY_RESULT_LOST && moves_left <= CORPUS_NEAR_LOSS_MOVES) {
+        return CORPUS_PHASE_NEAR_LOSS;
+    }
+    max_tile = engine_max_tile(grid);
+    if(max_tile < CORPUS_MID_TILE) {
+        return CORPUS_PHASE_EARLY;
+    }
+    return max_tile < CORPUS_LATE_TILE ? CORPUS_PHASE_MID : CORPUS_PHASE_LATE;
+}
+
+const char *corpus_phase_name(int phase) {
+    return phase_names[phase];
+}
+
+int write_boards(FILE *out, const uint64_t *boards, uint64_t count) {
+    uint8_t buf[WRITE_BOARDS * CORPUS_BOARD_LEN];
+    uint64_t ii, chunk;
+
+    while(count > 0) {
+        chunk = count < WRITE_BOARDS ? count : WRITE_BOARDS;
+        for(ii = 0; ii < chunk; ii++) {
+            put_u64(buf + ii * CORPUS_BOARD_LEN, boards[ii]);
+        }
+        if(fwrite(buf, CORPUS_BOARD_LEN, chunk, out) != chunk) {
+            return -1;
+        }
+        boards += chunk;
+        count -= chunk;
+    }
+    return 0;
+}
+
+int corpus_write(
+        const char *path,
+        uint64_t seed,
+        uint64_t games,
+        uint64_t *const boards[CORPUS_PHASES],
+        const uint64_t count[CORPUS_PHASES]) {
+    uint8_t header[CORPUS_HEADER_LEN];
+    FILE *out;
+    int ii, rt = 0;
+
+    memset(header, 0, sizeof(header));
+    put_u64(header, CORPUS_MAGIC | ((uint64_t) CORPUS_VERSION << 32)
+        | ((uint64_t) CORPUS_PHASES << 48));
+    put_u64(header + 8, seed);
+    put_u64(header + 16, games);
+    for(ii = 0; ii < CORPUS_PHASES; ii++) {
+        put_u64(header + 24 + 8 * ii, count[ii]);
+    }
+
+    out = fopen(path, "wb");
+    if(out == NULL) {
+        return -1;
+    }
+    if(fwrite(header, 1, sizeof(header), out) != sizeof(header)) {
+        rt = -1;
+    }
+    for(ii = 0; ii < CORPUS_PHASES && rt == 0; ii++) {
+        rt = write_boards(out, boards[ii], count[ii]);
+    }
+    if(fclose(out) != 0) {
+        rt = -1;
+    }
+    return rt;
+}
+
+int corpus_open(corpus_t *corpus, const char *path) {
+    struct stat st;
+    uint64_t tag, total = 0;
+    const uint8_t *next;
+    void *map;
+    int ii, fd;
+
+    memset(corpus, 0, sizeof(*corpus));
+    fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return -1;
+    }
+    if(fstat(fd, &st) < 0 || st.st_size < CORPUS_HEADER_LEN) {
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        return -1;
+    }
+    corpus->data = map;
+    corpus->len = st.st_size;
+
+    tag = get_u64(corpus->data);
+    if((uint32_t) tag != CORPUS_MAGIC || ((tag >> 32) & 0xFFFF) != CORPUS_VERSION
+            || (tag >> 48) != CORPUS_PHASES) {
+        corpus_close(corpus);
+        return -1;
+    }
+    corpus->seed = get_u64(corpus->data + 8);
+    corpus->games = get_u64(corpus->data + 16);
+
+    /* The phases follow each other; together they fill the file. */
+    next = corpus->data + CORPUS_HEADER_LEN;
+    for(ii = 0; ii < CORPUS_PHASES; ii++) {
+        corpus->count[ii] = get_u64(corpus->data + 24 + 8 * ii);
+        if(corpus->count[ii] > (corpus->len - CORPUS_HEADER_LEN) / CORPUS_BOARD_LEN) {
+            corpus_close(corpus);
+            return -1;
+        }
+        corpus->boards[ii] = next;
+        next += corpus->count[ii] * CORPUS_BOARD_LEN;
+        total += corpus->count[ii];
+    }
+    if(total * CORPUS_BOARD_LEN != corpus->len - CORPUS_HEADER_LEN) {
+        corpus_close(corpus);
+        return -1;
+    }
+    return 0;
+}
+
+void corpus_close(corpus_t *corpus) {
+    if(corpus->data != NULL) {
+        munmap((void*) corpus->data, corpus->len);
+    }
+    memset(corpus, 0, sizeof(*corpus));
+}
+
+uint64_t corpus_board(const corpus_t *corpus, int phase, uint64_t ii) {
+    return get_u64(corpus->boards[phase] + ii * CORPUS_BOARD_LEN);
+}
@@ -0,0 +1,150 @@
+/** @file corpus.h
+ *  @brief A fixed set of real positions to benchmark the engine on.
+ *
+ *  Timing the engine on random boards says little about how it runs in
+ *  a game: random boards have the wrong mix of empty cells, merges and
+ *  large tiles, so branches predict differently.  A corpus is instead
+ *  sampled from the positions of recorded games, and kept in a file so
+ *  every benchmark run sees the same boards.
+ *
+ *  The boards are split by phase, as the engine's work changes over a
+ *  game:
+ *
+ *  - early: no tile of CORPUS_MID_TILE yet.
+ *  - mid: the largest tile is below CORPUS_LATE_TILE.
+ *  - late: a tile of CORPUS_LATE_TILE or more.
+ *  - near loss: within CORPUS_NEAR_LOSS_MOVES moves of losing, whatever
+ *    the tiles.
+ *
+ *  A corpus file is:
+ *
+ *      offset  size  field
+ *      0       4     magic, "RCRP"
+ *      4       2     version
+ *      6       2     number of phases, CORPUS_PHASES
+ *      8       8     seed the boards were sampled with
+ *      16      8     games the boards were sampled from
+ *      24      8     boards in each phase, one number a phase
+ *      ...     ...   zeros, up to CORPUS_HEADER_LEN
+ *      64      ...   boards, 8 bytes each, phase by phase
+ *
+ *  Numbers are little endian.  A board is packed by engine_pack_board,
+ *  log2 of each tile in 4 bits, so tiles past 32768 cannot be stored
+ *  and their positions are left out.
+ *
+ *  The file is mapped, not read, so a large corpus costs nothing to
+ *  open.  Its version changes whenever the format or the meaning of a
+ *  phase does, so timings are only compared over like corpora.
+ *
+ *  @bug None known.
+ */
+
+#ifndef _CORPUS_H_
+#define _CORPUS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "engine.h"
+
+/** Identifies a corpus file, "RCRP" read as little endian */
+#define CORPUS_MAGIC 0x50524352u
+/** The current corpus file version */
+#define CORPUS_VERSION 1
+/** Size of the corpus file header, in bytes */
+#define CORPUS_HEADER_LEN 64
+/** Size of a board, in bytes */
+#define CORPUS_BOARD_LEN 8
+
+/** Positions before the first tile of CORPUS_MID_TILE */
+#define CORPUS_PHASE_EARLY 0
+/** Positions before the first tile of CORPUS_LATE_TILE */
+#define CORPUS_PHASE_MID 1
+/** Positions from the first tile of CORPUS_LATE_TILE on */
+#define CORPUS_PHASE_LATE 2
+/** Positions close to a loss */
+#define CORPUS_PHASE_NEAR_LOSS 3
+/** Number of phases */
+#define CORPUS_PHASES 4
+
+/** The tile that starts the middle of a game */
+#define CORPUS_MID_TILE 128
+/** The tile that starts the end of a game */
+#define CORPUS_LATE_TILE 512
+/** Positions this many moves or fewer from a loss are near it */
+#define CORPUS_NEAR_LOSS_MOVES 10
+
+/** @brief An open corpus file.
+ */
+typedef struct corpus_t {
+    /** The mapped file */
+    const uint8_t *data;
+    /** The size of the file */
+    size_t len;
+    /** The seed the boards were sampled with */
+    uint64_t seed;
+    /** The number of games the boards were sampled from */
+    uint64_t games;
+    /** The number of boards in each phase */
+    uint64_t count[CORPUS_PHASES];
+    /** The first board of each phase */
+    const uint8_t *boards[CORPUS_PHASES];
+} corpus_t;
+
+/** @brief Find the phase of a position.
+ *
+ * @param grid The board.
+ * @param moves_left The moves the game went on for after it.
+ * @param result How the game ended, one of the REPLAY_RESULT_ constants.
+ * @return One of the CORPUS_PHASE_ constants.
+ */
+int corpus_phase(int grid[GRID_SIZE][GRID_SIZE], uint32_t moves_left, int result);
+
+/** @brief Name a phase, for reports.
+ *
+ * @param phase One of the CORPUS_PHASE_ constants.
+ * @return The name.
+ */
+const char *corpus_phase_name(int phase);
+
+/** @brief Write a corpus file.
+ *
+ * @param path The file.
+ * @param seed The seed the boards were sampled with.
+ * @param games The number of games they were sampled from.
+ * @param boards The packed boards of each phase.
+ * @param count The number of boards in each phase.
+ * @return 0 on success, -1 on error.
+ */
+int corpus_write(
+        const char *path,
+        uint64_t seed,
+        uint64_t games,
+        uint64_t *const boards[CORPUS_PHASES],
+        const uint64_t count[CORPUS_PHASES]);
+
+/** @brief Open a corpus file.
+ *
+ * @param corpus Set to the open corpus.
+ * @param path The file.
+ * @return 0 on success, -1 if the file cannot be read or is not a
+ *         corpus of this version.
+ */
+int corpus_open(corpus_t *corpus, const char *path);
+
+/** @brief Close a corpus file.
+ *
+ * @param corpus The corpus.
+ * @return None.
+ */
+void corpus_close(corpus_t *corpus);
+
+/** @brief Get a board of a corpus.
+ *
+ * @param corpus The corpus.
+ * @param phase One of the CORPUS_PHASE_ constants.
+ * @param ii The board's index in its phase, below corpus->count[phase].
+ * @return The packed board.
+ */
+uint64_t corpus_board(const corpus_t *corpus, int phase, uint64_t ii);
+
+#endif
@@ -0,0 +1,565 @@
+/** @file coverage.c
+ *  @brief Measures how much of the game's positions a run explored.
+ *
+ *  Replays every game of some segments (see segment.h) and counts the
+ *  positions they pass through: how many there were, how many were
+ *  distinct, and both of those by depth, the number of moves made.
+ *  Runs are far too big to keep a set of every position, so each thread
+ *  keeps HyperLogLog counters and, if asked, a Bloom filter (see
+ *  sketch.h), and they are merged at the end.
+ *
+ *  A run can save its sketches with -o, and a later run can load them
+ *  with -b as a baseline: it then also reports how many of its
+ *  positions the baseline had seen before, and how many distinct
+ *  positions the two cover together.  A coverage file is:
+ *
+ *      offset  size  field
+ *      0       4     magic, "RCOV"
+ *      4       2     version
+ *      6       1     SKETCH_HLL_BITS
+ *      7       1     reserved, 0
+ *      8       8     positions visited
+ *      16      8     size of the Bloom filter, in bytes
+ *      24      ...   HyperLogLog registers, SKETCH_HLL_REGISTERS bytes
+ *      ...     ...   Bloom filter
+ *
+ *  Numbers are little endian.
+ *
+ *  Usage: coverage [-j threads] [-m megabytes] [-b baseline] [-o file] segment...
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "bytes.h"
+#include "replay.h"
+#include "segment.h"
+#include "sketch.h"
+#include "corpus.h"
+
+/** Most threads */
+#define MAX_THREADS 64
+/** Blocks a thread takes at a time */
+#define BLOCKS_PER_TAKE 4
+/** Depths are counted in buckets: 0, 1, 2-3, 4-7 and so on */
+#define NUM_DEPTHS 26
+/** Identifies a coverage file, "RCOV" read as little endian */
+#define COVERAGE_MAGIC 0x564f4352u
+/** The current coverage file version */
+#define COVERAGE_VERSION 1
+/** Size of the coverage file header, in bytes */
+#define COVERAGE_HEADER_LEN 24
+/** The first 8 bytes of a coverage file, read as little endian */
+#define COVERAGE_TAG (COVERAGE_MAGIC | ((uint64_t) COVERAGE_VERSION << 32) \
+    | ((uint64_t) SKETCH_HLL_BITS << 48))
+
+/** @brief Settings from the command line.
+ */
+typedef struct options_t {
+    /** Number of threads */
+    int threads;
+    /** Size of each thread's Bloom filter, in bytes */
+    size_t bloom_len;
+    /** A coverage file to compare with, or NULL */
+    const char *baseline;
+    /** Where to save this run's coverage, or NULL */
+    const char *output;
+} options_t;
+
+/** @brief What is known about the positions at some depths.
+ */
+typedef struct depth_t {
+    /** The number of positions visited */
+    uint64_t positions;
+    /** How many of them the baseline had seen */
+    uint64_t seen;
+    /** The distinct positions */
+    sketch_hll_t distinct;
+} depth_t;
+
+/** @brief A run's sketches, as saved in a coverage file.
+ */
+typedef struct sketches_t {
+    /** The number of positions visited */
+    uint64_t positions;
+    /** The distinct positions */
+    sketch_hll_t distinct;
+    /** Every position, if kept */
+    sketch_bloom_t seen;
+} sketches_t;
+
+/** @brief What every thread shares.
+ */
+typedef struct survey_t {
+    /** The settings */
+    const options_t *options;
+    /** The baseline, if any */
+    const sketches_t *baseline;
+    /** The segments */
+    segment_t *segments;
+    /** Their paths */
+    char **paths;
+    /** The number of segments */
+    int num_segments;
+    /** Hands the blocks out to the threads */
+    segment_queue_t blocks;
+} survey_t;
+
+/** @brief A replaying thread.
+ */
+typedef struct walker_t {
+    /** The thread */
+    pthread_t thread;
+    /** What the threads share */
+    survey_t *shared;
+    /** The block being replayed */
+    segment_block_t *block;
+    /** The game being replayed */
+    replay_t replay;
+    /** What the thread has seen, over all depths */
+    sketches_t sketches;
+    /** What the thread has seen, by depth */
+    depth_t depths[NUM_DEPTHS];
+    /** The number of games replayed */
+    unsigned long games;
+    /** The number of games whose moves do not replay */
+    unsigned long bad;
+} walker_t;
+
+/***** Function prototypes ******/
+
+/** @brief Print how to run the program.
+ *
+ * @param name The program's name.
+ * @return None.
+ */
+static void usage(const char *name);
+
+/** @brief Read the command line.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param options Set to the settings.
+ * @return The index of the first segment, or -1 on a usage error.
+ */
+static int parse_options(int argc, char **argv, options_t *options);
+
+/** @brief Save a run's sketches to a coverage file.
+ *
+ * @param path The file.
+ * @param sketches The sketches, with a Bloom filter.
+ * @return 0 on success, -1 on error.
+ */
+static int save_sketches(const char *path, const sketches_t *sketches);
+
+/** @brief Load a run's sketches from a coverage file.
+ *
+ * @param path The file.
+ * @param sketches Set to the sketches.
+ * @return 0 on success, -1 if the file cannot be read or is not a
+ *         coverage file.
+ */
+static int load_sketches(const char *path, sketches_t *sketches);
+
+/** @brief Pack a board into a key.
+ *
+ * The key is the board as engine_pack_board packs it; the rare tile
+ * past 32768 is folded in on top.
+ *
+ * @param grid The board.
+ * @return The key.
+ */
+static uint64_t board_key(int grid[GRID_SIZE][GRID_SIZE]);
+
+/** @brief Find the bucket of a depth.
+ *
+ * @param depth The number of moves made.
+ * @return The bucket, below NUM_DEPTHS.
+ */
+static int depth_bucket(uint32_t depth);
+
+/** @brief Count a position.
+ *
+ * @param walker The thread.
+ * @param grid The board.
+ * @param depth The number of moves made to reach it.
+ * @return None.
+ */
+static void visit(walker_t *walker, int grid[GRID_SIZE][GRID_SIZE], uint32_t depth);
+
+/** @brief Replay one game of a block, counting its positions.
+ *
+ * @param walker The thread, with the game's block read.
+ * @param ii The game.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int walk_game(walker_t *walker, uint32_t ii);
+
+/** @brief Estimate the distinct positions among some.
+ *
+ * @param distinct The distinct positions.
+ * @param positions The number of positions, which the estimate is
+ *        kept below.
+ * @return The estimate.
+ */
+static double count_distinct(const sketch_hll_t *distinct, uint64_t positions);
+
+/** @brief Replay blocks until none are left.
+ *
+ * @param arg The thread's walker_t.
+ * @return NULL.
+ */
+static void *walker_main(void *arg);
+
+/***** Function definitions ******/
+
+void usage(const char *name) {
+    fprintf(stderr,
+        "usage: %s [-j threads] [-m megabytes] [-b baseline] [-o file] segment...\n"
+        "  -j  threads (default 4)\n"
+        "  -m  Bloom filter size per thread, in megabytes, with -o (default 64)\n"
+        "  -b  compare with the coverage saved by an earlier run\n"
+        "  -o  save this run's coverage to a file\n",
+        name);
+}
+
+int parse_options(int argc, char **argv, options_t *options) {
+    long value;
+    int opt;
+
+    options->threads = 4;
+    options->bloom_len = (size_t) 64 << 20;
+    options->baseline = NULL;
+    options->output = NULL;
+
+    while((opt = getopt(argc, argv, "j:m:b:o:")) != -1) {
+        switch(opt) {
+            case 'j':
+                options->threads = atoi(optarg);
+                if(options->threads < 1 || options->threads > MAX_THREADS) {
+                    return -1;
+                }
+                break;
+            case 'm':
+                value = atol(optarg);
+                if(value < 1) {
+                    return -1;
+                }
+                options->bloom_len = (size_t) value << 20;
+                break;
+            case 'b':
+                options->baseline = optarg;
+                break;
+            case 'o':
+                options->output = optarg;
+                break;
+            default:
+                return -1;
+        }
+    }
+    if(optind >= argc) {
+        return -1;
+    }
+    return optind;
+}
+
+int save_sketches(const char *path, const sketches_t *sketches) {
+    uint8_t header[COVERAGE_HEADER_LEN];
+    size_t bloom_len = sketches->seen.num_blocks * SKETCH_BLOOM_BLOCK_LEN;
+    FILE *out;
+    int rt = 0;
+
+    memset(header, 0, sizeof(header));
+    put_u64(header, COVERAGE_TAG);
+    put_u64(header + 8, sketches->positions);
+    put_u64(header + 16, bloom_len);
+
+    out = fopen(path, "wb");
+    if(out == NULL) {
+        return -1;
+    }
+    if(fwrite(header, 1, sizeof(header), out) != sizeof(header)
+            || fwrite(sketches->distinct.registers, 1, SKETCH_HLL_REGISTERS, out)
+                != SKETCH_HLL_REGISTERS
+            || fwrite(sketches->seen.bits, 1, bloom_len, out) != bloom_len) {
+        rt = -1;
+    }
+    if(fclose(out) != 0) {
+        rt = -1;
+    }
+    return rt;
+}
+
+int load_sketches(const char *path, sketches_t *sketches) {
+    uint8_t header[COVERAGE_HEADER_LEN];
+    uint64_t bloom_len;
+    FILE *in;
+    int rt = -1;
+
+    memset(sketches, 0, sizeof(*sketches));
+    in = fopen(path, "rb");
+    if(in == NULL) {
+        return -1;
+    }
+    if(fread(header, 1, sizeof(header), in) == sizeof(header)
+            && get_u64(header) == COVERAGE_TAG
+            && fread(sketches->distinct.registers, 1, SKETCH_HLL_REGISTERS, in)
+                == SKETCH_HLL_REGISTERS) {
+        sketches->positions = get_u64(header + 8);
+        bloom_len = get_u64(header + 16);
+        if(bloom_len > 0 && bloom_len % SKETCH_BLOOM_BLOCK_LEN == 0
+                && sketch_bloom_init(&sketches->seen, bloom_len) == 0) {
+            if(fread(sketches->seen.bits, 1, bloom_len, in) == bloom_len) {
+                rt = 0;
+            } else {
+                sketch_bloom_free(&sketches->seen);
+            }
+        }
+    }
+    fclose(in);
+    return rt;
+}
+
+uint64_t board_key(int grid[GRID_SIZE][GRID_SIZE]) {
+    uint64_t key, extra = 0;
+    int ii, jj, log2;
+
+    if(engine_pack_board(grid, &key) == 0) {
+        return key;
+    }
+    for(ii = 0; ii < GRID_SIZE; ii++) {
+        for(jj = 0; jj < GRID_SIZE; jj++) {
+            log2 = engine_tile_log2(grid[ii][jj]);
+            if(log2 > 0xF) {
+                extra = extra * 31 + (ii * GRID_SIZE + jj) * 32 + log2;
+            }
+        }
+    }
+    return key ^ sketch_hash(extra);
+}
+
+int depth_bucket(uint32_t depth) {
+    return depth ? 32 - __builtin_clz(depth) : 0;
+}
+
+void visit(walker_t *walker, int grid[GRID_SIZE][GRID_SIZE], uint32_t depth) {
+    const sketches_t *baseline = walker->shared->baseline;
+    depth_t *bucket = &walker->depths[depth_bucket(depth)];
+    uint64_t hash = sketch_hash(board_key(grid));
+
+    walker->sketches.positions++;
+    sketch_hll_add(&walker->sketches.distinct, hash);
+    if(walker->sketches.seen.bits != NULL) {
+        sketch_bloom_add(&walker->sketches.seen, hash);
+    }
+    bucket->positions++;
+    sketch_hll_add(&bucket->distinct, hash);
+    if(baseline != NULL && sketch_bloom_test(&baseline->seen, hash)) {
+        bucket->seen++;
+    }
+}
+
+int walk_game(walker_t *walker, uint32_t ii) {
+    segment_record_t rec;
+    replay_cursor_t cursor;
+    int rt;
+
+    segment_block_record(walker->block, ii, &rec);
+    if(segment_record_to_replay(&rec, &walker->replay) < 0) {
+        return -1;
+    }
+    replay_cursor_start(&cursor, &walker->replay);
+    visit(walker, cursor.grid, 0);
+    while((rt = replay_cursor_step(&cursor)) > 0) {
+        visit(walker, cursor.grid, cursor.played);
+    }
+    if(rt < 0) {
+        walker->bad++;
+    }
+    walker->games++;
+    return 0;
+}
+
+double count_distinct(const sketch_hll_t *distinct, uint64_t positions) {
+    double estimate = sketch_hll_count(distinct);
+    return estimate < positions ? estimate : positions;
+}
+
+void *walker_main(void *arg) {
+    walker_t *walker = arg;
+    survey_t *shared = walker->shared;
+    uint32_t first, count, ii, jj;
+    int segment, rt = 0;
+
+    while(rt == 0 && segment_queue_take(&shared->blocks, &segment, &first, &count)) {
+        for(ii = first; ii < first + count && rt == 0; ii++) {
+            rt = segment_read_block(&shared->segments[segment], ii, SEGMENT_READ_ALL,
+                walker->block);
+            if(rt < 0) {
+                fprintf(stderr, "%s: malformed block %u\n", shared->paths[segment], ii);
+            }
+            for(jj = 0; jj < walker->block->count && rt == 0; jj++) {
+                rt = walk_game(walker, jj);
+                if(rt < 0) {
+                    fprintf(stderr, "out of memory\n");
+                }
+            }
+        }
+    }
+    if(rt < 0) {
+        segment_queue_fail(&shared->blocks);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    options_t options;
+    survey_t shared;
+    sketches_t baseline;
+    walker_t *walkers;
+    walker_t *total;
+    sketch_hll_t together;
+    unsigned long games = 0, bad = 0;
+    char label[32];
+    int ii, jj, first, lo, hi;
+
+    first = parse_options(argc, argv, &options);
+    if(first < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    memset(&shared, 0, sizeof(shared));
+    shared.options = &options;
+    shared.paths = argv + first;
+    shared.num_segments = argc - first;
+    shared.segments = calloc(shared.num_segments, sizeof(*shared.segments));
+    segment_queue_init(&shared.blocks, shared.segments, shared.num_segments, BLOCKS_PER_TAKE);
+    walkers = calloc(options.threads, sizeof(*walkers));
+    if(shared.segments == NULL || walkers == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    if(options.baseline != NULL) {
+        if(load_sketches(options.baseline, &baseline) < 0) {
+            fprintf(stderr, "%s: not a readable coverage file\n", options.baseline);
+            return 1;
+        }
+        shared.baseline = &baseline;
+    }
+    for(ii = 0; ii < shared.num_segments; ii++) {
+        if(segment_open(&shared.segments[ii], shared.paths[ii]) < 0) {
+            fprintf(stderr, "%s: not a readable segment\n", shared.paths[ii]);
+            return 1;
+        }
+    }
+
+    for(ii = 0; ii < options.threads; ii++) {
+        walkers[ii].shared = &shared;
+        walkers[ii].block = calloc(1, sizeof(segment_block_t));
+        replay_init(&walkers[ii].replay);
+        sketch_hll_init(&walkers[ii].sketches.distinct);
+        for(jj = 0; jj < NUM_DEPTHS; jj++) {
+            sketch_hll_init(&walkers[ii].depths[jj].distinct);
+        }
+        if(walkers[ii].block == NULL || (options.output != NULL
+                && sketch_bloom_init(&walkers[ii].sketches.seen, options.bloom_len) < 0)) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+        if(pthread_create(&walkers[ii].thread, NULL, walker_main, &walkers[ii]) != 0) {
+            fprintf(stderr, "could not start thread\n");
+            return 1;
+        }
+    }
+
+    /* Merge every thread's sketches into the first's. */
+    total = &walkers[0];
+    for(ii = 0; ii < options.threads; ii++) {
+        pthread_join(walkers[ii].thread, NULL);
+        games += walkers[ii].games;
+        bad += walkers[ii].bad;
+        if(ii == 0) {
+            continue;
+        }
+        total->sketches.positions += walkers[ii].sketches.positions;
+        sketch_hll_merge(&total->sketches.distinct, &walkers[ii].sketches.distinct);
+        if(options.output != NULL) {
+            sketch_bloom_merge(&total->sketches.seen, &walkers[ii].sketches.seen);
+        }
+        for(jj = 0; jj < NUM_DEPTHS; jj++) {
+            total->depths[jj].positions += walkers[ii].depths[jj].positions;
+            total->depths[jj].seen += walkers[ii].depths[jj].seen;
+            sketch_hll_merge(&total->depths[jj].distinct, &walkers[ii].depths[jj].distinct);
+        }
+    }
+    if(segment_queue_failed(&shared.blocks)) {
+        return 1;
+    }
+
+    printf("%-17s %14s %14s", "depth", "positions", "distinct");
+    if(shared.baseline != NULL) {
+        printf(" %12s", "seen before");
+    }
+    printf("\n");
+    for(ii = 0; ii < NUM_DEPTHS; ii++) {
+        if(total->depths[ii].positions == 0) {
+            continue;
+        }
+        lo = ii ? 1 << (ii - 1) : 0;
+        hi = ii ? (1 << ii) - 1 : 0;
+        if(lo == hi) {
+            snprintf(label, sizeof(label), "%d", lo);
+        } else {
+            snprintf(label, sizeof(label), "%d-%d", lo, hi);
+        }
+        printf("%-17s %14llu %14.0f", label,
+            (unsigned long long) total->depths[ii].positions,
+            count_distinct(&total->depths[ii].distinct, total->depths[ii].positions));
+        if(shared.baseline != NULL) {
+            printf(" %11.1f%%", 100.0 * total->depths[ii].seen / total->depths[ii].positions);
+        }
+        printf("\n");
+    }
+
+    printf("%lu games, %lu of them corrupt; %llu positions, about %.0f distinct"
+        " (to within %.1f%%)\n", games, bad,
+        (unsigned long long) total->sketches.positions,
+        count_distinct(&total->sketches.distinct, total->sketches.positions),
+        104.0 / (1 << (SKETCH_HLL_BITS / 2)));
+    if(shared.baseline != NULL) {
+        together = baseline.distinct;
+        sketch_hll_merge(&together, &total->sketches.distinct);
+        printf("about %.0f distinct positions with the baseline's %.0f\n",
+            count_distinct(&together, total->sketches.positions + baseline.positions),
+            count_distinct(&baseline.distinct, baseline.positions));
+    }
+    if(options.output != NULL) {
+        if(save_sketches(options.output, &total->sketches) < 0) {
+            fprintf(stderr, "%s: could not save coverage\n", options.output);
+            return 1;
+        }
+        printf("coverage saved to %s; its Bloom filter has a %.2g%% false positive rate\n",
+            options.output, 100 * sketch_bloom_false_positive_rate(&total->sketches.seen));
+    }
+
+    for(ii = 0; ii < options.threads; ii++) {
+        segment_block_free(walkers[ii].block);
+        free(walkers[ii].block);
+        replay_free(&walkers[ii].replay);
+        sketch_bloom_free(&walkers[ii].sketches.seen);
+    }
+    for(ii = 0; ii < shared.num_segments; ii++) {
+        segment_close(&shared.segments[ii]);
+    }
+    if(shared.baseline != NULL) {
+        sketch_bloom_free(&baseline.seen);
+    }
+    free(shared.segments);
+    free(walkers);
+    return 0;
+}
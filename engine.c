@@ -0,0 +1,306 @@
+/** @file engine.c
+ *  @brief Implementation of the 2048 rules.
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "engine.h"
+
+/***** Function prototypes ******/
+
+/** @brief Find where a line of the grid starts, and how it runs.
+ *
+ * Cells are numbered row by row.  Position 0 of the line, at cell
+ * first, is the edge the tiles move toward, and each position after it
+ * is step cells on.
+ *
+ * @param dir One of the DIR_ constants.
+ * @param line The row (left/right) or column (up/down).
+ * @param first Set to the cell at position 0.
+ * @param step Set to the distance from one position's cell to the next.
+ * @return None.
+ */
+static void line_start(int dir, int line, int *first, int *step);
+
+/** @brief Record a tile that moved.
+ *
+ * @param motion Set to the motion.
+ * @param from The cell the tile left.
+ * @param to The cell it stopped in.
+ * @param value Its value.
+ * @param merged Set if it merged.
+ * @return None.
+ */
+static void trace_motion(engine_motion_t *motion, int from, int to, int value, int merged);
+
+/** @brief Determines if a tile can move or merge.
+ *
+ * @param row The row of the tile.
+ * @param col The column of the tile.
+ * @param grid The collection of blocks.
+ * @return 1 if an adjacent cell is empty or matches, 0 otherwise.
+ */
+static int can_move(int row, int col, int grid[GRID_SIZE][GRID_SIZE]);
+
+/***** Function definitions ******/
+
+void engine_rng_seed(engine_rng_t *rng, uint64_t seed) {
+    rng->state = seed;
+}
+
+uint32_t engine_rng_next(engine_rng_t *rng) {
+    /* splitmix64: small, fast, and good enough for placing tiles. */
+    uint64_t z = (rng->state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z = z ^ (z >> 31);
+    return (uint32_t)(z >> 32);
+}
+
+void engine_new_game(int grid[GRID_SIZE][GRID_SIZE], engine_rng_t *rng) {
+    memset(grid, 0, sizeof(int) * NUM_CELLS);
+    engine_spawn(grid, rng, NULL, NULL);
+    engine_spawn(grid, rng, NULL, NULL);
+}
+
+int engine_spawn(int grid[GRID_SIZE][GRID_SIZE], engine_rng_t *rng, int *row, int *col) {
+    int empty[NUM_CELLS];
+    int ii, jj;
+    int count = 0;
+    int value, cell;
+
+    /* Find all empty locations, in row order. */
+    for(ii = 0; ii < GRID_SIZE; ii++) {
+        for(jj = 0; jj < GRID_SIZE; jj++) {
+            if(grid[ii][jj] == 0) {
+                empty[count++] = ii * GRID_SIZE + jj;
+            }
+        }
+    }
+    if(count == 0) {
+        return 0;
+    }
+
+    /* The value is drawn first, then the location. */
+    value = ((engine_rng_next(rng) % 2) + 1) * 2;
+    cell = empty[engine_rng_next(rng) % count];
+    grid[cell / GRID_SIZE][cell % GRID_SIZE] = value;
+    if(row != NULL) {
+        *row = cell / GRID_SIZE;
+    }
+    if(col != NULL) {
+        *col = cell % GRID_SIZE;
+    }
+    return value;
+}
+
+void line_start(int dir, int line, int *first, int *step) {
+    switch(dir) {
+        case DIR_LEFT:  *first = line * GRID_SIZE; *step = 1; break;
+        case DIR_RIGHT: *first = line * GRID_SIZE + GRID_SIZE - 1; *step = -1; break;
+        case DIR_UP:    *first = line; *step = GRID_SIZE; break;
+        default:        *first = (GRID_SIZE - 1) * GRID_SIZE + line; *step = -GRID_SIZE; break;
+    }
+}
+
+void trace_motion(engine_motion_t *motion, int from, int to, int value, int merged) {
+    motion->from_row = from / GRID_SIZE;
+    motion->from_col = from % GRID_SIZE;
+    motion->to_row = to / GRID_SIZE;
+    motion->to_col = to % GRID_SIZE;
+    motion->value = value;
+    motion->merged = merged;
+}
+
+int engine_move(int grid[GRID_SIZE][GRID_SIZE], int dir, unsigned int *score) {
+    return engine_move_traced(grid, dir, score, NULL, NULL);
+}
+
+int engine_move_traced(
+        int grid[GRID_SIZE][GRID_SIZE],
+        int dir,
+        unsigned int *score,
+        engine_motion_t motions[ENGINE_MAX_MOTIONS],
+        int *num_motions) {
+    int *cells = &grid[0][0];
+    int line, pos, out;
+    int first, step;
+    int value, mergeable;
+    int result[GRID_SIZE];
+    int count = 0;
+    int moved = 0;
+
+    for(line = 0; line < GRID_SIZE; line++) {
+        /*
+         * Pack the tiles toward position 0.  A tile merges into the
+         * one before it if they match and that one is not itself the
+         * product of a merge.
+         */
+        line_start(dir, line, &first, &step);
+        out = 0;
+        mergeable = 0;
+        for(pos = 0; pos < GRID_SIZE; pos++) {
+            result[pos] = 0;
+        }
+        for(pos = 0; pos < GRID_SIZE; pos++) {
+            value = cells[first + pos * step];
+            if(value == 0) {
+                continue;
+            }
+            if(value == mergeable) {
+                result[out - 1] = value * 2;
+                if(score != NULL) {
+                    *score += value * 2;
+                }
+                mergeable = 0;
+                if(motions != NULL) {
+                    trace_motion(&motions[count++], first + pos * step,
+                        first + (out - 1) * step, value, 1);
+                }
+            } else {
+                if(motions != NULL && out != pos) {
+                    trace_motion(&motions[count++], first + pos * step,
+                        first + out * step, value, 0);
+                }
+                result[out++] = value;
+                mergeable = value;
+            }
+        }
+
+        for(pos = 0; pos < GRID_SIZE; pos++) {
+            if(cells[first + pos * step] != result[pos]) {
+                cells[first + pos * step] = result[pos];
+                moved = 1;
+            }
+        }
+    }
+    if(num_motions != NULL) {
+        *num_motions = count;
+    }
+    return moved;
+}
+
+int can_move(int row, int col, int grid[GRID_SIZE][GRID_SIZE]) {
+    int value, other;
+
+    value = grid[row][col];
+
+    if(value == 0) {
+        return 0;
+    }
+
+    /*
+     * Look at the 4 adjacent squares.  If one
+     * is empty or has a matching value, we can
+     * move (though not necessarily merge)
+     */
+    if((row - 1) >= 0) {
+        other = grid[row - 1][col];
+        if(other == 0 || other == value) {
+            return 1;
+        }
+    }
+    if((row + 1) < GRID_SIZE) {
+        other = grid[row + 1][col];
+        if(other == 0 || other == value) {
+            return 1;
+        }
+    }
+    if((col - 1) >= 0) {
+        other = grid[row][col - 1];
+        if(other == 0 || other == value) {
+            return 1;
+        }
+    }
+    if((col + 1) < GRID_SIZE) {
+        other = grid[row][col + 1];
+        if(other == 0 || other == value) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int engine_is_won(int grid[GRID_SIZE][GRID_SIZE], int win_tile) {
+    int ii, jj;
+
+    /* Is the winning tile present? */
+    for(ii = 0; ii < GRID_SIZE; ii++) {
+        for(jj = 0; jj < GRID_SIZE; jj++) {
+            if(grid[ii][jj] == win_tile) {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int engine_is_lost(int grid[GRID_SIZE][GRID_SIZE]) {
+    int ii, jj;
+
+    /* If any tile is empty, or we can move any tile, we haven't lost yet */
+    for(ii = 0; ii < GRID_SIZE; ii++) {
+        for(jj = 0; jj < GRID_SIZE; jj++) {
+            if(grid[ii][jj] == 0 || can_move(ii, jj, grid)) {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+int engine_max_tile(int grid[GRID_SIZE][GRID_SIZE]) {
+    int ii, jj;
+    int best = 0;
+    for(ii = 0; ii < GRID_SIZE; ii++) {
+        for(jj = 0; jj < GRID_SIZE; jj++) {
+            if(grid[ii][jj] > best) {
+                best = grid[ii][jj];
+            }
+        }
+    }
+    return best;
+}
+
+int engine_tile_log2(uint32_t tile) {
+    if(tile == 0) {
+        return 0;
+    }
+    if(tile == 1 || (tile & (tile - 1)) != 0) {
+        return -1;
+    }
+    return __builtin_ctz(tile);
+}
+
+int engine_pack_board(int grid[GRID_SIZE][GRID_SIZE], uint64_t *board) {
+    int ii, jj, log2, rt = 0;
+
+    *board = 0;
+    for(ii = 0; ii < GRID_SIZE; ii++) {
+        for(jj = 0; jj < GRID_SIZE; jj++) {
+            log2 = engine_tile_log2(grid[ii][jj]);
+            if(log2 < 0 || log2 > 0xF) {
+                rt = -1;
+            }
+            *board = (*board << 4) | (log2 & 0xF);
+        }
+    }
+    return rt;
+}
+
+void engine_unpack_board(uint64_t board, int grid[GRID_SIZE][GRID_SIZE]) {
+    int ii, jj, log2;
+
+    for(ii = GRID_SIZE - 1; ii >= 0; ii--) {
+        for(jj = GRID_SIZE - 1; jj >= 0; jj--) {
+            log2 = board & 0xF;
+            grid[ii][jj] = log2 ? 1 << log2 : 0;
+            board >>= 4;
+        }
+    }
+}
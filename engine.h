@@ -0,0 +1,174 @@
+/** @file engine.h
+ *  @brief The rules of 2048, without any drawing or animation.
+ *
+ *  The engine works on a plain grid of tile values, so the same rules
+ *  can drive the interactive game, replay tools and simulations.  New
+ *  tiles come from a small seeded generator, so a game is fully
+ *  determined by its seed and its moves.
+ *
+ *  @bug None known.
+ */
+
+#ifndef _ENGINE_H_
+#define _ENGINE_H_
+
+#include <stdint.h>
+#include "game.h"
+
+/** Move the tiles left */
+#define DIR_LEFT 0
+/** Move the tiles right */
+#define DIR_RIGHT 1
+/** Move the tiles down */
+#define DIR_DOWN 2
+/** Move the tiles up */
+#define DIR_UP 3
+/** Number of directions */
+#define NUM_DIRS 4
+
+/** Most tiles a move can carry */
+#define ENGINE_MAX_MOTIONS NUM_CELLS
+
+/** @brief The generator for new tiles.
+ */
+typedef struct engine_rng_t {
+    /** The generator state */
+    uint64_t state;
+} engine_rng_t;
+
+/** @brief A tile carried by a move, so it can be animated.
+ */
+typedef struct engine_motion_t {
+    /** The cell the tile left */
+    uint8_t from_row;
+    uint8_t from_col;
+    /** The cell it stopped in */
+    uint8_t to_row;
+    uint8_t to_col;
+    /** Its value while it moves */
+    int value;
+    /** Set if it merged with the tile it stopped on, doubling it */
+    int merged;
+} engine_motion_t;
+
+/** @brief Seed the generator.
+ *
+ * @param rng The generator.
+ * @param seed Any value; equal seeds give equal games.
+ * @return None.
+ */
+void engine_rng_seed(engine_rng_t *rng, uint64_t seed);
+
+/** @brief Draw the next number from the generator.
+ *
+ * @param rng The generator.
+ * @return A uniformly distributed 32 bit number.
+ */
+uint32_t engine_rng_next(engine_rng_t *rng);
+
+/** @brief Empty a grid and place the two starting tiles.
+ *
+ * @param grid The grid.
+ * @param rng The generator for the new tiles.
+ * @return None.
+ */
+void engine_new_game(int grid[GRID_SIZE][GRID_SIZE], engine_rng_t *rng);
+
+/** @brief Place a 2 or a 4 on a random empty cell.
+ *
+ * @param grid The grid.
+ * @param rng The generator.
+ * @param row Set to the row of the new tile, may be NULL.
+ * @param col Set to the column of the new tile, may be NULL.
+ * @return The value placed, or 0 if the grid is full.
+ */
+int engine_spawn(int grid[GRID_SIZE][GRID_SIZE], engine_rng_t *rng, int *row, int *col);
+
+/** @brief Move all tiles in a direction, merging equal neighbours.
+ *
+ * A tile merges at most once per move.
+ *
+ * @param grid The grid.
+ * @param dir One of the DIR_ constants.
+ * @param score Increased by the value of every merged tile, may be NULL.
+ * @return 1 if anything moved, 0 otherwise.
+ */
+int engine_move(int grid[GRID_SIZE][GRID_SIZE], int dir, unsigned int *score);
+
+/** @brief Move all tiles like engine_move, and trace the tiles that moved.
+ *
+ * The interactive game animates a move from its trace, so it plays by
+ * the same rules as the replay tools.
+ *
+ * @param grid The grid.
+ * @param dir One of the DIR_ constants.
+ * @param score Increased by the value of every merged tile, may be NULL.
+ * @param motions Set to the tiles that moved, may be NULL.
+ * @param num_motions Set to the number of motions, may be NULL.
+ * @return 1 if anything moved, 0 otherwise.
+ */
+int engine_move_traced(
+        int grid[GRID_SIZE][GRID_SIZE],
+        int dir,
+        unsigned int *score,
+        engine_motion_t motions[ENGINE_MAX_MOTIONS],
+        int *num_motions);
+
+/** @brief Determines if the given grid represents a won game.
+ *
+ * The grid must contain the tile specified by the win_tile argument.
+ *
+ * @param grid The collection of blocks.
+ * @param win_tile The winning tile.
+ * @return 1 if the game is won, 0 otherwise.
+ */
+int engine_is_won(int grid[GRID_SIZE][GRID_SIZE], int win_tile);
+
+/** @brief Determines if the given grid represents a lost game.
+ *
+ * A game is lost if no tiles on the board can move, either by merging
+ * or moving into empty spaces.
+ *
+ * @param grid The collection of blocks.
+ * @return 1 if the game is lost, 0 otherwise.
+ */
+int engine_is_lost(int grid[GRID_SIZE][GRID_SIZE]);
+
+/** @brief Find the largest tile on a grid.
+ *
+ * @param grid The collection of blocks.
+ * @return The largest value, 0 for an empty grid.
+ */
+int engine_max_tile(int grid[GRID_SIZE][GRID_SIZE]);
+
+/** @brief Find log2 of a tile.
+ *
+ * @param tile The tile, 0 for none.
+ * @return log2 of the tile, 0 for none, or -1 if the tile is not a
+ *         power of two of at least 2.
+ */
+int engine_tile_log2(uint32_t tile);
+
+/** @brief Pack a board into 64 bits.
+ *
+ * Each cell takes 4 bits, log2 of its tile, top left cell in the top
+ * bits.  Corpora, coverage files and frozen sessions all keep boards
+ * this way.
+ *
+ * @param grid The board.
+ * @param board Set to the packed board.  A tile too large to store
+ *        keeps only the low 4 bits of its log2.
+ * @return 0 on success, -1 if a tile is too large to store, or not a
+ *         tile.
+ */
+int engine_pack_board(int grid[GRID_SIZE][GRID_SIZE], uint64_t *board);
+
+/** @brief Unpack a board packed by engine_pack_board.
+ *
+ * @param board The packed board.
+ * @param grid Set to the board.
+ * @return None.
+ */
+void engine_unpack_board(uint64_t board, int grid[GRID_SIZE][GRID_SIZE]);
+
+#endif
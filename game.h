@@ -18,6 +18,16 @@
 /** Maps a grid column to a console column */
 #define CONSOLE_COL(C) (((C) * 12) + 1)
 
+/** Console location and width of the in game clock */
+#define TIMER_ROW 17
+#define TIMER_COL 52
+#define TIMER_WIDTH 11
+
+/** Height of a block, in console rows */
+#define BLOCK_HEIGHT 5
+/** Width of a block, in console columns */
+#define BLOCK_WIDTH 11
+
 /** The animated block isn't moving or idle. */
 #define ANI_BLOCK_DEAD 0x1
 /** The animated block was moving, now isn't. */
@@ -28,42 +38,6 @@
 /** The distance in console pixels an animated block travels per step */
 #define ANI_STEP_SIZE 1
 
-/** The starting game state. */
-#define ENTER_TITLE_SCREEN 0x01
-/** Game state for reading input on title screen. */
-#define TITLE_SCREEN_INPUT 0x02
-
-/** Game state for entering the instruction screen. */
-#define ENTER_INSTRUCTION_SCREEN 0x03
-/** Game state for reading input on instruction screen. */
-#define INSTRUCTION_SCREEN_INPUT 0x04
-
-/** Game state for entering the difficulty screen. */
-#define ENTER_DIFFICULTY_SCREEN 0x05
-/** Game state for reading input on difficulty screen. */
-#define DIFFICULTY_SCREEN_INPUT 0x06
-
-/** Game state for starting a new 2048 round. */
-#define GAME_START 0x07
-/** Game state for entering a new round of the game (e.g. after a move) */
-#define ENTER_GAME 0x08
-/** Game state for reading input during a 2048 game. */
-#define GAME_INPUT 0x09
-/** Game state for entering the pause screen. */
-#define ENTER_PAUSE 0x0A
-/** Game state for reading input on pause screen. */
-#define PAUSE_INPUT 0x0F
-/** Game state for animating shifting blocks */
-#define SHIFTING_BLOCKS 0x0B 
-/** Game state when blocks are done shifting */
-#define DONE_SHIFTING_BLOCKS 0x0C
-/** Game state when victory detected */
-#define GAME_VICTORY 0x0D
-/** Game state when defeat detected */
-#define GAME_DEFEAT 0x0E
-/** Game state for reading input when game is over. */
-#define GAME_OVER_INPUT 0x1F
-
 /** Max length of a string reprenting an integer */
 #define MAX_INT_STR_LEN 20
 
@@ -73,6 +47,18 @@
 /** Max allowable animated (idle, moving) objects */
 #define MAX_ANIMATIONS 16
 
+/** A block slid from one cell to another. */
+#define DAMAGE_BLOCK_MOVED 0x1
+/** A block slid into another block, and the two merged. */
+#define DAMAGE_BLOCK_MERGED 0x2
+/** A new block appeared on the board. */
+#define DAMAGE_BLOCK_SPAWNED 0x3
+/** The score (and maybe the high score) changed. */
+#define DAMAGE_SCORE 0x4
+
+/** Max pending damage events: every animation, plus a spawn and the score */
+#define MAX_DAMAGE_EVENTS (MAX_ANIMATIONS + 2)
+
 /** @brief An animated block.
  *
  * This struct represents a block that is moving as the result of
@@ -97,4 +83,24 @@ typedef struct animated_block_t {
     int state; 
 } animated_block_t;
 
+/** @brief A change to the game board, as reported by the engine.
+ *
+ * The renderer maps each event to the console rectangle it touches 
+ * (see CONSOLE_ROW, CONSOLE_COL) and recomposites only those.  Locations 
+ * are grid coordinates.  A spawned block only uses the destination, and
+ * a score change uses neither.
+ */
+typedef struct damage_event_t {
+    /** DAMAGE_BLOCK_MOVED, DAMAGE_BLOCK_MERGED, DAMAGE_BLOCK_SPAWNED, ... */
+    int type;
+    /** The grid row the block came from */
+    uint8_t from_row;
+    /** The grid column the block came from */
+    uint8_t from_col;
+    /** The grid row the block ended up in */
+    uint8_t to_row;
+    /** The grid column the block ended up in */
+    uint8_t to_col;
+} damage_event_t;
+
 #endif
@@ -0,0 +1,192 @@
+/** @file key_decoder.c
+ *  @brief Implementation of the key decoder and reader.
+ *
+ *  @bug No known bugs.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <ncurses.h>
+#include "key_decoder.h"
+
+/** @brief An escape sequence and the key it stands for.
+ */
+typedef struct sequence_t {
+    /** The bytes of the sequence */
+    const char *bytes;
+    /** The number of bytes */
+    int len;
+    /** The key, one of the ncurses KEY_ codes */
+    int key;
+} sequence_t;
+
+/** The sequences a decoder knows */
+static const sequence_t sequences[] = {
+    { "\033[A", 3, KEY_UP },
+    { "\033[B", 3, KEY_DOWN },
+    { "\033[C", 3, KEY_RIGHT },
+    { "\033[D", 3, KEY_LEFT },
+    { "\033OA", 3, KEY_UP },
+    { "\033OB", 3, KEY_DOWN },
+    { "\033OC", 3, KEY_RIGHT },
+    { "\033OD", 3, KEY_LEFT },
+};
+
+/** Number of sequences */
+#define NUM_SEQUENCES ((int) (sizeof(sequences) / sizeof(sequences[0])))
+
+/***** Function prototypes ******/
+
+/** @brief Check if input is waiting.
+ *
+ * @param reader The reader.
+ * @param timeout_ms How long to wait for it, -1 for good.
+ * @return 1 if it is, 0 if not.
+ */
+static int input_waiting(key_reader_t *reader, int timeout_ms);
+
+/** @brief Read every byte waiting, and queue the keys they make.
+ *
+ * Marks the reader closed at end of file or on an error.
+ *
+ * @param reader The reader.
+ * @return None.
+ */
+static void read_input(key_reader_t *reader);
+
+/** @brief Queue keys.
+ *
+ * @param reader The reader.
+ * @param keys The keys.
+ * @param count The number of keys.
+ * @return None.
+ */
+static void queue_keys(key_reader_t *reader, const int *keys, int count);
+
+/***** Function definitions ******/
+
+void key_decoder_init(key_decoder_t *dec) {
+    dec->pending_len = 0;
+}
+
+int key_decoder_byte(key_decoder_t *dec, unsigned char byte, int *keys) {
+    int ii, count, partial = 0;
+
+    if(dec->pending_len == 0 && byte != 033) {
+        keys[0] = byte;
+        return 1;
+    }
+
+    dec->pending[dec->pending_len++] = byte;
+    for(ii = 0; ii < NUM_SEQUENCES; ii++) {
+        if(sequences[ii].len < dec->pending_len
+                || memcmp(sequences[ii].bytes, dec->pending, dec->pending_len) != 0) {
+            continue;
+        }
+        if(sequences[ii].len == dec->pending_len) {
+            dec->pending_len = 0;
+            keys[0] = sequences[ii].key;
+            return 1;
+        }
+        partial = 1;
+    }
+    if(partial) {
+        return 0;
+    }
+
+    /*
+     * No sequence starts this way.  The bytes before this one go out as
+     * they came; this one may start a sequence of its own.
+     */
+    for(count = 0; count < dec->pending_len - 1; count++) {
+        keys[count] = dec->pending[count];
+    }
+    dec->pending_len = 0;
+    return count + key_decoder_byte(dec, byte, keys + count);
+}
+
+int key_decoder_flush(key_decoder_t *dec, int *keys) {
+    int ii, count = dec->pending_len;
+
+    for(ii = 0; ii < count; ii++) {
+        keys[ii] = dec->pending[ii];
+    }
+    dec->pending_len = 0;
+    return count;
+}
+
+void key_reader_init(key_reader_t *reader, int fd) {
+    reader->fd = fd;
+    key_decoder_init(&reader->decoder);
+    reader->head = 0;
+    reader->count = 0;
+    reader->closed = 0;
+}
+
+int input_waiting(key_reader_t *reader, int timeout_ms) {
+    struct pollfd pfd;
+
+    pfd.fd = reader->fd;
+    pfd.events = POLLIN;
+    return poll(&pfd, 1, timeout_ms) > 0;
+}
+
+void read_input(key_reader_t *reader) {
+    unsigned char in[KEY_READER_QUEUE_LEN];
+    int keys[KEY_DECODER_MAX_SEQ];
+    ssize_t got, ii;
+    int room;
+
+    /* A byte makes at most one key, counting the bytes already held. */
+    room = KEY_READER_QUEUE_LEN - reader->count - reader->decoder.pending_len;
+    if(room <= 0) {
+        return;
+    }
+    got = read(reader->fd, in, room);
+    if(got == 0 || (got < 0 && errno != EINTR && errno != EAGAIN)) {
+        /* End of file, or the terminal hung up; poll would wake for it forever. */
+        reader->closed = 1;
+        return;
+    }
+    for(ii = 0; ii < got; ii++) {
+        queue_keys(reader, keys, key_decoder_byte(&reader->decoder, in[ii], keys));
+    }
+}
+
+void queue_keys(key_reader_t *reader, const int *keys, int count) {
+    int ii;
+
+    for(ii = 0; ii < count && reader->count < KEY_READER_QUEUE_LEN; ii++) {
+        reader->keys[(reader->head + reader->count) % KEY_READER_QUEUE_LEN] = keys[ii];
+        reader->count++;
+    }
+}
+
+int key_reader_next(key_reader_t *reader, int timeout_ms) {
+    int keys[KEY_DECODER_MAX_SEQ];
+    int key;
+
+    if(reader->count == 0 && !reader->closed && input_waiting(reader, timeout_ms)) {
+        read_input(reader);
+    }
+    /*
+     * The rest of a sequence follows within moments; if it does not, the
+     * bytes held were typed as they are.
+     */
+    if(reader->count == 0 && reader->decoder.pending_len > 0) {
+        if(!reader->closed && input_waiting(reader, KEY_READER_SEQUENCE_MS)) {
+            read_input(reader);
+        } else {
+            queue_keys(reader, keys, key_decoder_flush(&reader->decoder, keys));
+        }
+    }
+    if(reader->count == 0) {
+        return reader->closed ? KEY_DECODER_CLOSED : KEY_DECODER_NONE;
+    }
+    key = reader->keys[reader->head];
+    reader->head = (reader->head + 1) % KEY_READER_QUEUE_LEN;
+    reader->count--;
+    return key;
+}
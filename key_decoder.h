@@ -0,0 +1,106 @@
+/** @file key_decoder.h
+ *  @brief Turns the bytes a terminal sends into keys.
+ *
+ *  Arrow keys arrive as escape sequences, ESC [ A or, with the keypad in
+ *  application mode, ESC O A.  A decoder takes bytes one at a time and
+ *  matches them against a small table of sequences, holding the start
+ *  of a sequence until it either completes or cannot, and then hands
+ *  over the key, or the bytes as they came.  Its state carries from one
+ *  read to the next, so a sequence split between reads still decodes.
+ *
+ *  A reader puts a decoder behind a terminal: it takes every byte
+ *  waiting in one read() and queues the keys, so keys typed faster than
+ *  the game runs are all there on its next pass.  The rest of a sequence
+ *  split between reads is waited for only briefly, so an ESC on its own
+ *  is handed over in a few milliseconds rather than after ncurses'
+ *  escape delay of a second.  Once the terminal's input reaches end of
+ *  file or fails, the reader says so rather than waiting on it again.
+ *
+ *  @bug None known.
+ */
+
+#ifndef _KEY_DECODER_H_
+#define _KEY_DECODER_H_
+
+/** Returned when there is no key; the same value as ncurses' ERR */
+#define KEY_DECODER_NONE (-1)
+/** Returned once the input is closed; the same value as KEY_INPUT_CLOSED */
+#define KEY_DECODER_CLOSED (-2)
+/** Longest escape sequence a decoder knows */
+#define KEY_DECODER_MAX_SEQ 3
+/** Keys a reader holds before they are taken */
+#define KEY_READER_QUEUE_LEN 256
+/** How long a reader waits for the rest of a sequence, in milliseconds */
+#define KEY_READER_SEQUENCE_MS 25
+
+/** @brief The state of a decoder.
+ */
+typedef struct key_decoder_t {
+    /** The start of a sequence, read but not yet complete */
+    unsigned char pending[KEY_DECODER_MAX_SEQ];
+    /** The number of bytes in pending */
+    int pending_len;
+} key_decoder_t;
+
+/** @brief A queue of keys read from a terminal.
+ */
+typedef struct key_reader_t {
+    /** The terminal's file descriptor */
+    int fd;
+    /** Decodes the bytes read */
+    key_decoder_t decoder;
+    /** Keys not taken yet, in a ring */
+    int keys[KEY_READER_QUEUE_LEN];
+    /** The oldest key in keys */
+    int head;
+    /** The number of keys in keys */
+    int count;
+    /** Set once the input reached end of file or failed */
+    int closed;
+} key_reader_t;
+
+/** @brief Start a decoder with no bytes held.
+ *
+ * @param dec The decoder.
+ * @return None.
+ */
+void key_decoder_init(key_decoder_t *dec);
+
+/** @brief Decode a byte.
+ *
+ * @param dec The decoder.
+ * @param byte The byte.
+ * @param keys Set to the keys the byte completes, characters or ncurses
+ *        KEY_ codes; room for KEY_DECODER_MAX_SEQ.
+ * @return The number of keys, 0 if the byte starts or continues a
+ *         sequence.
+ */
+int key_decoder_byte(key_decoder_t *dec, unsigned char byte, int *keys);
+
+/** @brief Hand over the bytes of an unfinished sequence as they came.
+ *
+ * @param dec The decoder.
+ * @param keys Set to the bytes held; room for KEY_DECODER_MAX_SEQ.
+ * @return The number of keys.
+ */
+int key_decoder_flush(key_decoder_t *dec, int *keys);
+
+/** @brief Start a reader.
+ *
+ * @param reader The reader.
+ * @param fd The terminal, in a mode that passes bytes on as they come.
+ * @return None.
+ */
+void key_reader_init(key_reader_t *reader, int fd);
+
+/** @brief Take the next key, reading if none is queued.
+ *
+ * @param reader The reader.
+ * @param timeout_ms How long to wait for input if none is queued, 0 to
+ *        not wait, -1 to wait for good.
+ * @return The key, KEY_DECODER_NONE if there is none, or
+ *         KEY_DECODER_CLOSED if there is none and never will be.
+ */
+int key_reader_next(key_reader_t *reader, int timeout_ms);
+
+#endif
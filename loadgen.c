@@ -0,0 +1,994 @@
+/** @file loadgen.c
+ *  @brief Simulates many players against a game server, and reports.
+ *
+ *  Each simulated player connects to the server, starts a game, and
+ *  then sends moves after a random think time, drawn from an
+ *  exponential distribution with the given mean.  When a game ends it
+ *  starts another.  Moves follow one of a few key patterns.
+ *
+ *  For every move, the time from sending the key to the first byte of
+ *  the server's answer is taken as the frame latency.  A playing
+ *  session also redraws its clock once a second, in a frame of its own,
+ *  so each player follows the cursor through the frames it gets, and
+ *  only a frame that draws more than the clock answers a move.  A move
+ *  that changes nothing gets no answer, and is counted as unanswered
+ *  when the next key goes out.  A frame drawn before the cursor could
+ *  be placed may or may not be the answer; its sample is dropped and
+ *  counted as ambiguous.  At the end a report gives the latency
+ *  percentiles, the throughput and, given the server's pid, the CPU the
+ *  server used per player.
+ *
+ *  Players are scheduled with a timer wheel (see timer_wheel.h), so a
+ *  single thread can drive thousands of them.
+ *
+ *  Usage: loadgen [-H host] [-p port] [-n players] [-d seconds]
+ *                 [-t think_ms] [-k random|corner|spin] [-r rate]
+ *                 [-P server_pid] [-o samples_file]
+ *
+ *  @bug No known bugs.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "console_model.h"
+#include "game.h"
+#include "timer_wheel.h"
+
+/** The server's port, unless -p says otherwise */
+#define DEFAULT_PORT 2048
+/** Events taken from epoll at once */
+#define MAX_EVENTS 256
+/** Bytes read from a connection at once */
+#define READ_CHUNK 16384
+
+/** Keys sent for each move */
+#define KEY_SEQ_UP "\033[A"
+#define KEY_SEQ_DOWN "\033[B"
+#define KEY_SEQ_RIGHT "\033[C"
+#define KEY_SEQ_LEFT "\033[D"
+
+/** Start a game at the hardest difficulty, so games run long */
+#define KEYS_NEW_GAME "n0"
+/** Leave the game over message, and start another game */
+#define KEYS_NEXT_GAME "qn0"
+
+/** The private mode the server wraps every frame in */
+#define SYNC_MODE 2026
+/** Shown in the message at the end of a game */
+#define GAME_OVER_TEXT "RETURN"
+
+/** Moves in any direction */
+#define PATTERN_RANDOM 0
+/** Mostly down and left, now and then right, like a corner strategy */
+#define PATTERN_CORNER 1
+/** Up, right, down, left, over and over */
+#define PATTERN_SPIN 2
+
+/** The player is connecting */
+#define PLAYER_CONNECTING 0
+/** Connected; waiting for the title screen */
+#define PLAYER_TITLE 1
+/** In a game */
+#define PLAYER_PLAYING 2
+/** The connection failed or was closed */
+#define PLAYER_GONE 3
+
+/** Reading text */
+#define SCAN_TEXT 0
+/** Read an escape */
+#define SCAN_ESC 1
+/** Reading a control sequence's parameters */
+#define SCAN_CSI 2
+
+/** The frame drew the clock */
+#define DREW_CLOCK 0x1
+/** The frame drew something besides the clock */
+#define DREW_SCREEN 0x2
+/** The frame drew before the cursor could be placed */
+#define DREW_UNPLACED 0x4
+
+/** Gets the player a timer is embedded in */
+#define PLAYER_OF_TIMER(t) ((player_t*) ((char*) (t) - offsetof(player_t, timer)))
+
+/** @brief Finds a fixed string in a stream of bytes.
+ *
+ * The pattern must not repeat its first byte, which holds for the
+ * patterns used here, so a mismatch only needs to look at that byte.
+ */
+typedef struct matcher_t {
+    /** The string to find */
+    const char *pattern;
+    /** How much of the pattern has matched so far */
+    int pos;
+} matcher_t;
+
+/** @brief Follows where the server's output lands on the screen.
+ *
+ * Knows the cursor motions and colors the server's encoder sends.
+ * Anything else loses the cursor until the next absolute move.
+ */
+typedef struct screen_cursor_t {
+    /** The cursor's row, or -1 if not known */
+    int row;
+    /** The cursor's column, or -1 if not known */
+    int col;
+    /** One of the SCAN_ constants */
+    int scan;
+    /** Set if the control sequence being read is a private one */
+    int private_mode;
+    /** The control sequence's first two parameters, 0 if left out */
+    int params[2];
+    /** The number of parameters read so far, less one */
+    int num_params;
+} screen_cursor_t;
+
+/** @brief One simulated player.
+ */
+typedef struct player_t {
+    /** The socket, or -1 */
+    int fd;
+    /** One of the PLAYER_ constants */
+    int state;
+    /** Fires when the player connects or sends the next key */
+    wheel_timer_t timer;
+    /** The player's random numbers */
+    uint64_t rng;
+    /** The number of moves made, used by PATTERN_SPIN */
+    unsigned long moves;
+    /** When the last move went out, in us, or 0 if it has been answered */
+    uint64_t sent_us;
+    /** Where the server's output lands */
+    screen_cursor_t cursor;
+    /** When the frame being read started, in us */
+    uint64_t frame_us;
+    /** What the frame being read drew, as DREW_ flags */
+    int frame_drew;
+    /** Finds the game over message */
+    matcher_t game_over;
+} player_t;
+
+/** @brief Settings from the command line.
+ */
+typedef struct options_t {
+    /** The server's address */
+    const char *host;
+    /** The server's port */
+    int port;
+    /** The number of players */
+    int players;
+    /** How long to run, in seconds */
+    double duration;
+    /** Mean time between a player's moves, in ms */
+    double think_ms;
+    /** One of the PATTERN_ constants */
+    int pattern;
+    /** Connections opened per second */
+    double rate;
+    /** The server's process id, to measure its CPU, or 0 */
+    int server_pid;
+    /** Where to write the latency samples, or NULL */
+    const char *samples_path;
+} options_t;
+
+/** @brief What the run measured.
+ */
+typedef struct stats_t {
+    /** Connections made */
+    unsigned long connected;
+    /** Connections that failed or were dropped */
+    unsigned long failed;
+    /** Moves sent */
+    unsigned long keys;
+    /** Frames received */
+    unsigned long frames;
+    /** Bytes received */
+    unsigned long long bytes;
+    /** Games that ended */
+    unsigned long games;
+    /** Moves that got no answer before the next one */
+    unsigned long unanswered;
+    /** Moves whose answer could not be told from a clock redraw */
+    unsigned long ambiguous;
+    /** Frame latencies, in us */
+    uint32_t *samples;
+    /** The number of samples */
+    size_t num_samples;
+    /** The room for samples */
+    size_t samples_cap;
+} stats_t;
+
+/* Settings for the run. */
+static options_t options;
+
+/* The server's address. */
+static struct sockaddr_in server_addr;
+
+/* The epoll instance the players' sockets are registered with. */
+static int epoll_fd = -1;
+
+/* Players waiting to connect or to move, keyed by time in ms. */
+static timer_wheel_t wheel;
+
+/* What has been measured so far. */
+static stats_t stats;
+
+/* Set by a signal to end the run early. */
+static volatile sig_atomic_t stopping = 0;
+
+/***** Function prototypes ******/
+
+/** @brief Print how to use the program.
+ *
+ * @param name The name of the program.
+ * @return None.
+ */
+static void usage(const char *name);
+
+/** @brief Read the command line.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @return 0 on success, -1 on a bad command line.
+ */
+static int parse_options(int argc, char **argv);
+
+/** @brief Read the monotonic clock.
+ *
+ * @return Microseconds since some fixed, unspecified point.
+ */
+static uint64_t monotonic_us(void);
+
+/** @brief End the run early.
+ *
+ * @param sig The signal.
+ * @return None.
+ */
+static void handle_signal(int sig);
+
+/** @brief Draw a random number.
+ *
+ * @param state The generator's state.
+ * @return 64 random bits.
+ */
+static uint64_t next_random(uint64_t *state);
+
+/** @brief Draw a think time.
+ *
+ * @param player The player.
+ * @return The time until the player's next move, in ms.
+ */
+static uint64_t think_time(player_t *player);
+
+/** @brief Feed a byte to a matcher.
+ *
+ * @param matcher The matcher.
+ * @param byte The byte.
+ * @return 1 if the byte completes the pattern, 0 otherwise.
+ */
+static int match_byte(matcher_t *matcher, unsigned char byte);
+
+/** @brief Note that a player's screen changed at the cursor.
+ *
+ * @param player The player.
+ * @return None.
+ */
+static void draw_cell(player_t *player);
+
+/** @brief Act on a control sequence the server sent a player.
+ *
+ * @param player The player.
+ * @param final The sequence's final byte.
+ * @param now_us The current time, in us.
+ * @return None.
+ */
+static void run_sequence(player_t *player, unsigned char final, uint64_t now_us);
+
+/** @brief Follow a byte the server sent a player across the screen.
+ *
+ * @param player The player.
+ * @param byte The byte.
+ * @param now_us The current time, in us.
+ * @return None.
+ */
+static void scan_byte(player_t *player, unsigned char byte, uint64_t now_us);
+
+/** @brief Take a frame's latency if it answers the player's last move.
+ *
+ * Only a frame that started after the move went out and drew more
+ * than the clock counts.
+ *
+ * @param player The player.
+ * @return None.
+ */
+static void end_frame(player_t *player);
+
+/** @brief Start connecting a player.
+ *
+ * @param player The player.
+ * @return None.
+ */
+static void connect_player(player_t *player);
+
+/** @brief Drop a player's connection.
+ *
+ * @param player The player.
+ * @return None.
+ */
+static void drop_player(player_t *player);
+
+/** @brief Send bytes to the server for a player.
+ *
+ * A player sends a few bytes at a time, so a short write means the
+ * server is not reading, and the player is dropped.
+ *
+ * @param player The player.
+ * @param s The bytes.
+ * @return 0 on success, -1 if the player was dropped.
+ */
+static int send_keys(player_t *player, const char *s);
+
+/** @brief Send a player's next move, and schedule the one after.
+ *
+ * @param player The player.
+ * @param now_us The current time, in us.
+ * @return None.
+ */
+static void make_move(player_t *player, uint64_t now_us);
+
+/** @brief Read what the server sent a player, and account for it.
+ *
+ * @param player The player.
+ * @param now_us The current time, in us.
+ * @return None.
+ */
+static void read_player(player_t *player, uint64_t now_us);
+
+/** @brief Keep a latency sample.
+ *
+ * @param us The latency, in us.
+ * @return None.
+ */
+static void add_sample(uint64_t us);
+
+/** @brief Read a process's CPU time so far.
+ *
+ * @param pid The process.
+ * @return Seconds of user and system time, or -1 if it cannot be read.
+ */
+static double process_cpu(int pid);
+
+/** @brief Compare two samples, for qsort.
+ *
+ * @param a A sample.
+ * @param b Another sample.
+ * @return Less than, equal to or greater than 0, as a is less than,
+ *         equal to or greater than b.
+ */
+static int compare_samples(const void *a, const void *b);
+
+/** @brief Find a percentile of the sorted samples.
+ *
+ * @param p The percentile, from 0 to 100.
+ * @return The sample, in ms.
+ */
+static double percentile(double p);
+
+/** @brief Print the report.
+ *
+ * @param seconds How long the run took.
+ * @param server_cpu The server's CPU time during the run, or -1.
+ * @param own_cpu This program's CPU time during the run.
+ * @return None.
+ */
+static void report(double seconds, double server_cpu, double own_cpu);
+
+/***** Function definitions ******/
+
+void usage(const char *name) {
+    fprintf(stderr,
+        "usage: %s [-H host] [-p port] [-n players] [-d seconds] [-t think_ms]\n"
+        "       [-k random|corner|spin] [-r rate] [-P server_pid] [-o samples_file]\n"
+        "  -H  server address (default 127.0.0.1)\n"
+        "  -p  server port (default %d)\n"
+        "  -n  players (default 1000)\n"
+        "  -d  length of the run, in seconds (default 30)\n"
+        "  -t  mean think time between moves, in ms (default 250)\n"
+        "  -k  key pattern (default random)\n"
+        "  -r  connections opened per second (default 1000)\n"
+        "  -P  the server's pid, to report its CPU per player\n"
+        "  -o  write each latency sample, in us, to a file\n",
+        name, DEFAULT_PORT);
+}
+
+int parse_options(int argc, char **argv) {
+    int opt;
+
+    options.host = "127.0.0.1";
+    options.port = DEFAULT_PORT;
+    options.players = 1000;
+    options.duration = 30;
+    options.think_ms = 250;
+    options.pattern = PATTERN_RANDOM;
+    options.rate = 1000;
+    options.server_pid = 0;
+    options.samples_path = NULL;
+
+    while((opt = getopt(argc, argv, "H:p:n:d:t:k:r:P:o:")) != -1) {
+        switch(opt) {
+            case 'H':
+                options.host = optarg;
+                break;
+            case 'p':
+                options.port = atoi(optarg);
+                if(options.port < 1 || options.port > 65535) {
+                    return -1;
+                }
+                break;
+            case 'n':
+                options.players = atoi(optarg);
+                if(options.players < 1) {
+                    return -1;
+                }
+                break;
+            case 'd':
+                options.duration = atof(optarg);
+                if(options.duration <= 0) {
+                    return -1;
+                }
+                break;
+            case 't':
+                options.think_ms = atof(optarg);
+                if(options.think_ms < 0) {
+                    return -1;
+                }
+                break;
+            case 'k':
+                if(strcmp(optarg, "random") == 0) {
+                    options.pattern = PATTERN_RANDOM;
+                } else if(strcmp(optarg, "corner") == 0) {
+                    options.pattern = PATTERN_CORNER;
+                } else if(strcmp(optarg, "spin") == 0) {
+                    options.pattern = PATTERN_SPIN;
+                } else {
+                    return -1;
+                }
+                break;
+            case 'r':
+                options.rate = atof(optarg);
+                if(options.rate <= 0) {
+                    return -1;
+                }
+                break;
+            case 'P':
+                options.server_pid = atoi(optarg);
+                break;
+            case 'o':
+                options.samples_path = optarg;
+                break;
+            default:
+                return -1;
+        }
+    }
+    return optind == argc ? 0 : -1;
+}
+
+uint64_t monotonic_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void handle_signal(int sig) {
+    (void) sig;
+    stopping = 1;
+}
+
+uint64_t next_random(uint64_t *state) {
+    /* splitmix64 */
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+uint64_t think_time(player_t *player) {
+    /* Uniform in (0, 1], so the log is finite. */
+    double u = ((next_random(&player->rng) >> 11) + 1) / 9007199254740992.0;
+    return (uint64_t) (-log(u) * options.think_ms);
+}
+
+int match_byte(matcher_t *matcher, unsigned char byte) {
+    if((unsigned char) matcher->pattern[matcher->pos] == byte) {
+        matcher->pos++;
+        if(matcher->pattern[matcher->pos] == '\0') {
+            matcher->pos = 0;
+            return 1;
+        }
+        return 0;
+    }
+    matcher->pos = ((unsigned char) matcher->pattern[0] == byte) ? 1 : 0;
+    return 0;
+}
+
+void draw_cell(player_t *player) {
+    screen_cursor_t *cursor = &player->cursor;
+
+    if(cursor->row < 0) {
+        player->frame_drew |= DREW_UNPLACED;
+        return;
+    }
+    if(cursor->row == TIMER_ROW && cursor->col >= TIMER_COL
+            && cursor->col < TIMER_COL + TIMER_WIDTH) {
+        player->frame_drew |= DREW_CLOCK;
+    } else {
+        player->frame_drew |= DREW_SCREEN;
+    }
+
+    /* Terminals disagree about where the cursor is after the last column. */
+    if(++cursor->col >= CONSOLE_WIDTH) {
+        cursor->row = -1;
+        cursor->col = -1;
+    }
+}
+
+void run_sequence(player_t *player, unsigned char final, uint64_t now_us) {
+    screen_cursor_t *cursor = &player->cursor;
+    int count = cursor->params[0] ? cursor->params[0] : 1;
+
+    if(cursor->private_mode) {
+        if(cursor->params[0] == SYNC_MODE && final == 'h') {
+            player->frame_us = now_us;
+            player->frame_drew = 0;
+        } else if(cursor->params[0] == SYNC_MODE && final == 'l') {
+            stats.frames++;
+            end_frame(player);
+        }
+        return;
+    }
+    switch(final) {
+        case 'H':
+            cursor->row = (cursor->params[0] ? cursor->params[0] : 1) - 1;
+            cursor->col = (cursor->params[1] ? cursor->params[1] : 1) - 1;
+            return;
+        case 'm':
+            return;
+        case 'J':
+            player->frame_drew |= DREW_SCREEN;
+            return;
+    }
+    if(cursor->row < 0) {
+        return;
+    }
+    switch(final) {
+        case 'A':
+            cursor->row -= count;
+            break;
+        case 'B':
+            cursor->row += count;
+            break;
+        case 'C':
+            cursor->col += count;
+            break;
+        case 'D':
+            cursor->col -= count;
+            break;
+        default:
+            cursor->row = -1;
+            cursor->col = -1;
+            break;
+    }
+}
+
+void scan_byte(player_t *player, unsigned char byte, uint64_t now_us) {
+    screen_cursor_t *cursor = &player->cursor;
+
+    switch(cursor->scan) {
+        case SCAN_ESC:
+            cursor->scan = byte == '[' ? SCAN_CSI : SCAN_TEXT;
+            cursor->private_mode = 0;
+            cursor->params[0] = 0;
+            cursor->params[1] = 0;
+            cursor->num_params = 0;
+            return;
+        case SCAN_CSI:
+            if(byte == '?') {
+                cursor->private_mode = 1;
+            } else if(byte >= '0' && byte <= '9') {
+                if(cursor->num_params < 2) {
+                    cursor->params[cursor->num_params] =
+                        cursor->params[cursor->num_params] * 10 + (byte - '0');
+                }
+            } else if(byte == ';') {
+                cursor->num_params++;
+            } else if(byte >= 0x40 && byte <= 0x7e) {
+                cursor->scan = SCAN_TEXT;
+                run_sequence(player, byte, now_us);
+            }
+            return;
+    }
+    if(byte == '\033') {
+        cursor->scan = SCAN_ESC;
+    } else if(byte == '\r') {
+        cursor->col = cursor->row < 0 ? -1 : 0;
+    } else if(byte == '\n') {
+        if(cursor->row >= 0) {
+            cursor->row++;
+        }
+    } else if(byte >= ' ' && (byte & 0xc0) != 0x80) {
+        /* One cell per character; UTF-8 continuation bytes are skipped. */
+        draw_cell(player);
+    }
+}
+
+void end_frame(player_t *player) {
+    if(player->sent_us == 0 || player->frame_us < player->sent_us) {
+        return;
+    }
+    if(player->frame_drew & DREW_SCREEN) {
+        add_sample(player->frame_us - player->sent_us);
+        player->sent_us = 0;
+    } else if(player->frame_drew & DREW_UNPLACED) {
+        stats.ambiguous++;
+        player->sent_us = 0;
+    }
+}
+
+void connect_player(player_t *player) {
+    struct epoll_event ev;
+    int one = 1;
+
+    player->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(player->fd < 0) {
+        player->state = PLAYER_GONE;
+        stats.failed++;
+        return;
+    }
+    setsockopt(player->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if(connect(player->fd, (struct sockaddr*) &server_addr, sizeof(server_addr)) < 0
+            && errno != EINPROGRESS) {
+        drop_player(player);
+        return;
+    }
+    player->state = PLAYER_CONNECTING;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+    ev.data.ptr = player;
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, player->fd, &ev) < 0) {
+        drop_player(player);
+    }
+}
+
+void drop_player(player_t *player) {
+    if(player->fd >= 0) {
+        close(player->fd);
+        player->fd = -1;
+    }
+    timer_wheel_cancel(&wheel, &player->timer);
+    if(player->state != PLAYER_GONE) {
+        player->state = PLAYER_GONE;
+        stats.failed++;
+    }
+}
+
+int send_keys(player_t *player, const char *s) {
+    size_t len = strlen(s);
+    if(send(player->fd, s, len, MSG_NOSIGNAL) != (ssize_t) len) {
+        drop_player(player);
+        return -1;
+    }
+    return 0;
+}
+
+void make_move(player_t *player, uint64_t now_us) {
+    static const char *moves[4] = {
+        KEY_SEQ_UP, KEY_SEQ_RIGHT, KEY_SEQ_DOWN, KEY_SEQ_LEFT
+    };
+    const char *key;
+    unsigned roll;
+
+    switch(options.pattern) {
+        case PATTERN_CORNER:
+            roll = next_random(&player->rng) % 8;
+            key = roll < 4 ? KEY_SEQ_DOWN : roll < 7 ? KEY_SEQ_LEFT : KEY_SEQ_RIGHT;
+            break;
+        case PATTERN_SPIN:
+            key = moves[player->moves % 4];
+            break;
+        default:
+            key = moves[next_random(&player->rng) % 4];
+            break;
+    }
+
+    if(player->sent_us != 0) {
+        stats.unanswered++;
+    }
+    if(send_keys(player, key) < 0) {
+        return;
+    }
+    player->sent_us = now_us;
+    player->moves++;
+    stats.keys++;
+    timer_wheel_schedule(&wheel, &player->timer, now_us / 1000 + think_time(player));
+}
+
+void read_player(player_t *player, uint64_t now_us) {
+    unsigned char in[READ_CHUNK];
+    ssize_t got, ii;
+
+    while((got = read(player->fd, in, sizeof(in))) > 0) {
+        stats.bytes += got;
+        for(ii = 0; ii < got; ii++) {
+            scan_byte(player, in[ii], now_us);
+            if(match_byte(&player->game_over, in[ii]) && player->state == PLAYER_PLAYING) {
+                stats.games++;
+                send_keys(player, KEYS_NEXT_GAME);
+                if(player->state == PLAYER_GONE) {
+                    return;
+                }
+            }
+        }
+        if(player->state == PLAYER_TITLE) {
+            /* The title screen is up; start a game, and move after a think. */
+            if(send_keys(player, KEYS_NEW_GAME) < 0) {
+                return;
+            }
+            player->state = PLAYER_PLAYING;
+            timer_wheel_schedule(&wheel, &player->timer, now_us / 1000 + think_time(player));
+        }
+    }
+    if(got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        drop_player(player);
+    }
+}
+
+void add_sample(uint64_t us) {
+    size_t cap;
+    uint32_t *grown;
+
+    if(stats.num_samples == stats.samples_cap) {
+        cap = stats.samples_cap ? stats.samples_cap * 2 : 65536;
+        grown = realloc(stats.samples, cap * sizeof(*grown));
+        if(grown == NULL) {
+            return;
+        }
+        stats.samples = grown;
+        stats.samples_cap = cap;
+    }
+    stats.samples[stats.num_samples++] = us > UINT32_MAX ? UINT32_MAX : us;
+}
+
+double process_cpu(int pid) {
+    char path[64];
+    char line[1024];
+    char *fields;
+    unsigned long utime, stime;
+    FILE *in;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    in = fopen(path, "r");
+    if(in == NULL) {
+        return -1;
+    }
+    if(fgets(line, sizeof(line), in) == NULL) {
+        fclose(in);
+        return -1;
+    }
+    fclose(in);
+
+    /* The command name may hold spaces; the fields start after its ')'. */
+    fields = strrchr(line, ')');
+    if(fields == NULL || sscanf(fields + 2,
+            "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+            &utime, &stime) != 2) {
+        return -1;
+    }
+    return (double) (utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+int compare_samples(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+    return (x > y) - (x < y);
+}
+
+double percentile(double p) {
+    size_t index;
+    if(stats.num_samples == 0) {
+        return 0;
+    }
+    index = (size_t) (p / 100 * (stats.num_samples - 1) + 0.5);
+    return stats.samples[index] / 1000.0;
+}
+
+void report(double seconds, double server_cpu, double own_cpu) {
+    double player_seconds = stats.connected * seconds;
+
+    printf("players         %d (%lu connected, %lu failed or dropped)\n",
+        options.players, stats.connected, stats.failed);
+    printf("duration        %.1f s\n", seconds);
+    printf("moves sent      %lu (%.1f/s)\n", stats.keys, stats.keys / seconds);
+    printf("frames received %lu (%.1f/s)\n", stats.frames, stats.frames / seconds);
+    printf("bytes received  %llu (%.2f MB/s)\n",
+        stats.bytes, stats.bytes / seconds / 1e6);
+    printf("games finished  %lu\n", stats.games);
+    printf("frame latency   %zu samples, %lu moves unanswered, %lu ambiguous\n",
+        stats.num_samples, stats.unanswered, stats.ambiguous);
+    if(stats.num_samples > 0) {
+        printf("                p50 %.2f ms  p90 %.2f ms  p99 %.2f ms  "
+            "p99.9 %.2f ms  max %.2f ms\n",
+            percentile(50), percentile(90), percentile(99),
+            percentile(99.9), percentile(100));
+    }
+    if(server_cpu >= 0) {
+        printf("server cpu      %.2f s (%.1f%% of a core)\n",
+            server_cpu, 100 * server_cpu / seconds);
+        if(player_seconds > 0) {
+            printf("                %.3f ms per player-second\n",
+                1000 * server_cpu / player_seconds);
+        }
+        if(stats.keys > 0) {
+            printf("                %.1f us per move\n", 1e6 * server_cpu / stats.keys);
+        }
+    }
+    printf("loadgen cpu     %.2f s\n", own_cpu);
+}
+
+/** @brief Load generator entrypoint.
+ *
+ * @return 0 after a run, 1 on a setup error, 2 on a bad command line.
+ */
+int main(int argc, char **argv)
+{
+    struct epoll_event events[MAX_EVENTS];
+    struct rusage usage_start, usage_end;
+    struct rlimit files;
+    player_t *players;
+    player_t *player;
+    wheel_timer_t *due, *next;
+    FILE *out;
+    uint64_t start_us, end_us, now_us, wake;
+    double server_cpu_start = -1, server_cpu = -1, own_cpu;
+    size_t ii;
+    int count, jj, timeout;
+
+    if(parse_options(argc, argv) < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(options.port);
+    if(inet_pton(AF_INET, options.host, &server_addr.sin_addr) != 1) {
+        fprintf(stderr, "%s: not an IPv4 address\n", options.host);
+        return 2;
+    }
+
+    /* Every player needs a descriptor; ask for as many as allowed. */
+    if(getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+
+    players = calloc(options.players, sizeof(*players));
+    epoll_fd = epoll_create1(0);
+    if(players == NULL || epoll_fd < 0) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    /* Connections are spread out at the given rate. */
+    start_us = monotonic_us();
+    timer_wheel_init(&wheel, start_us / 1000);
+    for(jj = 0; jj < options.players; jj++) {
+        player = &players[jj];
+        player->fd = -1;
+        player->state = PLAYER_CONNECTING;
+        player->rng = start_us ^ ((uint64_t) jj << 32);
+        player->cursor.row = -1;
+        player->cursor.col = -1;
+        player->game_over.pattern = GAME_OVER_TEXT;
+        wheel_timer_init(&player->timer);
+        timer_wheel_schedule(&wheel, &player->timer,
+            start_us / 1000 + (uint64_t) (jj * 1000.0 / options.rate));
+    }
+    if(options.server_pid > 0) {
+        server_cpu_start = process_cpu(options.server_pid);
+    }
+    getrusage(RUSAGE_SELF, &usage_start);
+    end_us = start_us + (uint64_t) (options.duration * 1e6);
+
+    while(!stopping && (now_us = monotonic_us()) < end_us) {
+        wake = timer_wheel_next_due(&wheel);
+        timeout = (end_us - now_us + 999) / 1000;
+        if(wake != WHEEL_NEVER && wake * 1000 < end_us) {
+            timeout = (wake * 1000 > now_us) ? (wake * 1000 - now_us + 999) / 1000 : 0;
+        }
+        count = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+        if(count < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+
+        now_us = monotonic_us();
+        for(jj = 0; jj < count; jj++) {
+            player = events[jj].data.ptr;
+            if(player->state == PLAYER_GONE) {
+                continue;
+            }
+            if(player->state == PLAYER_CONNECTING) {
+                if(events[jj].events & (EPOLLERR | EPOLLHUP)) {
+                    drop_player(player);
+                    continue;
+                }
+                /* Connected; from now on only input is of interest. */
+                events[jj].events = EPOLLIN | EPOLLRDHUP;
+                epoll_ctl(epoll_fd, EPOLL_CTL_MOD, player->fd, &events[jj]);
+                player->state = PLAYER_TITLE;
+                stats.connected++;
+            }
+            read_player(player, now_us);
+        }
+
+        due = timer_wheel_advance(&wheel, now_us / 1000);
+        while(due != NULL) {
+            next = due->next;
+            player = PLAYER_OF_TIMER(due);
+            if(player->fd < 0 && player->state == PLAYER_CONNECTING) {
+                connect_player(player);
+            } else if(player->state == PLAYER_PLAYING) {
+                make_move(player, now_us);
+            }
+            due = next;
+        }
+    }
+
+    now_us = monotonic_us();
+    getrusage(RUSAGE_SELF, &usage_end);
+    if(server_cpu_start >= 0) {
+        server_cpu = process_cpu(options.server_pid) - server_cpu_start;
+    }
+    own_cpu = (usage_end.ru_utime.tv_sec - usage_start.ru_utime.tv_sec)
+        + (usage_end.ru_stime.tv_sec - usage_start.ru_stime.tv_sec)
+        + ((usage_end.ru_utime.tv_usec - usage_start.ru_utime.tv_usec)
+        + (usage_end.ru_stime.tv_usec - usage_start.ru_stime.tv_usec)) / 1e6;
+
+    if(options.samples_path != NULL) {
+        out = fopen(options.samples_path, "w");
+        if(out == NULL) {
+            perror(options.samples_path);
+        } else {
+            for(ii = 0; ii < stats.num_samples; ii++) {
+                fprintf(out, "%u\n", stats.samples[ii]);
+            }
+            fclose(out);
+        }
+    }
+    qsort(stats.samples, stats.num_samples, sizeof(*stats.samples), compare_samples);
+    report((now_us - start_us) / 1e6, server_cpu, own_cpu);
+
+    for(jj = 0; jj < options.players; jj++) {
+        if(players[jj].fd >= 0) {
+            close(players[jj].fd);
+        }
+    }
+    free(players);
+    free(stats.samples);
+    return 0;
+}
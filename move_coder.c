@@ -0,0 +1,335 @@
+/** @file move_coder.c
+ *  @brief Implementation of the move coder.
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "engine.h"
+#include "move_coder.h"
+
+/** Bits in a probability */
+#define PROB_BITS 11
+/** A probability of 1 */
+#define PROB_ONE (1 << PROB_BITS)
+/** How fast probabilities adapt; each decision moves them 1/32 closer */
+#define ADAPT_SHIFT 5
+/** The range is topped up a byte at a time once it falls below this */
+#define RANGE_TOP (1u << 24)
+/** Mask of the moves in a context's history */
+#define HISTORY_MASK ((1 << (2 * MOVE_CODER_HISTORY)) - 1)
+
+/** @brief A game being played along with its moves.
+ */
+typedef struct play_t {
+    /** The board */
+    int grid[GRID_SIZE][GRID_SIZE];
+    /** The tile generator */
+    engine_rng_t rng;
+    /** The tile that wins the game */
+    int winning_tile;
+    /** The last moves, the latest in the low bits */
+    int history;
+} play_t;
+
+/***** Function prototypes ******/
+
+/** @brief Set up the opening board of a game.
+ *
+ * @param play The game.
+ * @param seed The seed of the game's tile generator.
+ * @param winning_tile The tile that wins the game.
+ * @return None.
+ */
+static void play_start(play_t *play, uint64_t seed, uint32_t winning_tile);
+
+/** @brief Find the context of the next move of a game.
+ *
+ * @param play The game.
+ * @return The context, below MOVE_CODER_CONTEXTS.
+ */
+static int play_context(play_t *play);
+
+/** @brief Play a move, and place a new tile as the game would.
+ *
+ * @param play The game.
+ * @param dir One of the DIR_ constants.
+ * @return None.
+ */
+static void play_move(play_t *play, int dir);
+
+/** @brief Find the moves that would change a board.
+ *
+ * @param grid The board.
+ * @return A mask with bit DIR_ set for each such move.
+ */
+static int legal_moves(int grid[GRID_SIZE][GRID_SIZE]);
+
+/** @brief Set every probability of a model to one half.
+ *
+ * @param model The model.
+ * @return None.
+ */
+static void model_reset(move_model_t *model);
+
+/** @brief Add a byte to the stream.
+ *
+ * @param enc The encoder.
+ * @param byte The byte.
+ * @return None.
+ */
+static void put_byte(move_encoder_t *enc, uint8_t byte);
+
+/** @brief Move the top byte of the range coder's low end to the stream.
+ *
+ * The byte is held back while a carry could still change it.
+ *
+ * @param enc The encoder.
+ * @return None.
+ */
+static void shift_low(move_encoder_t *enc);
+
+/** @brief Code a decision, and adapt its probability.
+ *
+ * @param enc The encoder.
+ * @param prob The chance of a 0.
+ * @param bit The decision.
+ * @return None.
+ */
+static void encode_bit(move_encoder_t *enc, uint16_t *prob, int bit);
+
+/** @brief Read the next byte of a stream.
+ *
+ * @param dec The decoder.
+ * @return The byte, or 0 past the end of the stream.
+ */
+static uint8_t get_byte(move_decoder_t *dec);
+
+/** @brief Read a decision, and adapt its probability.
+ *
+ * @param dec The decoder.
+ * @param prob The chance of a 0.
+ * @return The decision.
+ */
+static int decode_bit(move_decoder_t *dec, uint16_t *prob);
+
+/***** Function definitions ******/
+
+void play_start(play_t *play, uint64_t seed, uint32_t winning_tile) {
+    engine_rng_seed(&play->rng, seed);
+    engine_new_game(play->grid, &play->rng);
+    play->winning_tile = winning_tile;
+    play->history = 0;
+}
+
+int play_context(play_t *play) {
+    return (legal_moves(play->grid) << (2 * MOVE_CODER_HISTORY)) | play->history;
+}
+
+void play_move(play_t *play, int dir) {
+    /* As replay_cursor_step plays it, but a move may leave the board be. */
+    if(engine_move(play->grid, dir, NULL)
+            && !engine_is_won(play->grid, play->winning_tile)) {
+        engine_spawn(play->grid, &play->rng, NULL, NULL);
+    }
+    play->history = ((play->history << 2) | dir) & HISTORY_MASK;
+}
+
+int legal_moves(int grid[GRID_SIZE][GRID_SIZE]) {
+    int ii, jj;
+    int a, b;
+    int mask = 0;
+
+    /*
+     * A move changes the board if some tile has a gap or its twin next
+     * to it on the side the tiles move toward.  The tests are folded
+     * into the mask without branching, as they are hard to predict.
+     */
+    for(ii = 0; ii < GRID_SIZE; ii++) {
+        for(jj = 0; jj + 1 < GRID_SIZE; jj++) {
+            a = grid[ii][jj];
+            b = grid[ii][jj + 1];
+            mask |= ((b != 0) & ((a == 0) | (a == b))) << DIR_LEFT;
+            mask |= ((a != 0) & ((b == 0) | (a == b))) << DIR_RIGHT;
+            a = grid[jj][ii];
+            b = grid[jj + 1][ii];
+            mask |= ((b != 0) & ((a == 0) | (a == b))) << DIR_UP;
+            mask |= ((a != 0) & ((b == 0) | (a == b))) << DIR_DOWN;
+        }
+    }
+    return mask;
+}
+
+void model_reset(move_model_t *model) {
+    int ii, jj;
+
+    for(ii = 0; ii < MOVE_CODER_CONTEXTS; ii++) {
+        for(jj = 0; jj < 3; jj++) {
+            model->prob[ii][jj] = PROB_ONE / 2;
+        }
+    }
+}
+
+void put_byte(move_encoder_t *enc, uint8_t byte) {
+    size_t cap;
+    uint8_t *grown;
+
+    if(enc->len == enc->cap) {
+        cap = enc->cap ? enc->cap * 2 : 4096;
+        grown = realloc(enc->data, cap);
+        if(grown == NULL) {
+            enc->failed = 1;
+            return;
+        }
+        enc->data = grown;
+        enc->cap = cap;
+    }
+    enc->data[enc->len++] = byte;
+}
+
+void shift_low(move_encoder_t *enc) {
+    uint8_t carry, held;
+
+    if((uint32_t) enc->low < 0xFF000000u || (enc->low >> 32) != 0) {
+        /* The held bytes are final: a carry, if any, is here now. */
+        carry = enc->low >> 32;
+        held = enc->cache;
+        do {
+            put_byte(enc, held + carry);
+            held = 0xFF;
+        } while(--enc->cache_size != 0);
+        enc->cache = (enc->low >> 24) & 0xFF;
+    }
+    enc->cache_size++;
+    enc->low = (enc->low & 0x00FFFFFF) << 8;
+}
+
+void encode_bit(move_encoder_t *enc, uint16_t *prob, int bit) {
+    uint32_t bound = (enc->range >> PROB_BITS) * *prob;
+
+    if(bit == 0) {
+        enc->range = bound;
+        *prob += (PROB_ONE - *prob) >> ADAPT_SHIFT;
+    } else {
+        enc->low += bound;
+        enc->range -= bound;
+        *prob -= *prob >> ADAPT_SHIFT;
+    }
+    while(enc->range < RANGE_TOP) {
+        enc->range <<= 8;
+        shift_low(enc);
+    }
+}
+
+uint8_t get_byte(move_decoder_t *dec) {
+    if(dec->pos >= dec->len) {
+        dec->pos++;
+        return 0;
+    }
+    return dec->in[dec->pos++];
+}
+
+int decode_bit(move_decoder_t *dec, uint16_t *prob) {
+    uint32_t bound = (dec->range >> PROB_BITS) * *prob;
+    int bit;
+
+    if(dec->code < bound) {
+        dec->range = bound;
+        *prob += (PROB_ONE - *prob) >> ADAPT_SHIFT;
+        bit = 0;
+    } else {
+        dec->code -= bound;
+        dec->range -= bound;
+        *prob -= *prob >> ADAPT_SHIFT;
+        bit = 1;
+    }
+    while(dec->range < RANGE_TOP) {
+        dec->range <<= 8;
+        dec->code = (dec->code << 8) | get_byte(dec);
+    }
+    return bit;
+}
+
+void move_encoder_start(move_encoder_t *enc) {
+    model_reset(&enc->model);
+    enc->low = 0;
+    enc->range = 0xFFFFFFFFu;
+    enc->cache = 0;
+    enc->cache_size = 1;
+    enc->len = 0;
+    enc->failed = 0;
+}
+
+int move_encoder_add(
+        move_encoder_t *enc,
+        uint64_t seed,
+        uint32_t winning_tile,
+        const uint8_t *moves,
+        uint32_t num_moves) {
+    play_t play;
+    uint16_t *prob;
+    uint32_t ii;
+    int dir;
+
+    play_start(&play, seed, winning_tile);
+    for(ii = 0; ii < num_moves; ii++) {
+        dir = (moves[ii / 4] >> (2 * (ii % 4))) & 0x3;
+        prob = enc->model.prob[play_context(&play)];
+        encode_bit(enc, &prob[0], dir >> 1);
+        encode_bit(enc, &prob[1 + (dir >> 1)], dir & 1);
+        play_move(&play, dir);
+    }
+    return enc->failed ? -1 : 0;
+}
+
+int move_encoder_finish(move_encoder_t *enc) {
+    int ii;
+
+    for(ii = 0; ii < 5; ii++) {
+        shift_low(enc);
+    }
+    return enc->failed ? -1 : 0;
+}
+
+void move_encoder_free(move_encoder_t *enc) {
+    free(enc->data);
+    memset(enc, 0, sizeof(*enc));
+}
+
+void move_decoder_start(move_decoder_t *dec, const uint8_t *in, size_t len) {
+    int ii;
+
+    model_reset(&dec->model);
+    dec->in = in;
+    dec->len = len;
+    dec->pos = 0;
+    dec->range = 0xFFFFFFFFu;
+    dec->code = 0;
+    for(ii = 0; ii < 5; ii++) {
+        dec->code = (dec->code << 8) | get_byte(dec);
+    }
+}
+
+int move_decoder_next(
+        move_decoder_t *dec,
+        uint64_t seed,
+        uint32_t winning_tile,
+        uint8_t *moves,
+        uint32_t num_moves) {
+    play_t play;
+    uint16_t *prob;
+    uint32_t ii;
+    int dir;
+
+    play_start(&play, seed, winning_tile);
+    memset(moves, 0, (num_moves + 3) / 4);
+    for(ii = 0; ii < num_moves; ii++) {
+        prob = dec->model.prob[play_context(&play)];
+        dir = decode_bit(dec, &prob[0]) << 1;
+        dir |= decode_bit(dec, &prob[1 + (dir >> 1)]);
+        moves[ii / 4] |= dir << (2 * (ii % 4));
+        play_move(&play, dir);
+    }
+    return dec->pos > dec->len ? -1 : 0;
+}
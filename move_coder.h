@@ -0,0 +1,149 @@
+/** @file move_coder.h
+ *  @brief Compressing the moves of many games with an arithmetic coder.
+ *
+ *  Players do not move at random: a player keeping the big tiles in a
+ *  corner mostly alternates two moves, and only a move that changes
+ *  the board can be played at all.  The coder plays each game along with
+ *  the engine, and predicts each move from which moves are legal on the
+ *  board and the last MOVE_CODER_HISTORY moves.  A move is coded as two
+ *  binary decisions, each with an adaptive probability for its context,
+ *  and the decisions are range coded as in LZMA.
+ *
+ *  The probabilities carry over from one game to the next, so a stream
+ *  should hold many games; a move the model has never seen still costs
+ *  only a few bits.  A move that does not change the board can be coded
+ *  too; no tile is placed after it.
+ *
+ *  Moves go in and come out packed four to a byte, first move in the
+ *  low bits, as replay archives and segments store them.
+ *
+ *  @bug None known.
+ */
+
+#ifndef _MOVE_CODER_H_
+#define _MOVE_CODER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Number of earlier moves in a move's context */
+#define MOVE_CODER_HISTORY 2
+/** Number of contexts: every set of legal moves, and every history */
+#define MOVE_CODER_CONTEXTS (16 << (2 * MOVE_CODER_HISTORY))
+
+/** @brief The adaptive probabilities of a stream.
+ */
+typedef struct move_model_t {
+    /** For each context, the chance of a 0 for the first decision and
+     *  for the second after each first, out of 2048 */
+    uint16_t prob[MOVE_CODER_CONTEXTS][3];
+} move_model_t;
+
+/** @brief Codes the moves of games into a stream.
+ *
+ * Zero the encoder before it is first started.
+ */
+typedef struct move_encoder_t {
+    /** The model */
+    move_model_t model;
+    /** The range coder's state */
+    uint64_t low;
+    uint32_t range;
+    uint8_t cache;
+    uint64_t cache_size;
+    /** The stream */
+    uint8_t *data;
+    /** The number of bytes in the stream */
+    size_t len;
+    /** The number of bytes there is room for */
+    size_t cap;
+    /** Set once the stream could not grow */
+    int failed;
+} move_encoder_t;
+
+/** @brief Reads back the moves of games from a stream.
+ */
+typedef struct move_decoder_t {
+    /** The model */
+    move_model_t model;
+    /** The range coder's state */
+    uint32_t range;
+    uint32_t code;
+    /** The stream */
+    const uint8_t *in;
+    /** The number of bytes in the stream */
+    size_t len;
+    /** The next byte to read */
+    size_t pos;
+} move_decoder_t;
+
+/** @brief Start a new stream.
+ *
+ * The memory of the last stream is kept.
+ *
+ * @param enc The encoder.
+ * @return None.
+ */
+void move_encoder_start(move_encoder_t *enc);
+
+/** @brief Code the moves of a game.
+ *
+ * @param enc The encoder.
+ * @param seed The seed of the game's tile generator.
+ * @param winning_tile The tile that wins the game.
+ * @param moves The moves, packed.
+ * @param num_moves The number of moves.
+ * @return 0 on success, -1 if out of memory.
+ */
+int move_encoder_add(
+        move_encoder_t *enc,
+        uint64_t seed,
+        uint32_t winning_tile,
+        const uint8_t *moves,
+        uint32_t num_moves);
+
+/** @brief Finish a stream.
+ *
+ * The stream is then in enc->data, enc->len bytes long.
+ *
+ * @param enc The encoder.
+ * @return 0 on success, -1 if out of memory.
+ */
+int move_encoder_finish(move_encoder_t *enc);
+
+/** @brief Free the memory of an encoder.
+ *
+ * @param enc The encoder.
+ * @return None.
+ */
+void move_encoder_free(move_encoder_t *enc);
+
+/** @brief Start reading a stream.
+ *
+ * @param dec The decoder.
+ * @param in The stream, which must outlive the decoder.
+ * @param len The number of bytes in the stream.
+ * @return None.
+ */
+void move_decoder_start(move_decoder_t *dec, const uint8_t *in, size_t len);
+
+/** @brief Read the moves of the next game.
+ *
+ * The game must be the one that was coded next, with the same seed,
+ * winning tile and number of moves.
+ *
+ * @param dec The decoder.
+ * @param seed The seed of the game's tile generator.
+ * @param winning_tile The tile that wins the game.
+ * @param moves Set to the moves, packed, in (num_moves + 3) / 4 bytes.
+ * @param num_moves The number of moves.
+ * @return 0 on success, -1 if the stream ends first.
+ */
+int move_decoder_next(
+        move_decoder_t *dec,
+        uint64_t seed,
+        uint32_t winning_tile,
+        uint8_t *moves,
+        uint32_t num_moves);
+
+#endif
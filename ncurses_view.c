@@ -1,15 +1,54 @@
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <ncurses.h>
+#include "key_decoder.h"
 #include "ncurses_view.h"
 
+/* 
+ * A copy of the last frame presented to the screen, so that only cells
+ * that changed since then are handed to ncurses. 
+ */
+static cell_t front_buffer[CONSOLE_CELLS] CONSOLE_ALIGNED;
+
+/*
+ * Keys are read from the terminal and decoded here rather than by getch,
+ * so every key waiting is taken in one read and arrow keys need no
+ * escape delay.
+ */
+static key_reader_t reader;
+
+/* Forget the last frame, so the next copy redraws every cell. */
+static void invalidate_front_buffer(void) {
+    /* No cell is ever 0xFFFF, so every cell will compare as changed. */
+    memset(front_buffer, 0xFF, sizeof(front_buffer));
+}
+
+/* Map a glyph to the character ncurses draws for it. */
+static chtype glyph_to_chtype(uint8_t glyph) {
+    switch(glyph) {
+        case GLYPH_HLINE: return ACS_HLINE;
+        case GLYPH_VLINE: return ACS_VLINE;
+        case GLYPH_ULCORNER: return ACS_ULCORNER;
+        case GLYPH_URCORNER: return ACS_URCORNER;
+        case GLYPH_LLCORNER: return ACS_LLCORNER;
+        case GLYPH_LRCORNER: return ACS_LRCORNER;
+        case GLYPH_LTEE: return ACS_LTEE;
+        case GLYPH_RTEE: return ACS_RTEE;
+        case GLYPH_TTEE: return ACS_TTEE;
+        case GLYPH_BTEE: return ACS_BTEE;
+        case GLYPH_PLUS: return ACS_PLUS;
+        default: return (chtype) console_glyph_ascii(glyph);
+    }
+}
+
 void init_ncurses_view() {
+    invalidate_front_buffer();
     initscr();
     hide_cursor();
     noecho();
-    nodelay(stdscr, TRUE);
-    keypad(stdscr, TRUE);
     cbreak();
+    key_reader_init(&reader, STDIN_FILENO);
     start_color();
     init_color(COLOR_CYAN, 0, 0, 0);
     init_pair(1, COLOR_BLACK, COLOR_YELLOW);
@@ -34,29 +73,90 @@ void show_cursor() {
 
 void clear_console() {
     clear();
+    invalidate_front_buffer();
 }
 
 void copy_console(console_t* other) {
+    if(other == NULL) {
+        return;
+    }
+    copy_console_region(other, 0, 0, other->height, other->width);
+}
+
+void copy_console_region(console_t* other, int row, int col, int height, int width) {
+    stage_console_region(other, row, col, height, width);
+    present_view();
+}
+
+void present_view(void) {
+    refresh();
+}
+
+void stage_console_region(console_t* other, int row, int col, int height, int width) {
     int rr, cc;
-    char ch, color;
+    size_t start, end;
+    size_t line;
+    uint8_t ch, color;
     if(other == NULL) {
         return;
     }
-    for(int rr = 0; rr < other->height; rr++) {
-        for(int cc = 0; cc < other->width; cc++) {
-	    console_get(other, rr, cc, &ch, &color);   
-	    if(color > 0) {
-		attron(COLOR_PAIR(color));
-	    }
-            mvaddch(rr, cc, ch);  
-	    if(color > 0) {
-		attroff(COLOR_PAIR(color));
-	    }
+    if(other->width > CONSOLE_WIDTH || other->height > CONSOLE_HEIGHT) {
+        return;
+    }
+    /* Clip the region to the console. */
+    if(row < 0) {
+        height += row;
+        row = 0;
+    }
+    if(col < 0) {
+        width += col;
+        col = 0;
+    }
+    if(row + height > other->height) {
+        height = other->height - row;
+    }
+    if(col + width > other->width) {
+        width = other->width - col;
+    }
+    for(rr = row; rr < row + height; rr++) {
+        /* Hand ncurses only the runs of cells that changed. */
+        line = rr * other->width;
+        start = console_next_changed(
+                other->base_addr, front_buffer, line + col, line + col + width);
+        while(start < line + col + width) {
+            end = console_next_unchanged(
+                    other->base_addr, front_buffer, start, line + col + width);
+            for(cc = start - line; cc < end - line; cc++) {
+	        console_get(other, rr, cc, &ch, &color);   
+	        if(color > 0) {
+		    attron(COLOR_PAIR(color));
+	        }
+                mvaddch(rr, cc, glyph_to_chtype(ch));  
+	        if(color > 0) {
+		    attroff(COLOR_PAIR(color));
+	        }
+            }
+            memcpy(front_buffer + start, 
+                    (cell_t*)other->base_addr + start, 
+                    sizeof(cell_t) * (end - start));
+            start = console_next_changed(
+                    other->base_addr, front_buffer, end, line + col + width);
         }
     }
-    refresh();
 }
 
 int key_input(void) {
-    return getch();
+    return key_reader_next(&reader, 0);
+}
+
+int wait_key_input(void) {
+    int ch;
+    /* Block in poll, so an idle screen costs no CPU while we wait. */
+    while((ch = key_reader_next(&reader, -1)) == KEY_DECODER_NONE) {
+    }
+    return ch;
+}
+
+int key_input_timeout(int timeout_ms) {
+    return key_reader_next(&reader, timeout_ms);
 }
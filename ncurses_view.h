@@ -3,8 +3,17 @@
 
 #include "console_model.h"
 
+/** Returned by the key functions once the terminal's input is closed */
+#define KEY_INPUT_CLOSED (-2)
+
 void copy_console(console_t* other);
 
+void copy_console_region(console_t* other, int row, int col, int height, int width);
+
+void stage_console_region(console_t* other, int row, int col, int height, int width);
+
+void present_view(void);
+
 void init_ncurses_view(void);
 
 void close_view(void);
@@ -17,4 +26,8 @@ void clear_console(void);
 
 int key_input(void);
 
+int wait_key_input(void);
+
+int key_input_timeout(int timeout_ms);
+
 #endif
@@ -0,0 +1,639 @@
+/** @file query.c
+ *  @brief Answers questions about the games in segments.
+ *
+ *  Scans segments (see segment.h) for the games that pass some filters,
+ *  and prints how many there are and how their scores and lengths ran,
+ *  over all of them or grouped by difficulty, largest tile or result.
+ *
+ *  Nothing is replayed.  Only the columns the filters and the grouping
+ *  need are decoded, never the moves, and a block is skipped whole when
+ *  the index shows that none of its games can pass.  The segments are
+ *  mapped, and their blocks are handed out to the threads a few at a
+ *  time, so one big segment is scanned as fast as many small ones.
+ *
+ *  Usage: query [-j threads] [-s seeds] [-d tiles] [-S scores] [-t tiles]
+ *               [-n moves] [-r results] [-g group] segment...
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "replay.h"
+#include "segment.h"
+
+/** Most threads */
+#define MAX_THREADS 64
+/** Blocks a thread takes at a time */
+#define BLOCKS_PER_TAKE 16
+/** Most groups: every log2 of a tile, or every result */
+#define MAX_GROUPS 32
+
+/** Put all games in one group */
+#define GROUP_NONE 0
+/** Group games by their winning tile */
+#define GROUP_DIFFICULTY 1
+/** Group games by their largest tile */
+#define GROUP_MAX_TILE 2
+/** Group games by how they ended */
+#define GROUP_RESULT 3
+
+/** @brief A range of values to keep, both ends included.
+ */
+typedef struct range_t {
+    /** The least value kept */
+    uint64_t lo;
+    /** The greatest value kept */
+    uint64_t hi;
+    /** Set if the range was given, so the column must be read */
+    int set;
+} range_t;
+
+/** @brief What to look for, from the command line.
+ */
+typedef struct query_t {
+    /** Number of threads */
+    int threads;
+    /** The filters */
+    range_t seed;
+    range_t difficulty;
+    range_t score;
+    range_t max_tile;
+    range_t moves;
+    /** Bit n is set to keep games with result n */
+    int results;
+    /** How to group the games, a GROUP_ constant */
+    int group;
+    /** The columns to read, a mask of SEGMENT_READ() bits */
+    int columns;
+} query_t;
+
+/** @brief What is known about the games of one group.
+ */
+typedef struct stats_t {
+    /** The number of games */
+    uint64_t games;
+    /** The sum, least and greatest of their final scores */
+    uint64_t score_sum;
+    uint32_t score_min;
+    uint32_t score_max;
+    /** The sum, least and greatest of their numbers of moves */
+    uint64_t moves_sum;
+    uint32_t moves_min;
+    uint32_t moves_max;
+} stats_t;
+
+/** @brief What every thread shares.
+ */
+typedef struct scan_t {
+    /** The query */
+    const query_t *query;
+    /** The segments */
+    segment_t *segments;
+    /** Their paths */
+    char **paths;
+    /** The number of segments */
+    int num_segments;
+    /** Hands the blocks out to the threads */
+    segment_queue_t blocks;
+} scan_t;
+
+/** @brief A scanning thread.
+ */
+typedef struct scanner_t {
+    /** The thread */
+    pthread_t thread;
+    /** What the threads share */
+    scan_t *shared;
+    /** The block being scanned */
+    segment_block_t *block;
+    /** What the thread found, by group */
+    stats_t groups[MAX_GROUPS];
+    /** The number of games looked at */
+    uint64_t scanned;
+    /** The number of blocks read, and skipped by the index */
+    unsigned long blocks_read;
+    unsigned long blocks_skipped;
+} scanner_t;
+
+/***** Function prototypes ******/
+
+/** @brief Print how to run the program.
+ *
+ * @param name The program's name.
+ * @return None.
+ */
+static void usage(const char *name);
+
+/** @brief Read a range from the command line.
+ *
+ * The range is lo:hi, where either end may be left out, or a single
+ * value.
+ *
+ * @param arg The argument.
+ * @param range Set to the range.
+ * @return 0 on success, -1 if the argument is not a range.
+ */
+static int parse_range(const char *arg, range_t *range);
+
+/** @brief Read a list of results from the command line.
+ *
+ * @param arg Results separated by commas: won, lost or quit.
+ * @return A mask with bit REPLAY_RESULT_ set for each, or -1 if one is
+ *         not a result.
+ */
+static int parse_results(const char *arg);
+
+/** @brief Read the command line.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param query Set to the query.
+ * @return The index of the first segment, or -1 on a usage error.
+ */
+static int parse_options(int argc, char **argv, query_t *query);
+
+/** @brief Check whether a range of values overlaps a filter.
+ *
+ * @param filter The filter.
+ * @param lo The least value.
+ * @param hi The greatest value.
+ * @return 1 if some value could pass, 0 if none can.
+ */
+static int overlaps(const range_t *filter, uint64_t lo, uint64_t hi);
+
+/** @brief Check whether a value passes a filter.
+ *
+ * @param filter The filter.
+ * @param value The value.
+ * @return 1 if it does, 0 if not.
+ */
+static int passes(const range_t *filter, uint64_t value);
+
+/** @brief Find the tile a log2 stands for.
+ *
+ * @param log2 log2 of a tile, 0 for none.
+ * @return The tile, 0 for none.
+ */
+static uint64_t tile_of(int log2);
+
+/** @brief Check from the index whether a block could hold a game that
+ *         passes the filters.
+ *
+ * @param query The query.
+ * @param info The block's index entry.
+ * @return 1 if it could, 0 if it cannot.
+ */
+static int block_may_pass(const query_t *query, const segment_block_info_t *info);
+
+/** @brief Find a game's group.
+ *
+ * @param query The query.
+ * @param block The game's block.
+ * @param ii The game.
+ * @return The group, below MAX_GROUPS, or -1 if the game fits none.
+ */
+static int group_of(const query_t *query, const segment_block_t *block, uint32_t ii);
+
+/** @brief Add a game to a group.
+ *
+ * @param stats The group.
+ * @param score The game's final score.
+ * @param moves The game's number of moves.
+ * @return None.
+ */
+static void add_game(stats_t *stats, uint32_t score, uint32_t moves);
+
+/** @brief Add what is known about one group to another.
+ *
+ * @param to The group added to.
+ * @param from The group added.
+ * @return None.
+ */
+static void merge_stats(stats_t *to, const stats_t *from);
+
+/** @brief Scan one block.
+ *
+ * @param scanner The thread.
+ * @param segment The segment.
+ * @param index The block.
+ * @return 0 on success, -1 if the block is malformed.
+ */
+static int scan_block(scanner_t *scanner, const segment_t *segment, uint32_t index);
+
+/** @brief Scan blocks until none are left.
+ *
+ * @param arg The thread's scanner_t.
+ * @return NULL.
+ */
+static void *scanner_main(void *arg);
+
+/** @brief Print a group's line of the results.
+ *
+ * @param query The query.
+ * @param key The group.
+ * @param stats What is known about it.
+ * @return None.
+ */
+static void print_group(const query_t *query, int key, const stats_t *stats);
+
+/***** Function definitions ******/
+
+void usage(const char *name) {
+    fprintf(stderr,
+        "usage: %s [-j threads] [-s seeds] [-d tiles] [-S scores] [-t tiles]\n"
+        "          [-n moves] [-r results] [-g group] segment...\n"
+        "  -j  threads (default 4)\n"
+        "  -s  keep games whose seed is in the range\n"
+        "  -d  keep games whose winning tile is in the range\n"
+        "  -S  keep games whose final score is in the range\n"
+        "  -t  keep games whose largest tile is in the range\n"
+        "  -n  keep games whose number of moves is in the range\n"
+        "  -r  keep games with these results: won, lost, quit, separated by commas\n"
+        "  -g  group by difficulty, tile or result\n"
+        "A range is lo:hi, where either end may be left out, or a single value.\n",
+        name);
+}
+
+int parse_range(const char *arg, range_t *range) {
+    const char *colon = strchr(arg, ':');
+    char *end;
+
+    range->lo = 0;
+    range->hi = UINT64_MAX;
+    range->set = 1;
+    if(colon == NULL) {
+        range->lo = range->hi = strtoull(arg, &end, 0);
+        return (end == arg || *end != '\0') ? -1 : 0;
+    }
+    if(colon != arg) {
+        range->lo = strtoull(arg, &end, 0);
+        if(end != colon) {
+            return -1;
+        }
+    }
+    if(colon[1] != '\0') {
+        range->hi = strtoull(colon + 1, &end, 0);
+        if(*end != '\0') {
+            return -1;
+        }
+    }
+    return range->lo <= range->hi ? 0 : -1;
+}
+
+int parse_results(const char *arg) {
+    const char *name = arg;
+    size_t len;
+    int mask = 0;
+
+    while(*name != '\0') {
+        len = strcspn(name, ",");
+        if(len == 3 && strncmp(name, "won", len) == 0) {
+            mask |= 1 << REPLAY_RESULT_WON;
+        } else if(len == 4 && strncmp(name, "lost", len) == 0) {
+            mask |= 1 << REPLAY_RESULT_LOST;
+        } else if(len == 4 && strncmp(name, "quit", len) == 0) {
+            mask |= 1 << REPLAY_RESULT_QUIT;
+        } else {
+            return -1;
+        }
+        name += len;
+        if(*name == ',') {
+            name++;
+        }
+    }
+    return mask ? mask : -1;
+}
+
+int parse_options(int argc, char **argv, query_t *query) {
+    int opt;
+
+    memset(query, 0, sizeof(*query));
+    query->threads = 4;
+    query->results = 0xFF;
+    query->group = GROUP_NONE;
+
+    while((opt = getopt(argc, argv, "j:s:d:S:t:n:r:g:")) != -1) {
+        switch(opt) {
+            case 'j':
+                query->threads = atoi(optarg);
+                if(query->threads < 1 || query->threads > MAX_THREADS) {
+                    return -1;
+                }
+                break;
+            case 's':
+                if(parse_range(optarg, &query->seed) < 0) {
+                    return -1;
+                }
+                break;
+            case 'd':
+                if(parse_range(optarg, &query->difficulty) < 0) {
+                    return -1;
+                }
+                break;
+            case 'S':
+                if(parse_range(optarg, &query->score) < 0) {
+                    return -1;
+                }
+                break;
+            case 't':
+                if(parse_range(optarg, &query->max_tile) < 0) {
+                    return -1;
+                }
+                break;
+            case 'n':
+                if(parse_range(optarg, &query->moves) < 0) {
+                    return -1;
+                }
+                break;
+            case 'r':
+                query->results = parse_results(optarg);
+                if(query->results < 0) {
+                    return -1;
+                }
+                break;
+            case 'g':
+                if(strcmp(optarg, "difficulty") == 0) {
+                    query->group = GROUP_DIFFICULTY;
+                } else if(strcmp(optarg, "tile") == 0) {
+                    query->group = GROUP_MAX_TILE;
+                } else if(strcmp(optarg, "result") == 0) {
+                    query->group = GROUP_RESULT;
+                } else {
+                    return -1;
+                }
+                break;
+            default:
+                return -1;
+        }
+    }
+    if(optind >= argc) {
+        return -1;
+    }
+
+    /* The scores and lengths are always summed; the rest only if asked. */
+    query->columns = SEGMENT_READ(SEGMENT_COL_SCORE) | SEGMENT_READ(SEGMENT_COL_NUM_MOVES);
+    if(query->seed.set) {
+        query->columns |= SEGMENT_READ(SEGMENT_COL_SEED);
+    }
+    if(query->difficulty.set || query->group == GROUP_DIFFICULTY) {
+        query->columns |= SEGMENT_READ(SEGMENT_COL_WINNING);
+    }
+    if(query->max_tile.set || query->group == GROUP_MAX_TILE) {
+        query->columns |= SEGMENT_READ(SEGMENT_COL_MAX_TILE);
+    }
+    if(query->results != 0xFF || query->group == GROUP_RESULT) {
+        query->columns |= SEGMENT_READ(SEGMENT_COL_RESULT);
+    }
+    return optind;
+}
+
+int overlaps(const range_t *filter, uint64_t lo, uint64_t hi) {
+    return !filter->set || (lo <= filter->hi && hi >= filter->lo);
+}
+
+int passes(const range_t *filter, uint64_t value) {
+    return !filter->set || (value >= filter->lo && value <= filter->hi);
+}
+
+uint64_t tile_of(int log2) {
+    return log2 ? (uint64_t) 1 << log2 : 0;
+}
+
+int block_may_pass(const query_t *query, const segment_block_info_t *info) {
+    return overlaps(&query->seed, info->first_seed, info->last_seed)
+        && overlaps(&query->difficulty, tile_of(info->min_winning), tile_of(info->max_winning))
+        && overlaps(&query->score, info->min_score, info->max_score)
+        && overlaps(&query->max_tile, tile_of(info->min_max_tile), tile_of(info->max_max_tile))
+        && overlaps(&query->moves, info->min_moves, info->max_moves)
+        && (info->results & query->results) != 0;
+}
+
+int group_of(const query_t *query, const segment_block_t *block, uint32_t ii) {
+    int key = 0;
+
+    switch(query->group) {
+        case GROUP_DIFFICULTY:
+            key = engine_tile_log2(block->winning_tile[ii]);
+            break;
+        case GROUP_MAX_TILE:
+            key = engine_tile_log2(block->max_tile[ii]);
+            break;
+        case GROUP_RESULT:
+            key = block->result[ii];
+            break;
+        default:
+            break;
+    }
+    return key < MAX_GROUPS ? key : -1;
+}
+
+void add_game(stats_t *stats, uint32_t score, uint32_t moves) {
+    if(stats->games == 0 || score < stats->score_min) {
+        stats->score_min = score;
+    }
+    if(stats->games == 0 || moves < stats->moves_min) {
+        stats->moves_min = moves;
+    }
+    if(score > stats->score_max) {
+        stats->score_max = score;
+    }
+    if(moves > stats->moves_max) {
+        stats->moves_max = moves;
+    }
+    stats->score_sum += score;
+    stats->moves_sum += moves;
+    stats->games++;
+}
+
+void merge_stats(stats_t *to, const stats_t *from) {
+    if(from->games == 0) {
+        return;
+    }
+    if(to->games == 0 || from->score_min < to->score_min) {
+        to->score_min = from->score_min;
+    }
+    if(to->games == 0 || from->moves_min < to->moves_min) {
+        to->moves_min = from->moves_min;
+    }
+    if(from->score_max > to->score_max) {
+        to->score_max = from->score_max;
+    }
+    if(from->moves_max > to->moves_max) {
+        to->moves_max = from->moves_max;
+    }
+    to->score_sum += from->score_sum;
+    to->moves_sum += from->moves_sum;
+    to->games += from->games;
+}
+
+int scan_block(scanner_t *scanner, const segment_t *segment, uint32_t index) {
+    const query_t *query = scanner->shared->query;
+    const segment_block_t *block = scanner->block;
+    uint32_t ii;
+    int group;
+
+    if(!block_may_pass(query, &segment->index[index])) {
+        scanner->blocks_skipped++;
+        return 0;
+    }
+    if(segment_read_block(segment, index, query->columns, scanner->block) < 0) {
+        return -1;
+    }
+    scanner->blocks_read++;
+    scanner->scanned += block->count;
+
+    /* Columns that were not read are not looked at: their filters are unset. */
+    for(ii = 0; ii < block->count; ii++) {
+        if(passes(&query->seed, block->seed[ii])
+                && passes(&query->difficulty, block->winning_tile[ii])
+                && passes(&query->score, block->final_score[ii])
+                && passes(&query->max_tile, block->max_tile[ii])
+                && passes(&query->moves, block->num_moves[ii])
+                && (query->results == 0xFF || (query->results >> block->result[ii]) & 1)) {
+            group = group_of(query, block, ii);
+            if(group < 0) {
+                return -1;
+            }
+            add_game(&scanner->groups[group], block->final_score[ii], block->num_moves[ii]);
+        }
+    }
+    return 0;
+}
+
+void *scanner_main(void *arg) {
+    scanner_t *scanner = arg;
+    scan_t *shared = scanner->shared;
+    uint32_t first, count, ii;
+    int segment;
+
+    while(segment_queue_take(&shared->blocks, &segment, &first, &count)) {
+        for(ii = first; ii < first + count; ii++) {
+            if(scan_block(scanner, &shared->segments[segment], ii) < 0) {
+                fprintf(stderr, "%s: malformed block %u\n", shared->paths[segment], ii);
+                segment_queue_fail(&shared->blocks);
+                return NULL;
+            }
+        }
+    }
+    return NULL;
+}
+
+void print_group(const query_t *query, int key, const stats_t *stats) {
+    static const char *result_names[] = {"quit", "won", "lost"};
+    char name[32];
+
+    switch(query->group) {
+        case GROUP_DIFFICULTY:
+        case GROUP_MAX_TILE:
+            snprintf(name, sizeof(name), "%llu", (unsigned long long) tile_of(key));
+            break;
+        case GROUP_RESULT:
+            if(key <= REPLAY_RESULT_LOST) {
+                snprintf(name, sizeof(name), "%s", result_names[key]);
+            } else {
+                snprintf(name, sizeof(name), "result %d", key);
+            }
+            break;
+        default:
+            snprintf(name, sizeof(name), "all");
+            break;
+    }
+    printf("%-10s %12llu %9u %11.1f %9u %9u %11.1f %9u\n",
+        name, (unsigned long long) stats->games,
+        stats->score_min, stats->games ? (double) stats->score_sum / stats->games : 0.0,
+        stats->score_max,
+        stats->moves_min, stats->games ? (double) stats->moves_sum / stats->games : 0.0,
+        stats->moves_max);
+}
+
+int main(int argc, char **argv) {
+    query_t query;
+    scan_t shared;
+    scanner_t *scanners;
+    stats_t totals[MAX_GROUPS];
+    struct timespec start, end;
+    unsigned long blocks_read = 0, blocks_skipped = 0;
+    uint64_t scanned = 0, matched = 0, games = 0;
+    double seconds;
+    int ii, jj, first;
+
+    first = parse_options(argc, argv, &query);
+    if(first < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    memset(&shared, 0, sizeof(shared));
+    shared.query = &query;
+    shared.paths = argv + first;
+    shared.num_segments = argc - first;
+    shared.segments = calloc(shared.num_segments, sizeof(*shared.segments));
+    segment_queue_init(&shared.blocks, shared.segments, shared.num_segments, BLOCKS_PER_TAKE);
+    scanners = calloc(query.threads, sizeof(*scanners));
+    if(shared.segments == NULL || scanners == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for(ii = 0; ii < shared.num_segments; ii++) {
+        if(segment_open(&shared.segments[ii], shared.paths[ii]) < 0) {
+            fprintf(stderr, "%s: not a readable segment\n", shared.paths[ii]);
+            return 1;
+        }
+        games += shared.segments[ii].num_games;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(ii = 0; ii < query.threads; ii++) {
+        scanners[ii].shared = &shared;
+        scanners[ii].block = calloc(1, sizeof(segment_block_t));
+        if(scanners[ii].block == NULL) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+        if(pthread_create(&scanners[ii].thread, NULL, scanner_main, &scanners[ii]) != 0) {
+            fprintf(stderr, "could not start thread\n");
+            return 1;
+        }
+    }
+    memset(totals, 0, sizeof(totals));
+    for(ii = 0; ii < query.threads; ii++) {
+        pthread_join(scanners[ii].thread, NULL);
+        for(jj = 0; jj < MAX_GROUPS; jj++) {
+            merge_stats(&totals[jj], &scanners[ii].groups[jj]);
+        }
+        scanned += scanners[ii].scanned;
+        blocks_read += scanners[ii].blocks_read;
+        blocks_skipped += scanners[ii].blocks_skipped;
+        segment_block_free(scanners[ii].block);
+        free(scanners[ii].block);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    for(ii = 0; ii < shared.num_segments; ii++) {
+        segment_close(&shared.segments[ii]);
+    }
+    free(shared.segments);
+    free(scanners);
+    if(segment_queue_failed(&shared.blocks)) {
+        return 1;
+    }
+
+    printf("%-10s %12s %9s %11s %9s %9s %11s %9s\n", "group", "games",
+        "min score", "mean score", "max score", "min moves", "mean moves", "max moves");
+    for(ii = 0; ii < MAX_GROUPS; ii++) {
+        if(totals[ii].games > 0 || (ii == 0 && query.group == GROUP_NONE)) {
+            print_group(&query, ii, &totals[ii]);
+            matched += totals[ii].games;
+        }
+    }
+    printf("%llu of %llu games matched; %llu scanned in %lu blocks, %lu blocks skipped;"
+        " %.3f s\n", (unsigned long long) matched, (unsigned long long) games,
+        (unsigned long long) scanned, blocks_read, blocks_skipped, seconds);
+    return 0;
+}
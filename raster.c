@@ -0,0 +1,490 @@
+/** @file raster.c
+ *  @brief Implementation of console pictures.
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "raster.h"
+#include "tile_colors.h"
+
+/* Line arms of a cell, from its center toward an edge. */
+#define ARM_LEFT 0x1
+#define ARM_RIGHT 0x2
+#define ARM_UP 0x4
+#define ARM_DOWN 0x8
+/* A junction, which joins whatever lines meet it. */
+#define ARM_JOIN 0x10
+
+/* The digit font is 3x5, on a 4x7 grid so digits have room around them. */
+#define FONT_COLS 4
+#define FONT_ROWS 7
+
+/** @brief The digits 0 to 9, 3 bits a row, top row in the high bits.
+ */
+static const uint16_t digit_font[10] = {
+    075557, /* 0 */
+    026227, /* 1 */
+    071747, /* 2 */
+    071717, /* 3 */
+    055711, /* 4 */
+    074717, /* 5 */
+    074757, /* 6 */
+    071111, /* 7 */
+    075757, /* 8 */
+    075717, /* 9 */
+};
+
+/** @brief The 16 VGA colors, as 0xRRGGBB.
+ */
+static const uint32_t vga_rgb[16] = {
+    0x000000, 0x0000aa, 0x00aa00, 0x00aaaa,
+    0xaa0000, 0xaa00aa, 0xaa5500, 0xaaaaaa,
+    0x555555, 0x5555ff, 0x55ff55, 0x55ffff,
+    0xff5555, 0xff55ff, 0xffff55, 0xffffff,
+};
+
+/***** Function prototypes ******/
+
+/** @brief Find the RGB colors of a console color.
+ *
+ * @param color The console color.
+ * @param fg Set to the foreground color.
+ * @param bg Set to the background color.
+ * @return None.
+ */
+static void color_rgb(uint8_t color, uint32_t *fg, uint32_t *bg);
+
+/** @brief Find which line arms a glyph has on its own.
+ *
+ * @param glyph The glyph.
+ * @return A mask of ARM_ constants, 0 if the glyph is not a line.
+ */
+static int glyph_arms(uint8_t glyph);
+
+/** @brief Read a cell, treating cells off the console as empty.
+ *
+ * @param console The console.
+ * @param row The row.
+ * @param col The column.
+ * @param glyph Set to the glyph.
+ * @param color Set to the color.
+ * @return None.
+ */
+static void read_cell(console_t *console, int row, int col, uint8_t *glyph, uint8_t *color);
+
+/** @brief Find the line arms to draw for a cell.
+ *
+ * Junctions get an arm toward every neighbour with a line pointing back.
+ *
+ * @param console The console.
+ * @param row The row.
+ * @param col The column.
+ * @return A mask of ARM_ constants.
+ */
+static int cell_arms(console_t *console, int row, int col);
+
+/** @brief Check the arguments shared by the drawing functions.
+ *
+ * @param console The console.
+ * @param region The region.
+ * @param scale The scale.
+ * @return 0 if they are usable, -1 otherwise.
+ */
+static int check_args(console_t *console, const raster_region_t *region, int scale);
+
+/** @brief Fill a rectangle of an image.
+ *
+ * @param image The image.
+ * @param x The left edge.
+ * @param y The top edge.
+ * @param w The width.
+ * @param h The height.
+ * @param rgb The color, as 0xRRGGBB.
+ * @return None.
+ */
+static void fill_rect(raster_t *image, int x, int y, int w, int h, uint32_t rgb);
+
+/** @brief Draw one cell into an image.
+ *
+ * @param image The image.
+ * @param x The left edge of the cell.
+ * @param y The top edge of the cell.
+ * @param scale Pixels per cell column.
+ * @param glyph The glyph.
+ * @param color The console color.
+ * @param arms The line arms to draw.
+ * @return None.
+ */
+static void draw_cell(
+        raster_t *image,
+        int x,
+        int y,
+        int scale,
+        uint8_t glyph,
+        uint8_t color,
+        int arms);
+
+/** @brief Check if a glyph is drawn as text in an SVG document.
+ *
+ * @param glyph The glyph.
+ * @return 1 if it is, 0 otherwise.
+ */
+static int is_text(uint8_t glyph);
+
+/** @brief Write a character to an SVG document, escaped for XML.
+ *
+ * @param out The file.
+ * @param glyph The glyph, printable ASCII.
+ * @return None.
+ */
+static void put_xml_char(FILE *out, uint8_t glyph);
+
+/***** Function definitions ******/
+
+void color_rgb(uint8_t color, uint32_t *fg, uint32_t *bg) {
+    if(color == 0) {
+        *fg = BOARD_FG_RGB;
+        *bg = BOARD_BG_RGB;
+    } else if(color <= NUM_TILE_COLORS) {
+        *fg = tile_colors[color - 1].fg;
+        *bg = tile_colors[color - 1].bg;
+    } else {
+        *fg = vga_rgb[color & 0xF];
+        *bg = vga_rgb[(color >> 4) & 0xF];
+    }
+}
+
+int glyph_arms(uint8_t glyph) {
+    switch(glyph) {
+        case '-':
+        case GLYPH_HLINE:    return ARM_LEFT | ARM_RIGHT;
+        case '|':
+        case GLYPH_VLINE:    return ARM_UP | ARM_DOWN;
+        case GLYPH_ULCORNER: return ARM_RIGHT | ARM_DOWN;
+        case GLYPH_URCORNER: return ARM_LEFT | ARM_DOWN;
+        case GLYPH_LLCORNER: return ARM_RIGHT | ARM_UP;
+        case GLYPH_LRCORNER: return ARM_LEFT | ARM_UP;
+        case GLYPH_LTEE:     return ARM_UP | ARM_DOWN | ARM_RIGHT;
+        case GLYPH_RTEE:     return ARM_UP | ARM_DOWN | ARM_LEFT;
+        case GLYPH_TTEE:     return ARM_LEFT | ARM_RIGHT | ARM_DOWN;
+        case GLYPH_BTEE:     return ARM_LEFT | ARM_RIGHT | ARM_UP;
+        case GLYPH_PLUS:     return ARM_LEFT | ARM_RIGHT | ARM_UP | ARM_DOWN;
+        case '#':
+        case '+':            return ARM_JOIN;
+        default:             return 0;
+    }
+}
+
+void read_cell(console_t *console, int row, int col, uint8_t *glyph, uint8_t *color) {
+    if(console_get(console, row, col, glyph, color) < 0) {
+        *glyph = ' ';
+        *color = 0;
+    }
+}
+
+int cell_arms(console_t *console, int row, int col) {
+    uint8_t glyph, color;
+    int arms;
+
+    read_cell(console, row, col, &glyph, &color);
+    arms = glyph_arms(glyph);
+    if(arms != ARM_JOIN) {
+        return arms;
+    }
+
+    /* Neighbouring junctions count as pointing every way. */
+    arms = 0;
+    read_cell(console, row, col - 1, &glyph, &color);
+    if(glyph_arms(glyph) & (ARM_RIGHT | ARM_JOIN)) {
+        arms |= ARM_LEFT;
+    }
+    read_cell(console, row, col + 1, &glyph, &color);
+    if(glyph_arms(glyph) & (ARM_LEFT | ARM_JOIN)) {
+        arms |= ARM_RIGHT;
+    }
+    read_cell(console, row - 1, col, &glyph, &color);
+    if(glyph_arms(glyph) & (ARM_DOWN | ARM_JOIN)) {
+        arms |= ARM_UP;
+    }
+    read_cell(console, row + 1, col, &glyph, &color);
+    if(glyph_arms(glyph) & (ARM_UP | ARM_JOIN)) {
+        arms |= ARM_DOWN;
+    }
+    return arms;
+}
+
+int check_args(console_t *console, const raster_region_t *region, int scale) {
+    if(console == NULL || region == NULL) {
+        return -1;
+    }
+    if(region->rows <= 0 || region->cols <= 0) {
+        return -1;
+    }
+    if(region->rows > CONSOLE_HEIGHT || region->cols > CONSOLE_WIDTH) {
+        return -1;
+    }
+    if(scale < 1 || scale > RASTER_MAX_SCALE) {
+        return -1;
+    }
+    return 0;
+}
+
+void fill_rect(raster_t *image, int x, int y, int w, int h, uint32_t rgb) {
+    int ii, jj;
+    uint8_t *p;
+
+    for(ii = y; ii < y + h; ii++) {
+        p = image->pixels + 3 * ((size_t) ii * image->width + x);
+        for(jj = 0; jj < w; jj++) {
+            *p++ = rgb >> 16;
+            *p++ = rgb >> 8;
+            *p++ = rgb;
+        }
+    }
+}
+
+void draw_cell(
+        raster_t *image,
+        int x,
+        int y,
+        int scale,
+        uint8_t glyph,
+        uint8_t color,
+        int arms) {
+    uint32_t fg, bg;
+    int w = scale;
+    int h = 2 * scale;
+    int thick = scale / 4 > 0 ? scale / 4 : 1;
+    int cx = (w - thick) / 2;
+    int cy = (h - thick) / 2;
+    int ii, jj, fx, fy;
+    uint16_t bits;
+
+    color_rgb(color, &fg, &bg);
+    fill_rect(image, x, y, w, h, bg);
+
+    if(arms != 0) {
+        if(arms & ARM_LEFT) {
+            fill_rect(image, x, y + cy, cx + thick, thick, fg);
+        }
+        if(arms & ARM_RIGHT) {
+            fill_rect(image, x + cx, y + cy, w - cx, thick, fg);
+        }
+        if(arms & ARM_UP) {
+            fill_rect(image, x + cx, y, thick, cy + thick, fg);
+        }
+        if(arms & ARM_DOWN) {
+            fill_rect(image, x + cx, y + cy, thick, h - cy, fg);
+        }
+        return;
+    }
+    if(glyph == ' ' || glyph == 0) {
+        return;
+    }
+
+    /*
+     * Digits come from the font.  Anything else gets a solid mark in
+     * the middle of the cell, so text still shows up as text.
+     */
+    bits = (glyph >= '0' && glyph <= '9') ? digit_font[glyph - '0'] : 077777;
+    for(ii = 0; ii < h; ii++) {
+        fy = ii * FONT_ROWS / h - 1;
+        if(fy < 0 || fy > 4) {
+            continue;
+        }
+        if(bits == 077777 && (fy == 0 || fy == 4)) {
+            continue;
+        }
+        for(jj = 0; jj < w; jj++) {
+            fx = jj * FONT_COLS / w;
+            if(fx < 3 && (bits >> (3 * (4 - fy) + (2 - fx))) & 1) {
+                fill_rect(image, x + jj, y + ii, 1, 1, fg);
+            }
+        }
+    }
+}
+
+void raster_init(raster_t *image) {
+    if(image == NULL) {
+        return;
+    }
+    memset(image, 0, sizeof(*image));
+}
+
+void raster_free(raster_t *image) {
+    if(image == NULL) {
+        return;
+    }
+    free(image->pixels);
+    raster_init(image);
+}
+
+int raster_render(
+        raster_t *image,
+        console_t *console,
+        const raster_region_t *region,
+        int scale) {
+    size_t size;
+    uint8_t *pixels;
+    uint8_t glyph, color;
+    int ii, jj, row, col;
+
+    if(image == NULL || check_args(console, region, scale) < 0) {
+        return -1;
+    }
+
+    image->width = region->cols * scale;
+    image->height = region->rows * 2 * scale;
+    size = (size_t) image->width * image->height * 3;
+    if(size > image->capacity) {
+        pixels = realloc(image->pixels, size);
+        if(pixels == NULL) {
+            return -1;
+        }
+        image->pixels = pixels;
+        image->capacity = size;
+    }
+
+    for(ii = 0; ii < region->rows; ii++) {
+        for(jj = 0; jj < region->cols; jj++) {
+            row = region->row + ii;
+            col = region->col + jj;
+            read_cell(console, row, col, &glyph, &color);
+            draw_cell(image, jj * scale, ii * 2 * scale, scale, glyph, color,
+                cell_arms(console, row, col));
+        }
+    }
+    return 0;
+}
+
+int raster_write_ppm(FILE *out, const raster_t *image) {
+    size_t size;
+
+    if(out == NULL || image == NULL || image->pixels == NULL) {
+        return -1;
+    }
+    size = (size_t) image->width * image->height * 3;
+    if(fprintf(out, "P6\n%d %d\n255\n", image->width, image->height) < 0) {
+        return -1;
+    }
+    if(fwrite(image->pixels, 1, size, out) != size) {
+        return -1;
+    }
+    return 0;
+}
+
+int is_text(uint8_t glyph) {
+    return glyph > ' ' && glyph < 0x7F && glyph_arms(glyph) == 0;
+}
+
+void put_xml_char(FILE *out, uint8_t glyph) {
+    switch(glyph) {
+        case '&': fputs("&amp;", out); break;
+        case '<': fputs("&lt;", out); break;
+        case '>': fputs("&gt;", out); break;
+        case '"': fputs("&quot;", out); break;
+        default: fputc(glyph, out); break;
+    }
+}
+
+int raster_write_svg(
+        FILE *out,
+        console_t *console,
+        const raster_region_t *region,
+        int scale) {
+    uint8_t glyph, color, run_color;
+    uint32_t fg, bg, run_bg;
+    int ii, jj, kk, row, start, arms;
+    int w = scale;
+    int h = 2 * scale;
+    int thick = scale / 4 > 0 ? scale / 4 : 1;
+    int cx = (w - thick) / 2;
+    int cy = (h - thick) / 2;
+
+    if(out == NULL || check_args(console, region, scale) < 0) {
+        return -1;
+    }
+
+    fprintf(out,
+        "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" height=\"%d\" "
+        "viewBox=\"0 0 %d %d\" shape-rendering=\"crispEdges\">\n",
+        region->cols * w, region->rows * h, region->cols * w, region->rows * h);
+
+    for(ii = 0; ii < region->rows; ii++) {
+        row = region->row + ii;
+
+        /* Backgrounds, a rectangle per run of equal color. */
+        for(jj = 0; jj < region->cols; jj = kk) {
+            read_cell(console, row, region->col + jj, &glyph, &color);
+            color_rgb(color, &fg, &run_bg);
+            for(kk = jj + 1; kk < region->cols; kk++) {
+                read_cell(console, row, region->col + kk, &glyph, &color);
+                color_rgb(color, &fg, &bg);
+                if(bg != run_bg) {
+                    break;
+                }
+            }
+            fprintf(out,
+                "<rect x=\"%d\" y=\"%d\" width=\"%d\" height=\"%d\" fill=\"#%06x\"/>\n",
+                jj * w, ii * h, (kk - jj) * w, h, (unsigned) run_bg);
+        }
+
+        /* Lines, as in raster_render. */
+        for(jj = 0; jj < region->cols; jj++) {
+            arms = cell_arms(console, row, region->col + jj);
+            if(arms == 0) {
+                continue;
+            }
+            read_cell(console, row, region->col + jj, &glyph, &color);
+            color_rgb(color, &fg, &bg);
+            fprintf(out, "<path fill=\"#%06x\" d=\"", (unsigned) fg);
+            if(arms & ARM_LEFT) {
+                fprintf(out, "M%d %dh%dv%dh-%dz",
+                    jj * w, ii * h + cy, cx + thick, thick, cx + thick);
+            }
+            if(arms & ARM_RIGHT) {
+                fprintf(out, "M%d %dh%dv%dh-%dz",
+                    jj * w + cx, ii * h + cy, w - cx, thick, w - cx);
+            }
+            if(arms & ARM_UP) {
+                fprintf(out, "M%d %dh%dv%dh-%dz",
+                    jj * w + cx, ii * h, thick, cy + thick, thick);
+            }
+            if(arms & ARM_DOWN) {
+                fprintf(out, "M%d %dh%dv%dh-%dz",
+                    jj * w + cx, ii * h + cy, thick, h - cy, thick);
+            }
+            fputs("\"/>\n", out);
+        }
+
+        /* Text, an element per run of characters in the same color. */
+        for(jj = 0; jj < region->cols; jj = kk) {
+            read_cell(console, row, region->col + jj, &glyph, &run_color);
+            if(!is_text(glyph)) {
+                kk = jj + 1;
+                continue;
+            }
+            for(kk = jj + 1; kk < region->cols; kk++) {
+                read_cell(console, row, region->col + kk, &glyph, &color);
+                if(!is_text(glyph) || color != run_color) {
+                    break;
+                }
+            }
+            color_rgb(run_color, &fg, &bg);
+            fprintf(out,
+                "<text x=\"%d\" y=\"%d\" font-family=\"monospace\" font-size=\"%d\" "
+                "textLength=\"%d\" lengthAdjust=\"spacingAndGlyphs\" fill=\"#%06x\">",
+                jj * w, ii * h + (h * 4) / 5, (h * 4) / 5, (kk - jj) * w, (unsigned) fg);
+            for(start = jj; start < kk; start++) {
+                read_cell(console, row, region->col + start, &glyph, &color);
+                put_xml_char(out, glyph);
+            }
+            fputs("</text>\n", out);
+        }
+    }
+
+    fputs("</svg>\n", out);
+    return ferror(out) ? -1 : 0;
+}
@@ -0,0 +1,109 @@
+/** @file raster.h
+ *  @brief Turns a region of a console into a picture.
+ *
+ *  Each console cell becomes a block of pixels, scale wide and twice
+ *  that tall, filled with the cell's background color.  Digits are drawn
+ *  with a small bitmap font, and line drawing characters as lines, which
+ *  is all the game board needs.  Other characters are drawn as a solid
+ *  mark.
+ *
+ *  Pictures can be written as binary PPM images, or as SVG documents,
+ *  which are drawn straight from the console cells.
+ *
+ *  @bug None known.
+ */
+
+#ifndef _RASTER_H_
+#define _RASTER_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "console_model.h"
+
+/** Largest number of pixels per cell column */
+#define RASTER_MAX_SCALE 32
+
+/** @brief A region of a console.
+ */
+typedef struct raster_region_t {
+    /** The first console row */
+    int row;
+    /** The first console column */
+    int col;
+    /** The number of rows */
+    int rows;
+    /** The number of columns */
+    int cols;
+} raster_region_t;
+
+/** @brief An RGB image.
+ */
+typedef struct raster_t {
+    /** Width in pixels */
+    int width;
+    /** Height in pixels */
+    int height;
+    /** Pixels, three bytes (red, green, blue) each, row by row */
+    uint8_t *pixels;
+    /** The number of bytes allocated for pixels */
+    size_t capacity;
+} raster_t;
+
+/** @brief Set up an empty image.
+ *
+ * @param image The image.
+ * @return None.
+ */
+void raster_init(raster_t *image);
+
+/** @brief Free the pixels of an image.
+ *
+ * @param image The image.
+ * @return None.
+ */
+void raster_free(raster_t *image);
+
+/** @brief Draw a region of a console into an image.
+ *
+ * The image is resized to fit, reusing its pixels where possible.
+ * Cells outside the console are drawn as empty board.
+ *
+ * @param image The image.
+ * @param console The console to draw.
+ * @param region The region of the console to draw.
+ * @param scale Pixels per cell column, 1 to RASTER_MAX_SCALE.
+ * @return 0 on success, -1 on a bad argument or if out of memory.
+ */
+int raster_render(
+        raster_t *image,
+        console_t *console,
+        const raster_region_t *region,
+        int scale);
+
+/** @brief Write an image as a binary PPM (P6) file.
+ *
+ * @param out The file.
+ * @param image The image.
+ * @return 0 on success, -1 on a write error.
+ */
+int raster_write_ppm(FILE *out, const raster_t *image);
+
+/** @brief Write a region of a console as an SVG document.
+ *
+ * The document has the same size and layout as raster_render would
+ * give.  Runs of cells with the same background become one rectangle,
+ * and runs of text one text element.
+ *
+ * @param out The file.
+ * @param console The console to draw.
+ * @param region The region of the console to draw.
+ * @param scale Pixels per cell column, 1 to RASTER_MAX_SCALE.
+ * @return 0 on success, -1 on a bad argument or a write error.
+ */
+int raster_write_svg(
+        FILE *out,
+        console_t *console,
+        const raster_region_t *region,
+        int scale);
+
+#endif
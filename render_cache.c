@@ -0,0 +1,186 @@
+/** @file render_cache.c
+ *  @brief Implementation of the render cache.
+ *
+ *  @bug No known bugs.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include "render_cache.h"
+
+/***** Function prototypes ******/
+
+/** @brief Hash a key with FNV-1a.
+ *
+ * @param key The key.
+ * @return The hash.
+ */
+static uint64_t hash_key(const render_key_t *key);
+
+/** @brief Unlink an entry from the recency list.
+ *
+ * @param cache The cache.
+ * @param index The entry.
+ * @return None.
+ */
+static void unlink_entry(render_cache_t *cache, int index);
+
+/** @brief Link an entry in as the most recently used.
+ *
+ * @param cache The cache.
+ * @param index The entry.
+ * @return None.
+ */
+static void push_newest(render_cache_t *cache, int index);
+
+/** @brief Remove an entry from its hash bucket.
+ *
+ * @param cache The cache.
+ * @param index The entry.
+ * @return None.
+ */
+static void unchain_entry(render_cache_t *cache, int index);
+
+/***** Function definitions ******/
+
+uint64_t hash_key(const render_key_t *key) {
+    const unsigned char *bytes = (const unsigned char*) key;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t ii;
+    for(ii = 0; ii < sizeof(*key); ii++) {
+        hash ^= bytes[ii];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+void unlink_entry(render_cache_t *cache, int index) {
+    render_entry_t *entry = &cache->entries[index];
+    if(entry->newer != RENDER_CACHE_NONE) {
+        cache->entries[entry->newer].older = entry->older;
+    } else {
+        cache->newest = entry->older;
+    }
+    if(entry->older != RENDER_CACHE_NONE) {
+        cache->entries[entry->older].newer = entry->newer;
+    } else {
+        cache->oldest = entry->newer;
+    }
+    entry->newer = RENDER_CACHE_NONE;
+    entry->older = RENDER_CACHE_NONE;
+}
+
+void push_newest(render_cache_t *cache, int index) {
+    render_entry_t *entry = &cache->entries[index];
+    entry->newer = RENDER_CACHE_NONE;
+    entry->older = cache->newest;
+    if(cache->newest != RENDER_CACHE_NONE) {
+        cache->entries[cache->newest].newer = index;
+    } else {
+        cache->oldest = index;
+    }
+    cache->newest = index;
+}
+
+void unchain_entry(render_cache_t *cache, int index) {
+    render_entry_t *entry = &cache->entries[index];
+    int *link = &cache->buckets[entry->hash & (RENDER_CACHE_BUCKETS - 1)];
+    while(*link != RENDER_CACHE_NONE) {
+        if(*link == index) {
+            *link = entry->chain;
+            break;
+        }
+        link = &cache->entries[*link].chain;
+    }
+    entry->chain = RENDER_CACHE_NONE;
+}
+
+void render_cache_init(render_cache_t *cache) {
+    int ii;
+    if(cache == NULL) {
+        return;
+    }
+
+    for(ii = 0; ii < RENDER_CACHE_BUCKETS; ii++) {
+        cache->buckets[ii] = RENDER_CACHE_NONE;
+    }
+
+    /* Every entry starts out free, on the recency list in index order. */
+    cache->newest = RENDER_CACHE_NONE;
+    cache->oldest = RENDER_CACHE_NONE;
+    for(ii = 0; ii < RENDER_CACHE_ENTRIES; ii++) {
+        cache->entries[ii].used = 0;
+        cache->entries[ii].chain = RENDER_CACHE_NONE;
+        push_newest(cache, ii);
+    }
+    cache->hits = 0;
+    cache->misses = 0;
+}
+
+void render_key_make(
+        render_key_t *key,
+        int grid[GRID_SIZE][GRID_SIZE],
+        unsigned int score,
+        unsigned int high_score,
+        int phase) {
+    if(key == NULL || grid == NULL) {
+        return;
+    }
+    /* Zero any padding, since keys are hashed and compared as bytes. */
+    memset(key, 0, sizeof(*key));
+    memcpy(key->grid, grid, sizeof(key->grid));
+    key->score = score;
+    key->high_score = high_score;
+    key->phase = phase;
+}
+
+const cell_t *render_cache_lookup(render_cache_t *cache, const render_key_t *key) {
+    uint64_t hash;
+    int index;
+    render_entry_t *entry;
+
+    if(cache == NULL || key == NULL) {
+        return NULL;
+    }
+
+    hash = hash_key(key);
+    index = cache->buckets[hash & (RENDER_CACHE_BUCKETS - 1)];
+    while(index != RENDER_CACHE_NONE) {
+        entry = &cache->entries[index];
+        if(entry->hash == hash && memcmp(&entry->key, key, sizeof(*key)) == 0) {
+            unlink_entry(cache, index);
+            push_newest(cache, index);
+            cache->hits++;
+            return entry->cells;
+        }
+        index = entry->chain;
+    }
+    cache->misses++;
+    return NULL;
+}
+
+cell_t *render_cache_insert(render_cache_t *cache, const render_key_t *key) {
+    int index, bucket;
+    render_entry_t *entry;
+
+    if(cache == NULL || key == NULL) {
+        return NULL;
+    }
+
+    /* Reuse the least recently used entry. */
+    index = cache->oldest;
+    entry = &cache->entries[index];
+    if(entry->used) {
+        unchain_entry(cache, index);
+    }
+    unlink_entry(cache, index);
+
+    entry->key = *key;
+    entry->hash = hash_key(key);
+    entry->used = 1;
+    bucket = entry->hash & (RENDER_CACHE_BUCKETS - 1);
+    entry->chain = cache->buckets[bucket];
+    cache->buckets[bucket] = index;
+    push_newest(cache, index);
+    return entry->cells;
+}
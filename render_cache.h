@@ -0,0 +1,129 @@
+/** @file render_cache.h
+ *  @brief A least-recently-used cache of rendered board frames.
+ *
+ *  Drawing a board from scratch means drawing every block and score.
+ *  The same positions come up again and again: every game starts from
+ *  a handful of boards, and a position shown once tends to be shown
+ *  again.  This cache keeps the most recently rendered frames, keyed
+ *  by the board, the scores and the animation phase, so a repeated
+ *  position costs one copy.
+ *
+ *  @bug None known.
+ */
+
+#ifndef _RENDER_CACHE_H_
+#define _RENDER_CACHE_H_
+
+#include <stdint.h>
+#include "console_model.h"
+#include "game.h"
+
+/** Number of frames the cache holds */
+#define RENDER_CACHE_ENTRIES 32
+
+/** Number of hash buckets, a power of two */
+#define RENDER_CACHE_BUCKETS 64
+
+/** Animation phase of a board at rest */
+#define RENDER_PHASE_REST 0
+
+/** Marks the end of a list of entries */
+#define RENDER_CACHE_NONE (-1)
+
+/** @brief What a rendered frame depends on.
+ */
+typedef struct render_key_t {
+    /** The tiles on the board */
+    int grid[GRID_SIZE][GRID_SIZE];
+    /** The current score */
+    unsigned int score;
+    /** The high score */
+    unsigned int high_score;
+    /** The animation step, RENDER_PHASE_REST at rest */
+    int phase;
+} render_key_t;
+
+/** @brief A cached frame.
+ */
+typedef struct render_entry_t {
+    /** The key the frame was rendered for */
+    render_key_t key;
+    /** The hash of key */
+    uint64_t hash;
+    /** The next entry in the same bucket */
+    int chain;
+    /** The next more recently used entry */
+    int newer;
+    /** The next less recently used entry */
+    int older;
+    /** Set if the entry holds a frame */
+    int used;
+    /** The rendered frame */
+    cell_t cells[CONSOLE_CELLS] CONSOLE_ALIGNED;
+} render_entry_t;
+
+/** @brief The cache.
+ */
+typedef struct render_cache_t {
+    /** The entries */
+    render_entry_t entries[RENDER_CACHE_ENTRIES];
+    /** The first entry in each bucket */
+    int buckets[RENDER_CACHE_BUCKETS];
+    /** The most recently used entry */
+    int newest;
+    /** The least recently used entry, the next to be evicted */
+    int oldest;
+    /** Lookups that found a frame */
+    unsigned long hits;
+    /** Lookups that did not */
+    unsigned long misses;
+} render_cache_t;
+
+/** @brief Set up an empty cache.
+ *
+ * @param cache The cache.
+ * @return None.
+ */
+void render_cache_init(render_cache_t *cache);
+
+/** @brief Fill in a key.
+ *
+ * Unused bytes in the key are zeroed, so keys can be compared whole.
+ *
+ * @param key The key to fill in.
+ * @param grid The tiles on the board.
+ * @param score The current score.
+ * @param high_score The high score.
+ * @param phase The animation step, RENDER_PHASE_REST at rest.
+ * @return None.
+ */
+void render_key_make(
+        render_key_t *key,
+        int grid[GRID_SIZE][GRID_SIZE],
+        unsigned int score,
+        unsigned int high_score,
+        int phase);
+
+/** @brief Find the frame rendered for a key.
+ *
+ * A frame that is found becomes the most recently used.
+ *
+ * @param cache The cache.
+ * @param key The key.
+ * @return The frame, or NULL if it is not cached.
+ */
+const cell_t *render_cache_lookup(render_cache_t *cache, const render_key_t *key);
+
+/** @brief Make room for the frame of a key.
+ *
+ * The least recently used frame is evicted if the cache is full.  The
+ * caller renders into the returned cells.  The key must not already
+ * be cached.
+ *
+ * @param cache The cache.
+ * @param key The key.
+ * @return The cells to render into, or NULL if arguments are invalid.
+ */
+cell_t *render_cache_insert(render_cache_t *cache, const render_key_t *key);
+
+#endif
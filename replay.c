@@ -0,0 +1,300 @@
+/** @file replay.c
+ *  @brief Implementation of replay recording and reading.
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "bytes.h"
+#include "engine.h"
+#include "replay.h"
+
+/***** Function prototypes ******/
+
+/** @brief Make room for a number of moves.
+ *
+ * @param replay The replay.
+ * @param count The number of moves needed.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int reserve_moves(replay_t *replay, uint32_t count);
+
+/***** Function definitions ******/
+
+int reserve_moves(replay_t *replay, uint32_t count) {
+    uint32_t capacity;
+    uint8_t *moves;
+
+    if(count <= replay->capacity) {
+        return 0;
+    }
+    capacity = replay->capacity ? replay->capacity : 256;
+    while(capacity < count) {
+        capacity *= 2;
+    }
+    moves = realloc(replay->moves, capacity);
+    if(moves == NULL) {
+        return -1;
+    }
+    replay->moves = moves;
+    replay->capacity = capacity;
+    return 0;
+}
+
+void replay_init(replay_t *replay) {
+    if(replay == NULL) {
+        return;
+    }
+    memset(replay, 0, sizeof(*replay));
+}
+
+void replay_free(replay_t *replay) {
+    if(replay == NULL) {
+        return;
+    }
+    free(replay->moves);
+    replay_init(replay);
+}
+
+void replay_start(replay_t *replay, uint64_t seed, uint32_t winning_tile) {
+    if(replay == NULL) {
+        return;
+    }
+    replay->seed = seed;
+    replay->winning_tile = winning_tile;
+    replay->final_score = 0;
+    replay->max_tile = 0;
+    replay->result = REPLAY_RESULT_QUIT;
+    replay->num_moves = 0;
+}
+
+int replay_add_move(replay_t *replay, int dir) {
+    if(replay == NULL || dir < 0 || dir >= NUM_DIRS) {
+        return -1;
+    }
+    if(replay->num_moves >= REPLAY_MAX_MOVES) {
+        return -1;
+    }
+    if(reserve_moves(replay, replay->num_moves + 1) < 0) {
+        return -1;
+    }
+    replay->moves[replay->num_moves++] = dir;
+    return 0;
+}
+
+void replay_finish(
+        replay_t *replay,
+        int result,
+        int grid[GRID_SIZE][GRID_SIZE],
+        uint32_t score) {
+    if(replay == NULL) {
+        return;
+    }
+    replay->result = result;
+    replay->final_score = score;
+    replay->max_tile = engine_max_tile(grid);
+}
+
+void replay_encode_header(const replay_t *replay, uint8_t *out) {
+    put_u32(out, REPLAY_MAGIC);
+    put_u16(out + 4, REPLAY_VERSION);
+    out[6] = replay->result;
+    out[7] = 0;
+    put_u64(out + 8, replay->seed);
+    put_u32(out + 16, replay->winning_tile);
+    put_u32(out + 20, replay->final_score);
+    put_u32(out + 24, replay->max_tile);
+    put_u32(out + 28, replay->num_moves);
+}
+
+int replay_decode_header(const uint8_t *in, replay_t *replay) {
+    if(get_u32(in) != REPLAY_MAGIC || get_u16(in + 4) != REPLAY_VERSION) {
+        return -1;
+    }
+    if(get_u32(in + 28) > REPLAY_MAX_MOVES) {
+        return -1;
+    }
+    replay->result = in[6];
+    replay->seed = get_u64(in + 8);
+    replay->winning_tile = get_u32(in + 16);
+    replay->final_score = get_u32(in + 20);
+    replay->max_tile = get_u32(in + 24);
+    replay->num_moves = get_u32(in + 28);
+    return 0;
+}
+
+int replay_write(FILE *out, const replay_t *replay) {
+    uint8_t header[REPLAY_HEADER_LEN];
+    uint8_t packed[256];
+    uint32_t ii;
+    size_t len = 0;
+
+    if(out == NULL || replay == NULL) {
+        return -1;
+    }
+
+    replay_encode_header(replay, header);
+    if(fwrite(header, 1, sizeof(header), out) != sizeof(header)) {
+        return -1;
+    }
+
+    /* Pack the moves four to a byte, a block at a time. */
+    for(ii = 0; ii < replay->num_moves; ii++) {
+        if(ii % 4 == 0) {
+            packed[len++] = 0;
+        }
+        packed[len - 1] |= (replay->moves[ii] & 0x3) << (2 * (ii % 4));
+        if(len == sizeof(packed) && ii % 4 == 3) {
+            if(fwrite(packed, 1, len, out) != len) {
+                return -1;
+            }
+            len = 0;
+        }
+    }
+    if(len > 0 && fwrite(packed, 1, len, out) != len) {
+        return -1;
+    }
+    return 0;
+}
+
+uint8_t *replay_encode(const replay_t *replay, size_t *len) {
+    uint8_t *record;
+    uint32_t ii;
+
+    if(replay == NULL || len == NULL) {
+        return NULL;
+    }
+    *len = REPLAY_HEADER_LEN + (replay->num_moves + 3) / 4;
+    record = calloc(*len, 1);
+    if(record == NULL) {
+        return NULL;
+    }
+    replay_encode_header(replay, record);
+    for(ii = 0; ii < replay->num_moves; ii++) {
+        record[REPLAY_HEADER_LEN + ii / 4] |= (replay->moves[ii] & 0x3) << (2 * (ii % 4));
+    }
+    return record;
+}
+
+int replay_decode(const uint8_t *in, size_t len, replay_t *replay) {
+    uint32_t ii;
+
+    if(in == NULL || replay == NULL || len < REPLAY_HEADER_LEN) {
+        return -1;
+    }
+    if(replay_decode_header(in, replay) < 0) {
+        return -1;
+    }
+    if(len < REPLAY_HEADER_LEN + ((size_t) replay->num_moves + 3) / 4) {
+        return -1;
+    }
+    if(reserve_moves(replay, replay->num_moves) < 0) {
+        return -1;
+    }
+    in += REPLAY_HEADER_LEN;
+    for(ii = 0; ii < replay->num_moves; ii++) {
+        replay->moves[ii] = (in[ii / 4] >> (2 * (ii % 4))) & 0x3;
+    }
+    return 0;
+}
+
+int replay_append(const char *path, const replay_t *replay) {
+    uint8_t *record;
+    size_t len;
+    int fd;
+    int rt = 0;
+
+    if(path == NULL || replay == NULL) {
+        return -1;
+    }
+
+    /* Build the whole record, so it goes out in one write. */
+    record = replay_encode(replay, &len);
+    if(record == NULL) {
+        return -1;
+    }
+
+    /*
+     * With O_APPEND, each write lands whole at the end of the file, so
+     * games finished at the same moment by other threads or processes
+     * do not interleave with this one.
+     */
+    fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if(fd < 0) {
+        free(record);
+        return -1;
+    }
+    if(write(fd, record, len) != (ssize_t) len) {
+        rt = -1;
+    }
+    if(close(fd) != 0) {
+        rt = -1;
+    }
+    free(record);
+    return rt;
+}
+
+int replay_read(FILE *in, replay_t *replay) {
+    uint8_t header[REPLAY_HEADER_LEN];
+    uint8_t packed[256];
+    uint32_t ii, jj, count;
+    size_t got, want;
+
+    if(in == NULL || replay == NULL) {
+        return -1;
+    }
+
+    got = fread(header, 1, sizeof(header), in);
+    if(got == 0 && feof(in)) {
+        return 0;
+    }
+    if(got != sizeof(header) || replay_decode_header(header, replay) < 0) {
+        return -1;
+    }
+    count = replay->num_moves;
+    if(reserve_moves(replay, count) < 0) {
+        return -1;
+    }
+
+    /* Unpack the moves a block at a time. */
+    for(ii = 0; ii < count; ii += 4 * sizeof(packed)) {
+        want = (count - ii + 3) / 4;
+        if(want > sizeof(packed)) {
+            want = sizeof(packed);
+        }
+        if(fread(packed, 1, want, in) != want) {
+            return -1;
+        }
+        for(jj = 0; jj < 4 * want && ii + jj < count; jj++) {
+            replay->moves[ii + jj] = (packed[jj / 4] >> (2 * (jj % 4))) & 0x3;
+        }
+    }
+    return 1;
+}
+
+void replay_cursor_start(replay_cursor_t *cursor, const replay_t *replay) {
+    cursor->replay = replay;
+    cursor->score = 0;
+    cursor->played = 0;
+    engine_rng_seed(&cursor->rng, replay->seed);
+    engine_new_game(cursor->grid, &cursor->rng);
+}
+
+int replay_cursor_step(replay_cursor_t *cursor) {
+    const replay_t *replay = cursor->replay;
+
+    if(cursor->played >= replay->num_moves) {
+        return 0;
+    }
+    if(!engine_move(cursor->grid, replay->moves[cursor->played], &cursor->score)) {
+        return -1;
+    }
+    cursor->played++;
+    if(!engine_is_won(cursor->grid, replay->winning_tile)) {
+        engine_spawn(cursor->grid, &cursor->rng, NULL, NULL);
+    }
+    return 1;
+}
@@ -0,0 +1,225 @@
+/** @file replay.h
+ *  @brief Recording and reading back finished games.
+ *
+ *  A replay holds a game's seed, its winning tile and its moves, which
+ *  is all the engine needs to play the game again.  It also keeps a
+ *  summary of how the game ended, so tools can pick games without
+ *  replaying them.
+ *
+ *  Replays are stored back to back in archive files.  Each one is a
+ *  fixed header followed by the moves, packed four to a byte:
+ *
+ *      offset  size  field
+ *      0       4     magic, "RPLY"
+ *      4       2     version
+ *      6       1     result
+ *      7       1     reserved, 0
+ *      8       8     seed
+ *      16      4     winning tile
+ *      20      4     final score
+ *      24      4     max tile
+ *      28      4     number of moves
+ *      32      ...   moves, 2 bits each, first move in the low bits
+ *
+ *  All numbers are little endian.
+ *
+ *  @bug None known.
+ */
+
+#ifndef _REPLAY_H_
+#define _REPLAY_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "game.h"
+#include "engine.h"
+
+/** Identifies a replay record, "RPLY" read as little endian */
+#define REPLAY_MAGIC 0x594c5052u
+/** The current record version */
+#define REPLAY_VERSION 1
+/** Size of the record header, in bytes */
+#define REPLAY_HEADER_LEN 32
+/** Longest game a record may hold, to bound what a reader allocates */
+#define REPLAY_MAX_MOVES (1 << 24)
+
+/** The player quit before the game ended */
+#define REPLAY_RESULT_QUIT 0
+/** The winning tile was reached */
+#define REPLAY_RESULT_WON 1
+/** No move was left */
+#define REPLAY_RESULT_LOST 2
+
+/** @brief A recorded game.
+ */
+typedef struct replay_t {
+    /** The seed of the game's tile generator */
+    uint64_t seed;
+    /** The tile that wins the game */
+    uint32_t winning_tile;
+    /** The score when the game ended */
+    uint32_t final_score;
+    /** The largest tile when the game ended */
+    uint32_t max_tile;
+    /** One of the REPLAY_RESULT_ constants */
+    uint8_t result;
+    /** The number of moves */
+    uint32_t num_moves;
+    /** The moves, one DIR_ constant per byte */
+    uint8_t *moves;
+    /** The number of moves there is room for */
+    uint32_t capacity;
+} replay_t;
+
+/** @brief Plays a replay back one move at a time.
+ */
+typedef struct replay_cursor_t {
+    /** The replay being played */
+    const replay_t *replay;
+    /** The tile generator, as seeded for the game */
+    engine_rng_t rng;
+    /** The board */
+    int grid[GRID_SIZE][GRID_SIZE];
+    /** The score */
+    unsigned int score;
+    /** The number of moves played so far */
+    uint32_t played;
+} replay_cursor_t;
+
+/** @brief Set up an empty replay.
+ *
+ * @param replay The replay.
+ * @return None.
+ */
+void replay_init(replay_t *replay);
+
+/** @brief Free the moves of a replay.
+ *
+ * The replay is left empty, and may be used again.
+ *
+ * @param replay The replay.
+ * @return None.
+ */
+void replay_free(replay_t *replay);
+
+/** @brief Start recording a new game.
+ *
+ * Moves already recorded are dropped, but their memory is kept.
+ *
+ * @param replay The replay.
+ * @param seed The seed of the game's tile generator.
+ * @param winning_tile The tile that wins the game.
+ * @return None.
+ */
+void replay_start(replay_t *replay, uint64_t seed, uint32_t winning_tile);
+
+/** @brief Record a move.
+ *
+ * @param replay The replay.
+ * @param dir One of the DIR_ constants.
+ * @return 0 on success, -1 if out of memory or the game is too long.
+ */
+int replay_add_move(replay_t *replay, int dir);
+
+/** @brief Record how a game ended.
+ *
+ * @param replay The replay.
+ * @param result One of the REPLAY_RESULT_ constants.
+ * @param grid The final board.
+ * @param score The final score.
+ * @return None.
+ */
+void replay_finish(
+        replay_t *replay,
+        int result,
+        int grid[GRID_SIZE][GRID_SIZE],
+        uint32_t score);
+
+/** @brief Write a replay record to a file.
+ *
+ * @param out The file.
+ * @param replay The replay.
+ * @return 0 on success, -1 on a write error.
+ */
+int replay_write(FILE *out, const replay_t *replay);
+
+/** @brief Encode a whole replay record, header and packed moves.
+ *
+ * @param replay The replay.
+ * @param len Set to the length of the record.
+ * @return The record, to be freed by the caller, or NULL if out of
+ *         memory.
+ */
+uint8_t *replay_encode(const replay_t *replay, size_t *len);
+
+/** @brief Decode a whole replay record, as made by replay_encode.
+ *
+ * The replay's move buffer is reused, and grown if needed.
+ *
+ * @param in The record.
+ * @param len The number of bytes in the record.
+ * @param replay The replay to read into.
+ * @return 0 on success, -1 on a malformed record or out of memory.
+ */
+int replay_decode(const uint8_t *in, size_t len, replay_t *replay);
+
+/** @brief Append a replay to an archive file.
+ *
+ * The record is written with a single write, so any number of threads
+ * or processes may append to the same archive.
+ *
+ * @param path The archive file, created if needed.
+ * @param replay The replay.
+ * @return 0 on success, -1 on error.
+ */
+int replay_append(const char *path, const replay_t *replay);
+
+/** @brief Read the next replay record from a file.
+ *
+ * The replay's move buffer is reused, and grown if needed.
+ *
+ * @param in The file.
+ * @param replay The replay to read into.
+ * @return 1 if a replay was read, 0 at the end of the file, -1 on a
+ *         malformed record or read error.
+ */
+int replay_read(FILE *in, replay_t *replay);
+
+/** @brief Start playing a replay, from the opening board.
+ *
+ * @param cursor The cursor.
+ * @param replay The replay, which must outlive the cursor.
+ * @return None.
+ */
+void replay_cursor_start(replay_cursor_t *cursor, const replay_t *replay);
+
+/** @brief Play the next move of a replay.
+ *
+ * A new tile is placed after each move, as in the game, except after
+ * the move that reaches the winning tile.
+ *
+ * @param cursor The cursor.
+ * @return 1 if a move was played, 0 if there are no more moves, -1 if
+ *         the move does not move anything, so the replay is corrupt.
+ */
+int replay_cursor_step(replay_cursor_t *cursor);
+
+/** @brief Encode a replay header.
+ *
+ * @param replay The replay.
+ * @param out REPLAY_HEADER_LEN bytes to write into.
+ * @return None.
+ */
+void replay_encode_header(const replay_t *replay, uint8_t *out);
+
+/** @brief Decode a replay header.
+ *
+ * The moves are not touched.
+ *
+ * @param in REPLAY_HEADER_LEN bytes to read.
+ * @param replay The replay to fill in.
+ * @return 0 on success, -1 if the header is not a valid replay header.
+ */
+int replay_decode_header(const uint8_t *in, replay_t *replay);
+
+#endif
@@ -0,0 +1,690 @@
+/** @file segment.c
+ *  @brief Implementation of segment files.
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bytes.h"
+#include "segment.h"
+
+/** Longest varint, for a 64 bit number */
+#define MAX_VARINT_LEN 10
+
+/***** Function prototypes ******/
+
+/** @brief Make room for more bytes in a buffer.
+ *
+ * @param buf The buffer.
+ * @param more The number of bytes to make room for.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int buf_reserve(segment_buf_t *buf, size_t more);
+
+/** @brief Add a varint to a buffer, which has room for it.
+ *
+ * @param buf The buffer.
+ * @param value The number.
+ * @return None.
+ */
+static void buf_put_varint(segment_buf_t *buf, uint64_t value);
+
+/** @brief Read a varint.
+ *
+ * @param in The next byte to read, moved past the varint.
+ * @param end The end of the bytes that may be read.
+ * @param value Set to the number.
+ * @return 0 on success, -1 if the varint runs past end or is too long.
+ */
+static int get_varint(const uint8_t **in, const uint8_t *end, uint64_t *value);
+
+/** @brief Write bytes to a segment, noting any failure.
+ *
+ * @param writer The writer.
+ * @param data The bytes.
+ * @param len The number of bytes.
+ * @return None.
+ */
+static void write_bytes(segment_writer_t *writer, const void *data, size_t len);
+
+/** @brief Write the block being filled, and add it to the index.
+ *
+ * @param writer The writer.
+ * @return 0 on success, -1 on a write error or out of memory.
+ */
+static int flush_block(segment_writer_t *writer);
+
+/** @brief Encode an index entry.
+ *
+ * @param info The entry.
+ * @param out SEGMENT_INDEX_ENTRY_LEN bytes to write into.
+ * @return None.
+ */
+static void encode_block_info(const segment_block_info_t *info, uint8_t *out);
+
+/** @brief Decode an index entry.
+ *
+ * @param in SEGMENT_INDEX_ENTRY_LEN bytes to read.
+ * @param info Set to the entry.
+ * @return None.
+ */
+static void decode_block_info(const uint8_t *in, segment_block_info_t *info);
+
+/***** Function definitions ******/
+
+int buf_reserve(segment_buf_t *buf, size_t more) {
+    size_t cap;
+    uint8_t *grown;
+
+    if(buf->len + more <= buf->cap) {
+        return 0;
+    }
+    cap = buf->cap ? buf->cap : 4096;
+    while(cap < buf->len + more) {
+        cap *= 2;
+    }
+    grown = realloc(buf->data, cap);
+    if(grown == NULL) {
+        return -1;
+    }
+    buf->data = grown;
+    buf->cap = cap;
+    return 0;
+}
+
+void buf_put_varint(segment_buf_t *buf, uint64_t value) {
+    while(value >= 0x80) {
+        buf->data[buf->len++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    buf->data[buf->len++] = value;
+}
+
+int get_varint(const uint8_t **in, const uint8_t *end, uint64_t *value) {
+    const uint8_t *p = *in;
+    uint64_t result = 0;
+    int shift = 0;
+
+    while(p < end && shift < 7 * MAX_VARINT_LEN) {
+        result |= (uint64_t) (*p & 0x7F) << shift;
+        if((*p++ & 0x80) == 0) {
+            *in = p;
+            *value = result;
+            return 0;
+        }
+        shift += 7;
+    }
+    return -1;
+}
+
+void write_bytes(segment_writer_t *writer, const void *data, size_t len) {
+    if(len > 0 && fwrite(data, 1, len, writer->out) != len) {
+        writer->failed = 1;
+    }
+    writer->offset += len;
+}
+
+void encode_block_info(const segment_block_info_t *info, uint8_t *out) {
+    memset(out, 0, SEGMENT_INDEX_ENTRY_LEN);
+    put_u64(out, info->offset);
+    put_u32(out + 8, info->length);
+    put_u32(out + 12, info->count);
+    put_u64(out + 16, info->first_seed);
+    put_u64(out + 24, info->last_seed);
+    put_u32(out + 32, info->min_score);
+    put_u32(out + 36, info->max_score);
+    put_u32(out + 40, info->min_moves);
+    put_u32(out + 44, info->max_moves);
+    out[48] = info->min_max_tile;
+    out[49] = info->max_max_tile;
+    out[50] = info->min_winning;
+    out[51] = info->max_winning;
+    out[52] = info->results;
+}
+
+void decode_block_info(const uint8_t *in, segment_block_info_t *info) {
+    info->offset = get_u64(in);
+    info->length = get_u32(in + 8);
+    info->count = get_u32(in + 12);
+    info->first_seed = get_u64(in + 16);
+    info->last_seed = get_u64(in + 24);
+    info->min_score = get_u32(in + 32);
+    info->max_score = get_u32(in + 36);
+    info->min_moves = get_u32(in + 40);
+    info->max_moves = get_u32(in + 44);
+    info->min_max_tile = in[48];
+    info->max_max_tile = in[49];
+    info->min_winning = in[50];
+    info->max_winning = in[51];
+    info->results = in[52];
+}
+
+int segment_record_ok(const segment_record_t *rec) {
+    return rec->result < SEGMENT_RESULTS
+        && engine_tile_log2(rec->winning_tile) >= 0
+        && engine_tile_log2(rec->max_tile) >= 0
+        && rec->num_moves <= REPLAY_MAX_MOVES
+        && (rec->moves != NULL || rec->num_moves == 0);
+}
+
+int segment_record_compare(const segment_record_t *a, const segment_record_t *b) {
+    if(a->seed != b->seed) {
+        return a->seed < b->seed ? -1 : 1;
+    }
+    if(a->winning_tile != b->winning_tile) {
+        return a->winning_tile < b->winning_tile ? -1 : 1;
+    }
+    if(a->num_moves != b->num_moves) {
+        return a->num_moves < b->num_moves ? -1 : 1;
+    }
+    if(a->num_moves == 0) {
+        return 0;
+    }
+    return memcmp(a->moves, b->moves, (a->num_moves + 3) / 4);
+}
+
+int segment_record_to_replay(const segment_record_t *rec, replay_t *replay) {
+    uint32_t ii;
+
+    replay_start(replay, rec->seed, rec->winning_tile);
+    replay->result = rec->result;
+    replay->final_score = rec->final_score;
+    replay->max_tile = rec->max_tile;
+    for(ii = 0; ii < rec->num_moves; ii++) {
+        if(replay_add_move(replay, (rec->moves[ii / 4] >> (2 * (ii % 4))) & 0x3) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int segment_writer_open(segment_writer_t *writer, const char *path, int codec) {
+    uint8_t header[SEGMENT_HEADER_LEN];
+    int fd;
+
+    memset(writer, 0, sizeof(*writer));
+    if(codec != SEGMENT_CODEC_PACKED && codec != SEGMENT_CODEC_CONTEXT) {
+        return -1;
+    }
+    writer->codec = codec;
+    fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if(fd < 0) {
+        return -1;
+    }
+    writer->out = fdopen(fd, "wb");
+    if(writer->out == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    memset(header, 0, sizeof(header));
+    put_u32(header, SEGMENT_MAGIC);
+    put_u16(header + 4, SEGMENT_VERSION);
+    header[6] = codec;
+    write_bytes(writer, header, sizeof(header));
+    return writer->failed ? -1 : 0;
+}
+
+int segment_writer_add(segment_writer_t *writer, const segment_record_t *rec) {
+    segment_block_info_t *block = &writer->block;
+    segment_buf_t *columns = writer->columns;
+    size_t moves_len = writer->codec == SEGMENT_CODEC_PACKED ? (rec->num_moves + 3) / 4 : 0;
+    int winning, max_tile;
+    int ii;
+
+    if(!segment_record_ok(rec) || (writer->num_games > 0 && rec->seed < writer->last_seed)) {
+        return -1;
+    }
+    for(ii = 0; ii < SEGMENT_COLUMNS; ii++) {
+        if(buf_reserve(&columns[ii], ii == SEGMENT_COL_MOVES ? moves_len : MAX_VARINT_LEN) < 0) {
+            return -1;
+        }
+    }
+    winning = engine_tile_log2(rec->winning_tile);
+    max_tile = engine_tile_log2(rec->max_tile);
+
+    if(block->count == 0) {
+        block->first_seed = rec->seed;
+        block->min_score = block->max_score = rec->final_score;
+        block->min_moves = block->max_moves = rec->num_moves;
+        block->min_max_tile = block->max_max_tile = max_tile;
+        block->min_winning = block->max_winning = winning;
+        buf_put_varint(&columns[SEGMENT_COL_SEED], rec->seed);
+        if(writer->codec == SEGMENT_CODEC_CONTEXT) {
+            move_encoder_start(&writer->coder);
+        }
+    } else {
+        buf_put_varint(&columns[SEGMENT_COL_SEED], rec->seed - block->last_seed);
+    }
+    columns[SEGMENT_COL_RESULT].data[columns[SEGMENT_COL_RESULT].len++] = rec->result;
+    columns[SEGMENT_COL_WINNING].data[columns[SEGMENT_COL_WINNING].len++] = winning;
+    columns[SEGMENT_COL_MAX_TILE].data[columns[SEGMENT_COL_MAX_TILE].len++] = max_tile;
+    buf_put_varint(&columns[SEGMENT_COL_SCORE], rec->final_score);
+    buf_put_varint(&columns[SEGMENT_COL_NUM_MOVES], rec->num_moves);
+    if(writer->codec == SEGMENT_CODEC_CONTEXT) {
+        if(move_encoder_add(&writer->coder, rec->seed, rec->winning_tile,
+                rec->moves, rec->num_moves) < 0) {
+            return -1;
+        }
+    } else if(moves_len > 0) {
+        memcpy(columns[SEGMENT_COL_MOVES].data + columns[SEGMENT_COL_MOVES].len,
+            rec->moves, moves_len);
+        columns[SEGMENT_COL_MOVES].len += moves_len;
+    }
+
+    /* Widen the block's ranges for the index. */
+    block->last_seed = rec->seed;
+    if(rec->final_score < block->min_score) {
+        block->min_score = rec->final_score;
+    }
+    if(rec->final_score > block->max_score) {
+        block->max_score = rec->final_score;
+    }
+    if(rec->num_moves < block->min_moves) {
+        block->min_moves = rec->num_moves;
+    }
+    if(rec->num_moves > block->max_moves) {
+        block->max_moves = rec->num_moves;
+    }
+    if(max_tile < block->min_max_tile) {
+        block->min_max_tile = max_tile;
+    }
+    if(max_tile > block->max_max_tile) {
+        block->max_max_tile = max_tile;
+    }
+    if(winning < block->min_winning) {
+        block->min_winning = winning;
+    }
+    if(winning > block->max_winning) {
+        block->max_winning = winning;
+    }
+    block->results |= 1 << rec->result;
+    block->count++;
+
+    writer->last_seed = rec->seed;
+    writer->num_games++;
+    if(block->count == SEGMENT_BLOCK_GAMES) {
+        return flush_block(writer);
+    }
+    return writer->failed ? -1 : 0;
+}
+
+int flush_block(segment_writer_t *writer) {
+    uint8_t header[SEGMENT_BLOCK_HEADER_LEN];
+    segment_block_info_t *grown;
+    segment_buf_t *moves;
+    uint32_t cap;
+    int ii;
+
+    if(writer->block.count == 0) {
+        return 0;
+    }
+    if(writer->codec == SEGMENT_CODEC_CONTEXT) {
+        moves = &writer->columns[SEGMENT_COL_MOVES];
+        if(move_encoder_finish(&writer->coder) < 0
+                || buf_reserve(moves, writer->coder.len) < 0) {
+            return -1;
+        }
+        memcpy(moves->data + moves->len, writer->coder.data, writer->coder.len);
+        moves->len += writer->coder.len;
+    }
+    if(writer->num_blocks == writer->index_cap) {
+        cap = writer->index_cap ? writer->index_cap * 2 : 64;
+        grown = realloc(writer->index, sizeof(*grown) * cap);
+        if(grown == NULL) {
+            return -1;
+        }
+        writer->index = grown;
+        writer->index_cap = cap;
+    }
+
+    memset(header, 0, sizeof(header));
+    put_u32(header, writer->block.count);
+    writer->block.offset = writer->offset;
+    for(ii = 0; ii < SEGMENT_COLUMNS; ii++) {
+        put_u32(header + 4 + 4 * ii, writer->columns[ii].len);
+    }
+    write_bytes(writer, header, sizeof(header));
+    for(ii = 0; ii < SEGMENT_COLUMNS; ii++) {
+        write_bytes(writer, writer->columns[ii].data, writer->columns[ii].len);
+        writer->columns[ii].len = 0;
+    }
+    writer->block.length = writer->offset - writer->block.offset;
+    writer->index[writer->num_blocks++] = writer->block;
+    memset(&writer->block, 0, sizeof(writer->block));
+    return writer->failed ? -1 : 0;
+}
+
+int segment_writer_close(segment_writer_t *writer) {
+    uint8_t entry[SEGMENT_INDEX_ENTRY_LEN];
+    uint8_t trailer[SEGMENT_TRAILER_LEN];
+    uint64_t index_offset;
+    uint32_t ii;
+    int rt;
+
+    rt = flush_block(writer);
+    index_offset = writer->offset;
+    for(ii = 0; ii < writer->num_blocks; ii++) {
+        encode_block_info(&writer->index[ii], entry);
+        write_bytes(writer, entry, sizeof(entry));
+    }
+    memset(trailer, 0, sizeof(trailer));
+    put_u32(trailer, SEGMENT_TRAILER_MAGIC);
+    put_u16(trailer + 4, SEGMENT_VERSION);
+    put_u32(trailer + 8, writer->num_blocks);
+    put_u64(trailer + 16, writer->num_games);
+    put_u64(trailer + 24, index_offset);
+    write_bytes(writer, trailer, sizeof(trailer));
+
+    if(fclose(writer->out) != 0 || writer->failed) {
+        rt = -1;
+    }
+    for(ii = 0; ii < SEGMENT_COLUMNS; ii++) {
+        free(writer->columns[ii].data);
+    }
+    free(writer->index);
+    move_encoder_free(&writer->coder);
+    memset(writer, 0, sizeof(*writer));
+    return rt;
+}
+
+int segment_open(segment_t *seg, const char *path) {
+    const uint8_t *trailer;
+    segment_block_info_t *info;
+    struct stat st;
+    uint64_t index_offset;
+    uint32_t ii;
+    void *map;
+    int fd;
+
+    memset(seg, 0, sizeof(*seg));
+    fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return -1;
+    }
+    if(fstat(fd, &st) < 0 || st.st_size < SEGMENT_HEADER_LEN + SEGMENT_TRAILER_LEN) {
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        return -1;
+    }
+    seg->data = map;
+    seg->len = st.st_size;
+
+    trailer = seg->data + seg->len - SEGMENT_TRAILER_LEN;
+    if(get_u32(seg->data) != SEGMENT_MAGIC || get_u16(seg->data + 4) != SEGMENT_VERSION
+            || get_u32(trailer) != SEGMENT_TRAILER_MAGIC
+            || seg->data[6] > SEGMENT_CODEC_CONTEXT) {
+        segment_close(seg);
+        return -1;
+    }
+    seg->codec = seg->data[6];
+    seg->num_blocks = get_u32(trailer + 8);
+    seg->num_games = get_u64(trailer + 16);
+    index_offset = get_u64(trailer + 24);
+    if(index_offset < SEGMENT_HEADER_LEN
+            || index_offset > seg->len - SEGMENT_TRAILER_LEN
+            || (seg->len - SEGMENT_TRAILER_LEN - index_offset)
+                != (uint64_t) seg->num_blocks * SEGMENT_INDEX_ENTRY_LEN) {
+        segment_close(seg);
+        return -1;
+    }
+
+    seg->index = malloc(sizeof(*seg->index) * (seg->num_blocks ? seg->num_blocks : 1));
+    if(seg->index == NULL) {
+        segment_close(seg);
+        return -1;
+    }
+    for(ii = 0; ii < seg->num_blocks; ii++) {
+        info = &seg->index[ii];
+        decode_block_info(seg->data + index_offset + ii * SEGMENT_INDEX_ENTRY_LEN, info);
+        if(info->offset < SEGMENT_HEADER_LEN || info->offset > index_offset
+                || info->length > index_offset - info->offset
+                || info->count > SEGMENT_BLOCK_GAMES) {
+            segment_close(seg);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void segment_close(segment_t *seg) {
+    if(seg->data != NULL) {
+        munmap((void*) seg->data, seg->len);
+    }
+    free(seg->index);
+    memset(seg, 0, sizeof(*seg));
+}
+
+int segment_read_block(
+        const segment_t *seg,
+        uint32_t index,
+        int columns,
+        segment_block_t *block) {
+    const segment_block_info_t *info;
+    const uint8_t *start[SEGMENT_COLUMNS];
+    const uint8_t *end[SEGMENT_COLUMNS];
+    const uint8_t *p, *block_end;
+    move_decoder_t decoder;
+    uint64_t value, seed = 0;
+    size_t moves_len, total;
+    uint32_t count, ii;
+    int col;
+
+    if(index >= seg->num_blocks) {
+        return -1;
+    }
+    info = &seg->index[index];
+    if(info->length < SEGMENT_BLOCK_HEADER_LEN) {
+        return -1;
+    }
+    p = seg->data + info->offset;
+    block_end = p + info->length;
+    count = get_u32(p);
+    if(count != info->count) {
+        return -1;
+    }
+
+    /* Find each column; they must fill the block exactly. */
+    start[0] = p + SEGMENT_BLOCK_HEADER_LEN;
+    for(col = 0; col < SEGMENT_COLUMNS; col++) {
+        if(col > 0) {
+            start[col] = end[col - 1];
+        }
+        if(get_u32(p + 4 + 4 * col) > (size_t) (block_end - start[col])) {
+            return -1;
+        }
+        end[col] = start[col] + get_u32(p + 4 + 4 * col);
+    }
+    if(end[SEGMENT_COLUMNS - 1] != block_end) {
+        return -1;
+    }
+    for(col = SEGMENT_COL_RESULT; col <= SEGMENT_COL_MAX_TILE; col++) {
+        if(end[col] - start[col] != count) {
+            return -1;
+        }
+    }
+    if(columns & SEGMENT_READ(SEGMENT_COL_MOVES)) {
+        columns |= SEGMENT_READ(SEGMENT_COL_NUM_MOVES);
+        if(seg->codec == SEGMENT_CODEC_CONTEXT) {
+            columns |= SEGMENT_READ(SEGMENT_COL_SEED) | SEGMENT_READ(SEGMENT_COL_WINNING);
+        }
+    }
+
+    block->count = count;
+    if(columns & SEGMENT_READ(SEGMENT_COL_SEED)) {
+        p = start[SEGMENT_COL_SEED];
+        for(ii = 0; ii < count; ii++) {
+            if(get_varint(&p, end[SEGMENT_COL_SEED], &value) < 0) {
+                return -1;
+            }
+            seed += value;
+            block->seed[ii] = seed;
+        }
+    }
+    if(columns & SEGMENT_READ(SEGMENT_COL_RESULT)) {
+        memcpy(block->result, start[SEGMENT_COL_RESULT], count);
+        /* Each result must be one the block's index says it holds. */
+        for(ii = 0; ii < count; ii++) {
+            if(block->result[ii] >= SEGMENT_RESULTS
+                    || !(info->results & (1 << block->result[ii]))) {
+                return -1;
+            }
+        }
+    }
+    if(columns & SEGMENT_READ(SEGMENT_COL_WINNING)) {
+        p = start[SEGMENT_COL_WINNING];
+        for(ii = 0; ii < count; ii++) {
+            block->winning_tile[ii] = (p[ii] && p[ii] < 32) ? (uint32_t) 1 << p[ii] : 0;
+        }
+    }
+    if(columns & SEGMENT_READ(SEGMENT_COL_MAX_TILE)) {
+        p = start[SEGMENT_COL_MAX_TILE];
+        for(ii = 0; ii < count; ii++) {
+            block->max_tile[ii] = (p[ii] && p[ii] < 32) ? (uint32_t) 1 << p[ii] : 0;
+        }
+    }
+    if(columns & SEGMENT_READ(SEGMENT_COL_SCORE)) {
+        p = start[SEGMENT_COL_SCORE];
+        for(ii = 0; ii < count; ii++) {
+            if(get_varint(&p, end[SEGMENT_COL_SCORE], &value) < 0) {
+                return -1;
+            }
+            block->final_score[ii] = value;
+        }
+    }
+    if(columns & SEGMENT_READ(SEGMENT_COL_NUM_MOVES)) {
+        p = start[SEGMENT_COL_NUM_MOVES];
+        for(ii = 0; ii < count; ii++) {
+            if(get_varint(&p, end[SEGMENT_COL_NUM_MOVES], &value) < 0
+                    || value > REPLAY_MAX_MOVES) {
+                return -1;
+            }
+            block->num_moves[ii] = value;
+        }
+    }
+    if((columns & SEGMENT_READ(SEGMENT_COL_MOVES)) && seg->codec == SEGMENT_CODEC_CONTEXT) {
+        /* The games share one stream, so they are decoded all at once. */
+        total = 0;
+        for(ii = 0; ii < count; ii++) {
+            total += (block->num_moves[ii] + 3) / 4;
+        }
+        block->decoded.len = 0;
+        if(buf_reserve(&block->decoded, total) < 0) {
+            return -1;
+        }
+        move_decoder_start(&decoder, start[SEGMENT_COL_MOVES],
+            end[SEGMENT_COL_MOVES] - start[SEGMENT_COL_MOVES]);
+        for(ii = 0; ii < count; ii++) {
+            block->moves[ii] = block->decoded.data + block->decoded.len;
+            if(block->num_moves[ii] > 0
+                    && move_decoder_next(&decoder, block->seed[ii], block->winning_tile[ii],
+                        block->decoded.data + block->decoded.len, block->num_moves[ii]) < 0) {
+                return -1;
+            }
+            block->decoded.len += (block->num_moves[ii] + 3) / 4;
+        }
+    } else if(columns & SEGMENT_READ(SEGMENT_COL_MOVES)) {
+        p = start[SEGMENT_COL_MOVES];
+        for(ii = 0; ii < count; ii++) {
+            moves_len = (block->num_moves[ii] + 3) / 4;
+            if(moves_len > (size_t) (end[SEGMENT_COL_MOVES] - p)) {
+                return -1;
+            }
+            block->moves[ii] = p;
+            p += moves_len;
+        }
+    }
+    return 0;
+}
+
+void segment_block_free(segment_block_t *block) {
+    free(block->decoded.data);
+    memset(&block->decoded, 0, sizeof(block->decoded));
+}
+
+void segment_block_record(const segment_block_t *block, uint32_t ii, segment_record_t *rec) {
+    rec->seed = block->seed[ii];
+    rec->winning_tile = block->winning_tile[ii];
+    rec->final_score = block->final_score[ii];
+    rec->max_tile = block->max_tile[ii];
+    rec->result = block->result[ii];
+    rec->num_moves = block->num_moves[ii];
+    rec->moves = block->moves[ii];
+}
+
+int segment_is_segment(const char *path) {
+    uint8_t magic[4];
+    FILE *in;
+    int rt = 0;
+
+    in = fopen(path, "rb");
+    if(in == NULL) {
+        return 0;
+    }
+    if(fread(magic, 1, sizeof(magic), in) == sizeof(magic)) {
+        rt = get_u32(magic) == SEGMENT_MAGIC;
+    }
+    fclose(in);
+    return rt;
+}
+
+void segment_queue_init(
+        segment_queue_t *queue,
+        const segment_t *segments,
+        int num_segments,
+        uint32_t per_take) {
+    queue->segments = segments;
+    queue->num_segments = num_segments;
+    queue->per_take = per_take;
+    pthread_mutex_init(&queue->lock, NULL);
+    queue->next_segment = 0;
+    queue->next_block = 0;
+    queue->failed = 0;
+}
+
+int segment_queue_take(segment_queue_t *queue, int *segment, uint32_t *first, uint32_t *count) {
+    uint32_t left;
+    int rt = 0;
+
+    pthread_mutex_lock(&queue->lock);
+    while(queue->next_segment < queue->num_segments && !queue->failed) {
+        left = queue->segments[queue->next_segment].num_blocks - queue->next_block;
+        if(left == 0) {
+            queue->next_segment++;
+            queue->next_block = 0;
+            continue;
+        }
+        *segment = queue->next_segment;
+        *first = queue->next_block;
+        *count = left < queue->per_take ? left : queue->per_take;
+        queue->next_block += *count;
+        rt = 1;
+        break;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return rt;
+}
+
+void segment_queue_fail(segment_queue_t *queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->failed = 1;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+int segment_queue_failed(segment_queue_t *queue) {
+    int failed;
+
+    pthread_mutex_lock(&queue->lock);
+    failed = queue->failed;
+    pthread_mutex_unlock(&queue->lock);
+    return failed;
+}
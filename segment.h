@@ -0,0 +1,397 @@
+/** @file segment.h
+ *  @brief Sorted, indexed files of many replays.
+ *
+ *  A segment holds any number of games, sorted by seed, in blocks of up
+ *  to SEGMENT_BLOCK_GAMES.  Within a block each field of the games is
+ *  stored as a column of its own, so a reader can skip the fields it
+ *  does not need, and a footer indexes the blocks with the range of
+ *  each field, so a reader can skip whole blocks too.
+ *
+ *      offset  size  field
+ *      0       4     magic, "RSEG"
+ *      4       2     version
+ *      6       1     how the moves are coded, a SEGMENT_CODEC_ constant
+ *      7       9     reserved, 0
+ *      16      ...   blocks
+ *      ...     ...   index, SEGMENT_INDEX_ENTRY_LEN bytes per block
+ *      end-32  32    trailer
+ *
+ *  A block is a SEGMENT_BLOCK_HEADER_LEN byte header, the number of
+ *  games and then the length of each column, followed by the columns in
+ *  SEGMENT_COL_ order:
+ *
+ *      seed        varint, the first from 0, the rest from the one before
+ *      result      1 byte per game
+ *      winning     1 byte, log2 of the winning tile
+ *      max tile    1 byte, log2 of the largest tile
+ *      score       varint
+ *      moves count varint
+ *      moves       with SEGMENT_CODEC_PACKED, each game's moves, starting
+ *                  on a byte; with SEGMENT_CODEC_CONTEXT, one stream of
+ *                  the whole block's moves, from move_coder.h
+ *
+ *  An index entry is the block's offset (8 bytes), length (4), number of
+ *  games (4), first and last seed (8 each), least and greatest score (4
+ *  each), least and greatest number of moves (4 each), least and
+ *  greatest max tile and winning tile (1 each, log2), a mask of the
+ *  results present (1), and 3 reserved bytes.
+ *
+ *  The trailer is the magic "RSGX" (4), the version (2), 2 reserved
+ *  bytes, the number of blocks (4), 4 reserved bytes, the number of
+ *  games (8) and the offset of the index (8).
+ *
+ *  Numbers are little endian; varints take 7 bits a byte, low first.
+ *  Tiles are stored as log2, 0 for none, so they must be powers of two.
+ *
+ *  @bug None known.
+ */
+
+#ifndef _SEGMENT_H_
+#define _SEGMENT_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "replay.h"
+#include "move_coder.h"
+
+/** Identifies a segment file, "RSEG" read as little endian */
+#define SEGMENT_MAGIC 0x47455352u
+/** Identifies a segment trailer, "RSGX" read as little endian */
+#define SEGMENT_TRAILER_MAGIC 0x58475352u
+/** The current segment version */
+#define SEGMENT_VERSION 1
+/** Size of the file header, in bytes */
+#define SEGMENT_HEADER_LEN 16
+/** Size of the trailer, in bytes */
+#define SEGMENT_TRAILER_LEN 32
+/** Size of a block header, in bytes */
+#define SEGMENT_BLOCK_HEADER_LEN 32
+/** Size of an index entry, in bytes */
+#define SEGMENT_INDEX_ENTRY_LEN 56
+/** Most games in a block */
+#define SEGMENT_BLOCK_GAMES 1024
+
+/** Moves packed four to a byte, first move in the low bits */
+#define SEGMENT_CODEC_PACKED 0
+/** Moves coded by their context, smaller but slower to read */
+#define SEGMENT_CODEC_CONTEXT 1
+
+/** The columns of a block */
+#define SEGMENT_COL_SEED 0
+#define SEGMENT_COL_RESULT 1
+#define SEGMENT_COL_WINNING 2
+#define SEGMENT_COL_MAX_TILE 3
+#define SEGMENT_COL_SCORE 4
+#define SEGMENT_COL_NUM_MOVES 5
+#define SEGMENT_COL_MOVES 6
+#define SEGMENT_COLUMNS 7
+
+/** Results a block can hold, one bit each in its results mask */
+#define SEGMENT_RESULTS 8
+
+/** Masks of columns to read, for segment_read_block */
+#define SEGMENT_READ(col) (1 << (col))
+#define SEGMENT_READ_ALL ((1 << SEGMENT_COLUMNS) - 1)
+
+/** @brief One game, as segments store it.
+ */
+typedef struct segment_record_t {
+    /** The seed of the game's tile generator */
+    uint64_t seed;
+    /** The tile that wins the game */
+    uint32_t winning_tile;
+    /** The score when the game ended */
+    uint32_t final_score;
+    /** The largest tile when the game ended */
+    uint32_t max_tile;
+    /** One of the REPLAY_RESULT_ constants */
+    uint8_t result;
+    /** The number of moves */
+    uint32_t num_moves;
+    /** The moves, packed four to a byte, first move in the low bits;
+     *  unused bits of the last byte are 0 */
+    const uint8_t *moves;
+} segment_record_t;
+
+/** @brief What the index says about a block.
+ */
+typedef struct segment_block_info_t {
+    /** Where the block starts in the file */
+    uint64_t offset;
+    /** The length of the block */
+    uint32_t length;
+    /** The number of games */
+    uint32_t count;
+    /** The first and last seed */
+    uint64_t first_seed;
+    uint64_t last_seed;
+    /** The least and greatest final score */
+    uint32_t min_score;
+    uint32_t max_score;
+    /** The least and greatest number of moves */
+    uint32_t min_moves;
+    uint32_t max_moves;
+    /** The least and greatest max tile, log2 */
+    uint8_t min_max_tile;
+    uint8_t max_max_tile;
+    /** The least and greatest winning tile, log2 */
+    uint8_t min_winning;
+    uint8_t max_winning;
+    /** Bit n is set if a game in the block has result n */
+    uint8_t results;
+} segment_block_info_t;
+
+/** @brief A growable run of bytes.
+ */
+typedef struct segment_buf_t {
+    /** The bytes */
+    uint8_t *data;
+    /** The number of bytes used */
+    size_t len;
+    /** The number of bytes there is room for */
+    size_t cap;
+} segment_buf_t;
+
+/** @brief Writes a segment file, a game at a time.
+ */
+typedef struct segment_writer_t {
+    /** The file */
+    FILE *out;
+    /** Set once a write failed */
+    int failed;
+    /** How the moves are coded, a SEGMENT_CODEC_ constant */
+    int codec;
+    /** Codes the moves of the block being filled, for SEGMENT_CODEC_CONTEXT */
+    move_encoder_t coder;
+    /** The number of bytes written so far */
+    uint64_t offset;
+    /** The number of games written so far */
+    uint64_t num_games;
+    /** The seed of the last game added */
+    uint64_t last_seed;
+    /** The block being filled */
+    segment_block_info_t block;
+    /** The columns of the block being filled */
+    segment_buf_t columns[SEGMENT_COLUMNS];
+    /** The index of the blocks written */
+    segment_block_info_t *index;
+    /** The number of entries in index */
+    uint32_t num_blocks;
+    /** The number of entries index has room for */
+    uint32_t index_cap;
+} segment_writer_t;
+
+/** @brief A segment file open for reading.
+ */
+typedef struct segment_t {
+    /** The file, mapped into memory */
+    const uint8_t *data;
+    /** The length of the file */
+    size_t len;
+    /** How the moves are coded, a SEGMENT_CODEC_ constant */
+    int codec;
+    /** The number of games */
+    uint64_t num_games;
+    /** The index */
+    segment_block_info_t *index;
+    /** The number of blocks */
+    uint32_t num_blocks;
+} segment_t;
+
+/** @brief Hands the blocks of some segments out to threads, a few at a
+ *  time, in order.
+ */
+typedef struct segment_queue_t {
+    /** The segments */
+    const segment_t *segments;
+    /** The number of segments */
+    int num_segments;
+    /** The most blocks handed out at once */
+    uint32_t per_take;
+    /** Guards everything below */
+    pthread_mutex_t lock;
+    /** The segment of the next block to hand out */
+    int next_segment;
+    /** The next block of that segment to hand out */
+    uint32_t next_block;
+    /** Set once a thread has failed, so no more blocks are handed out */
+    int failed;
+} segment_queue_t;
+
+/** @brief One block of a segment, decoded.
+ *
+ * Only the columns asked for are filled in.  Zero a block before it is
+ * first read, and free it with segment_block_free.
+ */
+typedef struct segment_block_t {
+    /** The number of games */
+    uint32_t count;
+    /** The columns */
+    uint64_t seed[SEGMENT_BLOCK_GAMES];
+    uint8_t result[SEGMENT_BLOCK_GAMES];
+    uint32_t winning_tile[SEGMENT_BLOCK_GAMES];
+    uint32_t max_tile[SEGMENT_BLOCK_GAMES];
+    uint32_t final_score[SEGMENT_BLOCK_GAMES];
+    uint32_t num_moves[SEGMENT_BLOCK_GAMES];
+    /** Each game's packed moves, in the segment's memory or in decoded */
+    const uint8_t *moves[SEGMENT_BLOCK_GAMES];
+    /** The packed moves of a block whose moves are coded, until the
+     *  next block is read */
+    segment_buf_t decoded;
+} segment_block_t;
+
+/** @brief Check that a record can be stored in a segment.
+ *
+ * @param rec The record.
+ * @return 1 if it can, 0 if not.
+ */
+int segment_record_ok(const segment_record_t *rec);
+
+/** @brief Order two records by seed, then winning tile, then moves.
+ *
+ * Two records compare equal only if they are the same game.
+ *
+ * @param a A record.
+ * @param b Another record.
+ * @return Less than, equal to or greater than 0, as with strcmp.
+ */
+int segment_record_compare(const segment_record_t *a, const segment_record_t *b);
+
+/** @brief Unpack the moves of a record into a replay.
+ *
+ * @param rec The record.
+ * @param replay The replay; its move buffer is reused, and grown if needed.
+ * @return 0 on success, -1 if out of memory.
+ */
+int segment_record_to_replay(const segment_record_t *rec, replay_t *replay);
+
+/** @brief Create a segment file.
+ *
+ * The file must not exist already.
+ *
+ * @param writer The writer.
+ * @param path The file.
+ * @param codec How to code the moves, a SEGMENT_CODEC_ constant.
+ * @return 0 on success, -1 on error.
+ */
+int segment_writer_open(segment_writer_t *writer, const char *path, int codec);
+
+/** @brief Add a game to a segment.
+ *
+ * Games must be added in order of seed.
+ *
+ * @param writer The writer.
+ * @param rec The game, which segment_record_ok accepts.
+ * @return 0 on success, -1 on a write error, out of memory or a game
+ *         out of order.
+ */
+int segment_writer_add(segment_writer_t *writer, const segment_record_t *rec);
+
+/** @brief Finish a segment file and close it.
+ *
+ * The writer is freed whether or not the file could be finished.
+ *
+ * @param writer The writer.
+ * @return 0 on success, -1 if anything written to the file failed.
+ */
+int segment_writer_close(segment_writer_t *writer);
+
+/** @brief Open a segment file for reading.
+ *
+ * @param seg The segment.
+ * @param path The file.
+ * @return 0 on success, -1 if the file cannot be read or is not a
+ *         valid segment.
+ */
+int segment_open(segment_t *seg, const char *path);
+
+/** @brief Close a segment file.
+ *
+ * @param seg The segment.
+ * @return None.
+ */
+void segment_close(segment_t *seg);
+
+/** @brief Decode some of the columns of a block.
+ *
+ * Reading the moves also reads the number of moves, and if the moves
+ * are coded by context, the seeds and winning tiles too.
+ *
+ * @param seg The segment.
+ * @param index The block.
+ * @param columns A mask of SEGMENT_READ() bits.
+ * @param block Set to the decoded block.
+ * @return 0 on success, -1 if the block is malformed.
+ */
+int segment_read_block(
+        const segment_t *seg,
+        uint32_t index,
+        int columns,
+        segment_block_t *block);
+
+/** @brief Free the memory a block decoded its moves into.
+ *
+ * @param block The block.
+ * @return None.
+ */
+void segment_block_free(segment_block_t *block);
+
+/** @brief Get one game of a block read with every column.
+ *
+ * @param block The block.
+ * @param ii The game.
+ * @param rec Set to the game, which points into the segment.
+ * @return None.
+ */
+void segment_block_record(const segment_block_t *block, uint32_t ii, segment_record_t *rec);
+
+/** @brief Check whether a file is a segment, going by its first bytes.
+ *
+ * @param path The file.
+ * @return 1 if it starts like a segment, 0 if not or it cannot be read.
+ */
+int segment_is_segment(const char *path);
+
+/** @brief Start handing out the blocks of some segments.
+ *
+ * @param queue The queue.
+ * @param segments The segments; they may be opened later, before the
+ *        first take.
+ * @param num_segments The number of segments.
+ * @param per_take The most blocks handed out at once.
+ * @return None.
+ */
+void segment_queue_init(
+        segment_queue_t *queue,
+        const segment_t *segments,
+        int num_segments,
+        uint32_t per_take);
+
+/** @brief Take the next few blocks.
+ *
+ * The blocks taken are all of one segment.
+ *
+ * @param queue The queue.
+ * @param segment Set to the segment of the blocks.
+ * @param first Set to the first block.
+ * @param count Set to the number of blocks.
+ * @return 1 if blocks were taken, 0 if none are left or a thread failed.
+ */
+int segment_queue_take(segment_queue_t *queue, int *segment, uint32_t *first, uint32_t *count);
+
+/** @brief Stop handing out blocks, because a thread failed.
+ *
+ * @param queue The queue.
+ * @return None.
+ */
+void segment_queue_fail(segment_queue_t *queue);
+
+/** @brief Check whether a thread failed.
+ *
+ * @param queue The queue.
+ * @return 1 if one did, 0 if not.
+ */
+int segment_queue_failed(segment_queue_t *queue);
+
+#endif
@@ -0,0 +1,1659 @@
+/** @file server.c
+ *  @brief Serves the game to many players at once over TCP.
+ *
+ *  Every connection gets a session of its own (see session.h), drawn
+ *  with an ANSI encoder, just as game_ansi draws into a terminal.
+ *  Players connect with telnet, which the server puts in character
+ *  mode, or with any client that sends raw keys.
+ *
+ *  The server runs one worker thread per core.  Each worker listens on
+ *  the port with SO_REUSEPORT, so the kernel spreads connections over
+ *  the workers, and a session stays on the worker that accepted it.
+ *
+ *  A worker runs its sessions from an epoll loop.  A session that waits
+ *  for a timer, for its next animation frame or the in game clock, is
+ *  put in the worker's timer wheel (see timer_wheel.h), rounded up to
+ *  the frame grid, so all the sessions that are animating come due in
+ *  the same slot.  Each pass of the loop then works in three sweeps
+ *  over the sessions that have keys or came due: first every session
+ *  is stepped, then every frame is encoded into one output buffer, and
+ *  last the frames are sent, one send per connection.  The game logic
+ *  and the encoder each stay hot in the cache for a whole sweep, and a
+ *  connection gets one send per pass however many times its session
+ *  ran.
+ *
+ *  A player who sends nothing for a while (-i, five minutes unless told
+ *  otherwise) has their session frozen once it rests on a screen: the
+ *  session and the copy of their terminal are freed, leaving the 40
+ *  byte session_cold_t and the packed moves of the game in progress.
+ *  The next key they send thaws it, and the whole screen is sent again.
+ *
+ *  Each session is charged the thread CPU time its steps and frames
+ *  take, read from CLOCK_THREAD_CPUTIME_ID between one session and the
+ *  next in each sweep, along with the bytes it was sent and sent back.
+ *  On SIGUSR1 every worker hands over its heaviest sessions and its
+ *  totals, and the server prints the -n heaviest of all to stderr, so a
+ *  hot host shows whether a few players, bots flooding it with keys or
+ *  the load as a whole is to blame.
+ *
+ *  Each player's moves are metered by a token bucket: a burst of up to
+ *  KEY_BURST move keys goes through at once, and after that -k a
+ *  second.  Moves past the limit are cut before they reach the session,
+ *  so a bot or a stuck key cannot keep a worker busy or fill the
+ *  session's key queue ahead of the player.  A cut move that repeats
+ *  the one before is counted as coalesced into it, any other as
+ *  dropped.  Other keys, such as quit and pause, always go through.
+ *
+ *  Usage: game_server [-p port] [-c 16|256|truecolor] [-t threads]
+ *                     [-i idle_seconds] [-n top_sessions] [-k moves_per_second]
+ *
+ *  @bug No known bugs.
+ */
+
+/* For accept4 and pthread_setaffinity_np. */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <ncurses.h>
+
+#include "console_model.h"
+#include "ansi_encoder.h"
+#include "key_decoder.h"
+#include "render_cache.h"
+#include "session.h"
+#include "timer_wheel.h"
+
+/** Environment variable naming the file finished games are appended to */
+#define REPLAY_ENV "CONSOLE_2048_REPLAYS"
+
+/** The port players connect to, unless -p says otherwise */
+#define DEFAULT_PORT 2048
+/** Most worker threads */
+#define MAX_THREADS 256
+/** Connections waiting to be accepted */
+#define LISTEN_BACKLOG 128
+/** Events taken from epoll at once */
+#define MAX_EVENTS 256
+/** Bytes read from a connection at once */
+#define READ_CHUNK 256
+/** Seconds without input before a session is frozen, unless -i says otherwise */
+#define DEFAULT_IDLE_SECONDS 300
+/** Sessions a usage report lists, unless -n says otherwise */
+#define DEFAULT_TOP_SESSIONS 10
+/** Moves a second a player may send, unless -k says otherwise */
+#define DEFAULT_KEY_RATE 30
+/** Moves a player may send at once, before the rate applies */
+#define KEY_BURST 10
+/** What a key costs from a token bucket, in thousandths of a key */
+#define KEY_COST 1000
+/** Most output a slow client may fall behind by before it is dropped */
+#define MAX_PENDING_OUTPUT (1 << 20)
+/** How long a worker stops accepting when it runs out of descriptors, in ms */
+#define ACCEPT_PAUSE_MS 100
+/** Longest the main thread waits for the workers' parts of a report, in ms */
+#define REPORT_WAIT_MS 1000
+
+/** Ask telnet for character mode: WILL ECHO, WILL SUPPRESS-GO-AHEAD */
+#define SEQ_TELNET_MODE "\377\373\001\377\373\003"
+/** Reset colors, clear the screen and hide the cursor */
+#define SEQ_ENTER "\033[0m\033[2J\033[?25l"
+/** Reset colors, clear the screen and show the cursor again */
+#define SEQ_LEAVE "\033[0m\033[2J\033[H\033[?25h"
+/** Start of a synchronized update */
+#define SEQ_SYNC_BEGIN "\033[?2026h"
+/** End of a synchronized update */
+#define SEQ_SYNC_END "\033[?2026l"
+
+/** Telnet: interpret as command */
+#define TELNET_IAC 255
+/** Telnet: option negotiation commands, WILL through DONT */
+#define TELNET_WILL 251
+#define TELNET_DONT 254
+/** Telnet: start and end of subnegotiation */
+#define TELNET_SB 250
+#define TELNET_SE 240
+
+/** States of the telnet command parser */
+#define TELNET_STATE_DATA 0
+#define TELNET_STATE_IAC 1
+#define TELNET_STATE_OPTION 2
+#define TELNET_STATE_SB 3
+#define TELNET_STATE_SB_IAC 4
+
+/** Gets the client a timer is embedded in */
+#define CLIENT_OF_TIMER(t) ((client_t*) ((char*) (t) - offsetof(client_t, timer)))
+
+/** Rounds a wake time up to the frame grid */
+#define FRAME_ALIGN(ms) \
+    (((ms) + SESSION_FRAME_MS - 1) / SESSION_FRAME_MS * SESSION_FRAME_MS)
+
+/** epoll data of the event that stops the workers */
+#define STOP_EVENT ((void*) &stop_fd)
+/** epoll data of the event that asks a worker for a usage report */
+#define REPORT_EVENT(w) ((void*) &(w)->report_fd)
+
+struct worker_t;
+
+/** @brief One connected player.
+ */
+typedef struct client_t {
+    /** What the player's terminal shows, NULL while the session is frozen */
+    cell_t *front_buffer;
+    /** The worker that owns the client */
+    struct worker_t *worker;
+    /** The socket */
+    int fd;
+    /** The player's game, NULL while it is frozen */
+    session_t *session;
+    /** The frozen game, while session is NULL */
+    session_cold_t cold;
+    /** The replay record of the frozen game, may be NULL */
+    uint8_t *cold_record;
+    /** The length of cold_record */
+    size_t cold_record_len;
+    /** When the player last sent anything, in ms */
+    unsigned long long last_input_ms;
+    /** Pending while the session waits for a timer */
+    wheel_timer_t timer;
+    /** The next client to run in this pass */
+    struct client_t *next_ready;
+    /** Set while the client is on its worker's ready list */
+    int queued;
+    /** Set once the client is to be disconnected */
+    int done;
+    /** Where this pass's frame starts in the worker's output */
+    size_t frame_start;
+    /** The length of this pass's frame */
+    size_t frame_len;
+    /** The terminal cursor row, column and color, as the encoder tracks them */
+    int term_row;
+    int term_col;
+    int term_color;
+    /** One of the TELNET_STATE_ constants */
+    int telnet_state;
+    /** Turns input bytes into keys */
+    key_decoder_t decoder;
+    /** Output the socket would not take yet */
+    char *pending;
+    /** The number of bytes in pending */
+    size_t pending_len;
+    /** The size of pending */
+    size_t pending_cap;
+    /** The worker's other clients */
+    struct client_t *prev_client;
+    struct client_t *next_client;
+    /** When the player connected, in ms */
+    unsigned long long connected_ms;
+    /** Thread CPU time spent running the session, in ns */
+    unsigned long long step_ns;
+    /** Thread CPU time spent encoding its frames, in ns */
+    unsigned long long encode_ns;
+    /** Bytes the player sent */
+    unsigned long long bytes_in;
+    /** Bytes sent to the player */
+    unsigned long long bytes_out;
+    /** Keys the player may send now, in thousandths of a key */
+    unsigned long long key_tokens;
+    /** When key_tokens was last topped up, in ms */
+    unsigned long long key_refill_ms;
+    /** The last move key the player sent, admitted or not */
+    int last_key;
+    /** Moves past the rate limit that repeated the one before */
+    unsigned long long keys_coalesced;
+    /** Other moves past the rate limit */
+    unsigned long long keys_dropped;
+} client_t;
+
+/** @brief What a session has cost, for a usage report.
+ */
+typedef struct usage_t {
+    /** The worker that owns it */
+    int worker;
+    /** Its socket */
+    int fd;
+    /** Set if it is frozen */
+    int frozen;
+    /** Thread CPU time spent running it, in ns */
+    unsigned long long step_ns;
+    /** Thread CPU time spent encoding its frames, in ns */
+    unsigned long long encode_ns;
+    /** Bytes the player sent */
+    unsigned long long bytes_in;
+    /** Bytes sent to the player */
+    unsigned long long bytes_out;
+    /** Keys cut by the rate limit */
+    unsigned long long keys_cut;
+    /** How long the player has been connected, in ms */
+    unsigned long long age_ms;
+    /** The memory it holds */
+    size_t memory;
+} usage_t;
+
+/** @brief A worker's totals, as handed over for a usage report.
+ */
+typedef struct worker_usage_t {
+    /** Set if the worker handed its part of the last report over */
+    int handed_over;
+    /** The number of clients it owned */
+    unsigned long num_clients;
+    /** The number of those whose sessions were frozen */
+    unsigned long num_frozen;
+    /** Its thread CPU time, in ns */
+    unsigned long long thread_ns;
+    /** The part of that its clients' sessions took, in ns */
+    unsigned long long session_ns;
+    /** The memory its clients held */
+    size_t memory;
+} worker_usage_t;
+
+/** @brief A thread and the clients it owns.
+ */
+typedef struct worker_t {
+    /** Encodes one client's frame at a time */
+    ansi_encoder_t encoder;
+    /** Recently rendered boards, shared by the worker's sessions */
+    render_cache_t render_cache;
+    /** Sessions waiting for a timer, keyed by their wake time in ms */
+    timer_wheel_t wheel;
+    /** The thread */
+    pthread_t thread;
+    /** The worker's number, which is also the core it prefers */
+    int id;
+    /** The epoll instance the worker's sockets are registered with */
+    int epoll_fd;
+    /** The worker's listening socket */
+    int listener;
+    /** When to accept connections again, in ms, or 0 if accepting */
+    unsigned long long accept_resume_ms;
+    /** The number of bytes in an empty frame */
+    size_t empty_frame_len;
+    /** Clients to run in this pass, linked through next_ready */
+    client_t *ready;
+    /** Where the next ready client is linked in */
+    client_t **ready_tail;
+    /** The frames encoded in this pass, back to back */
+    char *out;
+    /** The number of bytes in out */
+    size_t out_len;
+    /** The size of out */
+    size_t out_cap;
+    /** The number of clients the worker owns */
+    unsigned long num_clients;
+    /** The number of those whose sessions are frozen */
+    unsigned long num_frozen;
+    /** Every client the worker owns, linked through next_client */
+    client_t *clients;
+    /** Becomes readable when a usage report is wanted */
+    int report_fd;
+    /** The heaviest sessions at the last report, heaviest first */
+    usage_t *top;
+    /** The number of sessions in top */
+    int num_top;
+    /** The worker's totals at the last report, guarded by report.lock */
+    worker_usage_t totals;
+    /** Set, under report.lock, once the worker's thread has stopped */
+    int exited;
+} worker_t;
+
+/** @brief Settings from the command line.
+ */
+typedef struct options_t {
+    /** The TCP port to listen on */
+    int port;
+    /** One of the PALETTE_ constants */
+    int palette;
+    /** The number of worker threads */
+    int threads;
+    /** Seconds without input before a session is frozen, 0 for never */
+    int idle_seconds;
+    /** The number of sessions a usage report lists */
+    int top_sessions;
+    /** Moves a second a player may send, 0 for no limit */
+    int key_rate;
+} options_t;
+
+/** @brief A usage report being gathered from the workers.
+ */
+typedef struct report_t {
+    /** Guards waiting, round and every worker's totals and exited */
+    pthread_mutex_t lock;
+    /** Signalled as each worker hands its part over */
+    pthread_cond_t handed_over;
+    /** The number of workers yet to hand their part over */
+    int waiting;
+    /** Counts the reports asked for; a part for an old one is dropped */
+    unsigned long round;
+    /** The number of sessions each worker hands over */
+    int top;
+} report_t;
+
+/* The colors sent to every client. */
+static ansi_palette_t palette;
+
+/* Where finished games are appended, or NULL. */
+static const char *replay_path = NULL;
+
+/* Milliseconds without input before a session is frozen, 0 for never. */
+static unsigned long long idle_ms = 0;
+
+/* Moves a second a player may send, 0 for no limit. */
+static unsigned long long key_rate = DEFAULT_KEY_RATE;
+
+/* Becomes readable when the workers should stop. */
+static int stop_fd = -1;
+
+/* The usage report being gathered, if any. */
+static report_t report = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, DEFAULT_TOP_SESSIONS
+};
+
+/***** Function prototypes ******/
+
+/** @brief Print how to use the program.
+ *
+ * @param name The name of the program.
+ * @return None.
+ */
+static void usage(const char *name);
+
+/** @brief Read the command line.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param options Set to the settings.
+ * @return 0 on success, -1 on a bad command line.
+ */
+static int parse_options(int argc, char **argv, options_t *options);
+
+/** @brief Read the monotonic clock.
+ *
+ * @return Milliseconds since some fixed, unspecified point.
+ */
+static unsigned long long monotonic_ms(void);
+
+/** @brief Read the CPU time the calling thread has used.
+ *
+ * @return The time, in ns.
+ */
+static unsigned long long thread_cpu_ns(void);
+
+/** @brief Set up a worker, with its own listening socket.
+ *
+ * @param worker The worker.
+ * @param id The worker's number.
+ * @param port The TCP port.
+ * @return 0 on success, -1 on error.
+ */
+static int init_worker(worker_t *worker, int id, int port);
+
+/** @brief The body of a worker thread.
+ *
+ * @param arg The worker_t.
+ * @return NULL.
+ */
+static void *worker_main(void *arg);
+
+/** @brief Accept every waiting connection, and queue each to be drawn.
+ *
+ * If the process runs out of descriptors, the listener is paused for
+ * ACCEPT_PAUSE_MS rather than woken again and again by a connection it
+ * cannot take.
+ *
+ * @param worker The worker.
+ * @return None.
+ */
+static void accept_clients(worker_t *worker);
+
+/** @brief Stop or start watching a worker's listener.
+ *
+ * @param worker The worker.
+ * @param resume_ms When to accept connections again, or 0 to accept now.
+ * @return None.
+ */
+static void pause_accepting(worker_t *worker, unsigned long long resume_ms);
+
+/** @brief Set up a client for a new connection.
+ *
+ * @param worker The worker that owns the connection.
+ * @param fd The connected socket.
+ * @return The client, or NULL if out of memory.
+ */
+static client_t *create_client(worker_t *worker, int fd);
+
+/** @brief Allocate a copy of a terminal that matches no screen.
+ *
+ * @return The cells, or NULL if out of memory.
+ */
+static cell_t *new_front_buffer(void);
+
+/** @brief Freeze an idle client's session, and free what it can.
+ *
+ * @param client The client, whose session has been flushed.
+ * @param now The current time, in ms.
+ * @return 0 on success, -1 if the session cannot be frozen now.
+ */
+static int freeze_client(client_t *client, unsigned long long now);
+
+/** @brief Thaw a frozen client's session, and queue it to redraw.
+ *
+ * @param client The client.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int thaw_client(client_t *client);
+
+/** @brief Disconnect a client and free it.
+ *
+ * The client must not be on the ready list.
+ *
+ * @param client The client.
+ * @return None.
+ */
+static void close_client(client_t *client);
+
+/** @brief Put a client on its worker's ready list, if it is not already.
+ *
+ * @param client The client.
+ * @return None.
+ */
+static void queue_client(client_t *client);
+
+/** @brief Read what a client sent, and queue its keys for the session.
+ *
+ * A frozen session is thawed as soon as anything arrives.
+ *
+ * @param client The client.
+ * @param now The current time, in ms.
+ * @return 0 on success, -1 if the connection is closed or broken.
+ */
+static int read_client(client_t *client, unsigned long long now);
+
+/** @brief Strip telnet commands from input, and pass the rest on as keys.
+ *
+ * @param client The client.
+ * @param in The bytes read.
+ * @param len The number of bytes.
+ * @return None.
+ */
+static void decode_input(client_t *client, const unsigned char *in, size_t len);
+
+/** @brief Top up a client's token bucket for the time since the last.
+ *
+ * @param client The client.
+ * @param now The current time, in ms.
+ * @return None.
+ */
+static void refill_keys(client_t *client, unsigned long long now);
+
+/** @brief Spend a token on a move key, if the client has one.
+ *
+ * Keys that do not move the blocks, such as quit and pause, cost
+ * nothing, so a player flooding moves can still stop.
+ *
+ * @param client The client.
+ * @param key The key.
+ * @return 1 if the key goes to the session, 0 if it is cut.
+ */
+static int admit_key(client_t *client, int key);
+
+/** @brief Turn input bytes into keys, one at a time.
+ *
+ * Arrow key escape sequences become the ncurses KEY_ codes the game
+ * expects.  A sequence split across reads is held by the client's
+ * decoder until it completes.  Moves past the client's rate limit are
+ * cut here.
+ *
+ * @param client The client.
+ * @param byte The next input byte.
+ * @return None.
+ */
+static void decode_key_byte(client_t *client, unsigned char byte);
+
+/** @brief Run every client on the ready list, and send what they drew.
+ *
+ * @param worker The worker.
+ * @param now The current time, in ms.
+ * @return None.
+ */
+static void run_ready(worker_t *worker, unsigned long long now);
+
+/** @brief Run a client's session as far as it can go.
+ *
+ * The session's timer is rescheduled for whatever it waits for next,
+ * or for when the player will have been idle too long.  A session
+ * that is already idle too long, and did not run, is frozen instead.
+ *
+ * @param client The client.
+ * @param now The current time, in ms.
+ * @return None.
+ */
+static void step_client(client_t *client, unsigned long long now);
+
+/** @brief Encode what a client's session drew, onto the worker's output.
+ *
+ * @param client The client.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int encode_client(client_t *client);
+
+/** @brief Start a frame for a client in the worker's encoder.
+ *
+ * @param client The client.
+ * @return None.
+ */
+static void begin_frame(client_t *client);
+
+/** @brief Finish the frame in the encoder and add it to the worker's output.
+ *
+ * @param client The client the frame was begun for.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int end_frame(client_t *client);
+
+/** @brief Encode a changed region of a session's console for its client.
+ *
+ * @param ctx The client.
+ * @param console The console to copy from.
+ * @param row The top row of the region.
+ * @param col The left column of the region.
+ * @param height The number of rows in the region.
+ * @param width The number of columns in the region.
+ * @return None.
+ */
+static void stage_region(
+        void *ctx,
+        console_t *console,
+        int row,
+        int col,
+        int height,
+        int width);
+
+/** @brief Send bytes to a client, queueing what the socket will not take.
+ *
+ * @param client The client.
+ * @param s The bytes.
+ * @param len The number of bytes.
+ * @return 0 on success, -1 if the client has to be dropped.
+ */
+static int send_client(client_t *client, const char *s, size_t len);
+
+/** @brief Send as much queued output as the socket will take.
+ *
+ * @param client The client.
+ * @return 0 on success, -1 if the client has to be dropped.
+ */
+static int flush_client(client_t *client);
+
+/** @brief Ask epoll to report when a client's socket can take more output.
+ *
+ * @param client The client.
+ * @param on Whether to watch for that.
+ * @return None.
+ */
+static void watch_writable(client_t *client, int on);
+
+/** @brief Count the memory a client holds.
+ *
+ * @param client The client.
+ * @return The bytes allocated for it, its session included.
+ */
+static size_t client_memory(const client_t *client);
+
+/** @brief Hand a worker's part of a usage report over.
+ *
+ * Keeps the worker's report.top heaviest sessions, by CPU time, and
+ * copies its totals into worker->totals, for the main thread to read.
+ *
+ * @param worker The worker.
+ * @return None.
+ */
+static void report_usage(worker_t *worker);
+
+/** @brief Compare two sessions by the CPU time they took, for qsort.
+ *
+ * @param a The first session's usage.
+ * @param b The second session's usage.
+ * @return Less than 0 if a took more, greater than 0 if it took less.
+ */
+static int compare_usage(const void *a, const void *b);
+
+/** @brief Gather a usage report from every worker and print it to stderr.
+ *
+ * Waits at most REPORT_WAIT_MS for the workers' parts; a worker that has
+ * stopped, or does not answer in time, is listed without one.
+ *
+ * @param workers The workers.
+ * @param threads The number of workers.
+ * @return None.
+ */
+static void print_report(worker_t *workers, int threads);
+
+/***** Function definitions ******/
+
+void usage(const char *name) {
+    fprintf(stderr,
+        "usage: %s [-p port] [-c 16|256|truecolor] [-t threads] [-i idle_seconds]\n"
+        "          [-n top_sessions] [-k moves_per_second]\n"
+        "  -p  TCP port to listen on (default %d)\n"
+        "  -c  colors to send (default 256)\n"
+        "  -t  worker threads (default one per core)\n"
+        "  -i  seconds without input before a session is frozen, 0 for never\n"
+        "      (default %d)\n"
+        "  -n  sessions listed by the usage report SIGUSR1 prints (default %d)\n"
+        "  -k  moves a second a player may send, 0 for no limit (default %d)\n",
+        name, DEFAULT_PORT, DEFAULT_IDLE_SECONDS, DEFAULT_TOP_SESSIONS,
+        DEFAULT_KEY_RATE);
+}
+
+int parse_options(int argc, char **argv, options_t *options) {
+    int opt;
+
+    options->port = DEFAULT_PORT;
+    options->palette = PALETTE_256;
+    options->idle_seconds = DEFAULT_IDLE_SECONDS;
+    options->top_sessions = DEFAULT_TOP_SESSIONS;
+    options->key_rate = DEFAULT_KEY_RATE;
+    options->threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(options->threads < 1) {
+        options->threads = 1;
+    } else if(options->threads > MAX_THREADS) {
+        options->threads = MAX_THREADS;
+    }
+
+    while((opt = getopt(argc, argv, "p:c:t:i:n:k:")) != -1) {
+        switch(opt) {
+            case 'p':
+                options->port = atoi(optarg);
+                if(options->port < 1 || options->port > 65535) {
+                    return -1;
+                }
+                break;
+            case 'c':
+                if(strcmp(optarg, "16") == 0) {
+                    options->palette = PALETTE_16;
+                } else if(strcmp(optarg, "256") == 0) {
+                    options->palette = PALETTE_256;
+                } else if(strcmp(optarg, "truecolor") == 0) {
+                    options->palette = PALETTE_TRUECOLOR;
+                } else {
+                    return -1;
+                }
+                break;
+            case 't':
+                options->threads = atoi(optarg);
+                if(options->threads < 1 || options->threads > MAX_THREADS) {
+                    return -1;
+                }
+                break;
+            case 'i':
+                options->idle_seconds = atoi(optarg);
+                if(options->idle_seconds < 0) {
+                    return -1;
+                }
+                break;
+            case 'n':
+                options->top_sessions = atoi(optarg);
+                if(options->top_sessions < 1) {
+                    return -1;
+                }
+                break;
+            case 'k':
+                options->key_rate = atoi(optarg);
+                if(options->key_rate < 0) {
+                    return -1;
+                }
+                break;
+            default:
+                return -1;
+        }
+    }
+    return optind == argc ? 0 : -1;
+}
+
+unsigned long long monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+unsigned long long thread_cpu_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (unsigned long long)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+int init_worker(worker_t *worker, int id, int port) {
+    struct sockaddr_in addr;
+    struct epoll_event ev;
+    int one = 1;
+
+    worker->id = id;
+    worker->ready = NULL;
+    worker->ready_tail = &worker->ready;
+    worker->out = NULL;
+    worker->out_len = 0;
+    worker->out_cap = 0;
+    worker->num_clients = 0;
+    worker->num_frozen = 0;
+    worker->clients = NULL;
+    worker->num_top = 0;
+    worker->totals.handed_over = 0;
+    worker->exited = 0;
+    worker->accept_resume_ms = 0;
+    worker->top = malloc(sizeof(*worker->top) * report.top);
+    if(worker->top == NULL) {
+        return -1;
+    }
+    ansi_encoder_init(&worker->encoder, &palette);
+    render_cache_init(&worker->render_cache);
+    timer_wheel_init(&worker->wheel, monotonic_ms());
+
+    worker->epoll_fd = epoll_create1(0);
+    if(worker->epoll_fd < 0) {
+        return -1;
+    }
+    worker->listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(worker->listener < 0) {
+        return -1;
+    }
+    setsockopt(worker->listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(worker->listener, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if(bind(worker->listener, (struct sockaddr*) &addr, sizeof(addr)) < 0
+            || listen(worker->listener, LISTEN_BACKLOG) < 0) {
+        return -1;
+    }
+
+    worker->report_fd = eventfd(0, EFD_NONBLOCK);
+    if(worker->report_fd < 0) {
+        return -1;
+    }
+
+    /* The listener and the two events are the registrations without a client. */
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if(epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->listener, &ev) < 0) {
+        return -1;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = STOP_EVENT;
+    if(epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, stop_fd, &ev) < 0) {
+        return -1;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = REPORT_EVENT(worker);
+    if(epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->report_fd, &ev) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void *worker_main(void *arg) {
+    worker_t *worker = arg;
+    struct epoll_event events[MAX_EVENTS];
+    client_t *client;
+    wheel_timer_t *due, *next;
+    cpu_set_t cpus;
+    unsigned long long now, wake;
+    int count, ii, timeout;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(worker->id % CPU_SETSIZE, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+    while(1) {
+        /* Sleep until a socket is ready or the next session is due. */
+        now = monotonic_ms();
+        wake = timer_wheel_next_due(&worker->wheel);
+        if(worker->accept_resume_ms != 0 && worker->accept_resume_ms < wake) {
+            wake = worker->accept_resume_ms;
+        }
+        timeout = -1;
+        if(wake != WHEEL_NEVER) {
+            timeout = (wake > now) ? (wake - now > INT_MAX ? INT_MAX : wake - now) : 0;
+        }
+        count = epoll_wait(worker->epoll_fd, events, MAX_EVENTS, timeout);
+        if(count < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+        now = monotonic_ms();
+        if(worker->accept_resume_ms != 0 && now >= worker->accept_resume_ms) {
+            pause_accepting(worker, 0);
+        }
+
+        for(ii = 0; ii < count; ii++) {
+            client = events[ii].data.ptr;
+            if(client == STOP_EVENT) {
+                return NULL;
+            }
+            if(client == REPORT_EVENT(worker)) {
+                report_usage(worker);
+                continue;
+            }
+            if(client == NULL) {
+                accept_clients(worker);
+                continue;
+            }
+            if((events[ii].events & EPOLLOUT) && flush_client(client) < 0) {
+                client->done = 1;
+            }
+            if(!client->done
+                    && (events[ii].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                    && read_client(client, now) < 0) {
+                client->done = 1;
+            }
+            if(client->done || (client->session != NULL && client->session->key_count > 0)) {
+                queue_client(client);
+            }
+        }
+
+        /* Every session whose timer came due runs in the same pass. */
+        now = monotonic_ms();
+        due = timer_wheel_advance(&worker->wheel, now);
+        while(due != NULL) {
+            next = due->next;
+            queue_client(CLIENT_OF_TIMER(due));
+            due = next;
+        }
+        run_ready(worker, now);
+    }
+
+    /* No report will be handed over from here on. */
+    pthread_mutex_lock(&report.lock);
+    worker->exited = 1;
+    pthread_mutex_unlock(&report.lock);
+    return NULL;
+}
+
+void accept_clients(worker_t *worker) {
+    struct epoll_event ev;
+    client_t *client;
+    int fd, one = 1;
+
+    while((fd = accept4(worker->listener, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        client = create_client(worker, fd);
+        if(client == NULL) {
+            close(fd);
+            continue;
+        }
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = client;
+        if(epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close_client(client);
+            continue;
+        }
+        if(send_client(client, SEQ_TELNET_MODE, strlen(SEQ_TELNET_MODE)) < 0
+                || send_client(client, SEQ_ENTER, strlen(SEQ_ENTER)) < 0) {
+            close_client(client);
+            continue;
+        }
+        /* The session has not run yet, so it draws its title screen. */
+        queue_client(client);
+    }
+    if(errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+        pause_accepting(worker, monotonic_ms() + ACCEPT_PAUSE_MS);
+    }
+}
+
+void pause_accepting(worker_t *worker, unsigned long long resume_ms) {
+    struct epoll_event ev;
+
+    ev.events = resume_ms ? 0 : EPOLLIN;
+    ev.data.ptr = NULL;
+    if(epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, worker->listener, &ev) == 0) {
+        worker->accept_resume_ms = resume_ms;
+    }
+}
+
+client_t *create_client(worker_t *worker, int fd) {
+    client_t *client;
+
+    if(posix_memalign((void**) &client, 64, sizeof(*client)) != 0) {
+        return NULL;
+    }
+    memset(client, 0, sizeof(*client));
+    client->session = session_create(&worker->render_cache, replay_path);
+    client->front_buffer = new_front_buffer();
+    if(client->session == NULL || client->front_buffer == NULL) {
+        session_destroy(client->session);
+        free(client->front_buffer);
+        free(client);
+        return NULL;
+    }
+    client->last_input_ms = monotonic_ms();
+    client->connected_ms = client->last_input_ms;
+    client->key_tokens = KEY_BURST * KEY_COST;
+    client->key_refill_ms = client->last_input_ms;
+    client->last_key = SESSION_NO_KEY;
+    client->worker = worker;
+    client->fd = fd;
+    client->term_row = -1;
+    client->term_col = -1;
+    client->term_color = -1;
+    client->telnet_state = TELNET_STATE_DATA;
+    wheel_timer_init(&client->timer);
+    client->next_client = worker->clients;
+    if(worker->clients != NULL) {
+        worker->clients->prev_client = client;
+    }
+    worker->clients = client;
+    worker->num_clients++;
+    return client;
+}
+
+cell_t *new_front_buffer(void) {
+    cell_t *cells;
+
+    if(posix_memalign((void**) &cells, 64, sizeof(cell_t) * CONSOLE_CELLS) != 0) {
+        return NULL;
+    }
+    /* No cell is ever 0xFFFF, so the first frame redraws every cell. */
+    memset(cells, 0xFF, sizeof(cell_t) * CONSOLE_CELLS);
+    return cells;
+}
+
+int freeze_client(client_t *client, unsigned long long now) {
+    worker_t *worker = client->worker;
+
+    if(session_freeze(client->session, now, &client->cold,
+            &client->cold_record, &client->cold_record_len) < 0) {
+        return -1;
+    }
+    timer_wheel_cancel(&worker->wheel, &client->timer);
+    session_destroy(client->session);
+    client->session = NULL;
+    free(client->front_buffer);
+    client->front_buffer = NULL;
+    worker->num_frozen++;
+    return 0;
+}
+
+int thaw_client(client_t *client) {
+    worker_t *worker = client->worker;
+    session_t *session;
+    cell_t *front_buffer;
+
+    session = session_thaw(&client->cold, client->cold_record, client->cold_record_len,
+        &worker->render_cache, replay_path);
+    front_buffer = new_front_buffer();
+    if(session == NULL || front_buffer == NULL) {
+        session_destroy(session);
+        free(front_buffer);
+        return -1;
+    }
+    /* The terminal still shows the old screen, but nothing says so; send it all. */
+    client->session = session;
+    client->front_buffer = front_buffer;
+    free(client->cold_record);
+    client->cold_record = NULL;
+    client->cold_record_len = 0;
+    worker->num_frozen--;
+    queue_client(client);
+    return 0;
+}
+
+void close_client(client_t *client) {
+    worker_t *worker = client->worker;
+    timer_wheel_cancel(&worker->wheel, &client->timer);
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    if(client->session == NULL) {
+        worker->num_frozen--;
+    }
+    if(client->prev_client != NULL) {
+        client->prev_client->next_client = client->next_client;
+    } else {
+        worker->clients = client->next_client;
+    }
+    if(client->next_client != NULL) {
+        client->next_client->prev_client = client->prev_client;
+    }
+    session_destroy(client->session);
+    free(client->front_buffer);
+    free(client->cold_record);
+    free(client->pending);
+    free(client);
+    worker->num_clients--;
+}
+
+void queue_client(client_t *client) {
+    worker_t *worker = client->worker;
+    if(client->queued) {
+        return;
+    }
+    client->queued = 1;
+    client->next_ready = NULL;
+    *worker->ready_tail = client;
+    worker->ready_tail = &client->next_ready;
+}
+
+int read_client(client_t *client, unsigned long long now) {
+    unsigned char in[READ_CHUNK];
+    ssize_t got;
+
+    while(1) {
+        got = read(client->fd, in, sizeof(in));
+        if(got > 0) {
+            client->last_input_ms = now;
+            client->bytes_in += got;
+            if(client->session == NULL && thaw_client(client) < 0) {
+                return -1;
+            }
+            refill_keys(client, now);
+            decode_input(client, in, got);
+            continue;
+        }
+        if(got == 0) {
+            return -1;
+        }
+        if(errno == EINTR) {
+            continue;
+        }
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+}
+
+void decode_input(client_t *client, const unsigned char *in, size_t len) {
+    size_t ii;
+    unsigned char byte;
+
+    for(ii = 0; ii < len; ii++) {
+        byte = in[ii];
+        switch(client->telnet_state) {
+            case TELNET_STATE_DATA:
+                if(byte == TELNET_IAC) {
+                    client->telnet_state = TELNET_STATE_IAC;
+                } else {
+                    decode_key_byte(client, byte);
+                }
+                break;
+            case TELNET_STATE_IAC:
+                if(byte >= TELNET_WILL && byte <= TELNET_DONT) {
+                    client->telnet_state = TELNET_STATE_OPTION;
+                } else if(byte == TELNET_SB) {
+                    client->telnet_state = TELNET_STATE_SB;
+                } else {
+                    /* A one byte command, or an escaped 0xFF; neither is a key. */
+                    client->telnet_state = TELNET_STATE_DATA;
+                }
+                break;
+            case TELNET_STATE_OPTION:
+                /* The client's answer to our negotiation; we take any. */
+                client->telnet_state = TELNET_STATE_DATA;
+                break;
+            case TELNET_STATE_SB:
+                if(byte == TELNET_IAC) {
+                    client->telnet_state = TELNET_STATE_SB_IAC;
+                }
+                break;
+            case TELNET_STATE_SB_IAC:
+                client->telnet_state =
+                    (byte == TELNET_SE) ? TELNET_STATE_DATA : TELNET_STATE_SB;
+                break;
+        }
+    }
+}
+
+void decode_key_byte(client_t *client, unsigned char byte) {
+    int keys[KEY_DECODER_MAX_SEQ];
+    int ii, count;
+
+    count = key_decoder_byte(&client->decoder, byte, keys);
+    for(ii = 0; ii < count; ii++) {
+        if(admit_key(client, keys[ii])) {
+            session_push_key(client->session, keys[ii]);
+        }
+    }
+}
+
+void refill_keys(client_t *client, unsigned long long now) {
+    /* Moves a second times ms is thousandths of a key. */
+    client->key_tokens += (now - client->key_refill_ms) * key_rate;
+    if(client->key_tokens > KEY_BURST * KEY_COST) {
+        client->key_tokens = KEY_BURST * KEY_COST;
+    }
+    client->key_refill_ms = now;
+}
+
+int admit_key(client_t *client, int key) {
+    int repeat;
+
+    if(key_rate == 0 || !session_is_move_key(key)) {
+        return 1;
+    }
+    repeat = key == client->last_key;
+    client->last_key = key;
+    if(client->key_tokens >= KEY_COST) {
+        client->key_tokens -= KEY_COST;
+        return 1;
+    }
+    /* A stuck key or a bot repeating a move collapses into the move before. */
+    if(repeat) {
+        client->keys_coalesced++;
+    } else {
+        client->keys_dropped++;
+    }
+    return 0;
+}
+
+void run_ready(worker_t *worker, unsigned long long now) {
+    client_t *client, *next;
+    unsigned long long cpu, last_cpu;
+
+    /*
+     * Step every session, with nothing but game logic in the loop.  Each
+     * is charged the CPU time since the one before it finished, so the
+     * clock is read once a session.
+     */
+    last_cpu = thread_cpu_ns();
+    for(client = worker->ready; client != NULL; client = client->next_ready) {
+        if(!client->done) {
+            step_client(client, now);
+            cpu = thread_cpu_ns();
+            client->step_ns += cpu - last_cpu;
+            last_cpu = cpu;
+        }
+    }
+
+    /* Encode every frame, back to back in one buffer. */
+    worker->out_len = 0;
+    for(client = worker->ready; client != NULL; client = client->next_ready) {
+        client->frame_start = worker->out_len;
+        if(encode_client(client) < 0) {
+            client->done = 1;
+        }
+        client->frame_len = worker->out_len - client->frame_start;
+        cpu = thread_cpu_ns();
+        client->encode_ns += cpu - last_cpu;
+        last_cpu = cpu;
+    }
+
+    /* Send them all, and let go of the clients that are done. */
+    client = worker->ready;
+    worker->ready = NULL;
+    worker->ready_tail = &worker->ready;
+    while(client != NULL) {
+        next = client->next_ready;
+        client->queued = 0;
+        if(send_client(client, worker->out + client->frame_start, client->frame_len) < 0) {
+            client->done = 1;
+        }
+        if(client->done) {
+            if(client->session != NULL && (client->session->wait & SESSION_DONE)) {
+                send_client(client, SEQ_LEAVE, strlen(SEQ_LEAVE));
+            }
+            close_client(client);
+        }
+        client = next;
+    }
+}
+
+void step_client(client_t *client, unsigned long long now) {
+    session_t *session = client->session;
+    worker_t *worker = client->worker;
+    uint64_t due = WHEEL_NEVER;
+    uint64_t idle_at = WHEEL_NEVER;
+    int wait, ran = 0;
+
+    if(session == NULL) {
+        return;
+    }
+    wait = session->wait;
+    while(session_is_ready(session, now)) {
+        wait = session_run(session, now);
+        ran = 1;
+    }
+
+    if(wait & SESSION_DONE) {
+        client->done = 1;
+        timer_wheel_cancel(&worker->wheel, &client->timer);
+        return;
+    }
+
+    /*
+     * Freeze only a session that drew nothing this pass, so the player
+     * is not left without its last frame.
+     */
+    if(idle_ms != 0) {
+        idle_at = client->last_input_ms + idle_ms;
+        if(!ran && now >= idle_at) {
+            if(freeze_client(client, now) == 0) {
+                return;
+            }
+            /* It is busy after all; look again after another idle spell. */
+            idle_at = now + idle_ms;
+            client->last_input_ms = now;
+        }
+    }
+
+    if(wait & SESSION_WAIT_TIMER) {
+        due = FRAME_ALIGN(session->wake_ms);
+    }
+    if(idle_at < due) {
+        due = idle_at;
+    }
+    if(due != WHEEL_NEVER) {
+        timer_wheel_schedule(&worker->wheel, &client->timer, due);
+    } else {
+        timer_wheel_cancel(&worker->wheel, &client->timer);
+    }
+}
+
+int encode_client(client_t *client) {
+    if(client->session == NULL) {
+        return 0;
+    }
+    begin_frame(client);
+    session_flush(client->session, stage_region, client);
+    return end_frame(client);
+}
+
+void begin_frame(client_t *client) {
+    ansi_encoder_t *encoder = &client->worker->encoder;
+
+    /* The encoder is shared; load what it knows about this terminal. */
+    ansi_reset_frame(encoder);
+    encoder->row = client->term_row;
+    encoder->col = client->term_col;
+    encoder->color = client->term_color;
+    ansi_put_raw(encoder, SEQ_SYNC_BEGIN, strlen(SEQ_SYNC_BEGIN));
+    client->worker->empty_frame_len = encoder->len;
+}
+
+int end_frame(client_t *client) {
+    worker_t *worker = client->worker;
+    ansi_encoder_t *encoder = &worker->encoder;
+    size_t cap;
+    char *grown;
+
+    client->term_row = encoder->row;
+    client->term_col = encoder->col;
+    client->term_color = encoder->color;
+    if(encoder->len == worker->empty_frame_len) {
+        return 0;
+    }
+    ansi_put_raw(encoder, SEQ_SYNC_END, strlen(SEQ_SYNC_END));
+
+    if(worker->out_len + encoder->len > worker->out_cap) {
+        cap = worker->out_cap ? worker->out_cap : 65536;
+        while(cap < worker->out_len + encoder->len) {
+            cap *= 2;
+        }
+        grown = realloc(worker->out, cap);
+        if(grown == NULL) {
+            return -1;
+        }
+        worker->out = grown;
+        worker->out_cap = cap;
+    }
+    memcpy(worker->out + worker->out_len, encoder->frame, encoder->len);
+    worker->out_len += encoder->len;
+    return 0;
+}
+
+void stage_region(
+        void *ctx,
+        console_t *console,
+        int row,
+        int col,
+        int height,
+        int width) {
+    client_t *client = ctx;
+    ansi_encoder_t *encoder = &client->worker->encoder;
+    const cell_t *cells = (const cell_t*) console->base_addr;
+    size_t start, end, line;
+    int rr;
+
+    for(rr = row; rr < row + height; rr++) {
+        /* Encode only the runs of cells the terminal does not show yet. */
+        line = rr * CONSOLE_WIDTH;
+        start = console_next_changed(cells, client->front_buffer, line + col, line + col + width);
+        while(start < line + col + width) {
+            end = console_next_unchanged(cells, client->front_buffer, start, line + col + width);
+            if(ansi_encode_span(encoder, cells + start, client->front_buffer + line,
+                    rr, start - line, end - start) < 0) {
+                /* The frame is full; close it and start another. */
+                if(end_frame(client) < 0) {
+                    client->done = 1;
+                }
+                begin_frame(client);
+                ansi_encode_span(encoder, cells + start, client->front_buffer + line,
+                    rr, start - line, end - start);
+            }
+            memcpy(client->front_buffer + start, cells + start, sizeof(cell_t) * (end - start));
+            start = console_next_changed(cells, client->front_buffer, end, line + col + width);
+        }
+    }
+}
+
+int send_client(client_t *client, const char *s, size_t len) {
+    ssize_t written;
+    size_t cap;
+    char *grown;
+
+    /* Keep output in order behind anything already queued. */
+    while(client->pending_len == 0 && len > 0) {
+        written = send(client->fd, s, len, MSG_NOSIGNAL);
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return -1;
+        }
+        client->bytes_out += written;
+        s += written;
+        len -= written;
+    }
+    if(len == 0) {
+        return 0;
+    }
+
+    if(client->pending_len + len > MAX_PENDING_OUTPUT) {
+        return -1;
+    }
+    if(client->pending_len + len > client->pending_cap) {
+        cap = client->pending_cap ? client->pending_cap : 4096;
+        while(cap < client->pending_len + len) {
+            cap *= 2;
+        }
+        grown = realloc(client->pending, cap);
+        if(grown == NULL) {
+            return -1;
+        }
+        client->pending = grown;
+        client->pending_cap = cap;
+    }
+    if(client->pending_len == 0) {
+        watch_writable(client, 1);
+    }
+    memcpy(client->pending + client->pending_len, s, len);
+    client->pending_len += len;
+    return 0;
+}
+
+int flush_client(client_t *client) {
+    ssize_t written;
+    size_t sent = 0;
+
+    while(sent < client->pending_len) {
+        written = send(client->fd, client->pending + sent,
+            client->pending_len - sent, MSG_NOSIGNAL);
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return -1;
+        }
+        client->bytes_out += written;
+        sent += written;
+    }
+    memmove(client->pending, client->pending + sent, client->pending_len - sent);
+    client->pending_len -= sent;
+    if(client->pending_len == 0) {
+        watch_writable(client, 0);
+    }
+    return 0;
+}
+
+void watch_writable(client_t *client, int on) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | (on ? EPOLLOUT : 0);
+    ev.data.ptr = client;
+    epoll_ctl(client->worker->epoll_fd, EPOLL_CTL_MOD, client->fd, &ev);
+}
+
+size_t client_memory(const client_t *client) {
+    size_t memory = sizeof(*client) + client->pending_cap + client->cold_record_len;
+
+    if(client->session != NULL) {
+        memory += session_memory(client->session);
+    }
+    if(client->front_buffer != NULL) {
+        memory += sizeof(cell_t) * CONSOLE_CELLS;
+    }
+    return memory;
+}
+
+void report_usage(worker_t *worker) {
+    unsigned long long now = monotonic_ms();
+    uint64_t count;
+    unsigned long long session_ns = 0;
+    unsigned long round;
+    size_t memory = 0;
+    client_t *client;
+    usage_t usage;
+    int ii;
+
+    if(read(worker->report_fd, &count, sizeof(count)) != sizeof(count)) {
+        return;
+    }
+    pthread_mutex_lock(&report.lock);
+    round = report.round;
+    pthread_mutex_unlock(&report.lock);
+    worker->num_top = 0;
+    for(client = worker->clients; client != NULL; client = client->next_client) {
+        usage.worker = worker->id;
+        usage.fd = client->fd;
+        usage.frozen = client->session == NULL;
+        usage.step_ns = client->step_ns;
+        usage.encode_ns = client->encode_ns;
+        usage.bytes_in = client->bytes_in;
+        usage.bytes_out = client->bytes_out;
+        usage.keys_cut = client->keys_coalesced + client->keys_dropped;
+        usage.age_ms = now - client->connected_ms;
+        usage.memory = client_memory(client);
+        session_ns += usage.step_ns + usage.encode_ns;
+        memory += usage.memory;
+
+        /* Keep the heaviest few in order, heaviest first. */
+        ii = worker->num_top < report.top ? worker->num_top++ : report.top;
+        while(ii > 0 && compare_usage(&usage, &worker->top[ii - 1]) < 0) {
+            if(ii < report.top) {
+                worker->top[ii] = worker->top[ii - 1];
+            }
+            ii--;
+        }
+        if(ii < report.top) {
+            worker->top[ii] = usage;
+        }
+    }
+
+    /* The main thread may have stopped waiting for this report. */
+    pthread_mutex_lock(&report.lock);
+    if(round != report.round || worker->totals.handed_over) {
+        pthread_mutex_unlock(&report.lock);
+        return;
+    }
+    worker->totals.handed_over = 1;
+    worker->totals.num_clients = worker->num_clients;
+    worker->totals.num_frozen = worker->num_frozen;
+    worker->totals.thread_ns = thread_cpu_ns();
+    worker->totals.session_ns = session_ns;
+    worker->totals.memory = memory;
+    report.waiting--;
+    pthread_cond_signal(&report.handed_over);
+    pthread_mutex_unlock(&report.lock);
+}
+
+int compare_usage(const void *a, const void *b) {
+    const usage_t *x = a;
+    const usage_t *y = b;
+    unsigned long long x_ns = x->step_ns + x->encode_ns;
+    unsigned long long y_ns = y->step_ns + y->encode_ns;
+    return (x_ns < y_ns) - (x_ns > y_ns);
+}
+
+void print_report(worker_t *workers, int threads) {
+    worker_usage_t *totals;
+    usage_t *all;
+    usage_t *u;
+    struct timespec deadline;
+    uint64_t one = 1;
+    int ii, jj, count = 0;
+
+    /* A worker that has stopped is not asked. */
+    pthread_mutex_lock(&report.lock);
+    report.round++;
+    report.waiting = 0;
+    for(ii = 0; ii < threads; ii++) {
+        workers[ii].totals.handed_over = 0;
+        if(!workers[ii].exited
+                && write(workers[ii].report_fd, &one, sizeof(one)) == sizeof(one)) {
+            report.waiting++;
+        }
+    }
+    pthread_mutex_unlock(&report.lock);
+
+    /* Wait a while, then go without the parts still missing. */
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += REPORT_WAIT_MS / 1000;
+    deadline.tv_nsec += (REPORT_WAIT_MS % 1000) * 1000000L;
+    if(deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_lock(&report.lock);
+    while(report.waiting > 0) {
+        if(pthread_cond_timedwait(&report.handed_over, &report.lock, &deadline) != 0) {
+            break;
+        }
+    }
+    report.round++;
+    pthread_mutex_unlock(&report.lock);
+
+    /* The heaviest sessions of all are among each worker's heaviest. */
+    all = malloc(sizeof(*all) * threads * report.top);
+    if(all == NULL) {
+        return;
+    }
+    fprintf(stderr, "%-6s %8s %7s %12s %12s %10s\n",
+        "worker", "players", "idle", "cpu ms", "sessions ms", "memory KB");
+    for(ii = 0; ii < threads; ii++) {
+        totals = &workers[ii].totals;
+        if(!totals->handed_over) {
+            fprintf(stderr, "%-6d %8s\n", ii, "no report");
+            continue;
+        }
+        fprintf(stderr, "%-6d %8lu %7lu %12.1f %12.1f %10zu\n", ii,
+            totals->num_clients, totals->num_frozen, totals->thread_ns / 1e6,
+            totals->session_ns / 1e6, totals->memory / 1024);
+        for(jj = 0; jj < workers[ii].num_top; jj++) {
+            all[count++] = workers[ii].top[jj];
+        }
+    }
+    qsort(all, count, sizeof(*all), compare_usage);
+
+    fprintf(stderr, "%-6s %5s %10s %10s %6s %10s %10s %9s %9s %10s\n", "worker", "fd",
+        "step ms", "encode ms", "cpu %", "bytes in", "bytes out", "keys cut", "memory KB",
+        "connected");
+    for(ii = 0; ii < count && ii < report.top; ii++) {
+        u = &all[ii];
+        fprintf(stderr, "%-6d %5d %10.1f %10.1f %6.2f %10llu %10llu %9llu %9zu %8llus%s\n",
+            u->worker, u->fd, u->step_ns / 1e6, u->encode_ns / 1e6,
+            u->age_ms ? (u->step_ns + u->encode_ns) / 1e4 / u->age_ms : 0.0,
+            u->bytes_in, u->bytes_out, u->keys_cut, u->memory / 1024, u->age_ms / 1000,
+            u->frozen ? " idle" : "");
+    }
+    free(all);
+}
+
+/** @brief Server entrypoint.
+ *
+ *  Starts the workers, then waits for a signal to stop them, printing a
+ *  usage report on each SIGUSR1 in the meantime.
+ *
+ * @return 0 when stopped by a signal, 1 if the server could not start.
+ */
+int main(int argc, char **argv)
+{
+    options_t options;
+    worker_t *workers;
+    sigset_t signals;
+    unsigned long connected = 0;
+    unsigned long frozen = 0;
+    uint64_t one = 1;
+    int ii, sig;
+
+    if(parse_options(argc, argv, &options) < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    replay_path = getenv(REPLAY_ENV);
+    idle_ms = (unsigned long long) options.idle_seconds * 1000;
+    ansi_palette_init(&palette, options.palette);
+    report.top = options.top_sessions;
+    key_rate = options.key_rate;
+
+    /* Only the main thread takes the signals; workers inherit the mask. */
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    stop_fd = eventfd(0, EFD_NONBLOCK);
+    workers = NULL;
+    if(stop_fd < 0 || posix_memalign((void**) &workers, 64,
+            sizeof(*workers) * options.threads) != 0) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for(ii = 0; ii < options.threads; ii++) {
+        if(init_worker(&workers[ii], ii, options.port) < 0) {
+            perror("listen");
+            return 1;
+        }
+    }
+    for(ii = 0; ii < options.threads; ii++) {
+        if(pthread_create(&workers[ii].thread, NULL, worker_main, &workers[ii]) != 0) {
+            fprintf(stderr, "could not start worker thread\n");
+            return 1;
+        }
+    }
+
+    while(sigwait(&signals, &sig) == 0 && sig == SIGUSR1) {
+        print_report(workers, options.threads);
+    }
+    if(write(stop_fd, &one, sizeof(one)) != sizeof(one)) {
+        perror("write");
+    }
+    for(ii = 0; ii < options.threads; ii++) {
+        pthread_join(workers[ii].thread, NULL);
+        connected += workers[ii].num_clients;
+        frozen += workers[ii].num_frozen;
+        close(workers[ii].listener);
+        close(workers[ii].epoll_fd);
+        close(workers[ii].report_fd);
+        free(workers[ii].top);
+    }
+    fprintf(stderr, "stopped with %lu players connected, %lu of them idle\n",
+        connected, frozen);
+    return 0;
+}
@@ -0,0 +1,1377 @@
+/** @file session.c
+ *  @brief The game flow of one session, as a stackless coroutine.
+ *
+ *  Everything a game used to keep in globals lives in the session, and
+ *  the old state machine is the body of session_flow.  Where it used to
+ *  poll for a key every tick, it now yields until a key or a timer is
+ *  due, so a waiting session costs nothing until it is resumed.
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ncurses.h>
+
+#include "coroutine.h"
+#include "board_render.h"
+#include "session.h"
+
+/** Layers of the game screen, bottom first */
+#define LAYER_BACKGROUND 0
+#define LAYER_BLOCKS 1
+#define LAYER_ANIMATION 2
+#define LAYER_OVERLAY 3
+#define NUM_LAYERS 4
+
+/** Console location of pause/victory/defeat messages */
+#define OVERLAY_ROW 10
+
+/** Key presses a session reacts to */
+#define IS_KEY(ch, upper) ((ch) == (upper) || (ch) == (upper) - 'A' + 'a')
+
+/* 
+ * Waits used by session_flow.  Each leaves the key read in ch, or
+ * SESSION_NO_KEY if the timer ran out first.
+ */
+
+/** Wait for the next key. */
+#define AWAIT_KEY(s, ch) \
+    while(((ch) = pop_key(s)) == SESSION_NO_KEY) { \
+        CO_YIELD((s)->co_state, SESSION_WAIT_KEY); \
+    }
+
+/** Wait for the next key, but no later than a deadline. */
+#define AWAIT_KEY_UNTIL(s, ch, deadline) \
+    (s)->wake_ms = (deadline); \
+    while(((ch) = pop_key(s)) == SESSION_NO_KEY && (s)->now_ms < (s)->wake_ms) { \
+        CO_YIELD((s)->co_state, SESSION_WAIT_KEY | SESSION_WAIT_TIMER); \
+    }
+
+/**
+ * Note the screen the session is about to wait on, and let a thawed
+ * session start here.
+ */
+#define ENTER_SCREEN(s, id) \
+    CO_ENTRY(id) \
+    (s)->screen = (id)
+
+/** Wait for some milliseconds, leaving keys queued. */
+#define AWAIT_DELAY(s, ms) \
+    (s)->wake_ms = (s)->now_ms + (ms); \
+    while((s)->now_ms < (s)->wake_ms) { \
+        CO_YIELD((s)->co_state, SESSION_WAIT_TIMER); \
+    }
+
+/** @brief Game title screen.
+ */
+static char* title_screen =
+"*******************************************************************************\n"
+"*High Score:                                                                  *\n"
+"*                                                _____         .----.         *\n"
+"*           .-''-.                              /    /        / .--. \\        *\n"
+"*         .' .-.  )                            /    /        ' '    ' '       *\n"
+"*        / .'  / /                            /    /         \\ \\    / /       *\n"
+"*       (_/   / /         .-''` ''-.         /    /           `.`'--.'        *\n"
+"*            / /        .'          '.      /    /  __        / `'-. `.       *\n"
+"*           / /        /              `    /    /  |  |      ' /    `. \\      *\n"
+"*          . '        '                '  /    '   |  |     / /       \\ '     *\n"
+"*         / /    _.-')|         .-.    | /    '----|  |---.| |         | |    *\n"
+"*        .' '  _.'.-'' .        |  |   ./          |  |   || |         | |    *\n"
+"*       /  /.-'_.'      .       '_.'  / '----------|  |---' \\ \\       / /     *\n"
+"*      /    _.'          '._         .'            |  |     `.'-...-'.'       *\n"
+"*     ( _.-'                '-....-'`             /____\\       `-...-'        *\n"
+"*                                                                             *\n"
+"*                              The Return of Gazool                           *\n"
+"*                             ~*~*~*~*~*~*~*~*~*~*~*~                         *\n"
+"*                               (N)ew Game                                    *\n"
+"*                               (I)nstructions                                *\n"
+"*                               (Q)uit                                        *\n"
+"*                                                                             *\n"
+"*                                                                             *\n"
+"*A horsecatdog production                        Special Thanks to: Tom Cruise*\n"
+"*******************************************************************************";
+
+/** @brief Game instruction screen.
+ */
+static char* instruction_screen = 
+"*******************************************************************************\n"
+"*                                                                             *\n"
+"*                             How to Play                                     *\n"
+"*                             -----------                                     *\n"
+"*                             W/Up: Shift blocks up                           *\n"
+"*                             A/Left: Shift blocks left                       *\n"
+"*                             S/Down: Shift blocks down                       *\n"
+"*                             D/Right: Shift blocks right                     *\n"
+"*                             P: Pause/resume                                 *\n"
+"*                             Q: Quit                                         *\n"
+"*                                                                             *\n"
+"*                                                                             *\n"
+"*       It's the year 2048.  The Archdemon Gazool has awoken from his         *\n"
+"*       long slumber, and is hurtling towards Earth inside of a giant         *\n"
+"*       comet.  You are Cliff Zimble, expert custodian and rap music          *\n"
+"*       enthusiast.  Inexplicably, only you have the power to save the        *\n"
+"*       world from the Ice Demon.  Even less explicably, you shall do         *\n"
+"*       so by sliding tiles around.  Kind of like Ender's Game, but           *\n"
+"*       way less cool.                                                        *\n"
+"*                                                                             *\n"
+"*                                                                             *\n"
+"*                      (To Leave this screen , press 'Q')                     *\n"
+"*                                                                             *\n"
+"*                                                                             *\n"
+"*******************************************************************************";
+
+/** @brief Game difficulty screen.
+ */
+static char* difficulty_screen =
+"*******************************************************************************\n"
+"*                                                                             *\n"
+"*                                                                             *\n"
+"*                                                                             *\n"
+"*                                                                             *\n"
+"*                       Select A Difficulty Level                             *\n"
+"*                            (1) 8    -- Unicellular Organism                 *\n"
+"*                            (2) 16   -- Moss                                 *\n"
+"*                            (3) 32   -- Mango                                *\n"
+"*                            (4) 64   -- Jellyfish                            *\n"
+"*                            (5) 128  -- Cockroach                            *\n"
+"*                            (6) 256  -- Hamster                              *\n"
+"*                            (7) 512  -- Ferret                               *\n"
+"*                            (8) 1024 -- Kangaroo                             *\n"
+"*                            (9) 2048 -- Human                                *\n"
+"*                            (0) 4096 -- Dolphin                              *\n"
+"*                                                                             *\n"
+"*                                                                             *\n"
+"*                                                                             *\n"
+"*                                                                             *\n"
+"*                                                                             *\n"
+"*                                                                             *\n"
+"*                                                                             *\n"
+"*                                                                             *\n"
+"*******************************************************************************";
+
+/** @brief Game defeat message.
+ */
+static char* defeat_message =
+"********************************************************************\n"
+"*        YOU LOSE -- PRESS 'Q' TO RETURN TO THE MAIN SCREEN        *\n"
+"*        Or go see Tom Cruise in Jack Reacher, now on Blu-Ray.     *\n"
+"********************************************************************";
+
+/** @brief Game victory message.
+ */
+static char* victory_message =
+"********************************************************************\n"
+"*        YOU WIN -- PRESS 'Q' TO RETURN TO THE MAIN SCREEN         *\n"
+"*        Way to go, Ice Man.                                       *\n"
+"********************************************************************";
+
+/** @brief Game pause message.
+ */
+static char* pause_message =
+"********************************************************************\n"
+"*        PAUSED -- PRESS 'P' TO RESUME, 'Q' TO QUIT                *\n"
+"*        Gazool waits for no one.  Except you, apparently.         *\n"
+"********************************************************************";
+
+/***** Function prototypes ******/
+
+/***** Block moving functions *****/
+
+/** @brief Add a new block animation to the given animation list.
+ *
+ * We search the list of a cell that has state == ANI_BLOCK_DEAD.
+ * We then write the new animation into that cell.  If the list is 
+ * full, nothing happens.
+ *
+ * The "animation" we're talking about here is a block shifting from
+ * one grid cell to another, as a result of a user move.  The animation
+ * starts in one cell (row, col) and ends in another.  The moving 
+ * block has a certain value in it while it's moving, and a potentially
+ * different value when it reaches the destination (if it merges
+ * with another block).
+ * 
+ * @param animation_list The list of animations.
+ * @param start_row The row where the moving block starts
+ * @param start_col The column where the moving block starts
+ * @param end_row The row where the moving block stops
+ * @param end_col The column where the moving block stops
+ * @param start_val The value in the block while it's moving.
+ * @param end_val The value in the block when it stops.
+ * @return None.
+ */
+static void add_animation(
+        animated_block_t animation_list[MAX_ANIMATIONS],
+        int start_row, 
+        int start_col,
+        int end_row,
+        int end_col,
+        int start_val,
+        int end_val);
+
+/** @brief Report a change to the board.
+ *
+ * The event is queued in damage_events until the board is redrawn.  If 
+ * the queue is full, nothing happens.  Repeated score changes are only 
+ * queued once.
+ *
+ * @param s The session.
+ * @param type DAMAGE_BLOCK_MOVED, DAMAGE_BLOCK_MERGED, etc.
+ * @param from_row The grid row a block came from.
+ * @param from_col The grid column a block came from.
+ * @param to_row The grid row a block ended up in.
+ * @param to_col The grid column a block ended up in.
+ * @return None.
+ */
+static void add_damage(session_t *s, int type, int from_row, int from_col, int to_row, int to_col);
+
+/** @brief Forget all reported damage.
+ *
+ * Called once the damage has been painted, or a full redraw has made it 
+ * moot.
+ *
+ * @param s The session.
+ * @return None.
+ */
+static void clear_damage(session_t *s);
+
+/** @brief Get the console rectangle touched by a damage event.
+ *
+ * For a moving block, this is the whole path from the source cell to 
+ * the destination cell.
+ *
+ * @param event The damage event.
+ * @param row Set to the top row of the rectangle.
+ * @param col Set to the left column of the rectangle.
+ * @param height Set to the number of rows in the rectangle.
+ * @param width Set to the number of columns in the rectangle.
+ * @return None.
+ */
+static void get_damage_rect(
+        damage_event_t *event, 
+        int *row, 
+        int *col, 
+        int *height, 
+        int *width);
+
+/** @brief Lift the blocks that are about to move off the block layer.
+ *
+ * Called at the start of a move.  The source cell of each moved block 
+ * is cleared (the block is drawn on the animation layer from then on), 
+ * and the scores are redrawn if they changed.
+ *
+ * @param s The session.
+ * @return None.
+ */
+static void lift_moving_blocks(session_t *s);
+
+/** @brief Draw the settled results of all reported damage.
+ *
+ * The destination cell of each moved, merged or spawned block is 
+ * redrawn on the block layer, from number_grid.  The scores are redrawn 
+ * if they changed.  The rest of the board is left alone.
+ *
+ * @param s The session.
+ * @return None.
+ */
+static void draw_damage(session_t *s);
+
+/** @brief Draw the scores onto the block layer.
+ *
+ * @param s The session.
+ * @return None.
+ */
+static void draw_scores(session_t *s);
+
+/** @brief Draw a block onto a layer, and mark it dirty.
+ *
+ * @param s The session.
+ * @param layer The layer to draw to.
+ * @param row The console row of the upper left block corner
+ * @param col The console col of the upper left block corner
+ * @param value The value displayed inside the block
+ * @return None.
+ */
+static void draw_layer_block(session_t *s, int layer, int row, int col, int value);
+
+/** @brief Show a message over the board.
+ *
+ * @param s The session.
+ * @param message The message to show (e.g. victory_message).
+ * @return None.
+ */
+static void draw_overlay(session_t *s, char *message);
+
+/** @brief Flatten the game layers into the back console.
+ *
+ * The regions that changed are remembered for session_flush.
+ *
+ * @param s The session.
+ * @return None.
+ */
+static void present_board(session_t *s);
+
+/** @brief Update the current score.
+ * 
+ * If the score exceeds the high score, then the high score changes to this 
+ * value as well.
+ *
+ * @param s The session.
+ * @param score The new score.
+ * @return None.
+ */
+static void update_score(session_t *s, unsigned int score);
+
+/** @brief Add a new block to the board.
+ * 
+ * The block will have either 2 or 4 as its value.  It will occupy one of the 
+ * remaining locations, randomly.  If the board is full, nothing happens.
+ * The number_grid array is modified by this method.
+ *
+ * @param s The session.
+ * @return None.
+ */
+static void add_random_block(session_t *s);
+
+/** @brief Record how the current game ended, and save it.
+ *
+ * The game is appended to the session's replay archive, if it has one.
+ *
+ * @param s The session.
+ * @param result One of the REPLAY_RESULT_ constants.
+ * @return None.
+ */
+static void save_replay(session_t *s, int result);
+
+/** @brief Draw an animation frame.
+ * 
+ * This function draws the next animation frame into the console.  It is only 
+ * called while blocks are sliding after a move.  We iterate through the
+ * animated_blocks array, draw all the blocks therein. 
+ *
+ * The frame has two layers:
+ * 1. The background, consisting of the grid outline and any non-animated blocks.
+ * 2. Animated objects.  Draw on top of the background. this consists of 
+ *    blocks that are still moving, and blocks that were moving and reached
+ *    their desitnation (idle blocks).
+ *
+ * The blocks are drawn on the animation layer, over the paths reported by 
+ * the current move.  Only those paths are recomposited.
+ *
+ * @param s The session.
+ * @return None
+ */
+static void draw_animation_frame(session_t *s);
+
+/** @brief Move all moving blocks by one step. 
+ * 
+ * This function iterates through the  list of animated objects, and 
+ * moves them by one step towards their destination.  If an object reaches 
+ * it's destination, it is marked as idle. If all moving objects are idle, 
+ * the animation is done, and we return 0.  Otherwise we return 1.
+ *
+ * @param s The session.
+ * @return 0 if nothing moved, 1 otherwise.
+ */
+static int step_moving_blocks(session_t *s);
+
+/** @brief Draw the in game clock to a console.
+ *
+ * The clock is drawn as H:MM:SS, padded to TIMER_WIDTH so a shorter
+ * string clears a longer one.
+ *
+ * @param console The console to draw to.
+ * @param seconds The elapsed time to render.
+ * @return None.
+ */
+static void draw_timer(console_t *console, unsigned long seconds);
+
+/** @brief Start (or resume) the in game clock.
+ *
+ * Has no effect if the clock is already running.
+ *
+ * @param s The session.
+ * @return None.
+ */
+static void start_game_clock(session_t *s);
+
+/** @brief Stop the in game clock, banking the time played so far.
+ *
+ * Has no effect if the clock is already stopped.
+ *
+ * @param s The session.
+ * @return None.
+ */
+static void stop_game_clock(session_t *s);
+
+/** @brief Refresh the in game clock, if a new second has elapsed.
+ *
+ * Only the clock's own region of the block layer is redrawn and copied 
+ * out, and only when the displayed value changes.
+ *
+ * @param s The session.
+ * @return None.
+ */
+static void tick_game_clock(session_t *s);
+
+/** @brief Draw a full screen scene, such as the title screen.
+ * 
+ * Basically, this amounts to printing a large string to the back 
+ * console.  All of it is marked changed.
+ *
+ * @param s The session.
+ * @param screen The string containing the background.
+ * @return None.
+ */
+static void draw_background(session_t *s, const char* screen);
+
+/** @brief Draw the main game board.
+ * 
+ * This draws the main game interface, when nothing is being animated (we 
+ * are waiting for user input).  This consists of the grid, the blocks, 
+ * the score, etc.  Every layer is redrawn, and the whole screen will be
+ * recomposited by the next present_board.
+ *
+ * @param s The session.
+ * @return None.
+ */
+static void draw_board(session_t *s);
+
+/** @brief Draw the resting blocks and the scores into a layer.
+ *
+ * The result is looked up in the render cache first, and stored there
+ * if it had to be drawn.  The layer must be transparent to start with.
+ *
+ * @param s The session.
+ * @param layer The layer to draw into.
+ * @return None.
+ */
+static void draw_cached_blocks(session_t *s, console_t *layer);
+
+/***** Session functions *****/
+
+/** @brief Remember a region of the back console as changed.
+ *
+ * Has the signature of a present_region_fn, so it can be handed to
+ * compositor_flatten.
+ *
+ * @param ctx The session.
+ * @param console The console the region is in (unused).
+ * @param row The top row of the region.
+ * @param col The left column of the region.
+ * @param height The number of rows in the region.
+ * @param width The number of columns in the region.
+ * @return None.
+ */
+static void mark_region(
+        void *ctx,
+        console_t *console,
+        int row,
+        int col,
+        int height,
+        int width);
+
+/** @brief Take the oldest key from the session's queue.
+ *
+ * @param s The session.
+ * @return The key, or SESSION_NO_KEY if there is none.
+ */
+static int pop_key(session_t *s);
+
+/** @brief Map a key to the direction it shifts the board.
+ *
+ * @param ch The key.
+ * @return One of the DIR_ constants, or -1.
+ */
+static int key_direction(int ch);
+
+/** @brief Shift the blocks in a direction, producing game side effects.
+ *
+ * The engine moves the blocks, and its trace of the blocks that moved
+ * becomes the animations and damage events.  Blocks that stay put are
+ * left in animated_background while the others slide.
+ *
+ * @param s The session.
+ * @param dir One of the DIR_ constants.
+ * @return 1 if something moved, 0 if nothing moved.
+ */
+static int shift_blocks(session_t *s, int dir);
+
+/** @brief Find when the in game clock next shows a new second.
+ *
+ * @param s The session.
+ * @return The time, in ms, or now if the clock is stopped.
+ */
+static unsigned long long next_clock_tick(session_t *s);
+
+/** @brief Set up a new round: clear the board, place two blocks.
+ *
+ * @param s The session.
+ * @return None.
+ */
+static void start_round(session_t *s);
+
+/** @brief Finish a move once its animation is done.
+ *
+ * The moved blocks are settled, a new block is placed unless the game 
+ * was won, and the changes are painted.
+ *
+ * @param s The session.
+ * @return 0 if the game goes on, REPLAY_RESULT_WON or REPLAY_RESULT_LOST.
+ */
+static int settle_move(session_t *s);
+
+/** @brief Repaint the game screen of a thawed session, from its board.
+ *
+ * @param s The session, on one of the screens of a round.
+ * @return None.
+ */
+static void draw_thawed_game(session_t *s);
+
+/** @brief Step the game.
+ *
+ * The game is a coroutine.  It runs from where it last stopped until it
+ * has to wait for a key or a timer, and returns what it waits for.
+ *
+ * @param s The session.
+ * @return SESSION_ flags.
+ */
+static int session_flow(session_t *s);
+
+/***** Function definitions ******/
+
+void add_random_block(session_t *s) {
+    int row, col;
+
+    if(engine_spawn(s->number_grid, &s->game_rng, &row, &col) == 0) {
+        return;
+    }
+    add_damage(s, DAMAGE_BLOCK_SPAWNED, 0, 0, row, col);
+}
+
+void save_replay(session_t *s, int result) {
+    replay_finish(&s->replay, result, s->number_grid, s->current_score);
+    if(s->replay_path != NULL && s->replay_path[0] != '\0') {
+        replay_append(s->replay_path, &s->replay);
+    }
+}
+
+void add_animation(
+        animated_block_t animation_list[MAX_ANIMATIONS],
+        int start_row, 
+        int start_col,
+        int end_row,
+        int end_col,
+        int start_val,
+        int end_val) {
+    
+    int idx = 0;
+
+    /* Find a dead cell in the animation list, if one exists */
+    while(idx < MAX_ANIMATIONS) {
+        if(animation_list[idx].state == ANI_BLOCK_DEAD) {
+            animation_list[idx].state = ANI_BLOCK_MOVING;
+            animation_list[idx].cur_row = start_row;
+            animation_list[idx].cur_col = start_col;
+            animation_list[idx].dest_row = end_row;
+            animation_list[idx].dest_col = end_col;
+            animation_list[idx].moving_value = start_val;
+            animation_list[idx].idle_value = end_val;
+            break;
+        }
+        idx++;
+    }
+}
+
+void add_damage(session_t *s, int type, int from_row, int from_col, int to_row, int to_col) {
+    int ii;
+    damage_event_t *event;
+
+    if(type == DAMAGE_SCORE) {
+        for(ii = 0; ii < s->num_damage_events; ii++) {
+            if(s->damage_events[ii].type == DAMAGE_SCORE) {
+                return;
+            }
+        }
+    }
+    if(s->num_damage_events == MAX_DAMAGE_EVENTS) {
+        return;
+    }
+
+    event = &s->damage_events[s->num_damage_events++];
+    event->type = type;
+    event->from_row = from_row;
+    event->from_col = from_col;
+    event->to_row = to_row;
+    event->to_col = to_col;
+}
+
+void clear_damage(session_t *s) {
+    s->num_damage_events = 0;
+}
+
+void get_damage_rect(
+        damage_event_t *event, 
+        int *row, 
+        int *col, 
+        int *height, 
+        int *width) {
+    int top, left, bottom, right;
+
+    switch(event->type) {
+        case DAMAGE_BLOCK_MOVED:
+        case DAMAGE_BLOCK_MERGED:
+            /* The block passes through every cell between the two. */
+            top = (event->from_row < event->to_row)? event->from_row : event->to_row;
+            bottom = (event->from_row < event->to_row)? event->to_row : event->from_row;
+            left = (event->from_col < event->to_col)? event->from_col : event->to_col;
+            right = (event->from_col < event->to_col)? event->to_col : event->from_col;
+            *row = CONSOLE_ROW(top);
+            *col = CONSOLE_COL(left);
+            *height = CONSOLE_ROW(bottom) - CONSOLE_ROW(top) + BLOCK_HEIGHT;
+            *width = CONSOLE_COL(right) - CONSOLE_COL(left) + BLOCK_WIDTH;
+            break;
+        case DAMAGE_BLOCK_SPAWNED:
+            *row = CONSOLE_ROW(event->to_row);
+            *col = CONSOLE_COL(event->to_col);
+            *height = BLOCK_HEIGHT;
+            *width = BLOCK_WIDTH;
+            break;
+        case DAMAGE_SCORE:
+        default:
+            *row = SCORE_ROW;
+            *col = SCORE_COL;
+            *height = 1;
+            *width = SCORES_WIDTH;
+            break;
+    }
+}
+
+void lift_moving_blocks(session_t *s) {
+    int ii;
+    damage_event_t *event;
+
+    for(ii = 0; ii < s->num_damage_events; ii++) {
+        event = &s->damage_events[ii];
+        switch(event->type) {
+            case DAMAGE_BLOCK_MOVED:
+            case DAMAGE_BLOCK_MERGED:
+                compositor_erase(
+                    &s->compositor, 
+                    LAYER_BLOCKS, 
+                    CONSOLE_ROW(event->from_row), 
+                    CONSOLE_COL(event->from_col), 
+                    BLOCK_HEIGHT, 
+                    BLOCK_WIDTH);
+                break;
+            case DAMAGE_SCORE:
+                draw_scores(s);
+                break;
+        }
+    }
+}
+
+void draw_damage(session_t *s) {
+    int ii;
+    damage_event_t *event;
+
+    for(ii = 0; ii < s->num_damage_events; ii++) {
+        event = &s->damage_events[ii];
+        switch(event->type) {
+            case DAMAGE_BLOCK_MOVED:
+            case DAMAGE_BLOCK_MERGED:
+            case DAMAGE_BLOCK_SPAWNED:
+                draw_layer_block(s, 
+                    LAYER_BLOCKS, 
+                    CONSOLE_ROW(event->to_row), 
+                    CONSOLE_COL(event->to_col), 
+                    s->number_grid[event->to_row][event->to_col]);
+                break;
+            case DAMAGE_SCORE:
+                draw_scores(s);
+                break;
+        }
+    }
+}
+
+void draw_scores(session_t *s) {
+    console_t *layer = compositor_layer(&s->compositor, LAYER_BLOCKS);
+    compositor_erase(&s->compositor, LAYER_BLOCKS, SCORE_ROW, SCORE_COL, 1, SCORES_WIDTH);
+    board_draw_score(layer, SCORE_ROW, SCORE_COL, s->current_score);
+    board_draw_score(layer, SCORE_ROW, HIGH_SCORE_COL, s->high_score);
+    compositor_mark_dirty(&s->compositor, LAYER_BLOCKS, SCORE_ROW, SCORE_COL, 1, SCORES_WIDTH);
+}
+
+void draw_layer_block(session_t *s, int layer, int row, int col, int value) {
+    board_draw_block(compositor_layer(&s->compositor, layer), row, col, value);
+    compositor_mark_dirty(&s->compositor, layer, row, col, BLOCK_HEIGHT, BLOCK_WIDTH);
+}
+
+void draw_overlay(session_t *s, char *message) {
+    console_t *layer = compositor_layer(&s->compositor, LAYER_OVERLAY);
+    int start_row;
+
+    compositor_clear_layer(&s->compositor, LAYER_OVERLAY);
+    console_set_cursor(layer, OVERLAY_ROW, 0);
+    console_putstr(layer, message);
+
+    /* Mark every row the message touched. */
+    start_row = OVERLAY_ROW;
+    compositor_mark_dirty(
+        &s->compositor, 
+        LAYER_OVERLAY, 
+        start_row, 
+        0, 
+        layer->cursor.row - start_row + 1, 
+        CONSOLE_WIDTH);
+}
+
+void present_board(session_t *s) {
+    compositor_flatten(&s->compositor, &s->back_console, mark_region, s);
+}
+
+void update_score(session_t *s, unsigned int score) {
+    add_damage(s, DAMAGE_SCORE, 0, 0, 0, 0);
+    s->current_score = score;
+    if(s->current_score > s->high_score) {
+        s->high_score = s->current_score;
+    }
+}
+
+int step_moving_blocks(session_t *s) {
+    animated_block_t *cur;
+    int something_moved = 0;
+    int done_moving;
+    int row_delta;
+    int col_delta;
+    int ii;
+
+    for(ii = 0; ii < MAX_ANIMATIONS; ii++) {
+        cur = &s->animated_blocks[ii];
+        done_moving = 1;
+        if(cur->state == ANI_BLOCK_MOVING) {
+            /* 
+             * Step the row and/or column by ANI_STEP_SIZE,
+             * unless the row/col is closer to the destination 
+             * than the step size, in which case we just close 
+             * the remaining distance.
+             */
+            row_delta = cur->cur_row - cur->dest_row;
+            col_delta = cur->cur_col - cur->dest_col;
+            if(row_delta < 0) {
+                row_delta = -row_delta;
+                done_moving = 0;
+                cur->cur_row += (row_delta < ANI_STEP_SIZE)? row_delta : ANI_STEP_SIZE;
+            } else if(row_delta > 0) {
+                done_moving = 0;
+                cur->cur_row -= (row_delta < ANI_STEP_SIZE)? row_delta : ANI_STEP_SIZE;
+            }
+
+            if(col_delta < 0) {
+                col_delta = -col_delta;
+                done_moving = 0;
+                cur->cur_col += (col_delta < ANI_STEP_SIZE)? col_delta : ANI_STEP_SIZE;
+            } else if(col_delta > 0) {
+                done_moving = 0;
+                cur->cur_col -= (col_delta < ANI_STEP_SIZE)? col_delta : ANI_STEP_SIZE;
+            }
+
+            /* Block is now idle */
+            if(done_moving) {
+                cur->state = ANI_BLOCK_IDLE;
+            } else {
+                something_moved = 1;
+            }
+        }
+    }
+
+    return something_moved;
+}
+
+void draw_timer(console_t *console, unsigned long seconds) {
+    static char buf[MAX_TIMER_STR_LEN];
+    int len;
+
+    len = snprintf(buf, MAX_TIMER_STR_LEN, "%lu:%02lu:%02lu",
+            seconds / 3600, (seconds / 60) % 60, seconds % 60);
+    while(len < TIMER_WIDTH) {
+        buf[len++] = ' ';
+    }
+    buf[len] = '\0';
+    console_set_cursor(console, TIMER_ROW, TIMER_COL);
+    console_putstr(console, buf);
+}
+
+void start_game_clock(session_t *s) {
+    if(s->clock_started_ms == 0) {
+        s->clock_started_ms = s->now_ms;
+    }
+}
+
+void stop_game_clock(session_t *s) {
+    if(s->clock_started_ms != 0) {
+        s->clock_banked_ms += s->now_ms - s->clock_started_ms;
+        s->clock_started_ms = 0;
+    }
+}
+
+void tick_game_clock(session_t *s) {
+    unsigned long long elapsed = s->clock_banked_ms;
+    unsigned long seconds;
+
+    if(s->clock_started_ms != 0) {
+        elapsed += s->now_ms - s->clock_started_ms;
+    }
+    seconds = elapsed / 1000;
+    if(seconds != s->game_timer) {
+        s->game_timer = seconds;
+        draw_timer(compositor_layer(&s->compositor, LAYER_BLOCKS), s->game_timer);
+        compositor_mark_dirty(
+            &s->compositor, 
+            LAYER_BLOCKS, 
+            TIMER_ROW, 
+            TIMER_COL, 
+            1, 
+            TIMER_WIDTH);
+        present_board(s);
+    }
+}
+
+void draw_background(session_t *s, const char* screen) {
+    int ii;
+
+    console_clear(&s->back_console);
+    console_set_cursor(&s->back_console, 0, 0);
+    console_putstr(&s->back_console, screen);
+    for(ii = 0; ii < CONSOLE_HEIGHT; ii++) {
+        mark_region(s, &s->back_console, ii, 0, 1, CONSOLE_WIDTH);
+    }
+}
+
+void draw_board(session_t *s) {
+    console_t *layer;
+    int ii;
+
+    /* The background never changes, so it only needs drawing once. */
+    if(!s->background_ready) {
+        layer = compositor_layer(&s->compositor, LAYER_BACKGROUND);
+        console_clear(layer);
+        console_putstr(layer, board_background);
+        s->background_ready = 1;
+    }
+
+    for(ii = LAYER_BLOCKS; ii < NUM_LAYERS; ii++) {
+        compositor_clear_layer(&s->compositor, ii);
+    }
+    layer = compositor_layer(&s->compositor, LAYER_BLOCKS);
+    draw_cached_blocks(s, layer);
+    draw_timer(layer, s->game_timer);
+
+    /* 
+     * back_console may hold another screen, so recomposite all of it.  
+     * Any pending damage is moot.
+     */
+    compositor_invalidate(&s->compositor);
+    clear_damage(s);
+}
+
+void draw_cached_blocks(session_t *s, console_t *layer) {
+    render_key_t key;
+    const cell_t *cached;
+    cell_t *slot;
+
+    render_key_make(&key, s->number_grid, s->current_score, s->high_score, RENDER_PHASE_REST);
+    cached = render_cache_lookup(s->render_cache, &key);
+    if(cached != NULL) {
+        memcpy(layer->base_addr, cached, sizeof(cell_t) * CONSOLE_CELLS);
+        return;
+    }
+
+    board_draw_score(layer, SCORE_ROW, SCORE_COL, s->current_score);
+    board_draw_score(layer, SCORE_ROW, HIGH_SCORE_COL, s->high_score);
+    board_draw_blocks(layer, s->number_grid);
+    slot = render_cache_insert(s->render_cache, &key);
+    if(slot != NULL) {
+        memcpy(slot, layer->base_addr, sizeof(cell_t) * CONSOLE_CELLS);
+    }
+}
+
+void draw_animation_frame(session_t *s) {
+    int ii;
+    int row, col, height, width;
+    animated_block_t *cur;
+
+    /* Wipe the last frame from the paths of the moving blocks... */
+    for(ii = 0; ii < s->num_damage_events; ii++) {
+        get_damage_rect(&s->damage_events[ii], &row, &col, &height, &width);
+        if(s->damage_events[ii].type != DAMAGE_SCORE) {
+            compositor_erase(&s->compositor, LAYER_ANIMATION, row, col, height, width);
+        }
+    }
+
+    /* ...and draw the next one. */
+    for(ii = 0; ii < MAX_ANIMATIONS; ii++) {
+        cur = &s->animated_blocks[ii];
+        if(cur->state == ANI_BLOCK_MOVING) {
+            draw_layer_block(s, LAYER_ANIMATION, cur->cur_row, cur->cur_col, cur->moving_value);   
+        } else if(cur->state == ANI_BLOCK_IDLE) {
+            draw_layer_block(s, LAYER_ANIMATION, cur->cur_row, cur->cur_col, cur->idle_value);   
+        }
+    }
+}
+
+void mark_region(
+        void *ctx,
+        console_t *console,
+        int row,
+        int col,
+        int height,
+        int width) {
+    session_t *s = ctx;
+    int rr, end;
+
+    (void) console;
+
+    if(col < 0) {
+        width += col;
+        col = 0;
+    }
+    end = (col + width > CONSOLE_WIDTH) ? CONSOLE_WIDTH : col + width;
+    if(end <= col) {
+        return;
+    }
+    for(rr = (row < 0) ? 0 : row; rr < row + height && rr < CONSOLE_HEIGHT; rr++) {
+        if(s->dirty_end[rr] == 0 || col < s->dirty_start[rr]) {
+            s->dirty_start[rr] = col;
+        }
+        if(end > s->dirty_end[rr]) {
+            s->dirty_end[rr] = end;
+        }
+    }
+}
+
+int pop_key(session_t *s) {
+    int key;
+
+    if(s->key_count == 0) {
+        return SESSION_NO_KEY;
+    }
+    key = s->keys[s->key_head];
+    s->key_head = (s->key_head + 1) % SESSION_KEY_QUEUE_LEN;
+    s->key_count--;
+    return key;
+}
+
+int key_direction(int ch) {
+    switch(ch) {
+        case KEY_UP:
+        case 'W':
+        case 'w':
+            return DIR_UP;
+        case KEY_DOWN:
+        case 'S':
+        case 's':
+            return DIR_DOWN;
+        case KEY_LEFT:
+        case 'A':
+        case 'a':
+            return DIR_LEFT;
+        case KEY_RIGHT:
+        case 'D':
+        case 'd':
+            return DIR_RIGHT;
+        default:
+            return -1;
+    }
+}
+
+int shift_blocks(session_t *s, int dir) {
+    engine_motion_t motions[ENGINE_MAX_MOTIONS];
+    engine_motion_t *m;
+    unsigned int score = s->current_score;
+    int ii, jj, num_motions;
+
+    for(ii = 0; ii < GRID_SIZE; ii++) {
+        for(jj = 0; jj < GRID_SIZE; jj++) {
+            s->animated_background[ii][jj] = s->number_grid[ii][jj];
+        }
+    }
+    if(!engine_move_traced(s->number_grid, dir, &score, motions, &num_motions)) {
+        return 0;
+    }
+
+    /* Animations are in console coordinates, damage stays in grid coordinates. */
+    for(ii = 0; ii < num_motions; ii++) {
+        m = &motions[ii];
+        add_animation(
+            s->animated_blocks,
+            CONSOLE_ROW(m->from_row),
+            CONSOLE_COL(m->from_col),
+            CONSOLE_ROW(m->to_row),
+            CONSOLE_COL(m->to_col),
+            m->value,
+            m->merged ? m->value * 2 : m->value);
+        add_damage(s,
+            m->merged ? DAMAGE_BLOCK_MERGED : DAMAGE_BLOCK_MOVED,
+            m->from_row,
+            m->from_col,
+            m->to_row,
+            m->to_col);
+        s->animated_background[m->from_row][m->from_col] = 0;
+    }
+    if(score != s->current_score) {
+        update_score(s, score);
+    }
+    return 1;
+}
+
+unsigned long long next_clock_tick(session_t *s) {
+    unsigned long long elapsed;
+
+    if(s->clock_started_ms == 0) {
+        return s->now_ms;
+    }
+    elapsed = s->clock_banked_ms + s->now_ms - s->clock_started_ms;
+    return s->now_ms + 1000 - elapsed % 1000;
+}
+
+void start_round(session_t *s) {
+    uint64_t seed;
+    int ii, jj;
+
+    s->game_timer = 0;
+    s->clock_banked_ms = 0;
+    s->clock_started_ms = 0;
+    s->current_score = 0;
+    seed = ((uint64_t) time(NULL) << 32) ^ (s->now_ms << 8) ^ (uintptr_t) s;
+    engine_rng_seed(&s->game_rng, seed);
+    replay_start(&s->replay, seed, s->winning_tile);
+    for(ii = 0; ii < GRID_SIZE; ii++) {
+        for(jj = 0; jj < GRID_SIZE; jj++) {
+            s->number_grid[ii][jj] = 0;
+        }
+    }
+    add_random_block(s);
+    add_random_block(s);
+    start_game_clock(s);
+    draw_board(s);
+    present_board(s);
+}
+
+int settle_move(session_t *s) {
+    int ii;
+    int result = 0;
+
+    for(ii = 0; ii < MAX_ANIMATIONS; ii++) {
+        s->animated_blocks[ii].state = ANI_BLOCK_DEAD;
+    }
+    compositor_clear_layer(&s->compositor, LAYER_ANIMATION);
+
+    if(engine_is_won(s->number_grid, s->winning_tile)) {
+        result = REPLAY_RESULT_WON;
+    } else {
+        add_random_block(s);
+        if(engine_is_lost(s->number_grid)) {
+            result = REPLAY_RESULT_LOST;
+        }
+    }
+
+    /* 
+     * Settle the moved blocks and paint the new one.  The rest
+     * of the board is already on screen.
+     */
+    draw_damage(s);
+    clear_damage(s);
+    present_board(s);
+    return result;
+}
+
+void draw_thawed_game(session_t *s) {
+    draw_board(s);
+    if(s->screen == SESSION_SCREEN_PAUSED) {
+        draw_overlay(s, pause_message);
+    } else if(s->screen == SESSION_SCREEN_GAME_OVER) {
+        draw_overlay(s, engine_is_won(s->number_grid, s->winning_tile)
+            ? victory_message : defeat_message);
+    }
+    present_board(s);
+}
+
+int session_flow(session_t *s) {
+    int ch, dir, result;
+
+    CO_BEGIN(s->co_state);
+    for(;;) {
+        /* The title screen. */
+        ENTER_SCREEN(s, SESSION_SCREEN_TITLE);
+        draw_background(s, title_screen);
+        board_draw_score(&s->back_console, 1, 12, s->high_score);
+        do {
+            AWAIT_KEY(s, ch);
+        } while(!IS_KEY(ch, 'N') && !IS_KEY(ch, 'I') && !IS_KEY(ch, 'Q'));
+        if(IS_KEY(ch, 'Q')) {
+            CO_EXIT(s->co_state, SESSION_DONE);
+        }
+        if(IS_KEY(ch, 'I')) {
+            ENTER_SCREEN(s, SESSION_SCREEN_INSTRUCTIONS);
+            draw_background(s, instruction_screen);
+            do {
+                AWAIT_KEY(s, ch);
+            } while(!IS_KEY(ch, 'Q'));
+            continue;
+        }
+
+        /* The difficulty screen: keys 1 to 9 pick 8 to 2048, 0 picks 4096. */
+        ENTER_SCREEN(s, SESSION_SCREEN_DIFFICULTY);
+        draw_background(s, difficulty_screen);
+        do {
+            AWAIT_KEY(s, ch);
+        } while(ch < '0' || ch > '9');
+        s->winning_tile = (ch == '0') ? 4096 : 4 << (ch - '0');
+
+        /* A round, until the player quits or the game ends. */
+        start_round(s);
+        for(;;) {
+            /* The clock is already running, in a game just thawed too. */
+            ENTER_SCREEN(s, SESSION_SCREEN_PLAYING);
+            start_game_clock(s);
+            AWAIT_KEY_UNTIL(s, ch, next_clock_tick(s));
+            tick_game_clock(s);
+
+            if(IS_KEY(ch, 'Q')) {
+                stop_game_clock(s);
+                save_replay(s, REPLAY_RESULT_QUIT);
+                break;
+            }
+            if(IS_KEY(ch, 'P')) {
+                /*
+                 * Stop the clock and paint the pause message.  Nothing
+                 * ticks or repaints until the player comes back.
+                 */
+                stop_game_clock(s);
+                draw_overlay(s, pause_message);
+                present_board(s);
+                ENTER_SCREEN(s, SESSION_SCREEN_PAUSED);
+                do {
+                    AWAIT_KEY(s, ch);
+                } while(!IS_KEY(ch, 'P') && !IS_KEY(ch, 'Q'));
+                if(IS_KEY(ch, 'Q')) {
+                    save_replay(s, REPLAY_RESULT_QUIT);
+                    break;
+                }
+                /* Uncover the board; nothing under it has changed. */
+                compositor_clear_layer(&s->compositor, LAYER_OVERLAY);
+                present_board(s);
+                start_game_clock(s);
+                continue;
+            }
+
+            dir = key_direction(ch);
+            if(dir < 0 || !shift_blocks(s, dir)) {
+                continue;
+            }
+            replay_add_move(&s->replay, dir);
+            lift_moving_blocks(s);
+
+            /* Slide the blocks a step per frame, keys wait meanwhile. */
+            do {
+                draw_animation_frame(s);
+                present_board(s);
+                s->animating = step_moving_blocks(s);
+                AWAIT_DELAY(s, SESSION_FRAME_MS);
+                tick_game_clock(s);
+            } while(s->animating);
+
+            result = settle_move(s);
+            if(result == 0) {
+                continue;
+            }
+
+            /* The game is over. */
+            stop_game_clock(s);
+            save_replay(s, result);
+            draw_overlay(s, result == REPLAY_RESULT_WON ? victory_message : defeat_message);
+            present_board(s);
+            ENTER_SCREEN(s, SESSION_SCREEN_GAME_OVER);
+            do {
+                AWAIT_KEY(s, ch);
+            } while(!IS_KEY(ch, 'Q'));
+            break;
+        }
+    }
+    CO_END(s->co_state);
+    return SESSION_DONE;
+}
+
+session_t *session_create(render_cache_t *render_cache, const char *replay_path) {
+    session_t *s;
+    int ii;
+
+    if(posix_memalign((void**) &s, 64, sizeof(*s)) != 0) {
+        return NULL;
+    }
+    memset(s, 0, sizeof(*s));
+    s->back_console.cursor.visibility = INVISIBLE;
+    s->back_console.base_addr = s->back_buffer;
+    s->back_console.width = CONSOLE_WIDTH;
+    s->back_console.height = CONSOLE_HEIGHT;
+    compositor_init(&s->compositor, NUM_LAYERS);
+    s->render_cache = render_cache;
+    s->replay_path = replay_path;
+    replay_init(&s->replay);
+    for(ii = 0; ii < MAX_ANIMATIONS; ii++) {
+        s->animated_blocks[ii].state = ANI_BLOCK_DEAD;
+    }
+    s->co_state = CO_START;
+    return s;
+}
+
+void session_destroy(session_t *s) {
+    if(s == NULL) {
+        return;
+    }
+    replay_free(&s->replay);
+    free(s);
+}
+
+size_t session_memory(const session_t *s) {
+    return sizeof(*s) + s->replay.capacity;
+}
+
+int session_push_key(session_t *s, int key) {
+    if(s->key_count == SESSION_KEY_QUEUE_LEN) {
+        return -1;
+    }
+    s->keys[(s->key_head + s->key_count) % SESSION_KEY_QUEUE_LEN] = key;
+    s->key_count++;
+    return 0;
+}
+
+int session_is_move_key(int key) {
+    return key_direction(key) >= 0;
+}
+
+int session_is_ready(const session_t *s, unsigned long long now_ms) {
+    if(s->wait & SESSION_DONE) {
+        return 0;
+    }
+    if((s->wait & SESSION_WAIT_KEY) && s->key_count > 0) {
+        return 1;
+    }
+    if((s->wait & SESSION_WAIT_TIMER) && now_ms >= s->wake_ms) {
+        return 1;
+    }
+    /* A session that has not run yet. */
+    return s->wait == 0;
+}
+
+int session_run(session_t *s, unsigned long long now_ms) {
+    s->now_ms = now_ms;
+    s->wait = session_flow(s);
+    return s->wait;
+}
+
+int session_flush(session_t *s, present_region_fn present, void *ctx) {
+    int rr;
+    int count = 0;
+
+    for(rr = 0; rr < CONSOLE_HEIGHT; rr++) {
+        if(s->dirty_end[rr] == 0) {
+            continue;
+        }
+        if(present != NULL) {
+            present(ctx, &s->back_console, rr, s->dirty_start[rr], 1,
+                s->dirty_end[rr] - s->dirty_start[rr]);
+        }
+        s->dirty_end[rr] = 0;
+        count++;
+    }
+    return count;
+}
+
+int session_freeze(
+        const session_t *s,
+        unsigned long long now_ms,
+        session_cold_t *cold,
+        uint8_t **record,
+        size_t *record_len) {
+    unsigned long long clock_ms;
+
+    *record = NULL;
+    *record_len = 0;
+    if(s->wait == 0 || (s->wait & SESSION_DONE) || !(s->wait & SESSION_WAIT_KEY)
+            || s->key_count > 0 || s->animating) {
+        return -1;
+    }
+
+    memset(cold, 0, sizeof(*cold));
+    if(engine_pack_board((int (*)[GRID_SIZE]) s->number_grid, &cold->board) < 0) {
+        return -1;
+    }
+    clock_ms = s->clock_banked_ms;
+    if(s->clock_started_ms != 0) {
+        clock_ms += now_ms - s->clock_started_ms;
+        cold->frozen_ms = now_ms;
+    }
+    cold->clock_ms = (clock_ms > UINT32_MAX) ? UINT32_MAX : clock_ms;
+    cold->rng_state = s->game_rng.state;
+    cold->score = s->current_score;
+    cold->high_score = s->high_score;
+    cold->screen = s->screen;
+    cold->winning_log2 = engine_tile_log2(s->winning_tile);
+
+    /* Only a round still in play has a replay left to save. */
+    if((s->screen == SESSION_SCREEN_PLAYING || s->screen == SESSION_SCREEN_PAUSED)
+            && s->replay_path != NULL && s->replay_path[0] != '\0') {
+        *record = replay_encode(&s->replay, record_len);
+        if(*record == NULL) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+session_t *session_thaw(
+        const session_cold_t *cold,
+        const uint8_t *record,
+        size_t record_len,
+        render_cache_t *render_cache,
+        const char *replay_path) {
+    session_t *s;
+
+    if(cold->screen > SESSION_SCREEN_GAME_OVER || cold->winning_log2 > 15) {
+        return NULL;
+    }
+    s = session_create(render_cache, replay_path);
+    if(s == NULL) {
+        return NULL;
+    }
+
+    engine_unpack_board(cold->board, s->number_grid);
+    s->game_rng.state = cold->rng_state;
+    s->current_score = cold->score;
+    s->high_score = cold->high_score;
+    /* A clock that was running has run on since the freeze. */
+    s->clock_banked_ms = cold->clock_ms;
+    s->clock_started_ms = cold->frozen_ms;
+    s->game_timer = cold->clock_ms / 1000;
+    s->winning_tile = 1 << cold->winning_log2;
+    s->screen = cold->screen;
+    if(record != NULL) {
+        if(replay_decode(record, record_len, &s->replay) < 0) {
+            session_destroy(s);
+            return NULL;
+        }
+    } else {
+        replay_start(&s->replay, 0, s->winning_tile);
+    }
+
+    /* Menu screens draw themselves from their entry; a round is repainted here. */
+    if(s->screen >= SESSION_SCREEN_PLAYING) {
+        draw_thawed_game(s);
+    }
+    s->co_state = CO_ENTRY_STATE(s->screen);
+    return s;
+}
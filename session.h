@@ -0,0 +1,258 @@
+/** @file session.h
+ *  @brief One player's run of the game: menus, rounds and animations.
+ *
+ *  The flow from the title screen through the difficulty screen, the
+ *  game, its animations and the game over message is a stackless
+ *  coroutine (see coroutine.h).  It runs until it has to wait, for a
+ *  key or for a timer, and then returns what it is waiting for.  The
+ *  caller feeds it keys and the time, and copies what it drew out to a
+ *  screen, so one thread can drive any number of sessions and none of
+ *  them needs a stack of its own.
+ *
+ *  A session draws into its own back console.  The regions that changed
+ *  are remembered until session_flush hands them to the caller.
+ *
+ *  A session that sits waiting for a key can be frozen into a 40 byte
+ *  session_cold_t, plus the moves of the game in progress, and freed.
+ *  session_thaw makes a session again that picks up on the same screen,
+ *  redrawn from scratch.
+ *
+ *  @bug None known.
+ */
+
+#ifndef _SESSION_H_
+#define _SESSION_H_
+
+#include <stdint.h>
+#include "console_model.h"
+#include "compositor.h"
+#include "render_cache.h"
+#include "engine.h"
+#include "replay.h"
+#include "game.h"
+
+/** The session waits for a key */
+#define SESSION_WAIT_KEY 0x1
+/** The session waits for its wake time */
+#define SESSION_WAIT_TIMER 0x2
+/** The player quit; the session will not run again */
+#define SESSION_DONE 0x4
+
+/** Returned by the key queue when it is empty */
+#define SESSION_NO_KEY (-1)
+
+/** Keys a session holds before it reads them */
+#define SESSION_KEY_QUEUE_LEN 16
+
+/** Milliseconds between animation frames */
+#define SESSION_FRAME_MS 10
+
+/** Screens a session waits for keys on, and can be thawed back onto */
+#define SESSION_SCREEN_TITLE 0
+#define SESSION_SCREEN_INSTRUCTIONS 1
+#define SESSION_SCREEN_DIFFICULTY 2
+#define SESSION_SCREEN_PLAYING 3
+#define SESSION_SCREEN_PAUSED 4
+#define SESSION_SCREEN_GAME_OVER 5
+
+/** @brief What is left of a frozen session.
+ */
+typedef struct session_cold_t {
+    /** The board, as engine_pack_board packs it */
+    uint64_t board;
+    /** The state of the game's tile generator */
+    uint64_t rng_state;
+    /** When the session was frozen, in ms, if its game clock ran; else 0 */
+    uint64_t frozen_ms;
+    /** The player's current score */
+    uint32_t score;
+    /** The best score of the session */
+    uint32_t high_score;
+    /** Milliseconds of play on the in game clock, up to frozen_ms */
+    uint32_t clock_ms;
+    /** One of the SESSION_SCREEN_ constants */
+    uint8_t screen;
+    /** log2 of the winning tile */
+    uint8_t winning_log2;
+    /** Unused, 0 */
+    uint16_t reserved;
+} session_cold_t;
+
+/** @brief One player's game.
+ */
+typedef struct session_t {
+    /** The cells of back_console */
+    cell_t back_buffer[CONSOLE_CELLS] CONSOLE_ALIGNED;
+    /** The console the session's screens are drawn into */
+    console_t back_console;
+    /** Composites the game screen into back_console */
+    compositor_t compositor;
+    /** Recently rendered resting boards, may be shared, may be NULL */
+    render_cache_t *render_cache;
+    /** Where finished games are appended, NULL to not record them */
+    const char *replay_path;
+
+    /** Resume point of the coroutine */
+    int co_state;
+    /** The screen the session is on, one of the SESSION_SCREEN_ constants */
+    int screen;
+    /** What the session last said it waits for, SESSION_ flags */
+    int wait;
+    /** When a session waiting for SESSION_WAIT_TIMER wants to run */
+    unsigned long long wake_ms;
+    /** The time given to the current run */
+    unsigned long long now_ms;
+    /** Keys not read yet, in a ring */
+    int keys[SESSION_KEY_QUEUE_LEN];
+    /** The oldest key in keys */
+    int key_head;
+    /** The number of keys in keys */
+    int key_count;
+    /** First changed column of each row of back_console */
+    uint8_t dirty_start[CONSOLE_HEIGHT];
+    /** One past the last changed column of each row, 0 if clean */
+    uint8_t dirty_end[CONSOLE_HEIGHT];
+
+    /** The main 4x4 grid of numbers */
+    int number_grid[GRID_SIZE][GRID_SIZE];
+    /** The objects that are currently moving */
+    animated_block_t animated_blocks[MAX_ANIMATIONS];
+    /** The squares not moved by the last shift */
+    int animated_background[GRID_SIZE][GRID_SIZE];
+    /** Set while blocks are moving */
+    int animating;
+    /** Changes to the board since it was last drawn */
+    damage_event_t damage_events[MAX_DAMAGE_EVENTS];
+    /** The number of entries in damage_events */
+    int num_damage_events;
+    /** Set once board_background has been rendered to its layer */
+    int background_ready;
+    /** Seconds shown on the in game clock */
+    unsigned long game_timer;
+    /** Milliseconds of play banked before the clock was last started */
+    unsigned long long clock_banked_ms;
+    /** Time (ms) the clock was last started, 0 if stopped */
+    unsigned long long clock_started_ms;
+    /** The player's current score */
+    unsigned int current_score;
+    /** The best score of this session */
+    unsigned int high_score;
+    /** The tile that, when reached, indicates victory */
+    int winning_tile;
+    /** The generator for new tiles in the current game */
+    engine_rng_t game_rng;
+    /** The current game, as recorded so far */
+    replay_t replay;
+} session_t;
+
+/** @brief Make a session, at the title screen.
+ *
+ * @param render_cache A cache of rendered boards, which must outlive the
+ *        session and is only used by one thread at a time; may be NULL.
+ * @param replay_path Where finished games are appended, may be NULL.
+ * @return The session, or NULL if out of memory.
+ */
+session_t *session_create(render_cache_t *render_cache, const char *replay_path);
+
+/** @brief Free a session.
+ *
+ * @param s The session, may be NULL.
+ * @return None.
+ */
+void session_destroy(session_t *s);
+
+/** @brief Count the memory a session holds.
+ *
+ * @param s The session.
+ * @return The bytes allocated for it, including its replay so far.
+ */
+size_t session_memory(const session_t *s);
+
+/** @brief Queue a key for the session.
+ *
+ * @param s The session.
+ * @param key The key, a character or one of the ncurses KEY_ codes.
+ * @return 0 on success, -1 if the queue is full and the key was dropped.
+ */
+int session_push_key(session_t *s, int key);
+
+/** @brief Check if a key moves the blocks.
+ *
+ * @param key The key, a character or one of the ncurses KEY_ codes.
+ * @return 1 if it does, 0 for any other key.
+ */
+int session_is_move_key(int key);
+
+/** @brief Check if a session has something to do.
+ *
+ * @param s The session.
+ * @param now_ms The current time, in ms.
+ * @return 1 if session_run would make progress, 0 otherwise.
+ */
+int session_is_ready(const session_t *s, unsigned long long now_ms);
+
+/** @brief Run the session until it has to wait.
+ *
+ * @param s The session.
+ * @param now_ms The current time, in ms, from a monotonic clock.
+ * @return SESSION_ flags saying what the session waits for.  With
+ *         SESSION_WAIT_TIMER, s->wake_ms says when to run it again.
+ */
+int session_run(session_t *s, unsigned long long now_ms);
+
+/** @brief Hand the regions of the back console that changed to a screen.
+ *
+ * Each changed run of cells is passed to present once, and forgotten.
+ *
+ * @param s The session.
+ * @param present Copies a region out, as with compositor_flatten.
+ * @param ctx Passed to present.
+ * @return The number of regions passed to present.
+ */
+int session_flush(session_t *s, present_region_fn present, void *ctx);
+
+/** @brief Freeze a session that waits for a key.
+ *
+ * Only a session resting on one of the SESSION_SCREEN_ screens, with no
+ * keys queued, can be frozen.  A game clock that is running keeps
+ * running while the session is frozen, so a thawed session shows the
+ * same time as one that was never frozen.  The session itself is left
+ * as it was, and may be destroyed.
+ *
+ * @param s The session.
+ * @param now_ms The current time, in ms, from the clock session_run is
+ *        given.
+ * @param cold Set to the frozen state.
+ * @param record Set to the replay record of the game in progress, to be
+ *        freed by the caller, or NULL if there is none to keep.
+ * @param record_len Set to the length of record.
+ * @return 0 on success, -1 if the session cannot be frozen now or out of
+ *         memory.
+ */
+int session_freeze(
+        const session_t *s,
+        unsigned long long now_ms,
+        session_cold_t *cold,
+        uint8_t **record,
+        size_t *record_len);
+
+/** @brief Make a session again from its frozen state.
+ *
+ * The whole screen is marked changed, so the next session_flush hands
+ * all of it to the caller.
+ *
+ * @param cold The frozen state.
+ * @param record The replay record session_freeze gave, may be NULL.
+ * @param record_len The length of record.
+ * @param render_cache As for session_create.
+ * @param replay_path As for session_create.
+ * @return The session, or NULL if out of memory or cold is malformed.
+ */
+session_t *session_thaw(
+        const session_cold_t *cold,
+        const uint8_t *record,
+        size_t record_len,
+        render_cache_t *render_cache,
+        const char *replay_path);
+
+#endif
@@ -0,0 +1,152 @@
+/** @file sketch.c
+ *  @brief Implementation of HyperLogLog counters and blocked Bloom filters.
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sketch.h"
+
+/** Bits in a Bloom filter block */
+#define BLOCK_BITS (8 * SKETCH_BLOOM_BLOCK_LEN)
+
+/***** Function prototypes ******/
+
+/** @brief Find the block of a Bloom filter a key's bits fall in.
+ *
+ * @param bloom The filter.
+ * @param hash The key's hash.
+ * @return The first byte of the block.
+ */
+static uint8_t *bloom_block(const sketch_bloom_t *bloom, uint64_t hash);
+
+/***** Function definitions ******/
+
+uint64_t sketch_hash(uint64_t key) {
+    /* The splitmix64 finisher: every bit of the key moves every bit. */
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+    return key ^ (key >> 31);
+}
+
+void sketch_hll_init(sketch_hll_t *hll) {
+    memset(hll->registers, 0, sizeof(hll->registers));
+}
+
+void sketch_hll_add(sketch_hll_t *hll, uint64_t hash) {
+    uint64_t rest = hash << SKETCH_HLL_BITS;
+    uint8_t *reg = &hll->registers[hash >> (64 - SKETCH_HLL_BITS)];
+    uint8_t rank;
+
+    /* The register is picked by the top bits, the rank by the rest. */
+    rank = rest ? __builtin_clzll(rest) + 1 : 64 - SKETCH_HLL_BITS + 1;
+    if(rank > *reg) {
+        *reg = rank;
+    }
+}
+
+void sketch_hll_merge(sketch_hll_t *to, const sketch_hll_t *from) {
+    int ii;
+
+    for(ii = 0; ii < SKETCH_HLL_REGISTERS; ii++) {
+        if(from->registers[ii] > to->registers[ii]) {
+            to->registers[ii] = from->registers[ii];
+        }
+    }
+}
+
+double sketch_hll_count(const sketch_hll_t *hll) {
+    double m = SKETCH_HLL_REGISTERS;
+    double sum = 0, estimate;
+    int ii, zeros = 0;
+
+    for(ii = 0; ii < SKETCH_HLL_REGISTERS; ii++) {
+        sum += ldexp(1.0, -hll->registers[ii]);
+        if(hll->registers[ii] == 0) {
+            zeros++;
+        }
+    }
+    estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+
+    /* Few keys leave registers empty; counting those is more accurate. */
+    if(estimate <= 2.5 * m && zeros > 0) {
+        estimate = m * log(m / zeros);
+    }
+    return estimate;
+}
+
+int sketch_bloom_init(sketch_bloom_t *bloom, size_t len) {
+    bloom->num_blocks = len / SKETCH_BLOOM_BLOCK_LEN;
+    if(bloom->num_blocks == 0) {
+        bloom->num_blocks = 1;
+    }
+    bloom->bits = calloc(bloom->num_blocks, SKETCH_BLOOM_BLOCK_LEN);
+    return bloom->bits == NULL ? -1 : 0;
+}
+
+void sketch_bloom_free(sketch_bloom_t *bloom) {
+    free(bloom->bits);
+    bloom->bits = NULL;
+    bloom->num_blocks = 0;
+}
+
+uint8_t *bloom_block(const sketch_bloom_t *bloom, uint64_t hash) {
+    return bloom->bits + ((hash >> 32) % bloom->num_blocks) * SKETCH_BLOOM_BLOCK_LEN;
+}
+
+int sketch_bloom_add(sketch_bloom_t *bloom, uint64_t hash) {
+    uint8_t *block = bloom_block(bloom, hash);
+    uint32_t bit = hash % BLOCK_BITS;
+    uint32_t step = ((hash / BLOCK_BITS) % BLOCK_BITS) | 1;
+    int ii, seen = 1;
+
+    /* The bits within the block come from the low half, double hashed. */
+    for(ii = 0; ii < SKETCH_BLOOM_HASHES; ii++) {
+        if(!(block[bit / 8] & (1 << (bit % 8)))) {
+            block[bit / 8] |= 1 << (bit % 8);
+            seen = 0;
+        }
+        bit = (bit + step) % BLOCK_BITS;
+    }
+    return seen;
+}
+
+int sketch_bloom_test(const sketch_bloom_t *bloom, uint64_t hash) {
+    const uint8_t *block = bloom_block(bloom, hash);
+    uint32_t bit = hash % BLOCK_BITS;
+    uint32_t step = ((hash / BLOCK_BITS) % BLOCK_BITS) | 1;
+    int ii;
+
+    for(ii = 0; ii < SKETCH_BLOOM_HASHES; ii++) {
+        if(!(block[bit / 8] & (1 << (bit % 8)))) {
+            return 0;
+        }
+        bit = (bit + step) % BLOCK_BITS;
+    }
+    return 1;
+}
+
+int sketch_bloom_merge(sketch_bloom_t *to, const sketch_bloom_t *from) {
+    size_t ii, len;
+
+    if(to->num_blocks != from->num_blocks) {
+        return -1;
+    }
+    len = to->num_blocks * SKETCH_BLOOM_BLOCK_LEN;
+    for(ii = 0; ii < len; ii++) {
+        to->bits[ii] |= from->bits[ii];
+    }
+    return 0;
+}
+
+double sketch_bloom_false_positive_rate(const sketch_bloom_t *bloom) {
+    size_t ii, len = bloom->num_blocks * SKETCH_BLOOM_BLOCK_LEN;
+    uint64_t set = 0;
+
+    for(ii = 0; ii < len; ii++) {
+        set += __builtin_popcount(bloom->bits[ii]);
+    }
+    return pow((double) set / (8.0 * len), SKETCH_BLOOM_HASHES);
+}
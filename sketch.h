@@ -0,0 +1,138 @@
+/** @file sketch.h
+ *  @brief Approximate sets of 64 bit keys: counting and membership.
+ *
+ *  An exact set of every position a large run visits does not fit in
+ *  memory, so runs keep sketches instead:
+ *
+ *  - A HyperLogLog estimates how many distinct keys were added, to
+ *    about 1% (1.04 / sqrt(SKETCH_HLL_REGISTERS)), in a fixed 16 KB.
+ *  - A blocked Bloom filter says whether a key was added, with no false
+ *    negatives and a false positive rate set by its size.  All the
+ *    bits of a key fall in one 64 byte block, so a lookup touches one
+ *    cache line.
+ *
+ *  Both merge: each thread can fill its own and merge them at the end,
+ *  and sketches of separate runs can be merged to cover both.
+ *
+ *  Keys should be passed through sketch_hash first, once, as both
+ *  sketches need their bits evenly spread.
+ *
+ *  @bug None known.
+ */
+
+#ifndef _SKETCH_H_
+#define _SKETCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** log2 of the number of HyperLogLog registers */
+#define SKETCH_HLL_BITS 14
+/** Number of HyperLogLog registers */
+#define SKETCH_HLL_REGISTERS (1 << SKETCH_HLL_BITS)
+/** Size of a Bloom filter block, in bytes: a cache line */
+#define SKETCH_BLOOM_BLOCK_LEN 64
+/** Number of bits a key sets in a Bloom filter */
+#define SKETCH_BLOOM_HASHES 8
+
+/** @brief A HyperLogLog counter.
+ */
+typedef struct sketch_hll_t {
+    /** For each register, the longest run of leading zeros seen, plus 1 */
+    uint8_t registers[SKETCH_HLL_REGISTERS];
+} sketch_hll_t;
+
+/** @brief A blocked Bloom filter.
+ */
+typedef struct sketch_bloom_t {
+    /** The bits, SKETCH_BLOOM_BLOCK_LEN bytes a block */
+    uint8_t *bits;
+    /** The number of blocks */
+    uint64_t num_blocks;
+} sketch_bloom_t;
+
+/** @brief Spread the bits of a key for the sketches.
+ *
+ * @param key The key.
+ * @return The hash.
+ */
+uint64_t sketch_hash(uint64_t key);
+
+/** @brief Empty a HyperLogLog counter.
+ *
+ * @param hll The counter.
+ * @return None.
+ */
+void sketch_hll_init(sketch_hll_t *hll);
+
+/** @brief Add a key to a HyperLogLog counter.
+ *
+ * @param hll The counter.
+ * @param hash The key's hash.
+ * @return None.
+ */
+void sketch_hll_add(sketch_hll_t *hll, uint64_t hash);
+
+/** @brief Add every key of one HyperLogLog counter to another.
+ *
+ * @param to The counter added to.
+ * @param from The counter added.
+ * @return None.
+ */
+void sketch_hll_merge(sketch_hll_t *to, const sketch_hll_t *from);
+
+/** @brief Estimate how many distinct keys a HyperLogLog counter holds.
+ *
+ * @param hll The counter.
+ * @return The estimate.
+ */
+double sketch_hll_count(const sketch_hll_t *hll);
+
+/** @brief Make an empty Bloom filter.
+ *
+ * @param bloom The filter.
+ * @param len Its size in bytes, rounded down to whole blocks, but at
+ *        least one block.
+ * @return 0 on success, -1 if out of memory.
+ */
+int sketch_bloom_init(sketch_bloom_t *bloom, size_t len);
+
+/** @brief Free a Bloom filter.
+ *
+ * @param bloom The filter.
+ * @return None.
+ */
+void sketch_bloom_free(sketch_bloom_t *bloom);
+
+/** @brief Add a key to a Bloom filter.
+ *
+ * @param bloom The filter.
+ * @param hash The key's hash.
+ * @return 1 if the key may have been added before, 0 if it was not.
+ */
+int sketch_bloom_add(sketch_bloom_t *bloom, uint64_t hash);
+
+/** @brief Check whether a key was added to a Bloom filter.
+ *
+ * @param bloom The filter.
+ * @param hash The key's hash.
+ * @return 1 if it may have been, 0 if it was not.
+ */
+int sketch_bloom_test(const sketch_bloom_t *bloom, uint64_t hash);
+
+/** @brief Add every key of one Bloom filter to another of the same size.
+ *
+ * @param to The filter added to.
+ * @param from The filter added.
+ * @return 0 on success, -1 if the filters differ in size.
+ */
+int sketch_bloom_merge(sketch_bloom_t *to, const sketch_bloom_t *from);
+
+/** @brief Estimate the chance a Bloom filter wrongly says a key was added.
+ *
+ * @param bloom The filter.
+ * @return The chance, from how many of its bits are set.
+ */
+double sketch_bloom_false_positive_rate(const sketch_bloom_t *bloom);
+
+#endif
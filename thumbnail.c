@@ -0,0 +1,441 @@
+/** @file thumbnail.c
+ *  @brief Renders board thumbnails from replay archives.
+ *
+ *  Reads replays from an archive (see replay.h), plays each one back
+ *  with the engine, draws the board exactly as the game does, and
+ *  writes pictures of it.  By default only the final board of each game
+ *  is drawn; with -k a picture is also made whenever a new largest tile
+ *  first appears.
+ *
+ *  The archive is read by the main thread and handed to a pool of
+ *  worker threads through a small bounded queue, so memory use does not
+ *  grow with the size of the archive.
+ *
+ *  Usage: thumbnail [-j threads] [-f ppm|svg] [-s scale] [-o dir] [-k] archive
+ *
+ *  @bug No known bugs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "console_model.h"
+#include "board_render.h"
+#include "engine.h"
+#include "replay.h"
+#include "raster.h"
+
+/** Longest path of an output file */
+#define MAX_PATH_LEN 4096
+/** Most worker threads */
+#define MAX_THREADS 64
+/** Replays waiting for a worker, per worker */
+#define QUEUE_PER_THREAD 2
+
+/** Write PPM images */
+#define FORMAT_PPM 0
+/** Write SVG documents */
+#define FORMAT_SVG 1
+
+/** @brief A replay waiting to be drawn.
+ */
+typedef struct job_t {
+    /** The replay */
+    replay_t replay;
+    /** Its position in the archive, counting from 0 */
+    unsigned long index;
+} job_t;
+
+/** @brief The queue between the reader and the workers.
+ */
+typedef struct job_queue_t {
+    /** Guards everything below */
+    pthread_mutex_t lock;
+    /** Signalled when a job is added, or the reader is done */
+    pthread_cond_t not_empty;
+    /** Signalled when a job is taken */
+    pthread_cond_t not_full;
+    /** The jobs, in a ring */
+    job_t *jobs;
+    /** The size of the ring */
+    int size;
+    /** The oldest job */
+    int head;
+    /** The number of jobs in the ring */
+    int count;
+    /** Set once no more jobs will be added */
+    int done;
+} job_queue_t;
+
+/** @brief Settings from the command line.
+ */
+typedef struct options_t {
+    /** Number of worker threads */
+    int threads;
+    /** One of the FORMAT_ constants */
+    int format;
+    /** Pixels per console column */
+    int scale;
+    /** Where pictures are written */
+    const char *outdir;
+    /** Draw key positions as well as the final board */
+    int key_positions;
+} options_t;
+
+/** @brief What one worker needs.
+ */
+typedef struct worker_t {
+    /** The thread */
+    pthread_t thread;
+    /** The shared queue */
+    job_queue_t *queue;
+    /** The settings */
+    const options_t *options;
+    /** The job being drawn, swapped with queue slots to reuse memory */
+    job_t job;
+    /** The image buffer, reused between pictures */
+    raster_t image;
+    /** The cells of the console boards are drawn into */
+    cell_t cells[CONSOLE_CELLS];
+    /** The console boards are drawn into */
+    console_t console;
+    /** The number of pictures written */
+    unsigned long pictures;
+    /** The number of replays that could not be drawn */
+    unsigned long failures;
+} worker_t;
+
+/***** Function prototypes ******/
+
+/** @brief Print how to use the program.
+ *
+ * @param name The name of the program.
+ * @return None.
+ */
+static void usage(const char *name);
+
+/** @brief Read the command line.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param options Set to the settings.
+ * @return The index of the archive argument, or -1 on a bad command line.
+ */
+static int parse_options(int argc, char **argv, options_t *options);
+
+/** @brief Add a job to the queue, waiting for room.
+ *
+ * The job is swapped into the queue, and gets back the memory of the
+ * slot it took.
+ *
+ * @param queue The queue.
+ * @param job The job.
+ * @return None.
+ */
+static void queue_put(job_queue_t *queue, job_t *job);
+
+/** @brief Take a job from the queue, waiting for one.
+ *
+ * The job is swapped out of the queue, and the slot gets the memory of
+ * the caller's old job.
+ *
+ * @param queue The queue.
+ * @param job Set to the job.
+ * @return 1 if a job was taken, 0 if the queue is done and empty.
+ */
+static int queue_take(job_queue_t *queue, job_t *job);
+
+/** @brief Mark the queue done, waking every worker.
+ *
+ * @param queue The queue.
+ * @return None.
+ */
+static void queue_finish(job_queue_t *queue);
+
+/** @brief Swap two jobs.
+ *
+ * @param a A job.
+ * @param b Another job.
+ * @return None.
+ */
+static void swap_jobs(job_t *a, job_t *b);
+
+/** @brief Draw the board of a cursor and write it to a file.
+ *
+ * @param worker The worker.
+ * @param cursor The cursor.
+ * @param tag What the picture shows, used in the file name.
+ * @return 0 on success, -1 on error.
+ */
+static int write_picture(worker_t *worker, replay_cursor_t *cursor, const char *tag);
+
+/** @brief Play a replay back and write its pictures.
+ *
+ * @param worker The worker, holding the replay in its job.
+ * @return 0 on success, -1 on error.
+ */
+static int draw_replay(worker_t *worker);
+
+/** @brief The body of a worker thread.
+ *
+ * @param arg The worker_t.
+ * @return NULL.
+ */
+static void *worker_main(void *arg);
+
+/***** Function definitions ******/
+
+void usage(const char *name) {
+    fprintf(stderr,
+        "usage: %s [-j threads] [-f ppm|svg] [-s scale] [-o dir] [-k] archive\n"
+        "  -j  worker threads (default 4)\n"
+        "  -f  picture format (default ppm)\n"
+        "  -s  pixels per console column, 1 to %d (default 2)\n"
+        "  -o  output directory (default .)\n"
+        "  -k  also draw each new largest tile, not just the final board\n",
+        name, RASTER_MAX_SCALE);
+}
+
+int parse_options(int argc, char **argv, options_t *options) {
+    int opt;
+
+    options->threads = 4;
+    options->format = FORMAT_PPM;
+    options->scale = 2;
+    options->outdir = ".";
+    options->key_positions = 0;
+
+    while((opt = getopt(argc, argv, "j:f:s:o:k")) != -1) {
+        switch(opt) {
+            case 'j':
+                options->threads = atoi(optarg);
+                if(options->threads < 1 || options->threads > MAX_THREADS) {
+                    return -1;
+                }
+                break;
+            case 'f':
+                if(strcmp(optarg, "ppm") == 0) {
+                    options->format = FORMAT_PPM;
+                } else if(strcmp(optarg, "svg") == 0) {
+                    options->format = FORMAT_SVG;
+                } else {
+                    return -1;
+                }
+                break;
+            case 's':
+                options->scale = atoi(optarg);
+                if(options->scale < 1 || options->scale > RASTER_MAX_SCALE) {
+                    return -1;
+                }
+                break;
+            case 'o':
+                options->outdir = optarg;
+                break;
+            case 'k':
+                options->key_positions = 1;
+                break;
+            default:
+                return -1;
+        }
+    }
+    if(optind != argc - 1) {
+        return -1;
+    }
+    return optind;
+}
+
+void swap_jobs(job_t *a, job_t *b) {
+    job_t tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+void queue_put(job_queue_t *queue, job_t *job) {
+    pthread_mutex_lock(&queue->lock);
+    while(queue->count == queue->size) {
+        pthread_cond_wait(&queue->not_full, &queue->lock);
+    }
+    swap_jobs(&queue->jobs[(queue->head + queue->count) % queue->size], job);
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+int queue_take(job_queue_t *queue, job_t *job) {
+    pthread_mutex_lock(&queue->lock);
+    while(queue->count == 0 && !queue->done) {
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    }
+    if(queue->count == 0) {
+        pthread_mutex_unlock(&queue->lock);
+        return 0;
+    }
+    swap_jobs(&queue->jobs[queue->head], job);
+    queue->head = (queue->head + 1) % queue->size;
+    queue->count--;
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+    return 1;
+}
+
+void queue_finish(job_queue_t *queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->done = 1;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+int write_picture(worker_t *worker, replay_cursor_t *cursor, const char *tag) {
+    const options_t *options = worker->options;
+    raster_region_t region = {0, 0, BOARD_HEIGHT, BOARD_WIDTH};
+    char path[MAX_PATH_LEN];
+    FILE *out;
+    int rt;
+
+    /* Draw as the game does, then keep just the grid. */
+    board_draw_screen(&worker->console, cursor->grid, cursor->score, 0);
+
+    snprintf(path, sizeof(path), "%s/game%06lu_%s.%s", options->outdir,
+        worker->job.index, tag, options->format == FORMAT_SVG ? "svg" : "ppm");
+    out = fopen(path, "wb");
+    if(out == NULL) {
+        perror(path);
+        return -1;
+    }
+    if(options->format == FORMAT_SVG) {
+        rt = raster_write_svg(out, &worker->console, &region, options->scale);
+    } else {
+        rt = raster_render(&worker->image, &worker->console, &region, options->scale);
+        if(rt == 0) {
+            rt = raster_write_ppm(out, &worker->image);
+        }
+    }
+    if(fclose(out) != 0) {
+        rt = -1;
+    }
+    if(rt < 0) {
+        fprintf(stderr, "%s: could not write picture\n", path);
+        return -1;
+    }
+    worker->pictures++;
+    return 0;
+}
+
+int draw_replay(worker_t *worker) {
+    replay_cursor_t cursor;
+    char tag[32];
+    int best, max, rt;
+
+    replay_cursor_start(&cursor, &worker->job.replay);
+    best = engine_max_tile(cursor.grid);
+    while((rt = replay_cursor_step(&cursor)) > 0) {
+        if(!worker->options->key_positions) {
+            continue;
+        }
+        max = engine_max_tile(cursor.grid);
+        if(max > best) {
+            best = max;
+            snprintf(tag, sizeof(tag), "m%05u_%d", cursor.played, max);
+            if(write_picture(worker, &cursor, tag) < 0) {
+                return -1;
+            }
+        }
+    }
+    if(rt < 0) {
+        fprintf(stderr, "game %lu: move %u does not move anything\n",
+            worker->job.index, cursor.played);
+        return -1;
+    }
+    return write_picture(worker, &cursor, "final");
+}
+
+void *worker_main(void *arg) {
+    worker_t *worker = arg;
+
+    while(queue_take(worker->queue, &worker->job)) {
+        if(draw_replay(worker) < 0) {
+            worker->failures++;
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    options_t options;
+    job_queue_t queue;
+    worker_t *workers;
+    job_t next;
+    FILE *in;
+    unsigned long count = 0;
+    unsigned long pictures = 0;
+    unsigned long failures = 0;
+    int ii, arg, rt;
+
+    arg = parse_options(argc, argv, &options);
+    if(arg < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    in = fopen(argv[arg], "rb");
+    if(in == NULL) {
+        perror(argv[arg]);
+        return 1;
+    }
+
+    memset(&queue, 0, sizeof(queue));
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.not_empty, NULL);
+    pthread_cond_init(&queue.not_full, NULL);
+    queue.size = options.threads * QUEUE_PER_THREAD;
+    queue.jobs = calloc(queue.size, sizeof(job_t));
+    workers = calloc(options.threads, sizeof(worker_t));
+    if(queue.jobs == NULL || workers == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    for(ii = 0; ii < options.threads; ii++) {
+        workers[ii].queue = &queue;
+        workers[ii].options = &options;
+        workers[ii].console.base_addr = workers[ii].cells;
+        workers[ii].console.width = CONSOLE_WIDTH;
+        workers[ii].console.height = CONSOLE_HEIGHT;
+        raster_init(&workers[ii].image);
+        if(pthread_create(&workers[ii].thread, NULL, worker_main, &workers[ii]) != 0) {
+            fprintf(stderr, "could not start worker thread\n");
+            return 1;
+        }
+    }
+
+    /* Stream the archive through the queue. */
+    replay_init(&next.replay);
+    while((rt = replay_read(in, &next.replay)) > 0) {
+        next.index = count++;
+        queue_put(&queue, &next);
+    }
+    if(rt < 0) {
+        fprintf(stderr, "%s: bad replay record after %lu games\n", argv[arg], count);
+        failures++;
+    }
+    queue_finish(&queue);
+    fclose(in);
+
+    for(ii = 0; ii < options.threads; ii++) {
+        pthread_join(workers[ii].thread, NULL);
+        pictures += workers[ii].pictures;
+        failures += workers[ii].failures;
+        replay_free(&workers[ii].job.replay);
+        raster_free(&workers[ii].image);
+    }
+    replay_free(&next.replay);
+    for(ii = 0; ii < queue.size; ii++) {
+        replay_free(&queue.jobs[ii].replay);
+    }
+    free(queue.jobs);
+    free(workers);
+
+    printf("%lu games, %lu pictures, %lu failures\n", count, pictures, failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,17 @@
+/** @file tile_colors.c
+ *  @brief The block color table.
+ *
+ *  @bug No known bugs.
+ */
+
+#include "tile_colors.h"
+
+/* The basic palette keeps the same colors as the ncurses color pairs. */
+const tile_color_t tile_colors[NUM_TILE_COLORS] = {
+    {0x776e65, 0xeee4da, 43}, /* 2 */
+    {0x776e65, 0xede0c8, 46}, /* 4 */
+    {0xf9f6f2, 0xf2b179, 44}, /* 8 */
+    {0xf9f6f2, 0xf59563, 42}, /* 16 */
+    {0xf9f6f2, 0xf67c5f, 41}, /* 32 */
+    {0xf9f6f2, 0xf65e3b, 45}, /* 64 and up */
+};
@@ -0,0 +1,39 @@
+/** @file tile_colors.h
+ *  @brief The RGB colors of the blocks.
+ *
+ *  Console colors 1 through NUM_TILE_COLORS are the block colors (see
+ *  board_tile_color).  Every backend that can show true colors draws
+ *  them from this table, so blocks look the same everywhere.
+ *
+ *  @bug None known.
+ */
+
+#ifndef _TILE_COLORS_H_
+#define _TILE_COLORS_H_
+
+#include <stdint.h>
+
+/** Number of tile colors, not counting the default color 0 */
+#define NUM_TILE_COLORS 6
+
+/** Color of the board behind the blocks, as 0xRRGGBB */
+#define BOARD_BG_RGB 0xbbada0
+/** Color of the board lines and text, as 0xRRGGBB */
+#define BOARD_FG_RGB 0x776e65
+
+/** @brief Colors for one tile, as 0xRRGGBB.
+ */
+typedef struct tile_color_t {
+    /** Foreground, for the digits */
+    uint32_t fg;
+    /** Background */
+    uint32_t bg;
+    /** Background in the basic palette, as an SGR parameter */
+    int bg16;
+} tile_color_t;
+
+/** @brief The tile colors, indexed by console color - 1.
+ */
+extern const tile_color_t tile_colors[NUM_TILE_COLORS];
+
+#endif
@@ -0,0 +1,264 @@
+/** @file timer_wheel.c
+ *  @brief Implementation of the hierarchical timer wheel.
+ *
+ *  @bug No known bugs.
+ */
+
+#include <string.h>
+#include "timer_wheel.h"
+
+/** Mask for a slot index */
+#define SLOT_MASK ((uint64_t) WHEEL_SLOTS - 1)
+
+/** The number of ticks covered by one slot of a level */
+#define LEVEL_SHIFT(level) (WHEEL_BITS * (level))
+
+/***** Function prototypes ******/
+
+/** @brief Find the nearest occupied slot of a level, going round.
+ *
+ * @param bits The bitmap of the level.
+ * @param start The slot to start at, taken modulo WHEEL_SLOTS.
+ * @return How many slots past start the occupied slot is, or -1 if the
+ *         level is empty.
+ */
+static int slot_distance(const uint64_t *bits, uint64_t start);
+
+/** @brief Put a timer in the slot for its due tick.
+ *
+ * @param wheel The wheel.
+ * @param timer A timer that is not in any slot.
+ * @return None.
+ */
+static void place_timer(timer_wheel_t *wheel, wheel_timer_t *timer);
+
+/** @brief Take out all the timers in a slot.
+ *
+ * The timers keep their links to each other.
+ *
+ * @param wheel The wheel.
+ * @param level The level.
+ * @param index The slot.
+ * @return The first timer in the slot, or NULL.
+ */
+static wheel_timer_t *take_slot(timer_wheel_t *wheel, int level, uint64_t index);
+
+/** @brief Move the timers of the block the clock just entered down a level.
+ *
+ * @param wheel The wheel.
+ * @param level The level to move timers out of, at least 1.
+ * @return None.
+ */
+static void cascade(timer_wheel_t *wheel, int level);
+
+/***** Function definitions ******/
+
+int slot_distance(const uint64_t *bits, uint64_t start) {
+    uint64_t word;
+    int pos;
+    int dist = 0;
+
+    while(dist < WHEEL_SLOTS) {
+        pos = (start + dist) & SLOT_MASK;
+        word = bits[pos / 64] >> (pos % 64);
+        if(word != 0) {
+            return dist + __builtin_ctzll(word);
+        }
+        dist += 64 - (pos % 64);
+    }
+    return -1;
+}
+
+void place_timer(timer_wheel_t *wheel, wheel_timer_t *timer) {
+    uint64_t expires = timer->expires;
+    uint64_t delta;
+    uint64_t index;
+    wheel_timer_t **head;
+    int level = 0;
+
+    if(expires < wheel->now) {
+        /* Already due; it goes out with the next advance. */
+        head = &wheel->overdue;
+        index = WHEEL_OVERDUE;
+    } else {
+        delta = expires - wheel->now;
+        while(level < WHEEL_LEVELS - 1 && delta >> LEVEL_SHIFT(level + 1) != 0) {
+            level++;
+        }
+        if(delta >> LEVEL_SHIFT(WHEEL_LEVELS) != 0) {
+            /* Too far off; park it in the last slot, and look again then. */
+            expires = wheel->now + (((uint64_t) 1 << LEVEL_SHIFT(WHEEL_LEVELS)) - 1);
+        }
+        index = (expires >> LEVEL_SHIFT(level)) & SLOT_MASK;
+        head = &wheel->slots[level][index];
+        wheel->occupied[level][index / 64] |= (uint64_t) 1 << (index % 64);
+        index += level * WHEEL_SLOTS;
+    }
+
+    timer->next = *head;
+    if(*head != NULL) {
+        (*head)->pprev = &timer->next;
+    }
+    *head = timer;
+    timer->pprev = head;
+    timer->slot = index;
+}
+
+wheel_timer_t *take_slot(timer_wheel_t *wheel, int level, uint64_t index) {
+    wheel_timer_t *first = wheel->slots[level][index];
+    wheel->slots[level][index] = NULL;
+    wheel->occupied[level][index / 64] &= ~((uint64_t) 1 << (index % 64));
+    return first;
+}
+
+void cascade(timer_wheel_t *wheel, int level) {
+    uint64_t index = (wheel->now >> LEVEL_SHIFT(level)) & SLOT_MASK;
+    wheel_timer_t *timer = take_slot(wheel, level, index);
+    wheel_timer_t *next;
+
+    while(timer != NULL) {
+        next = timer->next;
+        place_timer(wheel, timer);
+        timer = next;
+    }
+}
+
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t now) {
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->now = now;
+}
+
+void wheel_timer_init(wheel_timer_t *timer) {
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expires = 0;
+    timer->slot = -1;
+}
+
+int wheel_timer_pending(const wheel_timer_t *timer) {
+    return timer->pprev != NULL;
+}
+
+void timer_wheel_schedule(timer_wheel_t *wheel, wheel_timer_t *timer, uint64_t expires) {
+    timer_wheel_cancel(wheel, timer);
+    timer->expires = expires;
+    place_timer(wheel, timer);
+    wheel->count++;
+}
+
+void timer_wheel_cancel(timer_wheel_t *wheel, wheel_timer_t *timer) {
+    int level, index;
+
+    if(!wheel_timer_pending(timer)) {
+        return;
+    }
+    *timer->pprev = timer->next;
+    if(timer->next != NULL) {
+        timer->next->pprev = timer->pprev;
+    }
+    level = timer->slot / WHEEL_SLOTS;
+    index = timer->slot % WHEEL_SLOTS;
+    if(timer->slot != WHEEL_OVERDUE && wheel->slots[level][index] == NULL) {
+        wheel->occupied[level][index / 64] &= ~((uint64_t) 1 << (index % 64));
+    }
+    wheel_timer_init(timer);
+    wheel->count--;
+}
+
+uint64_t timer_wheel_next_due(const timer_wheel_t *wheel) {
+    uint64_t best = WHEEL_NEVER;
+    uint64_t due, block;
+    int level, dist;
+
+    if(wheel->count == 0) {
+        return WHEEL_NEVER;
+    }
+    if(wheel->overdue != NULL) {
+        return wheel->now - 1;
+    }
+
+    /* Level 0 slots hold timers due within WHEEL_SLOTS ticks, exactly. */
+    dist = slot_distance(wheel->occupied[0], wheel->now);
+    if(dist >= 0) {
+        best = wheel->now + dist;
+    }
+
+    /*
+     * Above that, the best we know is when the clock enters the block.
+     * The current block has been brought down already, unless the clock
+     * stopped right at its start.
+     */
+    for(level = 1; level < WHEEL_LEVELS; level++) {
+        block = wheel->now >> LEVEL_SHIFT(level);
+        if((wheel->now & (((uint64_t) 1 << LEVEL_SHIFT(level)) - 1)) != 0) {
+            block++;
+        }
+        dist = slot_distance(wheel->occupied[level], block);
+        if(dist < 0) {
+            continue;
+        }
+        due = (block + dist) << LEVEL_SHIFT(level);
+        if(due < best) {
+            best = due;
+        }
+    }
+    return best;
+}
+
+wheel_timer_t *timer_wheel_advance(timer_wheel_t *wheel, uint64_t now) {
+    wheel_timer_t *expired = NULL;
+    wheel_timer_t **tail = &expired;
+    wheel_timer_t *timer;
+    uint64_t index, step;
+    int top, level, dist;
+
+    /* Overdue timers were due before anything in the slots. */
+    timer = wheel->overdue;
+    wheel->overdue = NULL;
+    *tail = timer;
+    while(timer != NULL) {
+        timer->pprev = NULL;
+        timer->slot = -1;
+        wheel->count--;
+        tail = &timer->next;
+        timer = timer->next;
+    }
+
+    while(wheel->now <= now) {
+        index = wheel->now & SLOT_MASK;
+        if(index == 0) {
+            /* A new block: bring its timers down, from the top level. */
+            top = 1;
+            while(top < WHEEL_LEVELS - 1
+                    && (wheel->now & (((uint64_t) 1 << LEVEL_SHIFT(top + 1)) - 1)) == 0) {
+                top++;
+            }
+            for(level = top; level >= 1; level--) {
+                cascade(wheel, level);
+            }
+        }
+
+        timer = take_slot(wheel, 0, index);
+        *tail = timer;
+        while(timer != NULL) {
+            timer->pprev = NULL;
+            timer->slot = -1;
+            wheel->count--;
+            tail = &timer->next;
+            timer = timer->next;
+        }
+
+        /* Skip the empty slots up to the next occupied one, or the block. */
+        dist = slot_distance(wheel->occupied[0], index + 1);
+        if(dist < 0 || index + 1 + dist >= WHEEL_SLOTS) {
+            step = WHEEL_SLOTS - index;
+        } else {
+            step = 1 + dist;
+        }
+        if(step > now + 1 - wheel->now) {
+            step = now + 1 - wheel->now;
+        }
+        wheel->now += step;
+    }
+    return expired;
+}
@@ -0,0 +1,139 @@
+/** @file timer_wheel.h
+ *  @brief A hashed hierarchical timer wheel.
+ *
+ *  The wheel keeps any number of timers, each due at some tick, and
+ *  hands back all the timers that are due when the clock moves on.
+ *  Scheduling and cancelling a timer take constant time, whatever the
+ *  number of timers, and moving the clock costs one step per occupied
+ *  slot rather than per timer or per tick.
+ *
+ *  Level 0 has one slot per tick for the next WHEEL_SLOTS ticks.  Each
+ *  level above covers WHEEL_SLOTS times the span of the one below, one
+ *  slot per block of ticks.  When the clock enters a block, the timers
+ *  in that block's slot are moved down a level, until they reach level
+ *  0 and fire.  A bitmap of occupied slots per level lets the clock
+ *  skip over empty slots.
+ *
+ *  Timers are embedded in the structs they belong to, so the wheel
+ *  never allocates.
+ *
+ *  @bug None known.
+ */
+
+#ifndef _TIMER_WHEEL_H_
+#define _TIMER_WHEEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Bits of the due tick consumed by each level */
+#define WHEEL_BITS 8
+/** Slots per level */
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+/** Number of levels; together they span 2^32 ticks */
+#define WHEEL_LEVELS 4
+/** Words in the bitmap of one level */
+#define WHEEL_WORDS (WHEEL_SLOTS / 64)
+
+/** The slot of a timer scheduled for a tick already processed */
+#define WHEEL_OVERDUE (WHEEL_LEVELS * WHEEL_SLOTS)
+
+/** Returned by timer_wheel_next_due when no timer is pending */
+#define WHEEL_NEVER UINT64_MAX
+
+/** @brief A timer, embedded in whatever it belongs to.
+ */
+typedef struct wheel_timer_t {
+    /** The next timer in the same slot, or in a list of expired timers */
+    struct wheel_timer_t *next;
+    /** The pointer that points at this timer, NULL if not pending */
+    struct wheel_timer_t **pprev;
+    /** The tick the timer is due at */
+    uint64_t expires;
+    /** level * WHEEL_SLOTS + slot of the slot holding the timer,
+     *  WHEEL_OVERDUE if it is overdue, or -1 */
+    int slot;
+} wheel_timer_t;
+
+/** @brief The wheel.
+ */
+typedef struct timer_wheel_t {
+    /** The first tick not yet processed */
+    uint64_t now;
+    /** The number of pending timers */
+    size_t count;
+    /** Timers scheduled for a tick already processed */
+    wheel_timer_t *overdue;
+    /** The timers in each slot */
+    wheel_timer_t *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    /** One bit per slot, set if the slot holds a timer */
+    uint64_t occupied[WHEEL_LEVELS][WHEEL_WORDS];
+} timer_wheel_t;
+
+/** @brief Set up an empty wheel.
+ *
+ * @param wheel The wheel.
+ * @param now The current tick.
+ * @return None.
+ */
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t now);
+
+/** @brief Set up a timer that is not pending.
+ *
+ * @param timer The timer.
+ * @return None.
+ */
+void wheel_timer_init(wheel_timer_t *timer);
+
+/** @brief Check if a timer is pending.
+ *
+ * @param timer The timer.
+ * @return 1 if the timer is in a wheel, 0 otherwise.
+ */
+int wheel_timer_pending(const wheel_timer_t *timer);
+
+/** @brief Schedule a timer, or move it if it is already pending.
+ *
+ * A timer due at a tick the wheel has already processed fires on the
+ * next call to timer_wheel_advance.
+ *
+ * @param wheel The wheel.
+ * @param timer The timer.
+ * @param expires The tick the timer is due at.
+ * @return None.
+ */
+void timer_wheel_schedule(timer_wheel_t *wheel, wheel_timer_t *timer, uint64_t expires);
+
+/** @brief Cancel a timer.
+ *
+ * @param wheel The wheel the timer is pending in.
+ * @param timer The timer, which may not be pending.
+ * @return None.
+ */
+void timer_wheel_cancel(timer_wheel_t *wheel, wheel_timer_t *timer);
+
+/** @brief Find out when the wheel next needs to be advanced.
+ *
+ * The answer is exact for timers due within WHEEL_SLOTS ticks, and a
+ * lower bound for later ones, so a caller may wake up early and find
+ * nothing due, but never late.
+ *
+ * @param wheel The wheel.
+ * @return The tick, or WHEEL_NEVER if no timer is pending.
+ */
+uint64_t timer_wheel_next_due(const timer_wheel_t *wheel);
+
+/** @brief Move the clock on, and take out every timer that is due.
+ *
+ * The due timers are returned as one list, linked through next, in
+ * the order they were due.  They are no longer pending, so they may be
+ * scheduled again while the list is walked, as long as next is read
+ * before that.
+ *
+ * @param wheel The wheel.
+ * @param now The current tick.
+ * @return The first due timer, or NULL if none is due.
+ */
+wheel_timer_t *timer_wheel_advance(timer_wheel_t *wheel, uint64_t now);
+
+#endif